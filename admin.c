@@ -0,0 +1,402 @@
+#include "admin.h"
+
+#include <ctype.h>
+#include <stddef.h>
+
+#include "cache.h"
+#include "logging.h"
+#include "profile.h"
+#include "protocol.h"
+#include "textout.h"
+#include "util.h"
+
+#ifdef _WIN32
+#define strcasecmp _stricmp
+#else
+#include <fcntl.h>
+#include <strings.h>
+#include <sys/un.h>
+#endif
+
+// 解析类型参数，支持 A / AAAA / 数字，缺省为0（全部类型）
+static int parse_qtype(const char *text, uint16_t *qtype) {
+    if (!text) {
+        *qtype = 0;
+    } else if (strcasecmp(text, "A") == 0) {
+        *qtype = DNS_TYPE_A;
+    } else if (strcasecmp(text, "AAAA") == 0) {
+        *qtype = DNS_TYPE_AAAA;
+    } else if (isdigit((unsigned char)text[0])) {
+        *qtype = (uint16_t)atoi(text);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// 去掉域名末尾的根标签点
+static void strip_trailing_dot(char *name) {
+    size_t len = strlen(name);
+    if (len > 1 && name[len - 1] == '.') name[len - 1] = '\0';
+}
+
+static void dump_entry(const CacheEntry *entry, uint32_t remaining_ttl, void *arg) {
+    textout_printf((TextOut *)arg, "%s %s ttl=%u bytes=%u\n", entry->key, entry->ip, remaining_ttl, entry->bytes);
+}
+
+static void cmd_stats(TextOut *reply, DNSContext *ctx) {
+    CacheStats st;
+    cache_get_stats(ctx->cache, &st);
+    textout_printf(reply, "cache_entries %u\n", st.current_size);
+    textout_printf(reply, "cache_bytes %llu\n", (unsigned long long)st.current_bytes);
+    textout_printf(reply, "cache_max_bytes %llu\n", (unsigned long long)st.max_bytes);
+    textout_printf(reply, "cache_hits %llu\n", (unsigned long long)st.hits);
+    textout_printf(reply, "cache_misses %llu\n", (unsigned long long)st.misses);
+    textout_printf(reply, "cache_hit_rate %.4f\n", cache_hit_rate(ctx->cache));
+    textout_printf(reply, "cache_expired %llu\n", (unsigned long long)st.expired);
+    textout_printf(reply, "cache_evicted %llu\n", (unsigned long long)st.evicted);
+    textout_printf(reply, "cache_flushed %llu\n", (unsigned long long)st.flushed);
+    textout_printf(reply, "relay_pending %llu\n",
+                   (unsigned long long)server_stats_sum(ctx, offsetof(ServerStats, relay_pending)));
+    if (ctx->rrl) {
+        textout_printf(reply, "rrl_slipped %llu\n",
+                       (unsigned long long)server_stats_sum(ctx, offsetof(ServerStats, rrl_slipped)));
+        textout_printf(reply, "rrl_dropped %llu\n",
+                       (unsigned long long)server_stats_sum(ctx, offsetof(ServerStats, rrl_dropped)));
+    }
+    // 先取出表的字段再输出，输出可能写出缓冲区而使本线程短暂离线
+    const DNSTable *table = atomic_load_explicit(ctx->dns_table, memory_order_acquire);
+    int table_loaded = table != NULL;
+    uint32_t table_rules = table ? table->rule_count : 0;
+    double table_fpr = table ? table_filter_fpr(&table->filter) : 0.0;
+    textout_printf(reply, "table_loaded %d\n", table_loaded);
+    textout_printf(reply, "table_rules %u\n", table_rules);
+    textout_printf(reply, "table_filter_fpr %.6f\n", table_fpr);
+    textout_printf(reply, "table_reloads %u\n", atomic_load(&ctx->reloader->reloads));
+    textout_printf(reply, "log_level %s\n", log_level_name(atomic_load(&g_log_level)));
+    textout_printf(reply, "log_dropped %llu\n", (unsigned long long)log_dropped());
+    textout_printf(reply, "log_suppressed %llu\n", (unsigned long long)log_suppressed());
+    if (ctx->qlog) {
+        textout_printf(reply, "qlog_written %llu\n", (unsigned long long)atomic_load(&ctx->qlog->written));
+        textout_printf(reply, "qlog_dropped %llu\n", (unsigned long long)qlog_dropped(ctx->qlog));
+        textout_printf(reply, "qlog_rotations %llu\n", (unsigned long long)atomic_load(&ctx->qlog->rotations));
+    }
+    LatencyHist *h = malloc(sizeof(LatencyHist));
+    if (!h) return;
+    for (int path = 0; path < PATH_COUNT; path++) {
+        const char *name = query_path_names[path];
+        hist_reset(h);
+        server_stats_collect(ctx, (QueryPath)path, h);
+        textout_printf(reply, "latency_%s_count %llu\n", name, (unsigned long long)hist_load(&h->count));
+        textout_printf(reply, "latency_%s_p50_us %.1f\n", name, hist_percentile(h, 0.5) / 1000.0);
+        textout_printf(reply, "latency_%s_p99_us %.1f\n", name, hist_percentile(h, 0.99) / 1000.0);
+        textout_printf(reply, "latency_%s_p999_us %.1f\n", name, hist_percentile(h, 0.999) / 1000.0);
+        textout_printf(reply, "latency_%s_max_us %.1f\n", name, hist_load(&h->max) / 1000.0);
+    }
+    free(h);
+}
+
+// 各路径延迟分位数表，时间单位为微秒
+static void cmd_latency(TextOut *reply, DNSContext *ctx) {
+    static const double points[] = {0.5, 0.9, 0.99, 0.999, 0.9999};
+    LatencyHist *h = malloc(sizeof(LatencyHist));
+    if (!h) return;
+    textout_printf(reply, "%-9s %10s %9s %9s %9s %9s %9s %9s %9s\n", "path", "count", "mean", "p50", "p90", "p99",
+                   "p99.9", "p99.99", "max");
+    for (int path = 0; path < PATH_COUNT; path++) {
+        hist_reset(h);
+        server_stats_collect(ctx, (QueryPath)path, h);
+        textout_printf(reply, "%-9s %10llu %9.1f", query_path_names[path], (unsigned long long)hist_load(&h->count),
+                       hist_mean(h) / 1000.0);
+        for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+            textout_printf(reply, " %9.1f", hist_percentile(h, points[i]) / 1000.0);
+        }
+        textout_printf(reply, " %9.1f\n", hist_load(&h->max) / 1000.0);
+    }
+    free(h);
+}
+
+// 各阶段耗时分布（纳秒）与占全部阶段总耗时的比例
+static void cmd_profile(TextOut *reply, DNSContext *ctx) {
+    static const double points[] = {0.5, 0.9, 0.99, 0.999};
+    LatencyHist *h = malloc(sizeof(LatencyHist));
+    uint64_t *sums = calloc(STAGE_COUNT, sizeof(uint64_t));
+    if (!h || !sums) {
+        free(h);
+        free(sums);
+        return;
+    }
+    double scale = profile_ns_per_tick();
+    uint64_t total = 0;
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        hist_reset(h);
+        server_stats_collect_stage(ctx, (QueryStage)stage, h);
+        sums[stage] = hist_load(&h->sum);
+        total += sums[stage];
+    }
+    textout_printf(reply, "profiling %s, clock %s (%.4f ns/tick)\n", profile_enabled() ? "on" : "off",
+                   profile_clock_name(), scale);
+    textout_printf(reply, "%-9s %10s %8s %8s %8s %8s %8s %8s %6s\n", "stage", "count", "mean", "p50", "p90", "p99",
+                   "p99.9", "max", "share");
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        hist_reset(h);
+        server_stats_collect_stage(ctx, (QueryStage)stage, h);
+        uint64_t count = hist_load(&h->count);
+        if (count == 0) continue;
+        textout_printf(reply, "%-9s %10llu %8.0f", query_stage_names[stage], (unsigned long long)count,
+                       hist_mean(h) * scale);
+        for (size_t i = 0; i < sizeof(points) / sizeof(points[0]); i++) {
+            textout_printf(reply, " %8.0f", hist_percentile(h, points[i]) * scale);
+        }
+        textout_printf(reply, " %8.0f %5.1f%%\n", hist_load(&h->max) * scale,
+                       total ? 100.0 * sums[stage] / total : 0.0);
+    }
+    free(sums);
+    free(h);
+}
+
+static void cmd_mrc(TextOut *reply, DNSContext *ctx) {
+    uint64_t entries[MRC_MAX_POINTS];
+    double ratios[MRC_MAX_POINTS];
+    int n = cache_export_mrc(ctx->cache, entries, ratios, MRC_MAX_POINTS);
+    if (n < 0) {
+        textout_printf(reply, "ERR mrc estimator disabled (start with --mrc)\n");
+        return;
+    }
+    for (int i = 0; i < n; i++) {
+        textout_printf(reply, "%llu %.4f\n", (unsigned long long)entries[i], ratios[i]);
+    }
+}
+
+// 执行一条命令并把结果写入reply
+static void admin_execute(TextOut *reply, DNSContext *ctx, char *line) {
+    char *argv[4] = {NULL};
+    int argc = 0;
+    for (char *tok = strtok(line, " \t\r\n"); tok && argc < 4; tok = strtok(NULL, " \t\r\n")) argv[argc++] = tok;
+    if (argc == 0) return;
+    for (int i = 1; i < argc; i++) {
+        for (char *p = argv[i]; *p; p++) *p = (char)tolower((unsigned char)*p);
+    }
+
+    const char *cmd = argv[0];
+    LOG_DEBUG("管理命令：%s\n", cmd);
+    if (strcmp(cmd, "flush") == 0 && argc >= 2) {
+        uint16_t qtype;
+        if (parse_qtype(argv[2], &qtype) < 0) {
+            textout_printf(reply, "ERR unknown type %s\n", argv[2]);
+            return;
+        }
+        strip_trailing_dot(argv[1]);
+        textout_printf(reply, "OK %d\n", cache_flush_name(ctx->cache, argv[1], qtype));
+    } else if (strcmp(cmd, "flush-suffix") == 0 && argc == 2) {
+        if (cache_flush_suffix(ctx->cache, argv[1]) < 0) {
+            textout_printf(reply, "ERR invalid suffix\n");
+        } else {
+            textout_printf(reply, "OK\n");
+        }
+    } else if (strcmp(cmd, "flush-all") == 0) {
+        textout_printf(reply, "OK %u\n", cache_flush_all(ctx->cache));
+    } else if (strcmp(cmd, "inspect") == 0 && argc == 2) {
+        static const uint16_t types[] = {DNS_TYPE_A, DNS_TYPE_AAAA};
+        int found = 0;
+        strip_trailing_dot(argv[1]);
+        for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+            const CacheEntry *entry = cache_peek(ctx->cache, argv[1], types[i]);
+            if (entry) {
+                dump_entry(entry, cache_get_remaining_ttl(entry), reply);
+                found++;
+            }
+        }
+        if (!found) textout_printf(reply, "NOTFOUND\n");
+    } else if (strcmp(cmd, "dump") == 0) {
+        if (cache_foreach(ctx->cache, dump_entry, reply) < 0) {
+            textout_printf(reply, "ERR out of memory\n");
+        } else {
+            textout_printf(reply, "END\n");
+        }
+    } else if (strcmp(cmd, "stats") == 0) {
+        cmd_stats(reply, ctx);
+    } else if (strcmp(cmd, "mrc") == 0) {
+        cmd_mrc(reply, ctx);
+    } else if (strcmp(cmd, "latency") == 0) {
+        cmd_latency(reply, ctx);
+    } else if (strcmp(cmd, "profile") == 0) {
+        if (argc == 2 && strcmp(argv[1], "on") == 0) {
+            profile_enable(1);
+        } else if (argc == 2 && strcmp(argv[1], "off") == 0) {
+            profile_enable(0);
+        } else if (argc == 2 && strcmp(argv[1], "reset") == 0) {
+            // 各服务线程在下一轮主循环中清空自己的直方图，此处只发出请求
+            server_stats_reset_stages();
+            textout_printf(reply, "OK counters reset\n");
+            return;
+        } else if (argc != 1) {
+            textout_printf(reply, "ERR usage: profile [on|off|reset]\n");
+            return;
+        }
+        cmd_profile(reply, ctx);
+    } else if (strcmp(cmd, "reload") == 0) {
+        if (table_reloader_request(ctx->reloader) < 0) {
+            textout_printf(reply, "ERR reload already in progress\n");
+        } else {
+            textout_printf(reply, "OK reloading in background\n");
+        }
+    } else if (strcmp(cmd, "log-level") == 0) {
+        if (argc == 2) {
+            int level = log_parse_level(argv[1]);
+            if (level < 0) {
+                textout_printf(reply, "ERR unknown level %s\n", argv[1]);
+                return;
+            }
+            log_set_level(level);
+        }
+        textout_printf(reply, "OK %s\n", log_level_name(atomic_load(&g_log_level)));
+    } else if (strcmp(cmd, "capacity") == 0) {
+        uint64_t bytes;
+        if (argc == 2) {
+            if (parse_size(argv[1], &bytes) < 0 || bytes == 0) {
+                textout_printf(reply, "ERR invalid size %s\n", argv[1]);
+                return;
+            }
+            cache_set_capacity(ctx->cache, bytes);
+        }
+        textout_printf(reply, "OK %llu\n", (unsigned long long)atomic_load(&ctx->cache->max_bytes));
+    } else {
+        textout_printf(reply,
+                       "commands:\n"
+                       "  flush <name> [A|AAAA]   remove one name from the cache\n"
+                       "  flush-suffix <suffix>   remove every name under a suffix\n"
+                       "  flush-all               empty the cache\n"
+                       "  inspect <name>          show cached answers for a name\n"
+                       "  dump                    list all cached entries, shard by shard in CLOCK order\n"
+                       "  stats                   cache and relay counters, latency percentiles per path\n"
+                       "  latency                 latency percentile table per resolution path (us)\n"
+                       "  mrc                     estimated miss-ratio curve\n"
+                       "  capacity [size]         show or set the cache byte budget\n"
+                       "  log-level [level]       show or set the log level (off, error, warn, info, debug)\n"
+                       "  profile [on|off|reset]  per-stage processing cost (ns); on/off toggles the timing\n"
+                       "  reload                  rebuild the local table in the background and swap it in\n");
+    }
+}
+
+#ifndef _WIN32
+
+int admin_open(AdminServer *admin, const char *path) {
+    admin->listen_fd = -1;
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        printf("管理套接字路径过长: %s\n", path);
+        return -1;
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("创建管理套接字失败\n");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);  // 清理上次异常退出残留的套接字文件
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        printf("绑定管理套接字失败: %s\n", path);
+        close(fd);
+        return -1;
+    }
+    // 非阻塞监听，避免select误报时accept阻塞管理线程而无法及时退出
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    admin->listen_fd = fd;
+    strcpy(admin->path, path);
+    printf("管理接口监听于 %s\n", path);
+    return 0;
+}
+
+// 接受一个连接并执行其中的命令；进入时本线程处于离线状态，返回时亦然
+static void admin_handle(AdminServer *admin) {
+    int fd = accept(admin->listen_fd, NULL, NULL);
+    if (fd < 0) return;
+
+    struct timeval tv = {0, ADMIN_IO_TIMEOUT_MS * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // 读取一行命令
+    char line[ADMIN_MAX_COMMAND];
+    size_t len = 0;
+    while (len < sizeof(line) - 1) {
+        ssize_t n = recv(fd, line + len, sizeof(line) - 1 - len, 0);
+        if (n <= 0) break;
+        len += (size_t)n;
+        if (memchr(line, '\n', len)) break;
+    }
+    line[len] = '\0';
+
+    QSBR *qsbr = &admin->ctx->reloader->qsbr;
+    TextOut reply;
+    textout_init(&reply, fd, qsbr, admin->qsbr_reader);
+    qsbr_online(qsbr, admin->qsbr_reader);
+    admin_execute(&reply, admin->ctx, line);
+    textout_flush(&reply);
+    qsbr_offline(qsbr, admin->qsbr_reader);
+    close(fd);
+}
+
+static void *admin_thread(void *arg) {
+    AdminServer *admin = arg;
+    while (!atomic_load(&admin->stop)) {
+        // 定期醒来检查退出标志
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(admin->listen_fd, &readfds);
+        struct timeval tv = {0, 100000};
+        if (select(admin->listen_fd + 1, &readfds, NULL, NULL, &tv) > 0) admin_handle(admin);
+    }
+    return NULL;
+}
+
+int admin_start(AdminServer *admin, DNSContext *ctx) {
+    if (admin->listen_fd < 0) return -1;
+    admin->ctx = ctx;
+    admin->qsbr_reader = qsbr_register(&ctx->reloader->qsbr);
+    if (admin->qsbr_reader < 0) {
+        printf("管理线程登记失败，关闭管理接口\n");
+        admin_close(admin);
+        return -1;
+    }
+    qsbr_offline(&ctx->reloader->qsbr, admin->qsbr_reader);
+    atomic_init(&admin->stop, 0);
+    if (pthread_create(&admin->thread, NULL, admin_thread, admin) != 0) {
+        printf("创建管理线程失败，关闭管理接口\n");
+        admin_close(admin);
+        return -1;
+    }
+    admin->running = 1;
+    return 0;
+}
+
+void admin_close(AdminServer *admin) {
+    if (admin->running) {
+        atomic_store(&admin->stop, 1);
+        pthread_join(admin->thread, NULL);
+        admin->running = 0;
+    }
+    if (admin->listen_fd < 0) return;
+    close(admin->listen_fd);
+    unlink(admin->path);
+    admin->listen_fd = -1;
+}
+
+#else
+
+int admin_open(AdminServer *admin, const char *path) {
+    admin->listen_fd = -1;
+    printf("当前平台不支持Unix域管理套接字: %s\n", path);
+    return -1;
+}
+
+int admin_start(AdminServer *admin, DNSContext *ctx) { return -1; }
+
+void admin_close(AdminServer *admin) { admin->listen_fd = -1; }
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef DNS_ADMIN_H
+#define DNS_ADMIN_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "server.h"
+
+// 单条管理命令的最大长度
+#define ADMIN_MAX_COMMAND 512
+// 管理连接的收发超时（毫秒），避免异常客户端长时间占住管理线程
+#define ADMIN_IO_TIMEOUT_MS 200
+
+/*
+ * 本地管理接口，监听一个Unix域流套接字。每个连接发送一行命令，
+ * 管理线程处理后写回结果并关闭连接，例如：
+ *   echo "flush-suffix example.com" | nc -U /tmp/dnsrelay.sock
+ * 管理线程作为QSBR读者登记，只在执行命令期间在线，收发数据时离线，
+ * 因此慢客户端既不阻塞服务线程，也不拖住表的热加载与缓存回收。
+ */
+typedef struct admin_server {
+    int listen_fd;     // 监听套接字，未启用时为-1
+    char path[108];    // 套接字文件路径
+    DNSContext *ctx;   // 0号线程的上下文（共享的缓存、表与统计）
+    int qsbr_reader;   // 管理线程的QSBR读者编号
+    atomic_int stop;   // 通知管理线程退出
+    pthread_t thread;
+    int running;       // thread是否需要join
+} AdminServer;
+
+int admin_open(AdminServer *admin, const char *path);
+// 启动管理线程，此后命令在该线程中执行
+int admin_start(AdminServer *admin, DNSContext *ctx);
+// 停止管理线程并关闭监听套接字
+void admin_close(AdminServer *admin);
+
+#endif /* DNS_ADMIN_H */
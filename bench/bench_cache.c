@@ -0,0 +1,161 @@
+/*
+ * 缓存基准：在Zipf、均匀与顺序扫描三种访问分布和多档字节预算下，
+ * 按服务器的读穿方式（cache_get未命中则cache_put）测量吞吐、
+ * 单次操作延迟的p50/p99、命中率与每条目占用字节，以及过期清理的开销。
+ * 用法：bench_cache [--keys n] [--ops n] [--csv]
+ */
+#include "bench_common.h"
+#include "cache.h"
+
+#define BENCH_NAME_LEN 40
+#define BENCH_CLEANUP_ROUNDS 5
+
+static const uint64_t bench_capacities[] = {1ULL << 20, 8ULL << 20, 64ULL << 20};
+
+typedef struct bench_config {
+    uint32_t keys;
+    uint32_t ops;
+    int csv;
+} BenchConfig;
+
+static char (*names)[BENCH_NAME_LEN];
+
+static void make_names(uint32_t keys) {
+    names = malloc((size_t)keys * BENCH_NAME_LEN);
+    for (uint32_t i = 0; i < keys; i++) snprintf(names[i], BENCH_NAME_LEN, "h%u.s%u.example.com", i, i % 997);
+}
+
+static inline void read_through(DNSCache *cache, uint32_t key) {
+    if (!cache_get(cache, names[key], DNS_TYPE_A)) cache_put(cache, names[key], DNS_TYPE_A, "192.0.2.1", 3600);
+}
+
+static double entry_bytes(DNSCache *cache) {
+    CacheStats st;
+    cache_get_stats(cache, &st);
+    return st.current_size ? (double)st.current_bytes / st.current_size : 0.0;
+}
+
+static void bench_read_through(const BenchConfig *cfg, BenchDist dist, uint64_t capacity, const uint32_t *trace,
+                               uint32_t *get_ns, uint32_t *put_ns) {
+    // 吞吐：不计时单次操作，避免时钟调用本身的开销
+    DNSCache *cache = cache_create(capacity);
+    uint64_t start = bench_now_ns();
+    for (uint32_t n = 0; n < cfg->ops; n++) read_through(cache, trace[n]);
+    double elapsed = (double)(bench_now_ns() - start);
+    double hit_ratio = cache_hit_rate(cache);
+    double per_entry = entry_bytes(cache);
+    cache_destroy(cache);
+
+    // 延迟：重新从空缓存开始，对每次get与put单独计时
+    cache = cache_create(capacity);
+    uint32_t gets = 0, puts = 0;
+    for (uint32_t n = 0; n < cfg->ops; n++) {
+        const char *name = names[trace[n]];
+        uint64_t t0 = bench_now_ns();
+        const CacheEntry *entry = cache_get(cache, name, DNS_TYPE_A);
+        uint64_t t1 = bench_now_ns();
+        get_ns[gets++] = (uint32_t)(t1 - t0);
+        if (!entry) {
+            cache_put(cache, name, DNS_TYPE_A, "192.0.2.1", 3600);
+            put_ns[puts++] = (uint32_t)(bench_now_ns() - t1);
+        }
+    }
+    cache_destroy(cache);
+
+    BenchRow row = {"cache", "get", bench_dist_names[dist], capacity, cfg->ops, cfg->ops / elapsed * 1e3,
+                    0, 0, hit_ratio, per_entry};
+    row.p50_ns = bench_percentile(get_ns, gets, 0.50);
+    row.p99_ns = bench_percentile(get_ns, gets, 0.99);
+    bench_print_row(cfg->csv, &row);
+
+    row.op = "put";
+    row.ops = puts;
+    row.p50_ns = bench_percentile(put_ns, puts, 0.50);
+    row.p99_ns = bench_percentile(put_ns, puts, 0.99);
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < puts; i++) sum += put_ns[i];
+    row.mops = sum ? puts / (double)sum * 1e3 : 0.0;
+    bench_print_row(cfg->csv, &row);
+}
+
+/**
+ * 过期清理：缓存装满后一半条目已过期（TTL为0），测量一次cache_cleanup_expired
+ * 平均到每个被扫描条目的耗时；各轮的单条目耗时作为p50/p99的样本。
+ */
+static void bench_cleanup(const BenchConfig *cfg, uint64_t capacity) {
+    uint32_t samples[BENCH_CLEANUP_ROUNDS];
+    uint64_t total_ns = 0, total_entries = 0;
+    double per_entry = 0.0;
+    for (int round = 0; round < BENCH_CLEANUP_ROUNDS; round++) {
+        DNSCache *cache = cache_create(capacity);
+        CacheStats st = {0};
+        for (uint32_t i = 0; i < cfg->keys && st.evicted == 0; i++) {
+            cache_put(cache, names[i], DNS_TYPE_A, "192.0.2.1", (i & 1) ? 3600 : 0);
+            if ((i & 1023) == 0) cache_get_stats(cache, &st);
+        }
+        cache_get_stats(cache, &st);
+        uint32_t scanned = st.current_size;
+        per_entry = entry_bytes(cache);
+        uint64_t start = bench_now_ns();
+        cache_cleanup_expired(cache);
+        uint64_t elapsed = bench_now_ns() - start;
+        samples[round] = scanned ? (uint32_t)(elapsed / scanned) : 0;
+        total_ns += elapsed;
+        total_entries += scanned;
+        cache_destroy(cache);
+    }
+    BenchRow row = {"cache", "cleanup", "half-exp", capacity, (uint32_t)(total_entries / BENCH_CLEANUP_ROUNDS),
+                    total_ns ? total_entries / (double)total_ns * 1e3 : 0.0, 0, 0, 0.0, per_entry};
+    row.p50_ns = bench_percentile(samples, BENCH_CLEANUP_ROUNDS, 0.50);
+    row.p99_ns = bench_percentile(samples, BENCH_CLEANUP_ROUNDS, 0.99);
+    bench_print_row(cfg->csv, &row);
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig cfg = {500000, 2000000, 0};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+            cfg.keys = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            cfg.ops = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            cfg.csv = 1;
+        } else {
+            printf("Usage: %s [--keys n] [--ops n] [--csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.keys == 0 || cfg.ops == 0) {
+        printf("键数与操作数必须大于0\n");
+        return 1;
+    }
+
+    make_names(cfg.keys);
+    uint32_t *get_ns = malloc(sizeof(uint32_t) * cfg.ops);
+    uint32_t *put_ns = malloc(sizeof(uint32_t) * cfg.ops);
+    if (!names || !get_ns || !put_ns) {
+        printf("内存不足\n");
+        return 1;
+    }
+
+    bench_print_header(cfg.csv);
+    for (int d = BENCH_ZIPF; d <= BENCH_SCAN; d++) {
+        uint32_t *trace = bench_make_trace((BenchDist)d, cfg.keys, cfg.ops, 0x9E3779B97F4A7C15ULL + d);
+        if (!trace) {
+            printf("内存不足\n");
+            return 1;
+        }
+        for (size_t c = 0; c < sizeof(bench_capacities) / sizeof(bench_capacities[0]); c++) {
+            bench_read_through(&cfg, (BenchDist)d, bench_capacities[c], trace, get_ns, put_ns);
+        }
+        free(trace);
+    }
+    for (size_t c = 0; c < sizeof(bench_capacities) / sizeof(bench_capacities[0]); c++) {
+        bench_cleanup(&cfg, bench_capacities[c]);
+    }
+
+    free(get_ns);
+    free(put_ns);
+    free(names);
+    return 0;
+}
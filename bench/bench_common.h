@@ -0,0 +1,137 @@
+#ifndef DNS_BENCH_COMMON_H
+#define DNS_BENCH_COMMON_H
+
+/*
+ * 基准程序共用的工具：纳秒时钟、按分布生成的访问序列、延迟分位数与结果输出。
+ * 访问序列在计时前整体生成，计时循环中只做数组读取。
+ */
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+static inline uint64_t bench_now_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// xorshift64*，各基准使用固定种子以便结果可复现
+static inline uint64_t bench_rand(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static inline double bench_rand_unit(uint64_t *state) { return (bench_rand(state) >> 11) * (1.0 / 9007199254740992.0); }
+
+typedef enum bench_dist { BENCH_ZIPF, BENCH_UNIFORM, BENCH_SCAN } BenchDist;
+
+static const char *const bench_dist_names[] = {"zipf", "uniform", "scan"};
+
+#define BENCH_ZIPF_S 0.99  // 接近实际DNS查询的名称热度分布
+
+/**
+ * 生成ops个取值在[0, keys)的键下标。
+ * zipf按秩的幂律分布，热点键打散到整个键空间；uniform为均匀分布；
+ * scan顺序循环访问全部键，键数大于容量时LRU每次都未命中。
+ */
+static inline uint32_t *bench_make_trace(BenchDist dist, uint32_t keys, uint32_t ops, uint64_t seed) {
+    uint32_t *trace = malloc(sizeof(uint32_t) * ops);
+    if (!trace) return NULL;
+    uint64_t state = seed | 1;
+    if (dist == BENCH_ZIPF) {
+        double *cdf = malloc(sizeof(double) * keys);
+        if (!cdf) {
+            free(trace);
+            return NULL;
+        }
+        double sum = 0;
+        for (uint32_t i = 0; i < keys; i++) cdf[i] = (sum += 1.0 / pow(i + 1.0, BENCH_ZIPF_S));
+        for (uint32_t n = 0; n < ops; n++) {
+            double u = bench_rand_unit(&state) * sum;
+            uint32_t lo = 0, hi = keys - 1;
+            while (lo < hi) {
+                uint32_t mid = (lo + hi) / 2;
+                if (cdf[mid] < u) lo = mid + 1;
+                else hi = mid;
+            }
+            // 秩乘以奇数常数后取模，使热点键不集中在编号靠前的名称上
+            trace[n] = (uint32_t)(((uint64_t)lo * 2654435761u) % keys);
+        }
+        free(cdf);
+    } else if (dist == BENCH_UNIFORM) {
+        for (uint32_t n = 0; n < ops; n++) trace[n] = (uint32_t)(bench_rand(&state) % keys);
+    } else {
+        for (uint32_t n = 0; n < ops; n++) trace[n] = n % keys;
+    }
+    return trace;
+}
+
+static inline int bench_cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// 对延迟样本排序后取分位数（p取0~1）
+static inline uint32_t bench_percentile(uint32_t *samples, uint32_t count, double p) {
+    if (count == 0) return 0;
+    qsort(samples, count, sizeof(uint32_t), bench_cmp_u32);
+    uint32_t idx = (uint32_t)(p * (count - 1) + 0.5);
+    return samples[idx];
+}
+
+// 一行结果，csv为1时输出逗号分隔的机器可读格式
+typedef struct bench_row {
+    const char *bench;
+    const char *op;
+    const char *workload;
+    uint64_t capacity;      // 缓存字节预算或表规则数
+    uint32_t ops;
+    double mops;            // 吞吐（百万次/秒）
+    uint32_t p50_ns;
+    uint32_t p99_ns;
+    double hit_ratio;
+    double bytes_per_entry;
+} BenchRow;
+
+static inline void bench_print_header(int csv) {
+    if (csv) {
+        printf("bench,op,workload,capacity,ops,mops,p50_ns,p99_ns,hit_ratio,bytes_per_entry\n");
+    } else {
+        printf("%-6s %-8s %-8s %12s %9s %8s %7s %7s %6s %10s\n", "bench", "op", "workload", "capacity", "ops", "Mops/s",
+               "p50ns", "p99ns", "hit", "B/entry");
+    }
+}
+
+static inline void bench_print_row(int csv, const BenchRow *r) {
+    if (csv) {
+        printf("%s,%s,%s,%llu,%u,%.3f,%u,%u,%.4f,%.1f\n", r->bench, r->op, r->workload,
+               (unsigned long long)r->capacity, r->ops, r->mops, r->p50_ns, r->p99_ns, r->hit_ratio,
+               r->bytes_per_entry);
+    } else {
+        printf("%-6s %-8s %-8s %12llu %9u %8.2f %7u %7u %6.3f %10.1f\n", r->bench, r->op, r->workload,
+               (unsigned long long)r->capacity, r->ops, r->mops, r->p50_ns, r->p99_ns, r->hit_ratio,
+               r->bytes_per_entry);
+    }
+    fflush(stdout);
+}
+
+#endif /* DNS_BENCH_COMMON_H */
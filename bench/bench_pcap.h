@@ -0,0 +1,199 @@
+#ifndef DNS_BENCH_PCAP_H
+#define DNS_BENCH_PCAP_H
+
+/*
+ * 只读映射经典pcap抓包文件并按顺序取出其中的UDP报文，供回放与模拟工具使用（POSIX）。
+ * 文件整体mmap，报文载荷直接指向映射区，不复制；内核按顺序预读，大文件也只占页缓存。
+ * 支持微秒/纳秒时间戳与两种字节序，链路层支持Ethernet（含802.1Q）、Linux cooked(v1/v2)、
+ * BSD loopback与raw IP；不支持pcapng、IP分片与IPv6扩展头。
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BENCH_PCAP_MAGIC_US 0xa1b2c3d4u
+#define BENCH_PCAP_MAGIC_NS 0xa1b23c4du
+
+typedef struct bench_pcap {
+    const uint8_t *data;
+    size_t size;
+    size_t pos;         // 下一条记录的偏移
+    int swapped;        // 文件字节序与主机相反
+    int nanos;          // 时间戳小数部分为纳秒
+    uint32_t linktype;
+    uint64_t packets;   // 已读取的记录数（含非UDP）
+} BenchPcap;
+
+typedef struct bench_udp {
+    uint64_t time_ns;   // 抓包时间（Unix纳秒）
+    int family;         // 4或6
+    uint8_t src[16];    // 源地址（IPv4只用前4字节）
+    uint8_t dst[16];
+    uint16_t sport;     // 主机字节序
+    uint16_t dport;
+    const uint8_t *payload;
+    uint32_t len;
+} BenchUdp;
+
+static inline uint32_t bench_pcap_u32(const BenchPcap *p, const uint8_t *b) {
+    uint32_t v;
+    memcpy(&v, b, 4);
+    return p->swapped ? __builtin_bswap32(v) : v;
+}
+
+static inline uint16_t bench_be16(const uint8_t *b) { return (uint16_t)(b[0] << 8 | b[1]); }
+
+/**
+ * 映射抓包文件并校验文件头。
+ * @return 成功返回0，无法打开或不是pcap文件返回-1。
+ */
+static inline int bench_pcap_open(BenchPcap *p, const char *path) {
+    memset(p, 0, sizeof(*p));
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < 24) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    p->data = map;
+    p->size = (size_t)st.st_size;
+    uint32_t magic;
+    memcpy(&magic, p->data, 4);
+    if (magic == BENCH_PCAP_MAGIC_US || magic == BENCH_PCAP_MAGIC_NS) {
+        p->nanos = magic == BENCH_PCAP_MAGIC_NS;
+    } else if (__builtin_bswap32(magic) == BENCH_PCAP_MAGIC_US || __builtin_bswap32(magic) == BENCH_PCAP_MAGIC_NS) {
+        p->swapped = 1;
+        p->nanos = __builtin_bswap32(magic) == BENCH_PCAP_MAGIC_NS;
+    } else {
+        munmap(map, p->size);
+        p->data = NULL;
+        return -1;
+    }
+    p->linktype = bench_pcap_u32(p, p->data + 20) & 0xFFFF;
+    p->pos = 24;
+    return 0;
+}
+
+static inline void bench_pcap_close(BenchPcap *p) {
+    if (p->data) munmap((void *)p->data, p->size);
+    p->data = NULL;
+}
+
+static inline void bench_pcap_rewind(BenchPcap *p) {
+    p->pos = 24;
+    p->packets = 0;
+}
+
+// 跳过链路层头部，返回网络层协议（4/6），无法识别返回0
+static inline int bench_pcap_link(const BenchPcap *p, const uint8_t **pkt, uint32_t *len) {
+    const uint8_t *b = *pkt;
+    uint32_t n = *len, skip;
+    uint16_t proto;
+    switch (p->linktype) {
+        case 1:  // Ethernet
+            if (n < 14) return 0;
+            proto = bench_be16(b + 12);
+            skip = 14;
+            while ((proto == 0x8100 || proto == 0x88A8) && n >= skip + 4) {
+                proto = bench_be16(b + skip + 2);
+                skip += 4;
+            }
+            break;
+        case 113:  // Linux cooked v1
+            if (n < 16) return 0;
+            proto = bench_be16(b + 14);
+            skip = 16;
+            break;
+        case 276:  // Linux cooked v2
+            if (n < 20) return 0;
+            proto = bench_be16(b);
+            skip = 20;
+            break;
+        case 0:  // BSD loopback，地址族为抓包主机字节序
+        {
+            if (n < 4) return 0;
+            uint32_t family;
+            memcpy(&family, b, 4);
+            if (family > 0xFFFF) family = __builtin_bswap32(family);
+            proto = family == 2 ? 0x0800 : (family == 24 || family == 28 || family == 30) ? 0x86DD : 0;
+            skip = 4;
+            break;
+        }
+        case 101:  // raw IP
+        case 228:
+        case 229:
+            if (n < 1) return 0;
+            proto = (b[0] >> 4) == 4 ? 0x0800 : (b[0] >> 4) == 6 ? 0x86DD : 0;
+            skip = 0;
+            break;
+        default:
+            return 0;
+    }
+    *pkt = b + skip;
+    *len = n - skip;
+    return proto == 0x0800 ? 4 : proto == 0x86DD ? 6 : 0;
+}
+
+/**
+ * 取出下一个UDP报文，跳过其他报文。
+ * @return 取到返回1，文件结束（或末尾记录不完整）返回0。
+ */
+static inline int bench_pcap_next_udp(BenchPcap *p, BenchUdp *out) {
+    while (p->pos + 16 <= p->size) {
+        const uint8_t *rec = p->data + p->pos;
+        uint32_t sec = bench_pcap_u32(p, rec), frac = bench_pcap_u32(p, rec + 4);
+        uint32_t incl = bench_pcap_u32(p, rec + 8);
+        if (p->pos + 16 + incl > p->size) return 0;
+        p->pos += 16 + incl;
+        p->packets++;
+
+        const uint8_t *pkt = rec + 16;
+        uint32_t len = incl;
+        int family = bench_pcap_link(p, &pkt, &len);
+        const uint8_t *udp;
+        uint32_t udp_len;
+        if (family == 4) {
+            if (len < 20) continue;
+            uint32_t ihl = (pkt[0] & 0xF) * 4u;
+            uint16_t frag = bench_be16(pkt + 6);
+            if (pkt[9] != 17 || ihl < 20 || len < ihl + 8 || (frag & 0x3FFF)) continue;  // 非UDP或分片
+            uint32_t total = bench_be16(pkt + 2);
+            if (total > len) total = len;
+            memset(out->src, 0, sizeof(out->src));
+            memset(out->dst, 0, sizeof(out->dst));
+            memcpy(out->src, pkt + 12, 4);
+            memcpy(out->dst, pkt + 16, 4);
+            udp = pkt + ihl;
+            udp_len = total > ihl ? total - ihl : 0;
+        } else if (family == 6) {
+            if (len < 48 || pkt[6] != 17) continue;
+            memcpy(out->src, pkt + 8, 16);
+            memcpy(out->dst, pkt + 24, 16);
+            udp = pkt + 40;
+            udp_len = len - 40;
+            if (bench_be16(pkt + 4) < udp_len) udp_len = bench_be16(pkt + 4);
+        } else {
+            continue;
+        }
+        if (udp_len < 8) continue;
+        uint32_t declared = bench_be16(udp + 4);
+        out->family = family;
+        out->sport = bench_be16(udp);
+        out->dport = bench_be16(udp + 2);
+        out->payload = udp + 8;
+        out->len = (declared >= 8 && declared <= udp_len ? declared : udp_len) - 8;
+        out->time_ns = (uint64_t)sec * 1000000000ULL + (p->nanos ? frac : (uint64_t)frac * 1000ULL);
+        return 1;
+    }
+    return 0;
+}
+
+#endif /* DNS_BENCH_PCAP_H */
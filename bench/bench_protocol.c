@@ -0,0 +1,182 @@
+/*
+ * protocol.c 微基准：对一组常见形态的查询/应答报文测量解析与构造的
+ * 每次操作耗时（ns/op）与处理的字节数（bytes/op）。
+ * 用法：bench_protocol [迭代次数]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "protocol.h"
+#include "util.h"
+
+#define BENCH_DEFAULT_ITERATIONS 2000000
+
+// 具有代表性的查询名称：短名、常见站点、CDN长名、多级标签、大小写混合（0x20随机化）
+static const char *const bench_names[] = {
+    "a.cn",
+    "www.baidu.com",
+    "www.google.com",
+    "clients4.google.com",
+    "e1234.dscb.akamaiedge.net",
+    "r3---sn-ab5l6nzr.googlevideo.com",
+    "ad.doubleclick.net",
+    "a.b.c.d.e.f.g.h.example.org",
+    "WwW.ExAmPlE.CoM",
+    "1.0.0.127.in-addr.arpa",
+    "very-long-label-used-by-some-tracking-services-0123456789abcdef.metrics.example.net",
+};
+#define BENCH_NAME_COUNT (sizeof(bench_names) / sizeof(bench_names[0]))
+
+typedef struct bench_packet {
+    uint8_t data[MAX_DNS_PACKET_SIZE];
+    int len;
+    int question_len;
+    int answer_off;  // 应答中第一条回答记录的偏移（属主为压缩指针）
+    char domain[MAX_DOMAIN_LENGTH];
+} BenchPacket;
+
+static BenchPacket queries[BENCH_NAME_COUNT];
+static BenchPacket responses[BENCH_NAME_COUNT];
+
+static double now_ns(void) {
+    struct timeval tv;
+    get_now(&tv);
+    return tv.tv_sec * 1e9 + tv.tv_usec * 1e3;
+}
+
+// 用构造器生成语料，保证与服务器实际收发的报文格式一致
+static void build_corpus(void) {
+    static const uint8_t addr[4] = {93, 184, 216, 34};
+    for (size_t i = 0; i < BENCH_NAME_COUNT; i++) {
+        DNSBuilder b;
+        dns_builder_init(&b, queries[i].data, MAX_DNS_PACKET_SIZE);
+        dns_builder_question(&b, bench_names[i], DNS_TYPE_A, DNS_CLASS_IN);
+        queries[i].len = dns_builder_finish(&b, (uint16_t)i, 0x0100);
+        queries[i].question_len = queries[i].len - DNS_HEADER_SIZE;
+        parse_dns_name(queries[i].data, queries[i].len, DNS_HEADER_SIZE, queries[i].domain, MAX_DOMAIN_LENGTH);
+
+        dns_builder_init(&b, responses[i].data, MAX_DNS_PACKET_SIZE);
+        dns_builder_question(&b, bench_names[i], DNS_TYPE_A, DNS_CLASS_IN);
+        responses[i].answer_off = b.len;
+        dns_builder_add_rr(&b, DNS_SECTION_ANSWER, bench_names[i], DNS_TYPE_A, DNS_CLASS_IN, 300, addr, sizeof(addr));
+        responses[i].len = dns_builder_finish(&b, (uint16_t)i, 0x8180);
+    }
+}
+
+typedef struct bench_result {
+    const char *name;
+    double ns_per_op;
+    double bytes_per_op;
+} BenchResult;
+
+static volatile int bench_sink;  // 防止编译器消除被测调用
+
+static BenchResult bench_parse_query(long iterations) {
+    char domain[MAX_DOMAIN_LENGTH];
+    long bytes = 0;
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        const BenchPacket *p = &queries[i % BENCH_NAME_COUNT];
+        int n = parse_dns_name(p->data, p->len, DNS_HEADER_SIZE, domain, sizeof(domain));
+        bench_sink += n;
+        bytes += n;
+    }
+    return (BenchResult){"parse_query_name", (now_ns() - start) / iterations, (double)bytes / iterations};
+}
+
+static BenchResult bench_parse_answer(long iterations) {
+    char domain[MAX_DOMAIN_LENGTH];
+    long bytes = 0;
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        const BenchPacket *p = &responses[i % BENCH_NAME_COUNT];
+        int n = parse_dns_name(p->data, p->len, p->answer_off, domain, sizeof(domain));
+        bench_sink += n;
+        bytes += (long)strlen(domain) + 2;  // 跟随压缩指针实际读取的名称字节
+    }
+    return (BenchResult){"parse_answer_name", (now_ns() - start) / iterations, (double)bytes / iterations};
+}
+
+static BenchResult bench_answer_rr(long iterations) {
+    static const uint8_t addr[16] = {0x20, 0x01, 0x0d, 0xb8};
+    uint8_t rr[DNS_ANSWER_RR_MAX];
+    DNSHeader header;
+    long bytes = 0;
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        const BenchPacket *p = &queries[i % BENCH_NAME_COUNT];
+        build_response_header(&header, p->data, DNS_RCODE_NO_ERROR, 1);
+        int n = build_answer_rr(rr, (i & 1) ? 6 : 4, addr, DNS_LOCAL_TTL);
+        bench_sink += n + header.flags;
+        bytes += (long)sizeof(header) + p->question_len + n;
+    }
+    return (BenchResult){"build_local_answer", (now_ns() - start) / iterations, (double)bytes / iterations};
+}
+
+static BenchResult bench_error_response(long iterations) {
+    uint8_t response[MAX_DNS_PACKET_SIZE];
+    long bytes = 0;
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        const BenchPacket *p = &queries[i % BENCH_NAME_COUNT];
+        int n = build_dns_error_response(response, p->data, p->question_len, DNS_RCODE_NOT_IMPLEMENTED);
+        bench_sink += response[n - 1];
+        bytes += n;
+    }
+    return (BenchResult){"build_error_response", (now_ns() - start) / iterations, (double)bytes / iterations};
+}
+
+static BenchResult bench_negative_response(long iterations) {
+    uint8_t response[MAX_DNS_PACKET_SIZE];
+    long bytes = 0;
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        const BenchPacket *p = &queries[i % BENCH_NAME_COUNT];
+        int n = build_negative_response(response, p->data, p->question_len, p->domain, DNS_RCODE_NAME_ERROR);
+        bench_sink += response[n - 1];
+        bytes += n;
+    }
+    return (BenchResult){"build_negative_response", (now_ns() - start) / iterations, (double)bytes / iterations};
+}
+
+// 多条回答加授权与附加记录，名称压缩的字典查找在此占主要开销
+static BenchResult bench_builder_multi(long iterations) {
+    static const uint8_t addr[4] = {198, 51, 100, 7};
+    uint8_t response[MAX_DNS_PACKET_SIZE];
+    long bytes = 0;
+    double start = now_ns();
+    for (long i = 0; i < iterations; i++) {
+        const BenchPacket *p = &queries[i % BENCH_NAME_COUNT];
+        DNSBuilder b;
+        dns_builder_init(&b, response, MAX_DNS_PACKET_SIZE);
+        dns_builder_question_raw(&b, p->data + DNS_HEADER_SIZE, p->question_len);
+        for (int k = 0; k < 4; k++) {
+            dns_builder_add_rr(&b, DNS_SECTION_ANSWER, p->domain, DNS_TYPE_A, DNS_CLASS_IN, 300, addr, sizeof(addr));
+        }
+        dns_builder_add_rr(&b, DNS_SECTION_ADDITIONAL, "ns1.example.net", DNS_TYPE_A, DNS_CLASS_IN, 300, addr,
+                           sizeof(addr));
+        int n = dns_builder_finish(&b, (uint16_t)i, 0x8180);
+        bench_sink += response[n - 1];
+        bytes += n;
+    }
+    return (BenchResult){"builder_multi_rr", (now_ns() - start) / iterations, (double)bytes / iterations};
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : BENCH_DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        printf("Usage: %s [iterations]\n", argv[0]);
+        return 1;
+    }
+    build_corpus();
+
+    BenchResult (*const benches[])(long) = {bench_parse_query,    bench_parse_answer,      bench_answer_rr,
+                                            bench_error_response, bench_negative_response, bench_builder_multi};
+    printf("%-26s %10s %10s\n", "benchmark", "ns/op", "bytes/op");
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        benches[i](iterations / 10);  // 预热
+        BenchResult r = benches[i](iterations);
+        printf("%-26s %10.1f %10.1f\n", r.name, r.ns_per_op, r.bytes_per_op);
+    }
+    return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * 本地表基准：生成多档规模的文本表，测量load_dns_table的加载速度与每条规则占用的内存，
+ * 以及在Zipf、均匀与顺序扫描分布下dns_table_lookup的吞吐和p50/p99延迟。
+ * 查询集合中一半为表中名称（含后缀规则下的子域名），一半为同后缀的未命中名称。
+ * 用法：bench_table [--max-rules n] [--ops n] [--csv] [--dir 临时目录]
+ */
+#include "bench_common.h"
+#include "table.h"
+
+#define BENCH_NAME_LEN 48
+#define BENCH_LOAD_ROUNDS 3
+
+typedef struct bench_config {
+    uint32_t max_rules;
+    uint32_t ops;
+    int csv;
+    const char *dir;
+} BenchConfig;
+
+// 第i条规则：七成普通地址，两成拦截，一成后缀规则
+static void rule_line(uint32_t i, char *line, size_t size) {
+    uint32_t kind = i % 10;
+    if (kind < 7) {
+        snprintf(line, size, "10.%u.%u.%u r%u.d%u.example.net\n", (i >> 16) & 255, (i >> 8) & 255, i & 255, i,
+                 i % 1000);
+    } else if (kind < 9) {
+        snprintf(line, size, "0.0.0.0 r%u.d%u.example.net\n", i, i % 1000);
+    } else {
+        snprintf(line, size, "0.0.0.0 .s%u.example.org\n", i);
+    }
+}
+
+// 查询名称：偶数下标命中第i/2条规则，奇数下标为同一后缀下不存在的名称
+static void query_name(uint32_t idx, char *name, size_t size) {
+    uint32_t i = idx / 2;
+    if (idx & 1) {
+        snprintf(name, size, "m%u.d%u.example.net", i, i % 1000);
+    } else if (i % 10 == 9) {
+        snprintf(name, size, "www.s%u.example.org", i);
+    } else {
+        snprintf(name, size, "r%u.d%u.example.net", i, i % 1000);
+    }
+}
+
+static int write_table(const char *path, uint32_t rules) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) return -1;
+    char line[96];
+    for (uint32_t i = 0; i < rules; i++) {
+        rule_line(i, line, sizeof(line));
+        fputs(line, fp);
+    }
+    return fclose(fp);
+}
+
+// 字典树各数组按容量计算的内存，镜像表按镜像大小计算
+static uint64_t table_bytes(const DNSTable *table) {
+    return (uint64_t)table->node_cap * sizeof(TableNode) + ((uint64_t)table->edge_mask + 1) * sizeof(TableEdge) +
+           table->labels_cap + (uint64_t)table->record_cap * sizeof(DNSRecord) +
+           (uint64_t)table->filter.block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t);
+}
+
+static DNSTable *bench_load(const BenchConfig *cfg, const char *path, uint32_t rules) {
+    uint32_t samples[BENCH_LOAD_ROUNDS];
+    uint64_t total_ns = 0;
+    DNSTable *table = NULL;
+    for (int round = 0; round < BENCH_LOAD_ROUNDS; round++) {
+        if (table) free_dns_table(table);
+        table = NULL;
+        uint64_t start = bench_now_ns();
+        if (load_dns_table(path, &table) < 0 || !table) {
+            printf("加载本地表失败: %s\n", path);
+            return NULL;
+        }
+        uint64_t elapsed = bench_now_ns() - start;
+        samples[round] = (uint32_t)(elapsed / rules);
+        total_ns += elapsed;
+    }
+    BenchRow row = {"table", "load", "text", rules, rules, (double)rules * BENCH_LOAD_ROUNDS / total_ns * 1e3,
+                    0, 0, 0.0, table->rule_count ? (double)table_bytes(table) / table->rule_count : 0.0};
+    row.p50_ns = bench_percentile(samples, BENCH_LOAD_ROUNDS, 0.50);
+    row.p99_ns = bench_percentile(samples, BENCH_LOAD_ROUNDS, 0.99);
+    bench_print_row(cfg->csv, &row);
+    return table;
+}
+
+static void bench_lookup(const BenchConfig *cfg, const DNSTable *table, uint32_t rules, BenchDist dist,
+                         char (*names)[BENCH_NAME_LEN], uint32_t *lat_ns) {
+    uint32_t keys = rules * 2;
+    uint32_t *trace = bench_make_trace(dist, keys, cfg->ops, 0xD1B54A32D192ED03ULL + dist);
+    if (!trace) return;
+
+    uint32_t hits = 0;
+    uint64_t start = bench_now_ns();
+    for (uint32_t n = 0; n < cfg->ops; n++) hits += dns_table_lookup(table, names[trace[n]]) != NULL;
+    double elapsed = (double)(bench_now_ns() - start);
+
+    for (uint32_t n = 0; n < cfg->ops; n++) {
+        uint64_t t0 = bench_now_ns();
+        const DNSRecord *record = dns_table_lookup(table, names[trace[n]]);
+        lat_ns[n] = (uint32_t)(bench_now_ns() - t0);
+        hits += record != NULL;  // 保证查找结果被使用
+    }
+
+    BenchRow row = {"table", "lookup", bench_dist_names[dist], rules, cfg->ops, cfg->ops / elapsed * 1e3,
+                    0, 0, hits / (2.0 * cfg->ops), (double)table_bytes(table) / table->rule_count};
+    row.p50_ns = bench_percentile(lat_ns, cfg->ops, 0.50);
+    row.p99_ns = bench_percentile(lat_ns, cfg->ops, 0.99);
+    bench_print_row(cfg->csv, &row);
+    free(trace);
+}
+
+int main(int argc, char *argv[]) {
+    BenchConfig cfg = {1000000, 2000000, 0, "."};
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--max-rules") == 0 && i + 1 < argc) {
+            cfg.max_rules = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            cfg.ops = (uint32_t)strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            cfg.dir = argv[++i];
+        } else if (strcmp(argv[i], "--csv") == 0) {
+            cfg.csv = 1;
+        } else {
+            printf("Usage: %s [--max-rules n] [--ops n] [--csv] [--dir path]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (cfg.max_rules < 10 || cfg.ops == 0) {
+        printf("规则数至少为10，操作数必须大于0\n");
+        return 1;
+    }
+
+    uint32_t *lat_ns = malloc(sizeof(uint32_t) * cfg.ops);
+    char (*names)[BENCH_NAME_LEN] = malloc((size_t)cfg.max_rules * 2 * BENCH_NAME_LEN);
+    if (!lat_ns || !names) {
+        printf("内存不足\n");
+        return 1;
+    }
+    for (uint32_t i = 0; i < cfg.max_rules * 2; i++) query_name(i, names[i], BENCH_NAME_LEN);
+
+    bench_print_header(cfg.csv);
+    for (uint32_t rules = cfg.max_rules / 100 ? cfg.max_rules / 100 : 10; rules <= cfg.max_rules; rules *= 10) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/bench_table_%u.txt", cfg.dir, rules);
+        if (write_table(path, rules) < 0) {
+            printf("无法写入临时表文件: %s\n", path);
+            return 1;
+        }
+        DNSTable *table = bench_load(&cfg, path, rules);
+        remove(path);
+        if (!table) return 1;
+        for (int d = BENCH_ZIPF; d <= BENCH_SCAN; d++) bench_lookup(&cfg, table, rules, (BenchDist)d, names, lat_ns);
+        free_dns_table(table);
+    }
+
+    free(lat_ns);
+    free(names);
+    return 0;
+}
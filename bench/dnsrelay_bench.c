@@ -0,0 +1,742 @@
+/*
+ * 端到端负载生成器：按给定速率以开环方式向中继发送查询，与应答是否返回无关，
+ * 延迟从计划发送时刻算起，发送端落后时排队的时间同样计入（避免协同遗漏）。
+ * 查询组合：名称按Zipf分布取自名称列表，按比例混入AAAA查询和拦截后缀下的名称。
+ * 每个模拟客户端占一个UDP套接字，分摊到若干发送线程；结束后报告实际QPS、
+ * 丢失率、响应码分布与HDR延迟分布。
+ * --stub在本机启动一个简易上游（或以--upstream指定dnsrelay-mock），--spawn再以该上游和只含拦截规则的临时本地表
+ * 启动被测中继，一条命令即可在无网络的环境下完成压测。
+ * --hangup在压测期间反复向中继的管理与指标接口发出请求后不读应答直接复位连接，
+ * 检查控制面客户端中途断开不会影响服务；被测中继在压测期间退出时以失败结束。
+ * 用法：dnsrelay-bench [选项] [-- 传给被测中继的额外参数]
+ */
+#ifdef __linux__
+#define _GNU_SOURCE  // ppoll
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "bench_common.h"
+#include "hist.h"
+#include "protocol.h"
+
+#define LOAD_MAX_CLIENTS 1024
+#define LOAD_MAX_THREADS 64
+#define LOAD_SLOT_BITS 14                      // 每个客户端最多同时等待16384个应答
+#define LOAD_SLOTS (1u << LOAD_SLOT_BITS)
+#define LOAD_TRACE_LEN (1u << 20)              // 预生成的Zipf访问序列长度，循环使用
+#define LOAD_DEFAULT_NAMES 10000
+#define LOAD_BLOCKED_NAMES 1000                // 拦截后缀下的不同名称数
+#define LOAD_READY_TIMEOUT_MS 5000             // 等待被测中继开始应答的时间
+
+typedef struct load_config {
+    struct sockaddr_in target;
+    double rate;            // 总发送速率（查询/秒）
+    double duration;        // 发送时长（秒）
+    int clients;
+    int threads;
+    const char *names_file;
+    uint32_t name_count;    // 未指定名称文件时生成的名称数
+    double aaaa_ratio;
+    double blocked_ratio;
+    const char *blocked_suffix;
+    uint32_t timeout_ms;    // 超过此时间的应答按丢失计
+    int stub_port;          // 内置上游端口，0表示不启动
+    uint32_t stub_ttl;
+    const char *upstream;   // 被测中继的上游（如dnsrelay-mock），未指定时使用内置上游
+    const char *spawn;      // 被测中继可执行文件
+    char **relay_args;      // "--"之后的参数原样传给中继
+    int relay_argc;
+    const char *admin;      // 中继的管理套接字，--spawn时传给中继
+    int metrics_port;       // 中继的指标端口，--spawn时传给中继
+    uint32_t hangup_ms;     // 每隔多少毫秒向管理与指标接口各发一个中途断开的请求，0表示不发
+    int verbose;            // 保留中继的标准输出
+    int print_hist;
+    int csv;
+} LoadConfig;
+
+// 预先构造好的查询报文，发送时只复制并填入ID
+typedef struct query_set {
+    uint8_t *pool;
+    uint32_t *offset;       // 下标 2*i 为名称i的A查询，2*i+1为AAAA查询
+    uint16_t *len;
+    uint32_t count;         // 名称数
+} QuerySet;
+
+typedef struct load_client {
+    int fd;
+    uint32_t seq;
+    uint64_t sent_at[LOAD_SLOTS];  // 计划发送时刻，0表示空闲
+    uint16_t slot_id[LOAD_SLOTS];
+} LoadClient;
+
+typedef struct load_thread {
+    pthread_t thread;
+    int index;
+    LoadClient *clients;
+    int client_count;
+    uint32_t *trace;
+    uint64_t start_ns;
+    uint64_t end_ns;
+    // 结果
+    uint64_t sent;
+    uint64_t received;
+    uint64_t late;          // 超过timeout_ms才到达的应答
+    uint64_t send_errors;
+    uint64_t truncated;
+    uint64_t rcodes[16];
+    LatencyHist hist;
+} LoadThread;
+
+static LoadConfig cfg = {
+    .rate = 10000,
+    .duration = 10,
+    .clients = 16,
+    .threads = 1,
+    .name_count = LOAD_DEFAULT_NAMES,
+    .aaaa_ratio = 0.3,
+    .blocked_ratio = 0.05,
+    .blocked_suffix = "blocked.bench.test",
+    .timeout_ms = 1000,
+    .stub_ttl = 300,
+};
+static QuerySet names, blocked;
+static atomic_int stub_stop;
+static atomic_int hangup_stop;
+static uint64_t hangup_admin, hangup_metrics;  // 已发出的中途断开请求数
+
+static void usage(const char *program) {
+    printf("Usage: %s [options] [-- relay options]\n", program);
+    printf("  -s <ip:port>        Relay to load (default 127.0.0.1:53)\n");
+    printf("  -r <qps>            Offered query rate, open loop (default 10000)\n");
+    printf("  -t <seconds>        Sending duration (default 10)\n");
+    printf("  -c <clients>        Simulated clients, one UDP socket each (default 16)\n");
+    printf("  -j <threads>        Sending threads (default 1)\n");
+    printf("  -n <file>           Query names, one per line, drawn with a Zipf distribution\n");
+    printf("  --names <n>         Number of generated names when -n is not given (default %d)\n", LOAD_DEFAULT_NAMES);
+    printf("  --aaaa <ratio>      Fraction of AAAA queries (default 0.3)\n");
+    printf("  --blocked <ratio>   Fraction of queries for names under the blocked suffix (default 0.05)\n");
+    printf("  --blocked-suffix <s>  Suffix blocked in the relay's table (default blocked.bench.test)\n");
+    printf("  --timeout <ms>      Answers later than this count as lost (default 1000)\n");
+    printf("  --stub <port>       Run a stub upstream on 127.0.0.1:port answering every A/AAAA query\n");
+    printf("  --stub-ttl <s>      TTL of stub answers (default 300)\n");
+    printf("  --upstream <ip:port>  Upstream of the spawned relay instead of the stub, e.g. a dnsrelay-mock\n");
+    printf("  --spawn <dnsrelay>  Start this relay on the -s port, forwarding to the stub, with a table\n");
+    printf("                      blocking the blocked suffix; stopped after the run\n");
+    printf("  --admin <socket>    Admin socket of the relay (passed to a spawned relay)\n");
+    printf("  --metrics <port>    Metrics port of the relay (passed to a spawned relay)\n");
+    printf("  --hangup <ms>       Every ms, send an admin dump and a metrics scrape and reset the connection\n");
+    printf("                      without reading the reply; fails the run if the spawned relay exits\n");
+    printf("  -v                  Keep the spawned relay's output\n");
+    printf("  --hist              Print the full latency percentile distribution\n");
+    printf("  --csv               Print one machine-readable result line\n");
+}
+
+static int parse_addr(const char *text, struct sockaddr_in *addr) {
+    char host[64];
+    const char *colon = strchr(text, ':');
+    size_t host_len = colon ? (size_t)(colon - text) : strlen(text);
+    if (host_len == 0 || host_len >= sizeof(host)) return -1;
+    memcpy(host, text, host_len);
+    host[host_len] = '\0';
+    int port = colon ? atoi(colon + 1) : DNS_PORT;
+    if (port <= 0 || port > 65535) return -1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((uint16_t)port);
+    return inet_pton(AF_INET, host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+static int parse_args(int argc, char *argv[]) {
+    parse_addr("127.0.0.1:53", &cfg.target);
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--") == 0) {
+            cfg.relay_args = argv + i + 1;
+            cfg.relay_argc = argc - i - 1;
+            break;
+        } else if (strcmp(arg, "-v") == 0) {
+            cfg.verbose = 1;
+        } else if (strcmp(arg, "--hist") == 0) {
+            cfg.print_hist = 1;
+        } else if (strcmp(arg, "--csv") == 0) {
+            cfg.csv = 1;
+        } else if (!val) {
+            return -1;
+        } else {
+            i++;
+            if (strcmp(arg, "-s") == 0) {
+                if (parse_addr(val, &cfg.target) < 0) return -1;
+            } else if (strcmp(arg, "-r") == 0) {
+                cfg.rate = atof(val);
+            } else if (strcmp(arg, "-t") == 0) {
+                cfg.duration = atof(val);
+            } else if (strcmp(arg, "-c") == 0) {
+                cfg.clients = atoi(val);
+            } else if (strcmp(arg, "-j") == 0) {
+                cfg.threads = atoi(val);
+            } else if (strcmp(arg, "-n") == 0) {
+                cfg.names_file = val;
+            } else if (strcmp(arg, "--names") == 0) {
+                cfg.name_count = (uint32_t)strtoul(val, NULL, 10);
+            } else if (strcmp(arg, "--aaaa") == 0) {
+                cfg.aaaa_ratio = atof(val);
+            } else if (strcmp(arg, "--blocked") == 0) {
+                cfg.blocked_ratio = atof(val);
+            } else if (strcmp(arg, "--blocked-suffix") == 0) {
+                cfg.blocked_suffix = val;
+            } else if (strcmp(arg, "--timeout") == 0) {
+                cfg.timeout_ms = (uint32_t)strtoul(val, NULL, 10);
+            } else if (strcmp(arg, "--stub") == 0) {
+                cfg.stub_port = atoi(val);
+            } else if (strcmp(arg, "--stub-ttl") == 0) {
+                cfg.stub_ttl = (uint32_t)strtoul(val, NULL, 10);
+            } else if (strcmp(arg, "--upstream") == 0) {
+                cfg.upstream = val;
+            } else if (strcmp(arg, "--spawn") == 0) {
+                cfg.spawn = val;
+            } else if (strcmp(arg, "--admin") == 0) {
+                cfg.admin = val;
+            } else if (strcmp(arg, "--metrics") == 0) {
+                cfg.metrics_port = atoi(val);
+            } else if (strcmp(arg, "--hangup") == 0) {
+                cfg.hangup_ms = (uint32_t)strtoul(val, NULL, 10);
+            } else {
+                return -1;
+            }
+        }
+    }
+    if (cfg.rate <= 0 || cfg.duration <= 0 || cfg.timeout_ms == 0) return -1;
+    if (cfg.clients < 1 || cfg.clients > LOAD_MAX_CLIENTS) return -1;
+    if (cfg.threads < 1 || cfg.threads > LOAD_MAX_THREADS || cfg.threads > cfg.clients) return -1;
+    if (cfg.aaaa_ratio < 0 || cfg.aaaa_ratio > 1 || cfg.blocked_ratio < 0 || cfg.blocked_ratio > 1) return -1;
+    if (!cfg.names_file && cfg.name_count == 0) return -1;
+    if (cfg.stub_port < 0 || cfg.stub_port > 65535) return -1;
+    if (cfg.metrics_port < 0 || cfg.metrics_port > 65535) return -1;
+    if (cfg.admin && strlen(cfg.admin) >= sizeof(((struct sockaddr_un *)0)->sun_path)) return -1;
+    if (cfg.hangup_ms && !cfg.admin && !cfg.metrics_port) {
+        printf("--hangup 需要同时指定 --admin 或 --metrics\n");
+        return -1;
+    }
+    if (cfg.spawn && !cfg.stub_port && !cfg.upstream) {
+        printf("--spawn 需要同时指定 --stub 或 --upstream\n");
+        return -1;
+    }
+    return 0;
+}
+
+// ----------- 查询组合 -----------
+
+static int query_set_init(QuerySet *set, uint32_t count) {
+    set->count = 0;
+    set->pool = malloc((size_t)count * 2 * (DNS_HEADER_SIZE + MAX_DOMAIN_LENGTH + sizeof(DNSQuestion)));
+    set->offset = malloc(sizeof(uint32_t) * count * 2);
+    set->len = malloc(sizeof(uint16_t) * count * 2);
+    return set->pool && set->offset && set->len ? 0 : -1;
+}
+
+static void query_set_add(QuerySet *set, const char *name) {
+    static const uint16_t types[2] = {DNS_TYPE_A, DNS_TYPE_AAAA};
+    uint32_t pos = set->count ? set->offset[set->count * 2 - 1] + set->len[set->count * 2 - 1] : 0;
+    for (int t = 0; t < 2; t++) {
+        DNSBuilder b;
+        dns_builder_init(&b, set->pool + pos, DNS_HEADER_SIZE + MAX_DOMAIN_LENGTH + sizeof(DNSQuestion));
+        if (dns_builder_question(&b, name, types[t], DNS_CLASS_IN) < 0) return;  // 名称非法，整条跳过
+        set->offset[set->count * 2 + t] = pos;
+        set->len[set->count * 2 + t] = (uint16_t)dns_builder_finish(&b, 0, 0x0100);  // RD
+        pos += set->len[set->count * 2 + t];
+    }
+    set->count++;
+}
+
+static int load_names(void) {
+    if (!cfg.names_file) {
+        if (query_set_init(&names, cfg.name_count) < 0) return -1;
+        char name[64];
+        for (uint32_t i = 0; i < cfg.name_count; i++) {
+            snprintf(name, sizeof(name), "h%u.s%u.bench.test", i, i % 997);
+            query_set_add(&names, name);
+        }
+        return 0;
+    }
+    FILE *fp = fopen(cfg.names_file, "r");
+    if (!fp) {
+        printf("无法打开名称文件 %s\n", cfg.names_file);
+        return -1;
+    }
+    char line[512];
+    uint32_t lines = 0;
+    while (fgets(line, sizeof(line), fp)) lines++;
+    if (lines == 0 || query_set_init(&names, lines) < 0) {
+        fclose(fp);
+        return -1;
+    }
+    rewind(fp);
+    while (fgets(line, sizeof(line), fp) && names.count < lines) {
+        char *name = strtok(line, " \t\r\n");
+        if (name && name[0] != '#') query_set_add(&names, name);
+    }
+    fclose(fp);
+    if (names.count == 0) {
+        printf("名称文件 %s 中没有可用的名称\n", cfg.names_file);
+        return -1;
+    }
+    return 0;
+}
+
+static int load_blocked(void) {
+    if (query_set_init(&blocked, LOAD_BLOCKED_NAMES) < 0) return -1;
+    char name[MAX_DOMAIN_LENGTH];
+    for (uint32_t i = 0; i < LOAD_BLOCKED_NAMES; i++) {
+        snprintf(name, sizeof(name), "b%u.%s", i, cfg.blocked_suffix);
+        query_set_add(&blocked, name);
+    }
+    return blocked.count ? 0 : -1;
+}
+
+// ----------- 内置上游 -----------
+
+// 对A/AAAA查询返回固定地址，其他类型返回空应答
+static void *stub_thread(void *arg) {
+    int fd = *(int *)arg;
+    static const uint8_t v4[4] = {192, 0, 2, 1};
+    static const uint8_t v6[16] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    uint8_t query[MAX_DNS_PACKET_SIZE], response[MAX_DNS_PACKET_SIZE];
+    char domain[MAX_DOMAIN_LENGTH];
+    while (!atomic_load(&stub_stop)) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = (int)recvfrom(fd, (char *)query, sizeof(query), 0, (struct sockaddr *)&from, &from_len);
+        if (len < DNS_HEADER_SIZE) continue;
+        int name_len = parse_dns_name(query, len, DNS_HEADER_SIZE, domain, sizeof(domain));
+        if (name_len < 0 || DNS_HEADER_SIZE + name_len + (int)sizeof(DNSQuestion) > len) continue;
+        const DNSQuestion *q = (const DNSQuestion *)(query + DNS_HEADER_SIZE + name_len);
+        uint16_t qtype = ntohs(q->qtype);
+
+        DNSBuilder b;
+        dns_builder_init(&b, response, sizeof(response));
+        dns_builder_question_raw(&b, query + DNS_HEADER_SIZE, name_len + (int)sizeof(DNSQuestion));
+        if (qtype == DNS_TYPE_A) {
+            dns_builder_add_rr(&b, DNS_SECTION_ANSWER, domain, DNS_TYPE_A, DNS_CLASS_IN, cfg.stub_ttl, v4, 4);
+        } else if (qtype == DNS_TYPE_AAAA) {
+            dns_builder_add_rr(&b, DNS_SECTION_ANSWER, domain, DNS_TYPE_AAAA, DNS_CLASS_IN, cfg.stub_ttl, v6, 16);
+        }
+        int out = dns_builder_finish(&b, ntohs(((const DNSHeader *)query)->id), 0x8180);
+        sendto(fd, (char *)response, out, 0, (struct sockaddr *)&from, from_len);
+    }
+    return NULL;
+}
+
+static int stub_start(pthread_t *thread, int *fd) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)cfg.stub_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    *fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (*fd < 0 || bind(*fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        printf("内置上游绑定 127.0.0.1:%d 失败\n", cfg.stub_port);
+        if (*fd >= 0) close(*fd);
+        return -1;
+    }
+    // 接收超时使线程能定期检查退出标志
+    struct timeval tv = {0, 100000};
+    setsockopt(*fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int size = 4 << 20;
+    setsockopt(*fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (pthread_create(thread, NULL, stub_thread, fd) != 0) {
+        close(*fd);
+        return -1;
+    }
+    return 0;
+}
+
+// ----------- 被测中继 -----------
+
+// 一次性同步查询，用于确认中继已开始应答
+static int probe_relay(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    struct timeval tv = {0, 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    connect(fd, (struct sockaddr *)&cfg.target, sizeof(cfg.target));
+    uint8_t buf[MAX_DNS_PACKET_SIZE];
+    int ok = -1;
+    uint64_t deadline = bench_now_ns() + LOAD_READY_TIMEOUT_MS * 1000000ULL;
+    while (ok < 0 && bench_now_ns() < deadline) {
+        send(fd, blocked.pool + blocked.offset[0], blocked.len[0], 0);
+        if (recv(fd, buf, sizeof(buf), 0) >= DNS_HEADER_SIZE) {
+            ok = 0;
+        } else if (errno == ECONNREFUSED) {
+            usleep(50000);  // 中继尚未绑定端口，recv立即失败
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+static pid_t spawn_relay(char *table_path) {
+    int tfd = mkstemp(table_path);
+    if (tfd < 0) return -1;
+    char rule[MAX_DOMAIN_LENGTH + 16];
+    int n = snprintf(rule, sizeof(rule), "0.0.0.0 .%s\n", cfg.blocked_suffix);
+    if (write(tfd, rule, (size_t)n) != n) {
+        close(tfd);
+        return -1;
+    }
+    close(tfd);
+
+    char port[16], upstream[64];
+    snprintf(port, sizeof(port), "%d", ntohs(cfg.target.sin_port));
+    if (cfg.upstream) {
+        snprintf(upstream, sizeof(upstream), "%s", cfg.upstream);
+    } else {
+        snprintf(upstream, sizeof(upstream), "127.0.0.1:%d", cfg.stub_port);
+    }
+    // 额外参数在前，中继要求选项位于位置参数之前
+    char metrics[16];
+    snprintf(metrics, sizeof(metrics), "%d", cfg.metrics_port);
+    char **argv = calloc((size_t)cfg.relay_argc + 10, sizeof(char *));
+    if (!argv) return -1;
+    int argc = 0;
+    argv[argc++] = (char *)cfg.spawn;
+    for (int i = 0; i < cfg.relay_argc; i++) argv[argc++] = cfg.relay_args[i];
+    if (cfg.admin) {
+        argv[argc++] = "-a";
+        argv[argc++] = (char *)cfg.admin;
+    }
+    if (cfg.metrics_port) {
+        argv[argc++] = "--metrics";
+        argv[argc++] = metrics;
+    }
+    argv[argc++] = "-p";
+    argv[argc++] = port;
+    argv[argc++] = upstream;
+    argv[argc++] = table_path;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!cfg.verbose) {
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+        }
+        signal(SIGPIPE, SIG_DFL);  // 忽略的信号会跨exec继承，中继应以默认处置运行
+        execv(cfg.spawn, argv);
+        _exit(127);
+    }
+    free(argv);
+    return pid;
+}
+
+/**
+ * 停止被测中继。
+ * @return 中继一直运行到被停止时返回0，此前已自行退出返回-1。
+ */
+static int stop_relay(pid_t pid) {
+    int status;
+    if (waitpid(pid, &status, WNOHANG) == pid) {
+        if (WIFSIGNALED(status)) {
+            printf("中继在压测期间被信号%d终止\n", WTERMSIG(status));
+        } else {
+            printf("中继在压测期间退出，状态%d\n", WEXITSTATUS(status));
+        }
+        return -1;
+    }
+    kill(pid, SIGINT);
+    waitpid(pid, NULL, 0);
+    return 0;
+}
+
+// ----------- 控制面中途断开 -----------
+
+// 发出请求后立即以SO_LINGER为0关闭，中继处理请求时写应答遇到的是已复位的连接
+static void hangup_send(int fd, const struct sockaddr *addr, socklen_t addr_len, const char *request) {
+    if (fd < 0) return;
+    if (connect(fd, addr, addr_len) == 0) {
+        send(fd, request, strlen(request), 0);
+        struct linger lg = {1, 0};
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    }
+    close(fd);
+}
+
+static void *hangup_thread(void *arg) {
+    (void)arg;
+    struct sockaddr_un admin = {0};
+    admin.sun_family = AF_UNIX;
+    if (cfg.admin) snprintf(admin.sun_path, sizeof(admin.sun_path), "%s", cfg.admin);
+    struct sockaddr_in metrics = {0};
+    metrics.sin_family = AF_INET;
+    metrics.sin_port = htons((uint16_t)cfg.metrics_port);
+    metrics.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    while (!atomic_load(&hangup_stop)) {
+        if (cfg.admin) {
+            hangup_send(socket(AF_UNIX, SOCK_STREAM, 0), (struct sockaddr *)&admin, sizeof(admin), "dump\n");
+            hangup_admin++;
+        }
+        if (cfg.metrics_port) {
+            hangup_send(socket(AF_INET, SOCK_STREAM, 0), (struct sockaddr *)&metrics, sizeof(metrics),
+                        "GET /metrics HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n");
+            hangup_metrics++;
+        }
+        usleep(cfg.hangup_ms * 1000);
+    }
+    return NULL;
+}
+
+// ----------- 发送与接收 -----------
+
+static int open_client(LoadClient *c) {
+    c->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (c->fd < 0) return -1;
+    int size = 1 << 20;
+    setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(c->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK);
+    // 连接后内核只投递来自中继的报文
+    if (connect(c->fd, (struct sockaddr *)&cfg.target, sizeof(cfg.target)) < 0) {
+        close(c->fd);
+        return -1;
+    }
+    return 0;
+}
+
+static void send_query(LoadThread *t, LoadClient *c, uint64_t intended, uint64_t *rng, uint32_t *pos) {
+    const QuerySet *set;
+    uint32_t name;
+    if (bench_rand_unit(rng) < cfg.blocked_ratio) {
+        set = &blocked;
+        name = (uint32_t)(bench_rand(rng) % blocked.count);
+    } else {
+        set = &names;
+        name = t->trace[(*pos)++ & (LOAD_TRACE_LEN - 1)];
+    }
+    uint32_t q = name * 2 + (bench_rand_unit(rng) < cfg.aaaa_ratio ? 1 : 0);
+
+    uint8_t packet[MAX_DNS_PACKET_SIZE];
+    uint16_t len = set->len[q];
+    memcpy(packet, set->pool + set->offset[q], len);
+    uint32_t seq = c->seq++;
+    uint16_t id = (uint16_t)seq;
+    ((DNSHeader *)packet)->id = htons(id);
+    if (send(c->fd, packet, len, 0) != len) {
+        t->send_errors++;
+        return;
+    }
+    uint32_t slot = seq & (LOAD_SLOTS - 1);
+    c->sent_at[slot] = intended;
+    c->slot_id[slot] = id;
+    t->sent++;
+}
+
+static void drain_client(LoadThread *t, LoadClient *c) {
+    uint8_t buf[MAX_DNS_PACKET_SIZE];
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n < 0) return;  // EAGAIN，或ICMP不可达引起的错误
+        if (n < DNS_HEADER_SIZE) continue;
+        const DNSHeader *h = (const DNSHeader *)buf;
+        uint16_t id = ntohs(h->id);
+        uint32_t slot = id & (LOAD_SLOTS - 1);
+        if (!c->sent_at[slot] || c->slot_id[slot] != id) continue;  // 重复或已被后续查询覆盖
+        uint64_t latency = bench_now_ns() - c->sent_at[slot];
+        c->sent_at[slot] = 0;
+        if (latency > (uint64_t)cfg.timeout_ms * 1000000ULL) {
+            t->late++;
+            continue;
+        }
+        uint16_t flags = ntohs(h->flags);
+        t->received++;
+        t->rcodes[flags & 0xF]++;
+        if (flags & DNS_FLAG_TC) t->truncated++;
+        hist_record(&t->hist, latency);
+    }
+}
+
+static void *load_thread(void *arg) {
+    LoadThread *t = arg;
+    struct pollfd pfds[LOAD_MAX_CLIENTS];
+    for (int i = 0; i < t->client_count; i++) {
+        pfds[i].fd = t->clients[i].fd;
+        pfds[i].events = POLLIN;
+    }
+    uint64_t rng = 0x9E3779B97F4A7C15ULL * (uint64_t)(t->index + 1);
+    uint32_t pos = 0;
+    double interval = 1e9 * cfg.threads / cfg.rate;
+    // 各线程的发送时刻错开，合起来是均匀的总速率
+    double next = (double)t->start_ns + interval * t->index / cfg.threads;
+    uint64_t deadline = t->end_ns + (uint64_t)cfg.timeout_ms * 1000000ULL;
+    int client = 0;
+
+    for (;;) {
+        uint64_t now = bench_now_ns();
+        // 开环：补发所有已到计划时刻的查询，不等待应答
+        while (next <= (double)now && next < (double)t->end_ns) {
+            send_query(t, &t->clients[client], (uint64_t)next, &rng, &pos);
+            if (++client == t->client_count) client = 0;
+            next += interval;
+        }
+        if (now >= deadline) break;
+        int sending = next < (double)t->end_ns;
+        uint64_t wake = sending ? (uint64_t)next : deadline;
+        uint64_t wait_ns = wake > now ? wake - now : 0;
+        // 等待到下一个发送时刻，期间有应答即返回；不忙等，避免与同核上的被测中继争抢CPU
+#ifdef __linux__
+        struct timespec ts = {(time_t)(wait_ns / 1000000000ULL), (long)(wait_ns % 1000000000ULL)};
+        int ready = ppoll(pfds, (nfds_t)t->client_count, &ts, NULL);
+#else
+        int ready = poll(pfds, (nfds_t)t->client_count, (int)((wait_ns + 999999ULL) / 1000000ULL));
+#endif
+        if (ready > 0) {
+            for (int i = 0; i < t->client_count; i++) {
+                if (pfds[i].revents) drain_client(t, &t->clients[i]);
+            }
+        }
+        // 发送结束后所有查询都已应答即可提前结束
+        if (!sending && t->received + t->late == t->sent) break;
+    }
+    return NULL;
+}
+
+// ----------- 结果输出 -----------
+
+static void report(LoadThread *threads, double elapsed_s) {
+    LoadThread total;
+    memset(&total, 0, sizeof(total));
+    for (int i = 0; i < cfg.threads; i++) {
+        LoadThread *t = &threads[i];
+        total.sent += t->sent;
+        total.received += t->received;
+        total.late += t->late;
+        total.send_errors += t->send_errors;
+        total.truncated += t->truncated;
+        for (int r = 0; r < 16; r++) total.rcodes[r] += t->rcodes[r];
+        hist_merge(&total.hist, &t->hist);
+    }
+    uint64_t lost = total.sent - total.received;
+    double loss = total.sent ? 100.0 * lost / total.sent : 0.0;
+    const LatencyHist *h = &total.hist;
+    if (cfg.csv) {
+        printf("rate,duration,clients,threads,sent,received,lost_pct,send_qps,answer_qps,mean_us,p50_us,p90_us,p99_us,"
+               "p999_us,p9999_us,max_us\n");
+        printf("%.0f,%.1f,%d,%d,%llu,%llu,%.4f,%.0f,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f\n", cfg.rate, cfg.duration,
+               cfg.clients, cfg.threads, (unsigned long long)total.sent, (unsigned long long)total.received, loss,
+               total.sent / cfg.duration, total.received / elapsed_s, hist_mean(h) / 1000.0,
+               hist_percentile(h, 0.5) / 1000.0, hist_percentile(h, 0.9) / 1000.0, hist_percentile(h, 0.99) / 1000.0,
+               hist_percentile(h, 0.999) / 1000.0, hist_percentile(h, 0.9999) / 1000.0, hist_load(&h->max) / 1000.0);
+        return;
+    }
+    printf("sent      %llu (%.0f/s, offered %.0f/s), send errors %llu\n", (unsigned long long)total.sent,
+           total.sent / cfg.duration, cfg.rate, (unsigned long long)total.send_errors);
+    printf("received  %llu (%.0f/s)\n", (unsigned long long)total.received, total.received / elapsed_s);
+    printf("lost      %llu (%.3f%%), of which late %llu\n", (unsigned long long)lost, loss,
+           (unsigned long long)total.late);
+    printf("rcode     NOERROR %llu  NXDOMAIN %llu  SERVFAIL %llu  other %llu  TC %llu\n",
+           (unsigned long long)total.rcodes[DNS_RCODE_NO_ERROR], (unsigned long long)total.rcodes[DNS_RCODE_NAME_ERROR],
+           (unsigned long long)total.rcodes[DNS_RCODE_SERVER_FAILURE],
+           (unsigned long long)(total.received - total.rcodes[DNS_RCODE_NO_ERROR] -
+                                total.rcodes[DNS_RCODE_NAME_ERROR] - total.rcodes[DNS_RCODE_SERVER_FAILURE]),
+           (unsigned long long)total.truncated);
+    printf("latency   mean %.1fus  p50 %.1fus  p90 %.1fus  p99 %.1fus  p99.9 %.1fus  p99.99 %.1fus  max %.1fus\n",
+           hist_mean(h) / 1000.0, hist_percentile(h, 0.5) / 1000.0, hist_percentile(h, 0.9) / 1000.0,
+           hist_percentile(h, 0.99) / 1000.0, hist_percentile(h, 0.999) / 1000.0, hist_percentile(h, 0.9999) / 1000.0,
+           hist_load(&h->max) / 1000.0);
+    if (cfg.print_hist) hist_print_distribution(h, stdout, 5);
+}
+
+int main(int argc, char *argv[]) {
+    if (parse_args(argc, argv) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (load_names() < 0 || load_blocked() < 0) return 1;
+
+    pthread_t stub;
+    int stub_fd = -1;
+    if (cfg.stub_port && stub_start(&stub, &stub_fd) < 0) return 1;
+
+    pid_t relay = -1;
+    char table_path[] = "/tmp/dnsrelay-bench-XXXXXX";
+    int status = 1;
+    if (cfg.spawn) {
+        relay = spawn_relay(table_path);
+        if (relay < 0) {
+            printf("启动中继 %s 失败\n", cfg.spawn);
+            goto out;
+        }
+    }
+    if (probe_relay() < 0) {
+        printf("中继在%d毫秒内没有应答\n", LOAD_READY_TIMEOUT_MS);
+        goto out;
+    }
+
+    LoadThread *threads = calloc((size_t)cfg.threads, sizeof(LoadThread));
+    LoadClient *clients = calloc((size_t)cfg.clients, sizeof(LoadClient));
+    if (!threads || !clients) goto out;
+    for (int i = 0; i < cfg.clients; i++) {
+        if (open_client(&clients[i]) < 0) {
+            printf("创建客户端套接字失败\n");
+            goto out;
+        }
+    }
+    if (!cfg.csv) {
+        char target[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &cfg.target.sin_addr, target, sizeof(target));
+        printf("target    %s:%d, %.0f qps for %.1fs, %d clients on %d threads\n", target, ntohs(cfg.target.sin_port),
+               cfg.rate, cfg.duration, cfg.clients, cfg.threads);
+        printf("mix       %u names zipf(%.2f), AAAA %.0f%%, blocked %.0f%% under %s\n", names.count, BENCH_ZIPF_S,
+               cfg.aaaa_ratio * 100, cfg.blocked_ratio * 100, cfg.blocked_suffix);
+    }
+
+    for (int i = 0; i < cfg.threads; i++) {
+        LoadThread *t = &threads[i];
+        t->index = i;
+        t->clients = clients + cfg.clients * i / cfg.threads;
+        t->client_count = cfg.clients * (i + 1) / cfg.threads - cfg.clients * i / cfg.threads;
+        t->trace = bench_make_trace(BENCH_ZIPF, names.count, LOAD_TRACE_LEN, 0x5EED + (uint64_t)i);
+        if (!t->trace) goto out;
+    }
+    // 访问序列生成完毕后再定起始时刻，否则开头的查询都会被计为迟发
+    uint64_t start = bench_now_ns() + 10000000ULL;  // 留出线程启动时间
+    uint64_t end = start + (uint64_t)(cfg.duration * 1e9);
+    for (int i = 0; i < cfg.threads; i++) {
+        threads[i].start_ns = start;
+        threads[i].end_ns = end;
+    }
+    pthread_t hangup;
+    int hangup_running = cfg.hangup_ms && pthread_create(&hangup, NULL, hangup_thread, NULL) == 0;
+    for (int i = 0; i < cfg.threads; i++) pthread_create(&threads[i].thread, NULL, load_thread, &threads[i]);
+    for (int i = 0; i < cfg.threads; i++) pthread_join(threads[i].thread, NULL);
+    if (hangup_running) {
+        atomic_store(&hangup_stop, 1);
+        pthread_join(hangup, NULL);
+    }
+    double elapsed = (bench_now_ns() - start) / 1e9;
+    // 接收窗口包含发送结束后的等待，速率按发送时长与实际结束时刻中较短者计
+    report(threads, elapsed < cfg.duration ? elapsed : cfg.duration);
+    if (hangup_running && !cfg.csv) {
+        printf("hangup    %llu admin and %llu metrics requests reset before reading the reply\n",
+               (unsigned long long)hangup_admin, (unsigned long long)hangup_metrics);
+    }
+    status = 0;
+
+out:
+    if (relay > 0) {
+        if (stop_relay(relay) < 0) status = 1;
+        unlink(table_path);
+    }
+    if (stub_fd >= 0) {
+        atomic_store(&stub_stop, 1);
+        pthread_join(stub, NULL);
+        close(stub_fd);
+    }
+    return status;
+}
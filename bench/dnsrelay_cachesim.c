@@ -0,0 +1,681 @@
+/*
+ * 离线缓存模拟器：把记录下来的查询流按虚拟时钟回放进真实的DNSCache代码（读穿：未命中即
+ * 计一次上游查询，应答可缓存时按其TTL写入），在一组字节预算与淘汰策略上报告命中率、
+ * 上游查询数与内存占用。时间只取自记录，不等待，运行速度远快于实际时间。
+ * 输入：
+ *   pcap      经典pcap抓包，查询取发往--dns-port的标准查询，应答的TTL与地址取自抓包中的应答；
+ *   qlog      dnsrelay --qlog写出的二进制日志，应答取自其中的应答记录，本地表应答的问题不计入上游；
+ *   文本      每行"[时间] 名称 [类型] [TTL]"（时间为秒，可带小数），或dnsrelay -d输出的查询日志行；
+ *             没有TTL的名称使用--ttl，没有时间时按--qps均匀推进。
+ * 策略：clock为真实的DNSCache（分片CLOCK，预算含桶数组）；lru、fifo与inf（不限容量，
+ * 只受TTL约束，即命中率上界）为按相同条目字节数计费的参照模型，便于判断换策略的收益。
+ * 同一问题在抓包中的TTL取出现过的最大值（递归服务器返回的是剩余TTL）；
+ * 上游往返期间的并发未命中按立即写入处理。
+ * 用法：dnsrelay-cachesim [选项] <trace>
+ */
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "bench_common.h"
+#include "bench_pcap.h"
+#include "server.h"
+
+#define SIM_MAX_CAPACITIES 32
+#define SIM_DEFAULT_CAPACITIES "256K,1M,4M,16M,64M"
+#define SIM_DEFAULT_POLICIES "clock,lru,fifo,inf"
+#define SIM_CLEANUP_INTERVAL_S CACHE_CLEANUP_INTERVAL  // 与服务器相同的定期清理间隔
+#define SIM_SAMPLE_INTERVAL 4096                        // 每隔多少个查询采样一次内存占用
+#define SIM_CLOCK_BASE_S 1000000000LL                   // 虚拟时钟起点（秒）
+#define SIM_NONE UINT32_MAX
+
+typedef enum sim_format { FORMAT_AUTO, FORMAT_PCAP, FORMAT_QLOG, FORMAT_TEXT } SimFormat;
+
+typedef enum sim_policy { POLICY_CLOCK, POLICY_LRU, POLICY_FIFO, POLICY_INF, POLICY_COUNT } SimPolicy;
+
+static const char *const policy_names[POLICY_COUNT] = {"clock", "lru", "fifo", "inf"};
+
+// 记录中出现过的一个问题（名称 + 类型），以及它的应答能否被中继缓存
+typedef struct sim_key {
+    UT_hash_handle hh;
+    uint32_t index;
+    uint32_t ttl;         // 应答中所查类型记录的TTL（取最大值）
+    uint32_t bytes;       // 按真实缓存的计费方式计算的条目字节数
+    uint8_t cacheable;    // 应答中有所查类型的A/AAAA记录
+    uint8_t local;        // 由本地表应答，不经过缓存
+    char ip[46];
+    uint16_t qtype;       // 哈希键从qtype开始，连同其后的name
+    char name[];
+} SimKey;
+
+typedef struct sim_event {
+    uint64_t time_ns;     // 相对记录开始的时间
+    uint32_t key;
+} SimEvent;
+
+typedef struct sim_trace {
+    SimKey *table;
+    SimKey **keys;
+    uint32_t key_count;
+    uint32_t key_capacity;
+    SimEvent *events;
+    uint64_t event_count;
+    uint64_t event_capacity;
+    uint64_t base_ns;     // 第一个查询的原始时间
+    uint64_t last_ns;     // 用于保证时间单调
+    int started;
+} SimTrace;
+
+typedef struct sim_result {
+    SimPolicy policy;
+    uint64_t capacity;    // 0表示不限
+    uint64_t queries;     // 经过缓存的查询（不含本地表应答）
+    uint64_t hits;
+    uint64_t upstream;
+    uint64_t evicted;
+    uint64_t expired;
+    uint64_t peak_bytes;
+    uint64_t final_bytes;
+    uint32_t entries;
+    double wall_s;
+} SimResult;
+
+// 参照模型的条目状态，按问题下标直接寻址
+typedef struct ref_slot {
+    uint32_t prev, next;  // 双向链表，头部最先淘汰
+    int64_t expire_s;
+    uint8_t present;
+} RefSlot;
+
+typedef struct sim_config {
+    const char *trace;
+    SimFormat format;
+    uint64_t capacities[SIM_MAX_CAPACITIES];
+    int capacity_count;
+    int policies[POLICY_COUNT];
+    uint32_t ttl;
+    double qps;
+    int dns_port;
+    const char *table;
+    int csv;
+} SimConfig;
+
+static SimConfig cfg = {
+    .ttl = 300,
+    .qps = 1000,
+    .dns_port = DNS_PORT,
+};
+
+static struct timeval virtual_now;
+
+static void usage(const char *program) {
+    printf("Usage: %s [options] <trace>\n", program);
+    printf("  -f <format>         pcap, qlog or text (default: detected from the file)\n");
+    printf("  -m <sizes>          Comma-separated cache budgets, K/M/G suffix allowed (default %s)\n",
+           SIM_DEFAULT_CAPACITIES);
+    printf("  -p <policies>       Comma-separated policies: clock (the real cache), lru, fifo, inf (default all)\n");
+    printf("  --ttl <s>           TTL of text-log names without one (default 300)\n");
+    printf("  --qps <n>           Query rate assumed for text logs without timestamps (default 1000)\n");
+    printf("  --dns-port <port>   Server port of DNS traffic in a pcap (default 53)\n");
+    printf("  --table <file>      Local table; names it answers never reach the cache\n");
+    printf("  --csv               Print machine-readable results\n");
+}
+
+static int parse_capacities(const char *text) {
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%s", text);
+    cfg.capacity_count = 0;
+    for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        if (cfg.capacity_count == SIM_MAX_CAPACITIES) return -1;
+        uint64_t bytes;
+        if (parse_size(tok, &bytes) < 0 || bytes == 0) return -1;
+        cfg.capacities[cfg.capacity_count++] = bytes;
+    }
+    return cfg.capacity_count ? 0 : -1;
+}
+
+static int parse_policies(const char *text) {
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s", text);
+    memset(cfg.policies, 0, sizeof(cfg.policies));
+    int any = 0;
+    for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        int found = 0;
+        for (int p = 0; p < POLICY_COUNT; p++) {
+            if (strcmp(tok, policy_names[p]) == 0) cfg.policies[p] = found = any = 1;
+        }
+        if (!found) return -1;
+    }
+    return any ? 0 : -1;
+}
+
+static int parse_args(int argc, char *argv[]) {
+    parse_capacities(SIM_DEFAULT_CAPACITIES);
+    parse_policies(SIM_DEFAULT_POLICIES);
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (arg[0] != '-') {
+            if (cfg.trace) return -1;
+            cfg.trace = arg;
+        } else if (strcmp(arg, "--csv") == 0) {
+            cfg.csv = 1;
+        } else if (!val) {
+            return -1;
+        } else {
+            i++;
+            if (strcmp(arg, "-f") == 0) {
+                if (strcmp(val, "pcap") == 0) cfg.format = FORMAT_PCAP;
+                else if (strcmp(val, "qlog") == 0) cfg.format = FORMAT_QLOG;
+                else if (strcmp(val, "text") == 0) cfg.format = FORMAT_TEXT;
+                else return -1;
+            } else if (strcmp(arg, "-m") == 0) {
+                if (parse_capacities(val) < 0) return -1;
+            } else if (strcmp(arg, "-p") == 0) {
+                if (parse_policies(val) < 0) return -1;
+            } else if (strcmp(arg, "--ttl") == 0) {
+                cfg.ttl = (uint32_t)strtoul(val, NULL, 10);
+            } else if (strcmp(arg, "--qps") == 0) {
+                cfg.qps = atof(val);
+            } else if (strcmp(arg, "--dns-port") == 0) {
+                cfg.dns_port = atoi(val);
+            } else if (strcmp(arg, "--table") == 0) {
+                cfg.table = val;
+            } else {
+                return -1;
+            }
+        }
+    }
+    if (!cfg.trace || cfg.qps <= 0 || cfg.dns_port <= 0 || cfg.dns_port > 65535) return -1;
+    return 0;
+}
+
+// ----------- 查询流 -----------
+
+/**
+ * 取得问题对应的下标，首次出现时登记。
+ * @return 下标，名称过长或内存不足时返回SIM_NONE。
+ */
+static uint32_t intern_key(SimTrace *t, const char *name, uint16_t qtype) {
+    size_t name_len = strlen(name);
+    if (name_len + 7 > CACHE_KEY_MAX) return SIM_NONE;
+    uint8_t lookup[sizeof(uint16_t) + MAX_DOMAIN_LENGTH];
+    memcpy(lookup, &qtype, sizeof(qtype));
+    memcpy(lookup + sizeof(qtype), name, name_len + 1);
+    unsigned key_len = (unsigned)(sizeof(qtype) + name_len + 1);
+    SimKey *k;
+    HASH_FIND(hh, t->table, lookup, key_len, k);
+    if (k) return k->index;
+
+    if (t->key_count == t->key_capacity) {
+        uint32_t capacity = t->key_capacity ? t->key_capacity * 2 : 4096;
+        SimKey **keys = realloc(t->keys, sizeof(SimKey *) * capacity);
+        if (!keys) return SIM_NONE;
+        t->keys = keys;
+        t->key_capacity = capacity;
+    }
+    k = calloc(1, sizeof(SimKey) + name_len + 1);
+    if (!k) return SIM_NONE;
+    k->index = t->key_count;
+    k->qtype = qtype;
+    memcpy(k->name, name, name_len + 1);
+    // 与cache_put相同：条目头部 + "名称#类型" + 结尾0
+    char type_digits[8];
+    k->bytes = (uint32_t)(sizeof(CacheEntry) + name_len + 1 + (size_t)snprintf(type_digits, sizeof(type_digits),
+                                                                                  "%u", qtype) + 1);
+    HASH_ADD(hh, t->table, qtype, key_len, k);
+    t->keys[t->key_count++] = k;
+    return k->index;
+}
+
+static int add_event(SimTrace *t, uint64_t time_ns, uint32_t key) {
+    if (key == SIM_NONE) return 0;
+    if (t->event_count == t->event_capacity) {
+        uint64_t capacity = t->event_capacity ? t->event_capacity * 2 : 65536;
+        SimEvent *events = realloc(t->events, sizeof(SimEvent) * capacity);
+        if (!events) return -1;
+        t->events = events;
+        t->event_capacity = capacity;
+    }
+    if (!t->started) {
+        t->base_ns = t->last_ns = time_ns;
+        t->started = 1;
+    }
+    if (time_ns < t->last_ns) time_ns = t->last_ns;  // 记录中的时间偶有倒退
+    t->last_ns = time_ns;
+    t->events[t->event_count].time_ns = time_ns - t->base_ns;
+    t->events[t->event_count].key = key;
+    t->event_count++;
+    return 0;
+}
+
+// 记录问题的应答：取所查类型的第一条A/AAAA记录，TTL保留最大值
+static void note_answer(SimTrace *t, uint32_t key, uint32_t ttl, const char *ip) {
+    if (key == SIM_NONE) return;
+    SimKey *k = t->keys[key];
+    if (!k->cacheable || ttl > k->ttl) {
+        k->ttl = ttl;
+        snprintf(k->ip, sizeof(k->ip), "%s", ip);
+    }
+    k->cacheable = 1;
+}
+
+/**
+ * 解析DNS报文的问题区。
+ * @return 问题区之后的偏移，报文不是单问题或格式错误时返回-1。
+ */
+static int parse_question(const uint8_t *msg, int len, char *name, uint16_t *qtype) {
+    if (len < DNS_HEADER_SIZE || ntohs(((const DNSHeader *)msg)->qdcount) != 1) return -1;
+    int name_len = parse_dns_name(msg, len, DNS_HEADER_SIZE, name, MAX_DOMAIN_LENGTH);
+    if (name_len < 0 || DNS_HEADER_SIZE + name_len + (int)sizeof(DNSQuestion) > len) return -1;
+    const DNSQuestion *q = (const DNSQuestion *)(msg + DNS_HEADER_SIZE + name_len);
+    *qtype = ntohs(q->qtype);
+    return DNS_HEADER_SIZE + name_len + (int)sizeof(DNSQuestion);
+}
+
+// 处理一个DNS报文：查询加入查询流，应答记下可缓存的记录；local为1表示该应答来自本地表
+static int add_message(SimTrace *t, uint64_t time_ns, const uint8_t *msg, int len, int local) {
+    char name[MAX_DOMAIN_LENGTH], rr_name[MAX_DOMAIN_LENGTH];
+    uint16_t qtype;
+    int off = parse_question(msg, len, name, &qtype);
+    if (off < 0) return 0;
+    uint16_t flags = ntohs(((const DNSHeader *)msg)->flags);
+    if (((flags >> 11) & 0xF) != 0) return 0;  // 只处理标准查询
+    uint32_t key = intern_key(t, name, qtype);
+    if (!(flags & 0x8000)) return add_event(t, time_ns, key);
+    if (key == SIM_NONE) return 0;
+    if (local) {
+        t->keys[key]->local = 1;
+        return 0;
+    }
+    // 与update_cache一致：回答区中第一条所查类型的A/AAAA记录
+    int ancount = ntohs(((const DNSHeader *)msg)->ancount);
+    for (int i = 0; i < ancount; i++) {
+        int name_len = parse_dns_name(msg, len, off, rr_name, sizeof(rr_name));
+        if (name_len < 0 || off + name_len + (int)sizeof(DNS_RR) > len) return 0;
+        const DNS_RR *rr = (const DNS_RR *)(msg + off + name_len);
+        uint16_t type = ntohs(rr->type), rdlength = ntohs(rr->rdlength);
+        const uint8_t *rdata = msg + off + name_len + sizeof(DNS_RR);
+        if (off + name_len + (int)sizeof(DNS_RR) + rdlength > len) return 0;
+        if (type == qtype && ((type == DNS_TYPE_A && rdlength == 4) || (type == DNS_TYPE_AAAA && rdlength == 16))) {
+            char ip[46];
+            inet_ntop(type == DNS_TYPE_A ? AF_INET : AF_INET6, rdata, ip, sizeof(ip));
+            note_answer(t, key, ntohl(rr->ttl), ip);
+            return 0;
+        }
+        off += name_len + (int)sizeof(DNS_RR) + rdlength;
+    }
+    return 0;
+}
+
+static int load_pcap(SimTrace *t, const char *path) {
+    BenchPcap pcap;
+    if (bench_pcap_open(&pcap, path) < 0) return -1;
+    BenchUdp u;
+    int ret = 0;
+    while (ret == 0 && bench_pcap_next_udp(&pcap, &u)) {
+        if (u.len > MAX_DNS_PACKET_SIZE) continue;
+        if (u.dport != cfg.dns_port && u.sport != cfg.dns_port) continue;
+        ret = add_message(t, u.time_ns, u.payload, (int)u.len, 0);
+    }
+    bench_pcap_close(&pcap);
+    return ret;
+}
+
+static int load_qlog(SimTrace *t, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(QLogFileHeader)) {
+        close(fd);
+        return -1;
+    }
+    size_t size = (size_t)st.st_size;
+    const uint8_t *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return -1;
+    madvise((void *)data, size, MADV_SEQUENTIAL);
+    QLogFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, QLOG_MAGIC, 8) != 0 || header.byte_order != QLOG_BYTE_ORDER) {
+        munmap((void *)data, size);
+        return -1;
+    }
+    int ret = 0;
+    size_t pos = sizeof(QLogFileHeader);
+    while (ret == 0 && pos + sizeof(QLogRecord) <= size) {
+        QLogRecord rec;
+        memcpy(&rec, data + pos, sizeof(rec));
+        if (rec.length < sizeof(QLogRecord) || pos + rec.length > size) break;
+        const uint8_t *msg = data + pos + sizeof(QLogRecord);
+        int local = rec.path == PATH_LOCAL || rec.path == PATH_BLOCKED;
+        if (rec.kind == QLOG_KIND_QUERY || rec.kind == QLOG_KIND_RESPONSE) {
+            ret = add_message(t, rec.time_ns, msg, rec.msg_len, local);
+        }
+        pos += ((size_t)rec.length + 7) & ~(size_t)7;
+    }
+    munmap((void *)data, size);
+    return ret;
+}
+
+// 解析dnsrelay日志行开头的"YYYY-mm-dd HH:MM:SS.usec"，返回Unix纳秒，格式不符返回0
+static uint64_t parse_log_time(const char *line) {
+    struct tm tm;
+    int usec = 0;
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(line, "%d-%d-%d %d:%d:%d.%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min,
+               &tm.tm_sec, &usec) != 7) {
+        return 0;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    return (uint64_t)timegm(&tm) * 1000000000ULL + (uint64_t)usec * 1000ULL;
+}
+
+static int parse_type(const char *text, uint16_t *qtype) {
+    if (strcasecmp(text, "A") == 0) {
+        *qtype = DNS_TYPE_A;
+    } else if (strcasecmp(text, "AAAA") == 0) {
+        *qtype = DNS_TYPE_AAAA;
+    } else if (strncasecmp(text, "TYPE", 4) == 0 && isdigit((unsigned char)text[4])) {
+        *qtype = (uint16_t)atoi(text + 4);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int is_number(const char *text) {
+    char *end;
+    strtod(text, &end);
+    return end != text && *end == '\0';
+}
+
+static int load_text(SimTrace *t, const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) return -1;
+    char line[1024], name[MAX_DOMAIN_LENGTH];
+    uint64_t untimed = 0;
+    int ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), fp)) {
+        uint64_t time_ns = 0;
+        int timed = 0;
+        uint16_t qtype = DNS_TYPE_A;
+        uint32_t ttl = cfg.ttl;
+        const char *domain = strstr(line, "Domain: ");
+        if (domain) {
+            // dnsrelay -d 的查询日志：时间戳在行首，类型未记录，按A处理
+            if (sscanf(domain + 8, "%255s", name) != 1) continue;
+            time_ns = parse_log_time(line);
+            timed = time_ns != 0;
+        } else {
+            line[strcspn(line, "#\r\n")] = '\0';
+            char *tok[4];
+            int n = 0;
+            for (char *p = strtok(line, " \t"); p && n < 4; p = strtok(NULL, " \t")) tok[n++] = p;
+            int i = 0;
+            if (n > 1 && is_number(tok[0])) {
+                time_ns = (uint64_t)(strtod(tok[0], NULL) * 1e9);
+                timed = 1;
+                i = 1;
+            }
+            if (i >= n) continue;
+            snprintf(name, sizeof(name), "%s", tok[i++]);
+            if (i < n && parse_type(tok[i], &qtype) == 0) i++;
+            if (i < n && is_number(tok[i])) ttl = (uint32_t)strtoul(tok[i], NULL, 10);
+        }
+        size_t len = strlen(name);
+        if (len > 1 && name[len - 1] == '.') name[--len] = '\0';
+        for (size_t c = 0; c < len; c++) name[c] = (char)tolower((unsigned char)name[c]);
+        if (!timed) time_ns = (uint64_t)(untimed++ * 1e9 / cfg.qps);
+        uint32_t key = intern_key(t, name, qtype);
+        if (key == SIM_NONE) continue;
+        if (!t->keys[key]->cacheable) {
+            note_answer(t, key, ttl, qtype == DNS_TYPE_AAAA ? "2001:db8::1" : "192.0.2.1");
+        }
+        ret = add_event(t, time_ns, key);
+    }
+    fclose(fp);
+    return ret;
+}
+
+static SimFormat detect_format(const char *path) {
+    uint8_t magic[8] = {0};
+    FILE *fp = fopen(path, "rb");
+    if (!fp) return FORMAT_TEXT;
+    size_t n = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    if (n == sizeof(magic) && memcmp(magic, QLOG_MAGIC, 8) == 0) return FORMAT_QLOG;
+    uint32_t m, swapped;
+    memcpy(&m, magic, 4);
+    swapped = __builtin_bswap32(m);
+    if (n >= 4 && (m == BENCH_PCAP_MAGIC_US || m == BENCH_PCAP_MAGIC_NS || swapped == BENCH_PCAP_MAGIC_US ||
+                   swapped == BENCH_PCAP_MAGIC_NS)) {
+        return FORMAT_PCAP;
+    }
+    return FORMAT_TEXT;
+}
+
+// ----------- 模拟 -----------
+
+static inline void advance_clock(uint64_t time_ns) {
+    virtual_now.tv_sec = (time_t)(SIM_CLOCK_BASE_S + (int64_t)(time_ns / 1000000000ULL));
+    virtual_now.tv_usec = (long)(time_ns % 1000000000ULL / 1000ULL);
+}
+
+static void run_clock(const SimTrace *t, SimResult *r) {
+    DNSCache *cache = cache_create(r->capacity);
+    if (!cache) return;
+    CacheStats st;
+    int64_t next_cleanup = SIM_CLOCK_BASE_S + SIM_CLEANUP_INTERVAL_S;
+    for (uint64_t i = 0; i < t->event_count; i++) {
+        const SimKey *k = t->keys[t->events[i].key];
+        if (k->local) continue;
+        advance_clock(t->events[i].time_ns);
+        if (virtual_now.tv_sec >= next_cleanup) {
+            cache_cleanup_expired(cache);
+            next_cleanup = virtual_now.tv_sec + SIM_CLEANUP_INTERVAL_S;
+        }
+        r->queries++;
+        const CacheEntry *e = cache_get(cache, k->name, k->qtype);
+        if (e) {
+            r->hits++;
+        } else {
+            r->upstream++;
+            if (k->cacheable) cache_put(cache, k->name, k->qtype, k->ip, k->ttl);
+        }
+        if ((r->queries & (SIM_SAMPLE_INTERVAL - 1)) == 0) {
+            cache_get_stats(cache, &st);
+            if (st.current_bytes > r->peak_bytes) r->peak_bytes = st.current_bytes;
+        }
+    }
+    cache_get_stats(cache, &st);
+    if (st.current_bytes > r->peak_bytes) r->peak_bytes = st.current_bytes;
+    r->final_bytes = st.current_bytes;
+    r->entries = st.current_size;
+    r->evicted = st.evicted;
+    r->expired = st.expired;
+    cache_destroy(cache);
+}
+
+typedef struct ref_cache {
+    RefSlot *slots;
+    uint32_t head, tail;
+    uint64_t bytes;
+    uint32_t count;
+} RefCache;
+
+static void ref_unlink(RefCache *c, uint32_t i) {
+    RefSlot *s = &c->slots[i];
+    if (s->prev != SIM_NONE) c->slots[s->prev].next = s->next;
+    else c->head = s->next;
+    if (s->next != SIM_NONE) c->slots[s->next].prev = s->prev;
+    else c->tail = s->prev;
+}
+
+static void ref_append(RefCache *c, uint32_t i) {
+    RefSlot *s = &c->slots[i];
+    s->prev = c->tail;
+    s->next = SIM_NONE;
+    if (c->tail != SIM_NONE) c->slots[c->tail].next = i;
+    else c->head = i;
+    c->tail = i;
+}
+
+static void ref_remove(RefCache *c, const SimTrace *t, uint32_t i) {
+    ref_unlink(c, i);
+    c->slots[i].present = 0;
+    c->bytes -= t->keys[i]->bytes;
+    c->count--;
+}
+
+/*
+ * 参照模型：lru命中时移到链表尾，fifo保持写入顺序，inf不淘汰。
+ * 与真实缓存一样，过期条目只在查找时视为未命中，由定期清理或淘汰回收，重新写入时原位替换。
+ */
+static void run_reference(const SimTrace *t, SimResult *r) {
+    RefCache c = {calloc(t->key_count ? t->key_count : 1, sizeof(RefSlot)), SIM_NONE, SIM_NONE, 0, 0};
+    if (!c.slots) return;
+    uint64_t capacity = r->policy == POLICY_INF ? UINT64_MAX : r->capacity;
+    int64_t next_cleanup = SIM_CLOCK_BASE_S + SIM_CLEANUP_INTERVAL_S;
+    for (uint64_t n = 0; n < t->event_count; n++) {
+        uint32_t i = t->events[n].key;
+        const SimKey *k = t->keys[i];
+        if (k->local) continue;
+        advance_clock(t->events[n].time_ns);
+        int64_t now = virtual_now.tv_sec;
+        if (now >= next_cleanup) {
+            for (uint32_t j = c.head; j != SIM_NONE;) {
+                uint32_t next = c.slots[j].next;
+                if (c.slots[j].expire_s <= now) {
+                    ref_remove(&c, t, j);
+                    r->expired++;
+                }
+                j = next;
+            }
+            next_cleanup = now + SIM_CLEANUP_INTERVAL_S;
+        }
+        r->queries++;
+        RefSlot *s = &c.slots[i];
+        if (s->present && s->expire_s > now) {
+            r->hits++;
+            if (r->policy == POLICY_LRU) {
+                ref_unlink(&c, i);
+                ref_append(&c, i);
+            }
+            continue;
+        }
+        r->upstream++;
+        if (!k->cacheable || k->bytes > capacity) continue;
+        if (s->present) {
+            s->expire_s = now + k->ttl;
+            if (r->policy == POLICY_LRU) {
+                ref_unlink(&c, i);
+                ref_append(&c, i);
+            }
+            continue;
+        }
+        while (c.bytes + k->bytes > capacity && c.head != SIM_NONE) {
+            ref_remove(&c, t, c.head);
+            r->evicted++;
+        }
+        s->present = 1;
+        s->expire_s = now + k->ttl;
+        c.bytes += k->bytes;
+        c.count++;
+        ref_append(&c, i);
+        if (c.bytes > r->peak_bytes) r->peak_bytes = c.bytes;
+    }
+    r->final_bytes = c.bytes;
+    r->entries = c.count;
+    free(c.slots);
+}
+
+static void run(const SimTrace *t, SimResult *r) {
+    uint64_t start = bench_now_ns();
+    if (r->policy == POLICY_CLOCK) run_clock(t, r);
+    else run_reference(t, r);
+    r->wall_s = (bench_now_ns() - start) / 1e9;
+}
+
+static void print_result(const SimResult *r, double span_s) {
+    double hit = r->queries ? (double)r->hits / r->queries : 0.0;
+    if (cfg.csv) {
+        printf("%s,%llu,%llu,%llu,%.4f,%llu,%llu,%llu,%llu,%llu,%u,%.3f\n", policy_names[r->policy],
+               (unsigned long long)r->capacity, (unsigned long long)r->queries, (unsigned long long)r->hits, hit,
+               (unsigned long long)r->upstream, (unsigned long long)r->evicted, (unsigned long long)r->expired,
+               (unsigned long long)r->peak_bytes, (unsigned long long)r->final_bytes, r->entries, r->wall_s);
+    } else {
+        char capacity[24];
+        if (r->capacity) snprintf(capacity, sizeof(capacity), "%llu", (unsigned long long)r->capacity);
+        else snprintf(capacity, sizeof(capacity), "inf");
+        printf("%-6s %12s %7.3f %11llu %10llu %10llu %12llu %9u %8.2f %9.0fx\n", policy_names[r->policy], capacity,
+               hit, (unsigned long long)r->upstream, (unsigned long long)r->evicted, (unsigned long long)r->expired,
+               (unsigned long long)r->peak_bytes, r->entries, r->wall_s, r->wall_s > 0 ? span_s / r->wall_s : 0.0);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    if (parse_args(argc, argv) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    SimTrace trace;
+    memset(&trace, 0, sizeof(trace));
+    SimFormat format = cfg.format == FORMAT_AUTO ? detect_format(cfg.trace) : cfg.format;
+    int ret = format == FORMAT_PCAP ? load_pcap(&trace, cfg.trace)
+              : format == FORMAT_QLOG ? load_qlog(&trace, cfg.trace)
+                                      : load_text(&trace, cfg.trace);
+    if (ret < 0) {
+        printf("无法读取记录文件 %s\n", cfg.trace);
+        return 1;
+    }
+    if (trace.event_count == 0) {
+        printf("记录中没有查询\n");
+        return 1;
+    }
+    uint32_t local = 0, cacheable = 0;
+    if (cfg.table) {
+        DNSTable *table;
+        if (load_dns_table(cfg.table, &table) < 0) return 1;
+        for (uint32_t i = 0; i < trace.key_count; i++) {
+            if (dns_table_lookup(table, trace.keys[i]->name)) trace.keys[i]->local = 1;
+        }
+        free_dns_table(table);
+    }
+    for (uint32_t i = 0; i < trace.key_count; i++) {
+        local += trace.keys[i]->local;
+        cacheable += trace.keys[i]->cacheable && !trace.keys[i]->local;
+    }
+    double span_s = trace.events[trace.event_count - 1].time_ns / 1e9;
+    static const char *const format_names[] = {"auto", "pcap", "qlog", "text"};
+    if (cfg.csv) {
+        printf("policy,capacity,queries,hits,hit_ratio,upstream,evicted,expired,peak_bytes,final_bytes,entries,"
+               "wall_s\n");
+    } else {
+        printf("trace  %s (%s): %llu queries over %.1fs, %u questions, %u cacheable, %u answered locally\n",
+               cfg.trace, format_names[format], (unsigned long long)trace.event_count, span_s, trace.key_count,
+               cacheable, local);
+        printf("%-6s %12s %7s %11s %10s %10s %12s %9s %8s %10s\n", "policy", "capacity", "hit", "upstream",
+               "evicted", "expired", "peak_bytes", "entries", "sim_s", "speedup");
+    }
+
+    // 缓存在写入、查找与清理时都通过get_now取时间，模拟期间改为读取虚拟时钟
+    set_virtual_clock(&virtual_now);
+    for (int p = 0; p < POLICY_COUNT; p++) {
+        if (!cfg.policies[p]) continue;
+        for (int c = 0; c < (p == POLICY_INF ? 1 : cfg.capacity_count); c++) {
+            SimResult r;
+            memset(&r, 0, sizeof(r));
+            r.policy = (SimPolicy)p;
+            r.capacity = p == POLICY_INF ? 0 : cfg.capacities[c];
+            run(&trace, &r);
+            print_result(&r, span_s);
+        }
+    }
+    set_virtual_clock(NULL);
+    return 0;
+}
@@ -0,0 +1,718 @@
+/*
+ * 模拟上游解析器：按区域描述文件应答，可配置应答延迟分布、丢包率、截断率与SERVFAIL率，
+ * 用于在本机确定性地测试中继的转发、超时与失败处理路径，并配合dnsrelay-bench测量吞吐。
+ * 每个服务线程各持有一个SO_REUSEPORT套接字；需要延迟的应答放入线程自己的定时堆，
+ * 到期后发出，线程从不阻塞在单个应答上，因此延迟不会降低吞吐。
+ *
+ * 区域文件每行一条记录，#或;之后为注释：
+ *   $TTL 300                           之后记录的默认TTL
+ *   www.example.com   60  A      192.0.2.10
+ *   www.example.com       AAAA   2001:db8::10
+ *   alias.example.com     CNAME  www.example.com
+ *   *.cdn.example.com 30  A      192.0.2.20     通配，匹配任意更深的名称
+ *   gone.example.com  600 NXDOMAIN              TTL用作否定应答的缓存时间
+ *   broken.example.com    SERVFAIL
+ *   dead.example.com      DROP                  永不应答，用于测试超时
+ * 区域中存在但没有所查类型的名称返回无数据（NOERROR + SOA）。
+ * 用法：dnsrelay-mock [选项]
+ */
+#ifdef __linux__
+#define _GNU_SOURCE  // ppoll
+#endif
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <strings.h>
+#include <sys/socket.h>
+
+#include "bench_common.h"
+#include "protocol.h"
+#include "uthash.h"
+
+#define MOCK_MAX_THREADS 64
+#define MOCK_DEFAULT_QUEUE 16384   // 每个线程最多同时等待发出的延迟应答
+#define MOCK_RECV_BATCH 64         // 每次唤醒最多连续接收的查询数
+#define MOCK_CNAME_DEPTH 8         // 区域内跟随CNAME链的最大深度
+#define MOCK_WIRE_NAME_MAX 256
+#define DNS_TYPE_CNAME 5
+
+// 区域中名称的处理方式
+typedef enum zone_action { ZONE_ANSWER, ZONE_NXDOMAIN, ZONE_SERVFAIL, ZONE_DROP } ZoneAction;
+
+// 不在区域中的名称的处理方式，SYNTH对A/AAAA返回固定地址
+typedef enum mock_default { MOCK_SYNTH, MOCK_NXDOMAIN, MOCK_SERVFAIL, MOCK_DROP } MockDefault;
+
+static const char *const mock_default_names[] = {"synth", "nxdomain", "servfail", "drop"};
+
+typedef enum latency_dist { LAT_NONE, LAT_FIXED, LAT_UNIFORM, LAT_EXP, LAT_LOGNORMAL } LatencyDist;
+
+typedef struct zone_record {
+    uint16_t type;
+    uint16_t rdlength;
+    uint32_t ttl;
+    uint8_t rdata[MOCK_WIRE_NAME_MAX];  // CNAME为未压缩的线格式名称
+    char *target;                       // CNAME的目标（点分形式），用于在区域内跟随
+} ZoneRecord;
+
+typedef struct zone_name {
+    char name[MAX_DOMAIN_LENGTH];  // 小写，不含结尾的点；通配以"*."开头
+    ZoneAction action;
+    uint32_t ttl;                  // 否定应答（NXDOMAIN与无数据）的TTL
+    ZoneRecord *records;
+    int count;
+    int capacity;
+    UT_hash_handle hh;
+} ZoneName;
+
+typedef struct mock_config {
+    struct sockaddr_in listen;
+    const char *zone_file;
+    int threads;
+    MockDefault fallback;
+    uint32_t ttl;           // 合成应答与未写TTL的记录使用的TTL
+    LatencyDist latency;
+    double lat_a, lat_b;    // 分布参数（毫秒）：fixed为a，uniform为[a,b]，exp均值为a，lognormal中位数a、sigma为b
+    double loss;            // 不应答的比例
+    double servfail;        // 返回SERVFAIL的比例
+    double truncate;        // 返回TC=1空应答的比例
+    uint32_t queue;
+    uint64_t seed;
+} MockConfig;
+
+typedef struct mock_stats {
+    uint64_t queries;
+    uint64_t answered;
+    uint64_t nxdomain;
+    uint64_t nodata;
+    uint64_t servfail;          // 含区域中标记为SERVFAIL的名称
+    uint64_t servfail_injected;
+    uint64_t truncated;
+    uint64_t dropped;           // 含区域中标记为DROP的名称
+    uint64_t dropped_injected;
+    uint64_t overflow;          // 延迟队列已满而丢弃的应答
+    uint64_t malformed;
+    uint64_t delayed;           // 经延迟队列发出的应答
+    double delay_ms;            // 注入延迟的总和
+} MockStats;
+
+// 等待发出的延迟应答
+typedef struct pending_reply {
+    struct sockaddr_in to;
+    uint16_t len;
+    uint8_t buf[MAX_DNS_PACKET_SIZE];
+} PendingReply;
+
+typedef struct timer_entry {
+    uint64_t due;
+    uint32_t slot;
+} TimerEntry;
+
+typedef struct mock_worker {
+    pthread_t thread;
+    int fd;
+    uint64_t rng;
+    PendingReply *replies;
+    uint32_t *free_slots;
+    uint32_t free_count;
+    TimerEntry *heap;       // 按到期时间的最小堆
+    uint32_t heap_size;
+    MockStats stats;
+} MockWorker;
+
+static MockConfig cfg = {
+    .threads = 1,
+    .ttl = 300,
+    .queue = MOCK_DEFAULT_QUEUE,
+    .seed = 1,
+};
+static int fallback_given;
+static ZoneName *zone;
+static volatile sig_atomic_t mock_stop;
+
+static void usage(const char *program) {
+    printf("Usage: %s [options]\n", program);
+    printf("  -l <ip:port>        Listen address (default 127.0.0.1:5300)\n");
+    printf("  -z <file>           Zone description to answer from (format in bench/dnsrelay_mock.c)\n");
+    printf("  -j <threads>        Serving threads, one SO_REUSEPORT socket each (default 1)\n");
+    printf("  --default <action>  For names outside the zone: synth, nxdomain, servfail or drop\n");
+    printf("                      (default synth without a zone, nxdomain with one)\n");
+    printf("  --ttl <s>           TTL of synthesized answers and zone records without one (default 300)\n");
+    printf("  --latency <dist>    Answer delay in ms: fixed:D, uniform:LO,HI, exp:MEAN or lognormal:MEDIAN,SIGMA\n");
+    printf("  --loss <ratio>      Fraction of queries never answered\n");
+    printf("  --servfail <ratio>  Fraction of queries answered with SERVFAIL\n");
+    printf("  --tc <ratio>        Fraction of queries answered with an empty truncated (TC=1) response\n");
+    printf("  --queue <n>         Delayed answers pending per thread before new ones are dropped (default %d)\n",
+           MOCK_DEFAULT_QUEUE);
+    printf("  --seed <n>          Seed of the loss/latency random streams (default 1)\n");
+}
+
+static int parse_addr(const char *text, struct sockaddr_in *addr) {
+    char host[64];
+    const char *colon = strchr(text, ':');
+    size_t host_len = colon ? (size_t)(colon - text) : strlen(text);
+    if (host_len == 0 || host_len >= sizeof(host)) return -1;
+    memcpy(host, text, host_len);
+    host[host_len] = '\0';
+    int port = colon ? atoi(colon + 1) : DNS_PORT;
+    if (port <= 0 || port > 65535) return -1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((uint16_t)port);
+    return inet_pton(AF_INET, host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+static int parse_latency(const char *text) {
+    const char *colon = strchr(text, ':');
+    if (!colon) return -1;
+    size_t kind = (size_t)(colon - text);
+    int fields = sscanf(colon + 1, "%lf,%lf", &cfg.lat_a, &cfg.lat_b);
+    if (fields < 1 || cfg.lat_a < 0) return -1;
+    if (kind == 5 && strncmp(text, "fixed", 5) == 0) {
+        cfg.latency = LAT_FIXED;
+    } else if (kind == 7 && strncmp(text, "uniform", 7) == 0 && fields == 2 && cfg.lat_b >= cfg.lat_a) {
+        cfg.latency = LAT_UNIFORM;
+    } else if (kind == 3 && strncmp(text, "exp", 3) == 0) {
+        cfg.latency = LAT_EXP;
+    } else if (kind == 9 && strncmp(text, "lognormal", 9) == 0 && fields == 2 && cfg.lat_b >= 0) {
+        cfg.latency = LAT_LOGNORMAL;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+static int parse_ratio(const char *text, double *out) {
+    *out = atof(text);
+    return *out >= 0 && *out <= 1 ? 0 : -1;
+}
+
+static int parse_args(int argc, char *argv[]) {
+    parse_addr("127.0.0.1:5300", &cfg.listen);
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!val) return -1;
+        i++;
+        if (strcmp(arg, "-l") == 0) {
+            if (parse_addr(val, &cfg.listen) < 0) return -1;
+        } else if (strcmp(arg, "-z") == 0) {
+            cfg.zone_file = val;
+        } else if (strcmp(arg, "-j") == 0) {
+            cfg.threads = atoi(val);
+        } else if (strcmp(arg, "--default") == 0) {
+            int found = -1;
+            for (int d = 0; d < (int)(sizeof(mock_default_names) / sizeof(mock_default_names[0])); d++) {
+                if (strcmp(val, mock_default_names[d]) == 0) found = d;
+            }
+            if (found < 0) return -1;
+            cfg.fallback = (MockDefault)found;
+            fallback_given = 1;
+        } else if (strcmp(arg, "--ttl") == 0) {
+            cfg.ttl = (uint32_t)strtoul(val, NULL, 10);
+        } else if (strcmp(arg, "--latency") == 0) {
+            if (parse_latency(val) < 0) return -1;
+        } else if (strcmp(arg, "--loss") == 0) {
+            if (parse_ratio(val, &cfg.loss) < 0) return -1;
+        } else if (strcmp(arg, "--servfail") == 0) {
+            if (parse_ratio(val, &cfg.servfail) < 0) return -1;
+        } else if (strcmp(arg, "--tc") == 0) {
+            if (parse_ratio(val, &cfg.truncate) < 0) return -1;
+        } else if (strcmp(arg, "--queue") == 0) {
+            cfg.queue = (uint32_t)strtoul(val, NULL, 10);
+        } else if (strcmp(arg, "--seed") == 0) {
+            cfg.seed = strtoull(val, NULL, 10);
+        } else {
+            return -1;
+        }
+    }
+    if (cfg.threads < 1 || cfg.threads > MOCK_MAX_THREADS || cfg.queue == 0) return -1;
+    if (cfg.loss + cfg.servfail + cfg.truncate > 1) {
+        printf("--loss、--servfail与--tc之和不能超过1\n");
+        return -1;
+    }
+    if (!fallback_given) cfg.fallback = cfg.zone_file ? MOCK_NXDOMAIN : MOCK_SYNTH;
+    return 0;
+}
+
+// ----------- 区域 -----------
+
+// 把点分名称转为小写、去掉结尾的点，过长时返回-1
+static int normalize_name(const char *in, char *out) {
+    size_t len = strlen(in);
+    if (len > 0 && in[len - 1] == '.') len--;
+    if (len >= MAX_DOMAIN_LENGTH) return -1;
+    for (size_t i = 0; i < len; i++) out[i] = (char)tolower((unsigned char)in[i]);
+    out[len] = '\0';
+    return 0;
+}
+
+// 把点分名称转为未压缩的线格式，返回长度，非法时返回-1
+static int encode_wire_name(const char *name, uint8_t *wire) {
+    size_t len = strlen(name);
+    if (len > MOCK_WIRE_NAME_MAX - 2) return -1;
+    int out = 0;
+    size_t start = 0;
+    while (start < len) {
+        size_t end = start;
+        while (end < len && name[end] != '.') end++;
+        if (end == start || end - start > 63) return -1;
+        wire[out++] = (uint8_t)(end - start);
+        memcpy(wire + out, name + start, end - start);
+        out += (int)(end - start);
+        start = end + 1;
+    }
+    wire[out++] = 0;
+    return out;
+}
+
+static ZoneName *zone_find(const char *name) {
+    ZoneName *z;
+    HASH_FIND_STR(zone, name, z);
+    return z;
+}
+
+static ZoneName *zone_get(const char *name) {
+    ZoneName *z = zone_find(name);
+    if (z) return z;
+    z = calloc(1, sizeof(ZoneName));
+    if (!z) return NULL;
+    strcpy(z->name, name);
+    z->action = ZONE_ANSWER;
+    z->ttl = DNS_NEGATIVE_TTL;
+    HASH_ADD_STR(zone, name, z);
+    return z;
+}
+
+static int zone_add_record(ZoneName *z, uint16_t type, uint32_t ttl, const char *data) {
+    if (z->count == z->capacity) {
+        int capacity = z->capacity ? z->capacity * 2 : 2;
+        ZoneRecord *records = realloc(z->records, sizeof(ZoneRecord) * (size_t)capacity);
+        if (!records) return -1;
+        z->records = records;
+        z->capacity = capacity;
+    }
+    ZoneRecord *r = &z->records[z->count];
+    memset(r, 0, sizeof(*r));
+    r->type = type;
+    r->ttl = ttl;
+    if (type == DNS_TYPE_A) {
+        if (inet_pton(AF_INET, data, r->rdata) != 1) return -1;
+        r->rdlength = 4;
+    } else if (type == DNS_TYPE_AAAA) {
+        if (inet_pton(AF_INET6, data, r->rdata) != 1) return -1;
+        r->rdlength = 16;
+    } else {
+        char target[MAX_DOMAIN_LENGTH];
+        if (normalize_name(data, target) < 0) return -1;
+        int len = encode_wire_name(target, r->rdata);
+        if (len < 0 || !(r->target = strdup(target))) return -1;
+        r->rdlength = (uint16_t)len;
+    }
+    z->count++;
+    return 0;
+}
+
+/**
+ * 读取区域文件。
+ * @return 成功返回名称数，无法打开或有非法行时返回-1（打印出错的行号）。
+ */
+static int load_zone(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        printf("无法打开区域文件 %s\n", path);
+        return -1;
+    }
+    char line[1024];
+    int lineno = 0;
+    uint32_t default_ttl = cfg.ttl;
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        line[strcspn(line, "#;\r\n")] = '\0';
+        char *tok[4];
+        int n = 0;
+        for (char *p = strtok(line, " \t"); p && n < 4; p = strtok(NULL, " \t")) tok[n++] = p;
+        if (n == 0) continue;
+        if (strcmp(tok[0], "$TTL") == 0 && n == 2) {
+            default_ttl = (uint32_t)strtoul(tok[1], NULL, 10);
+            continue;
+        }
+        char name[MAX_DOMAIN_LENGTH];
+        int t = 1;
+        uint32_t ttl = default_ttl;
+        if (n > 1 && isdigit((unsigned char)tok[1][0])) ttl = (uint32_t)strtoul(tok[t++], NULL, 10);
+        ZoneName *z = NULL;
+        int ok = t < n && normalize_name(tok[0], name) == 0 && (z = zone_get(name)) != NULL;
+        if (ok) {
+            const char *type = tok[t];
+            const char *data = t + 1 < n ? tok[t + 1] : NULL;
+            if (strcasecmp(type, "A") == 0 && data) {
+                ok = zone_add_record(z, DNS_TYPE_A, ttl, data) == 0;
+            } else if (strcasecmp(type, "AAAA") == 0 && data) {
+                ok = zone_add_record(z, DNS_TYPE_AAAA, ttl, data) == 0;
+            } else if (strcasecmp(type, "CNAME") == 0 && data) {
+                ok = zone_add_record(z, DNS_TYPE_CNAME, ttl, data) == 0;
+            } else if (strcasecmp(type, "NXDOMAIN") == 0) {
+                z->action = ZONE_NXDOMAIN;
+                z->ttl = ttl;
+            } else if (strcasecmp(type, "SERVFAIL") == 0) {
+                z->action = ZONE_SERVFAIL;
+            } else if (strcasecmp(type, "DROP") == 0) {
+                z->action = ZONE_DROP;
+            } else {
+                ok = 0;
+            }
+        }
+        if (!ok) {
+            printf("区域文件 %s 第%d行无效\n", path, lineno);
+            fclose(fp);
+            return -1;
+        }
+    }
+    fclose(fp);
+    return (int)HASH_COUNT(zone);
+}
+
+// 精确匹配，其次从最长的父域开始匹配通配记录
+static ZoneName *zone_lookup(const char *name) {
+    ZoneName *z = zone_find(name);
+    if (z) return z;
+    char wildcard[MAX_DOMAIN_LENGTH + 2];
+    for (const char *dot = strchr(name, '.'); dot; dot = strchr(dot + 1, '.')) {
+        snprintf(wildcard, sizeof(wildcard), "*%s", dot);
+        if ((z = zone_find(wildcard)) != NULL) return z;
+    }
+    return NULL;
+}
+
+// ----------- 应答 -----------
+
+static double sample_latency_ms(uint64_t *rng) {
+    double u = bench_rand_unit(rng);
+    switch (cfg.latency) {
+        case LAT_FIXED:
+            return cfg.lat_a;
+        case LAT_UNIFORM:
+            return cfg.lat_a + (cfg.lat_b - cfg.lat_a) * u;
+        case LAT_EXP:
+            return -cfg.lat_a * log(1.0 - u);
+        case LAT_LOGNORMAL: {
+            // Box-Muller取一个标准正态样本
+            double v = bench_rand_unit(rng);
+            double z = sqrt(-2.0 * log(1.0 - u)) * cos(2.0 * M_PI * v);
+            return cfg.lat_a * exp(cfg.lat_b * z);
+        }
+        default:
+            return 0;
+    }
+}
+
+// 否定应答（NXDOMAIN或无数据），授权区SOA的TTL与minimum取自区域
+static void add_negative_soa(DNSBuilder *b, const char *owner, uint32_t ttl) {
+    DNSSOA soa = {"mock.invalid", "hostmaster.mock.invalid", 1, 3600, 600, 86400, ttl};
+    dns_builder_add_soa(b, DNS_SECTION_AUTHORITY, owner[0] ? owner : ".", ttl, &soa);
+}
+
+/**
+ * 按区域构造应答。
+ * @return 应答长度，需要丢弃时返回0。
+ */
+static int build_reply(MockWorker *w, const uint8_t *query, int len, uint8_t *reply) {
+    static const uint8_t v4[4] = {192, 0, 2, 1};
+    static const uint8_t v6[16] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    MockStats *st = &w->stats;
+    char qname[MAX_DOMAIN_LENGTH];
+    int name_len = parse_dns_name(query, len, DNS_HEADER_SIZE, qname, sizeof(qname));
+    if (name_len < 0 || DNS_HEADER_SIZE + name_len + (int)sizeof(DNSQuestion) > len) {
+        st->malformed++;
+        return 0;
+    }
+    const DNSQuestion *q = (const DNSQuestion *)(query + DNS_HEADER_SIZE + name_len);
+    uint16_t qtype = ntohs(q->qtype);
+    uint16_t id = ntohs(((const DNSHeader *)query)->id);
+    uint16_t rd = ntohs(((const DNSHeader *)query)->flags) & 0x0100;
+    DNSBuilder b;
+    dns_builder_init(&b, reply, MAX_DNS_PACKET_SIZE);
+    dns_builder_question_raw(&b, query + DNS_HEADER_SIZE, name_len + (int)sizeof(DNSQuestion));
+
+    // 注入的故障先于区域内容
+    double u = bench_rand_unit(&w->rng);
+    if (u < cfg.loss) {
+        st->dropped++;
+        st->dropped_injected++;
+        return 0;
+    }
+    if (u < cfg.loss + cfg.servfail) {
+        st->servfail++;
+        st->servfail_injected++;
+        return dns_builder_finish(&b, id, 0x8080 | rd | DNS_RCODE_SERVER_FAILURE);
+    }
+    if (u < cfg.loss + cfg.servfail + cfg.truncate) {
+        st->truncated++;
+        return dns_builder_finish(&b, id, 0x8080 | rd | DNS_FLAG_TC);
+    }
+
+    const char *name = qname;
+    for (int depth = 0; depth < MOCK_CNAME_DEPTH; depth++) {
+        ZoneName *z = zone_lookup(name);
+        if (!z && depth == 0) {
+            // 区域之外的名称
+            if (cfg.fallback == MOCK_DROP) {
+                st->dropped++;
+                return 0;
+            }
+            if (cfg.fallback == MOCK_SERVFAIL) {
+                st->servfail++;
+                return dns_builder_finish(&b, id, 0x8080 | rd | DNS_RCODE_SERVER_FAILURE);
+            }
+            if (cfg.fallback == MOCK_NXDOMAIN) {
+                st->nxdomain++;
+                add_negative_soa(&b, qname, DNS_NEGATIVE_TTL);
+                return dns_builder_finish(&b, id, 0x8080 | rd | DNS_RCODE_NAME_ERROR);
+            }
+            if (qtype == DNS_TYPE_A) {
+                dns_builder_add_rr(&b, DNS_SECTION_ANSWER, qname, DNS_TYPE_A, DNS_CLASS_IN, cfg.ttl, v4, 4);
+            } else if (qtype == DNS_TYPE_AAAA) {
+                dns_builder_add_rr(&b, DNS_SECTION_ANSWER, qname, DNS_TYPE_AAAA, DNS_CLASS_IN, cfg.ttl, v6, 16);
+            }
+            st->answered++;
+            return dns_builder_finish(&b, id, 0x8080 | rd);
+        }
+        if (!z) break;  // CNAME指向区域之外，只返回已有的链
+        if (z->action == ZONE_DROP) {
+            st->dropped++;
+            return 0;
+        }
+        if (z->action == ZONE_SERVFAIL) {
+            st->servfail++;
+            return dns_builder_finish(&b, id, 0x8080 | rd | DNS_RCODE_SERVER_FAILURE);
+        }
+        if (z->action == ZONE_NXDOMAIN) {
+            st->nxdomain++;
+            add_negative_soa(&b, name, z->ttl);
+            return dns_builder_finish(&b, id, 0x8080 | rd | DNS_RCODE_NAME_ERROR);
+        }
+        int added = 0;
+        const ZoneRecord *cname = NULL;
+        for (int i = 0; i < z->count; i++) {
+            const ZoneRecord *r = &z->records[i];
+            if (r->type == qtype) {
+                dns_builder_add_rr(&b, DNS_SECTION_ANSWER, name, r->type, DNS_CLASS_IN, r->ttl, r->rdata,
+                                   r->rdlength);
+                added = 1;
+            } else if (r->type == DNS_TYPE_CNAME) {
+                cname = r;
+            }
+        }
+        if (added || !cname) {
+            if (!added && depth == 0) {
+                st->nodata++;
+                add_negative_soa(&b, name, z->ttl);
+            } else {
+                st->answered++;
+            }
+            return dns_builder_finish(&b, id, 0x8080 | rd);
+        }
+        dns_builder_add_rr(&b, DNS_SECTION_ANSWER, name, DNS_TYPE_CNAME, DNS_CLASS_IN, cname->ttl, cname->rdata,
+                           cname->rdlength);
+        name = cname->target;
+    }
+    st->answered++;
+    return dns_builder_finish(&b, id, 0x8080 | rd);
+}
+
+// ----------- 延迟队列 -----------
+
+static void heap_push(MockWorker *w, uint64_t due, uint32_t slot) {
+    uint32_t i = w->heap_size++;
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (w->heap[parent].due <= due) break;
+        w->heap[i] = w->heap[parent];
+        i = parent;
+    }
+    w->heap[i].due = due;
+    w->heap[i].slot = slot;
+}
+
+static void heap_pop(MockWorker *w) {
+    TimerEntry last = w->heap[--w->heap_size];
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= w->heap_size) break;
+        if (child + 1 < w->heap_size && w->heap[child + 1].due < w->heap[child].due) child++;
+        if (last.due <= w->heap[child].due) break;
+        w->heap[i] = w->heap[child];
+        i = child;
+    }
+    w->heap[i] = last;
+}
+
+// 发出所有已到期的应答，返回距下一个到期的纳秒数（队列为空时返回UINT64_MAX）
+static uint64_t flush_due(MockWorker *w) {
+    while (w->heap_size) {
+        uint64_t now = bench_now_ns();
+        if (w->heap[0].due > now) return w->heap[0].due - now;
+        uint32_t slot = w->heap[0].slot;
+        heap_pop(w);
+        PendingReply *p = &w->replies[slot];
+        sendto(w->fd, p->buf, p->len, 0, (struct sockaddr *)&p->to, sizeof(p->to));
+        w->free_slots[w->free_count++] = slot;
+    }
+    return UINT64_MAX;
+}
+
+static void handle_query(MockWorker *w, const uint8_t *query, int len, const struct sockaddr_in *from) {
+    uint8_t reply[MAX_DNS_PACKET_SIZE];
+    w->stats.queries++;
+    if (len < DNS_HEADER_SIZE) {
+        w->stats.malformed++;
+        return;
+    }
+    int out = build_reply(w, query, len, reply);
+    if (out <= 0) return;
+    double delay = sample_latency_ms(&w->rng);
+    if (delay <= 0) {
+        sendto(w->fd, reply, (size_t)out, 0, (const struct sockaddr *)from, sizeof(*from));
+        return;
+    }
+    if (w->free_count == 0) {
+        w->stats.overflow++;
+        return;
+    }
+    w->stats.delayed++;
+    w->stats.delay_ms += delay;
+    uint32_t slot = w->free_slots[--w->free_count];
+    PendingReply *p = &w->replies[slot];
+    p->to = *from;
+    p->len = (uint16_t)out;
+    memcpy(p->buf, reply, (size_t)out);
+    heap_push(w, bench_now_ns() + (uint64_t)(delay * 1e6), slot);
+}
+
+static void *worker_main(void *arg) {
+    MockWorker *w = arg;
+    struct pollfd pfd = {w->fd, POLLIN, 0};
+    uint8_t query[MAX_DNS_PACKET_SIZE];
+    while (!mock_stop) {
+        uint64_t wait_ns = flush_due(w);
+        if (wait_ns > 100000000ULL) wait_ns = 100000000ULL;  // 定期检查退出标志
+#ifdef __linux__
+        struct timespec ts = {0, (long)wait_ns};
+        int ready = ppoll(&pfd, 1, &ts, NULL);
+#else
+        int ready = poll(&pfd, 1, (int)((wait_ns + 999999ULL) / 1000000ULL));
+#endif
+        if (ready <= 0) continue;
+        for (int i = 0; i < MOCK_RECV_BATCH; i++) {
+            struct sockaddr_in from;
+            socklen_t from_len = sizeof(from);
+            ssize_t len = recvfrom(w->fd, query, sizeof(query), 0, (struct sockaddr *)&from, &from_len);
+            if (len < 0) break;
+            handle_query(w, query, (int)len, &from);
+        }
+    }
+    return NULL;
+}
+
+static int worker_init(MockWorker *w, int index) {
+    memset(w, 0, sizeof(*w));
+    w->rng = (cfg.seed + (uint64_t)index * 0x9E3779B97F4A7C15ULL) | 1;
+    w->replies = malloc(sizeof(PendingReply) * cfg.queue);
+    w->free_slots = malloc(sizeof(uint32_t) * cfg.queue);
+    w->heap = malloc(sizeof(TimerEntry) * cfg.queue);
+    if (!w->replies || !w->free_slots || !w->heap) return -1;
+    for (uint32_t i = 0; i < cfg.queue; i++) w->free_slots[i] = cfg.queue - 1 - i;
+    w->free_count = cfg.queue;
+
+    w->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (w->fd < 0) return -1;
+    int one = 1;
+    setsockopt(w->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+#ifdef SO_REUSEPORT
+    setsockopt(w->fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+#endif
+    int size = 4 << 20;
+    setsockopt(w->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(w->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL, 0) | O_NONBLOCK);
+    if (bind(w->fd, (struct sockaddr *)&cfg.listen, sizeof(cfg.listen)) < 0) {
+        close(w->fd);
+        w->fd = -1;
+        return -1;
+    }
+    return 0;
+}
+
+static void print_stats(const MockWorker *workers) {
+    MockStats sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int i = 0; i < cfg.threads; i++) {
+        const MockStats *s = &workers[i].stats;
+        sum.queries += s->queries;
+        sum.answered += s->answered;
+        sum.nxdomain += s->nxdomain;
+        sum.nodata += s->nodata;
+        sum.servfail += s->servfail;
+        sum.servfail_injected += s->servfail_injected;
+        sum.truncated += s->truncated;
+        sum.dropped += s->dropped;
+        sum.dropped_injected += s->dropped_injected;
+        sum.overflow += s->overflow;
+        sum.malformed += s->malformed;
+        sum.delayed += s->delayed;
+        sum.delay_ms += s->delay_ms;
+    }
+    printf("queries   %llu: answered %llu, nxdomain %llu, nodata %llu, malformed %llu\n",
+           (unsigned long long)sum.queries, (unsigned long long)sum.answered, (unsigned long long)sum.nxdomain,
+           (unsigned long long)sum.nodata, (unsigned long long)sum.malformed);
+    printf("failures  servfail %llu (%llu injected), truncated %llu, dropped %llu (%llu injected), overflow %llu\n",
+           (unsigned long long)sum.servfail, (unsigned long long)sum.servfail_injected,
+           (unsigned long long)sum.truncated, (unsigned long long)sum.dropped,
+           (unsigned long long)sum.dropped_injected, (unsigned long long)sum.overflow);
+    if (cfg.latency != LAT_NONE) {
+        printf("latency   mean injected delay %.2fms\n", sum.delayed ? sum.delay_ms / (double)sum.delayed : 0.0);
+    }
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    mock_stop = 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (parse_args(argc, argv) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (cfg.zone_file) {
+        int names = load_zone(cfg.zone_file);
+        if (names < 0) return 1;
+        printf("区域文件 %s：%d 个名称\n", cfg.zone_file, names);
+    }
+    MockWorker *workers = calloc((size_t)cfg.threads, sizeof(MockWorker));
+    if (!workers) return 1;
+    for (int i = 0; i < cfg.threads; i++) {
+        if (worker_init(&workers[i], i) < 0) {
+            printf("模拟上游绑定 %s:%d 失败\n", inet_ntoa(cfg.listen.sin_addr), ntohs(cfg.listen.sin_port));
+            return 1;
+        }
+    }
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    printf("模拟上游监听 %s:%d，%d 个线程，区域外名称：%s\n", inet_ntoa(cfg.listen.sin_addr),
+           ntohs(cfg.listen.sin_port), cfg.threads, mock_default_names[cfg.fallback]);
+    fflush(stdout);
+    for (int i = 0; i < cfg.threads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            printf("创建服务线程失败\n");
+            return 1;
+        }
+    }
+    for (int i = 0; i < cfg.threads; i++) pthread_join(workers[i].thread, NULL);
+    print_stats(workers);
+    return 0;
+}
@@ -0,0 +1,761 @@
+/*
+ * 抓包回放工具：从pcap抓包中取出发往DNS端口的客户端查询，按原始时间间隔（可缩放）
+ * 或固定速率以开环方式发给中继，报告实际速率、延迟分布、应答与抓包中原应答的一致率
+ * 以及中继的缓存命中率，用生产流量的真实形态验证改动，无需联网。
+ * 抓包文件只读映射后顺序读取，查询不预先载入内存；抓包中的应答按问题建立索引，
+ * --responder在本机启动一个上游，用这些应答回复中继转发的查询（没有对应应答的问题
+ * 返回固定地址），--spawn再以该上游启动被测中继并通过管理接口读取缓存命中率。
+ * 用法：dnsrelay-replay [选项] <capture.pcap> [-- 传给被测中继的额外参数]
+ */
+#ifdef __linux__
+#define _GNU_SOURCE  // ppoll
+#endif
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "bench_common.h"
+#include "bench_pcap.h"
+#include "hist.h"
+#include "protocol.h"
+#include "uthash.h"
+
+#define REPLAY_MAX_CLIENTS 1024
+#define REPLAY_SLOT_BITS 14                     // 每个客户端最多同时等待16384个应答
+#define REPLAY_SLOTS (1u << REPLAY_SLOT_BITS)
+#define REPLAY_MAX_ADDRS 32                     // 比较应答时每个报文最多取的地址数
+#define REPLAY_READY_TIMEOUT_MS 5000            // 等待被测中继开始应答的时间
+#define REPLAY_QUESTION_MAX (MAX_DOMAIN_LENGTH + 4)
+
+typedef struct replay_config {
+    const char *pcap;
+    struct sockaddr_in target;
+    int dns_port;           // 抓包中DNS服务器的端口
+    double speed;           // 时间轴缩放倍数，2表示以两倍速回放
+    double rate;            // 大于0时忽略抓包时间，按固定速率发送
+    double max_duration;    // 回放时长上限（秒），0表示回放整个抓包
+    uint64_t limit;         // 最多回放的查询数，0表示不限
+    int clients;
+    uint32_t timeout_ms;    // 超过此时间的应答按丢失计
+    int responder_port;     // 本地上游端口，0表示不启动
+    const char *spawn;      // 被测中继可执行文件
+    const char *table;      // 传给被测中继的本地表，默认使用空表
+    const char *admin;      // 中继的管理套接字，用于读取缓存命中率
+    char **relay_args;      // "--"之后的参数原样传给中继
+    int relay_argc;
+    int verbose;
+    int print_hist;
+    int csv;
+} ReplayConfig;
+
+// 抓包中的一个应答，按问题（小写线格式名称 + 类型 + 类）索引
+typedef struct answer_entry {
+    uint8_t key[REPLAY_QUESTION_MAX];
+    uint16_t key_len;
+    uint16_t len;
+    const uint8_t *msg;  // 指向映射区
+    UT_hash_handle hh;
+} AnswerEntry;
+
+typedef struct replay_client {
+    int fd;
+    uint32_t seq;
+    uint64_t sent_at[REPLAY_SLOTS];  // 计划发送时刻，0表示空闲
+    uint16_t slot_id[REPLAY_SLOTS];
+    const AnswerEntry *ref[REPLAY_SLOTS];  // 抓包中的原应答，没有则为NULL
+} ReplayClient;
+
+typedef struct replay_stats {
+    uint64_t sent;
+    uint64_t received;
+    uint64_t late;
+    uint64_t send_errors;
+    uint64_t truncated;
+    uint64_t rcodes[16];
+    uint64_t with_ref;      // 有原应答可比较的应答数
+    uint64_t exact;         // rcode与地址集合完全一致
+    uint64_t compatible;    // rcode一致且返回的地址都在原应答中（中继缓存每个名称只保留一个地址）
+    uint64_t first_ns, last_ns;  // 回放的第一个与最后一个查询的抓包时间
+    LatencyHist hist;
+} ReplayStats;
+
+static ReplayConfig cfg = {
+    .dns_port = DNS_PORT,
+    .speed = 1.0,
+    .clients = 64,
+    .timeout_ms = 1000,
+};
+static BenchPcap capture;
+static AnswerEntry *answers;
+static atomic_int responder_stop;
+static _Atomic uint64_t responder_captured;   // 用抓包应答回复的上游查询数
+static _Atomic uint64_t responder_synthetic;  // 抓包中没有对应应答、返回固定地址的上游查询数
+
+static void usage(const char *program) {
+    printf("Usage: %s [options] <capture.pcap> [-- relay options]\n", program);
+    printf("  -s <ip:port>        Relay to replay against (default 127.0.0.1:53)\n");
+    printf("  -x <speed>          Scale the captured timing, e.g. 2 replays twice as fast (default 1)\n");
+    printf("  -r <qps>            Ignore captured timing and send at this fixed rate\n");
+    printf("  -t <seconds>        Stop after this much replay time\n");
+    printf("  -l <queries>        Stop after this many queries\n");
+    printf("  -c <clients>        Client sockets; captured clients are hashed onto them (default 64)\n");
+    printf("  --dns-port <port>   Server port of DNS traffic in the capture (default 53)\n");
+    printf("  --timeout <ms>      Answers later than this count as lost (default 1000)\n");
+    printf("  --responder <port>  Run an upstream on 127.0.0.1:port answering with the captured responses\n");
+    printf("  --spawn <dnsrelay>  Start this relay on the -s port forwarding to the responder, stopped afterwards\n");
+    printf("  --table <file>      Local table for the spawned relay (default: empty)\n");
+    printf("  --admin <socket>    Admin socket of a relay started separately, for the cache hit ratio\n");
+    printf("  -v                  Keep the spawned relay's output\n");
+    printf("  --hist              Print the full latency percentile distribution\n");
+    printf("  --csv               Print one machine-readable result line\n");
+}
+
+static int parse_addr(const char *text, struct sockaddr_in *addr) {
+    char host[64];
+    const char *colon = strchr(text, ':');
+    size_t host_len = colon ? (size_t)(colon - text) : strlen(text);
+    if (host_len == 0 || host_len >= sizeof(host)) return -1;
+    memcpy(host, text, host_len);
+    host[host_len] = '\0';
+    int port = colon ? atoi(colon + 1) : DNS_PORT;
+    if (port <= 0 || port > 65535) return -1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((uint16_t)port);
+    return inet_pton(AF_INET, host, &addr->sin_addr) == 1 ? 0 : -1;
+}
+
+static int parse_args(int argc, char *argv[]) {
+    parse_addr("127.0.0.1:53", &cfg.target);
+    for (int i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--") == 0) {
+            cfg.relay_args = argv + i + 1;
+            cfg.relay_argc = argc - i - 1;
+            break;
+        } else if (arg[0] != '-') {
+            if (cfg.pcap) return -1;
+            cfg.pcap = arg;
+        } else if (strcmp(arg, "-v") == 0) {
+            cfg.verbose = 1;
+        } else if (strcmp(arg, "--hist") == 0) {
+            cfg.print_hist = 1;
+        } else if (strcmp(arg, "--csv") == 0) {
+            cfg.csv = 1;
+        } else if (!val) {
+            return -1;
+        } else {
+            i++;
+            if (strcmp(arg, "-s") == 0) {
+                if (parse_addr(val, &cfg.target) < 0) return -1;
+            } else if (strcmp(arg, "-x") == 0) {
+                cfg.speed = atof(val);
+            } else if (strcmp(arg, "-r") == 0) {
+                cfg.rate = atof(val);
+            } else if (strcmp(arg, "-t") == 0) {
+                cfg.max_duration = atof(val);
+            } else if (strcmp(arg, "-l") == 0) {
+                cfg.limit = strtoull(val, NULL, 10);
+            } else if (strcmp(arg, "-c") == 0) {
+                cfg.clients = atoi(val);
+            } else if (strcmp(arg, "--dns-port") == 0) {
+                cfg.dns_port = atoi(val);
+            } else if (strcmp(arg, "--timeout") == 0) {
+                cfg.timeout_ms = (uint32_t)strtoul(val, NULL, 10);
+            } else if (strcmp(arg, "--responder") == 0) {
+                cfg.responder_port = atoi(val);
+            } else if (strcmp(arg, "--spawn") == 0) {
+                cfg.spawn = val;
+            } else if (strcmp(arg, "--table") == 0) {
+                cfg.table = val;
+            } else if (strcmp(arg, "--admin") == 0) {
+                cfg.admin = val;
+            } else {
+                return -1;
+            }
+        }
+    }
+    if (!cfg.pcap || cfg.speed <= 0 || cfg.rate < 0 || cfg.max_duration < 0 || cfg.timeout_ms == 0) return -1;
+    if (cfg.clients < 1 || cfg.clients > REPLAY_MAX_CLIENTS) return -1;
+    if (cfg.dns_port <= 0 || cfg.dns_port > 65535) return -1;
+    if (cfg.responder_port < 0 || cfg.responder_port > 65535) return -1;
+    if (cfg.spawn && !cfg.responder_port) {
+        printf("--spawn 需要同时指定 --responder\n");
+        return -1;
+    }
+    return 0;
+}
+
+// ----------- 抓包中的DNS报文 -----------
+
+/**
+ * 生成问题的索引键：小写线格式名称加类型与类。
+ * @return 键长度，问题区使用压缩指针或越界时返回-1。
+ */
+static int question_key(const uint8_t *msg, int len, uint8_t *key) {
+    int off = DNS_HEADER_SIZE, k = 0;
+    for (;;) {
+        if (off >= len) return -1;
+        uint8_t label = msg[off];
+        if (label & 0xC0) return -1;
+        if (k + label + 1 > MAX_DOMAIN_LENGTH || off + label + 1 > len) return -1;
+        key[k++] = label;
+        off++;
+        if (label == 0) break;
+        for (int i = 0; i < label; i++) {
+            uint8_t c = msg[off++];
+            key[k++] = (c >= 'A' && c <= 'Z') ? (uint8_t)(c + 'a' - 'A') : c;
+        }
+    }
+    if (off + 4 > len) return -1;
+    memcpy(key + k, msg + off, 4);
+    return k + 4;
+}
+
+// 客户端查询：发往DNS端口、标准查询、恰好一个问题，且能放进中继的接收缓冲区
+static int is_client_query(const BenchUdp *u) {
+    if (u->dport != cfg.dns_port || u->len < DNS_HEADER_SIZE || u->len > MAX_DNS_PACKET_SIZE) return 0;
+    const DNSHeader *h = (const DNSHeader *)u->payload;
+    uint16_t flags = ntohs(h->flags);
+    return !(flags & 0x8000) && ((flags >> 11) & 0xF) == 0 && ntohs(h->qdcount) == 1;
+}
+
+static int is_server_answer(const BenchUdp *u) {
+    if (u->sport != cfg.dns_port || u->len < DNS_HEADER_SIZE || u->len > MAX_DNS_PACKET_SIZE) return 0;
+    const DNSHeader *h = (const DNSHeader *)u->payload;
+    return (ntohs(h->flags) & 0x8000) && ntohs(h->qdcount) == 1;
+}
+
+// 跳过一个可能压缩的名称，返回其后的偏移，格式错误返回-1
+static int skip_name(const uint8_t *msg, int len, int off) {
+    while (off < len) {
+        uint8_t label = msg[off];
+        if ((label & 0xC0) == 0xC0) return off + 2 <= len ? off + 2 : -1;
+        if (label & 0xC0) return -1;
+        off += label + 1;
+        if (label == 0) return off;
+    }
+    return -1;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// 取应答区A/AAAA记录数据的哈希（已排序），返回个数，报文格式错误返回-1
+static int answer_addrs(const uint8_t *msg, int len, uint64_t *out) {
+    const DNSHeader *h = (const DNSHeader *)msg;
+    int off = DNS_HEADER_SIZE;
+    for (int i = 0; i < ntohs(h->qdcount); i++) {
+        off = skip_name(msg, len, off);
+        if (off < 0 || off + 4 > len) return -1;
+        off += 4;
+    }
+    int n = 0;
+    for (int i = 0; i < ntohs(h->ancount); i++) {
+        off = skip_name(msg, len, off);
+        if (off < 0 || off + 10 > len) return -1;
+        uint16_t type = bench_be16(msg + off), rdlen = bench_be16(msg + off + 8);
+        off += 10;
+        if (off + rdlen > len) return -1;
+        if ((type == DNS_TYPE_A || type == DNS_TYPE_AAAA) && n < REPLAY_MAX_ADDRS) {
+            uint64_t hash = 0xcbf29ce484222325ULL ^ type;
+            for (int j = 0; j < rdlen; j++) hash = (hash ^ msg[off + j]) * 0x100000001b3ULL;
+            out[n++] = hash;
+        }
+        off += rdlen;
+    }
+    qsort(out, (size_t)n, sizeof(uint64_t), compare_u64);
+    return n;
+}
+
+// 比较中继的应答与抓包中的原应答
+static void match_answer(ReplayStats *st, const uint8_t *msg, int len, const AnswerEntry *ref) {
+    uint64_t got[REPLAY_MAX_ADDRS], want[REPLAY_MAX_ADDRS];
+    st->with_ref++;
+    if ((ntohs(((const DNSHeader *)msg)->flags) & 0xF) != (ntohs(((const DNSHeader *)ref->msg)->flags) & 0xF)) return;
+    int n_got = answer_addrs(msg, len, got), n_want = answer_addrs(ref->msg, ref->len, want);
+    if (n_got < 0 || n_want < 0 || (n_got == 0) != (n_want == 0)) return;
+    if (n_got == n_want && memcmp(got, want, sizeof(uint64_t) * (size_t)n_got) == 0) st->exact++;
+    for (int i = 0, j = 0; i < n_got; i++) {
+        while (j < n_want && want[j] < got[i]) j++;
+        if (j == n_want || want[j] != got[i]) return;
+    }
+    st->compatible++;
+}
+
+// 预扫描整个抓包：为应答建立索引，统计可回放的查询数与时间跨度
+static void index_capture(uint64_t *packets, uint64_t *queries, uint64_t *first_ns, uint64_t *last_ns) {
+    BenchUdp u;
+    uint8_t key[REPLAY_QUESTION_MAX];
+    *queries = 0;
+    while (bench_pcap_next_udp(&capture, &u)) {
+        if (is_client_query(&u)) {
+            if (!*queries) *first_ns = u.time_ns;
+            *last_ns = u.time_ns;
+            (*queries)++;
+        } else if (is_server_answer(&u)) {
+            int key_len = question_key(u.payload, (int)u.len, key);
+            if (key_len < 0) continue;
+            AnswerEntry *e;
+            HASH_FIND(hh, answers, key, (unsigned)key_len, e);
+            if (e) continue;  // 同一问题保留第一个应答
+            e = calloc(1, sizeof(AnswerEntry));
+            if (!e) continue;
+            memcpy(e->key, key, (size_t)key_len);
+            e->key_len = (uint16_t)key_len;
+            e->msg = u.payload;
+            e->len = (uint16_t)u.len;
+            HASH_ADD(hh, answers, key, e->key_len, e);
+        }
+    }
+    *packets = capture.packets;
+    bench_pcap_rewind(&capture);
+}
+
+static const AnswerEntry *find_answer(const uint8_t *msg, int len) {
+    uint8_t key[REPLAY_QUESTION_MAX];
+    int key_len = question_key(msg, len, key);
+    if (key_len < 0) return NULL;
+    AnswerEntry *e;
+    HASH_FIND(hh, answers, key, (unsigned)key_len, e);
+    return e;
+}
+
+// ----------- 本地上游 -----------
+
+// 用抓包中的应答回复中继转发的查询，没有对应应答时对A/AAAA返回固定地址
+static void *responder_thread(void *arg) {
+    int fd = *(int *)arg;
+    static const uint8_t v4[4] = {192, 0, 2, 1};
+    static const uint8_t v6[16] = {0x20, 0x01, 0x0d, 0xb8, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1};
+    uint8_t query[MAX_DNS_PACKET_SIZE], response[MAX_DNS_PACKET_SIZE];
+    char domain[MAX_DOMAIN_LENGTH];
+    while (!atomic_load(&responder_stop)) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = (int)recvfrom(fd, (char *)query, sizeof(query), 0, (struct sockaddr *)&from, &from_len);
+        if (len < DNS_HEADER_SIZE) continue;
+        uint16_t id = ((const DNSHeader *)query)->id;
+        const AnswerEntry *e = find_answer(query, len);
+        int out;
+        if (e) {
+            memcpy(response, e->msg, e->len);
+            ((DNSHeader *)response)->id = id;
+            out = e->len;
+            atomic_fetch_add(&responder_captured, 1);
+        } else {
+            int name_len = parse_dns_name(query, len, DNS_HEADER_SIZE, domain, sizeof(domain));
+            if (name_len < 0 || DNS_HEADER_SIZE + name_len + (int)sizeof(DNSQuestion) > len) continue;
+            uint16_t qtype = ntohs(((const DNSQuestion *)(query + DNS_HEADER_SIZE + name_len))->qtype);
+            DNSBuilder b;
+            dns_builder_init(&b, response, sizeof(response));
+            dns_builder_question_raw(&b, query + DNS_HEADER_SIZE, name_len + (int)sizeof(DNSQuestion));
+            if (qtype == DNS_TYPE_A) {
+                dns_builder_add_rr(&b, DNS_SECTION_ANSWER, domain, DNS_TYPE_A, DNS_CLASS_IN, 300, v4, 4);
+            } else if (qtype == DNS_TYPE_AAAA) {
+                dns_builder_add_rr(&b, DNS_SECTION_ANSWER, domain, DNS_TYPE_AAAA, DNS_CLASS_IN, 300, v6, 16);
+            }
+            out = dns_builder_finish(&b, ntohs(id), 0x8180);
+            atomic_fetch_add(&responder_synthetic, 1);
+        }
+        sendto(fd, (char *)response, out, 0, (struct sockaddr *)&from, from_len);
+    }
+    return NULL;
+}
+
+static int responder_start(pthread_t *thread, int *fd) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)cfg.responder_port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    *fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (*fd < 0 || bind(*fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        printf("本地上游绑定 127.0.0.1:%d 失败\n", cfg.responder_port);
+        if (*fd >= 0) close(*fd);
+        return -1;
+    }
+    // 接收超时使线程能定期检查退出标志
+    struct timeval tv = {0, 100000};
+    setsockopt(*fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    int size = 4 << 20;
+    setsockopt(*fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (pthread_create(thread, NULL, responder_thread, fd) != 0) {
+        close(*fd);
+        return -1;
+    }
+    return 0;
+}
+
+// ----------- 被测中继 -----------
+
+// 用抓包中的第一个查询确认中继已开始应答
+static int probe_relay(void) {
+    BenchUdp u;
+    int found = 0;
+    while (!found && bench_pcap_next_udp(&capture, &u)) found = is_client_query(&u);
+    bench_pcap_rewind(&capture);
+    if (!found) return -1;
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd < 0) return -1;
+    struct timeval tv = {0, 100000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    connect(fd, (struct sockaddr *)&cfg.target, sizeof(cfg.target));
+    uint8_t buf[MAX_DNS_PACKET_SIZE];
+    int ok = -1;
+    uint64_t deadline = bench_now_ns() + REPLAY_READY_TIMEOUT_MS * 1000000ULL;
+    while (ok < 0 && bench_now_ns() < deadline) {
+        send(fd, u.payload, u.len, 0);
+        if (recv(fd, buf, sizeof(buf), 0) >= DNS_HEADER_SIZE) {
+            ok = 0;
+        } else if (errno == ECONNREFUSED) {
+            usleep(50000);  // 中继尚未绑定端口，recv立即失败
+        }
+    }
+    close(fd);
+    return ok;
+}
+
+static pid_t spawn_relay(char *table_path, const char *admin_path) {
+    const char *table = cfg.table;
+    if (!table) {
+        int tfd = mkstemp(table_path);
+        if (tfd < 0) return -1;
+        close(tfd);
+        table = table_path;
+    }
+    char port[16], upstream[32];
+    snprintf(port, sizeof(port), "%d", ntohs(cfg.target.sin_port));
+    snprintf(upstream, sizeof(upstream), "127.0.0.1:%d", cfg.responder_port);
+    // 额外参数在前，中继要求选项位于位置参数之前
+    char **argv = calloc((size_t)cfg.relay_argc + 8, sizeof(char *));
+    if (!argv) return -1;
+    int argc = 0;
+    argv[argc++] = (char *)cfg.spawn;
+    for (int i = 0; i < cfg.relay_argc; i++) argv[argc++] = cfg.relay_args[i];
+    argv[argc++] = "-a";
+    argv[argc++] = (char *)admin_path;
+    argv[argc++] = "-p";
+    argv[argc++] = port;
+    argv[argc++] = upstream;
+    argv[argc++] = (char *)table;
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (!cfg.verbose) {
+            int devnull = open("/dev/null", O_WRONLY);
+            if (devnull >= 0) dup2(devnull, STDOUT_FILENO);
+        }
+        execv(cfg.spawn, argv);
+        _exit(127);
+    }
+    free(argv);
+    return pid;
+}
+
+static void stop_relay(pid_t pid) {
+    kill(pid, SIGINT);
+    waitpid(pid, NULL, 0);
+}
+
+/**
+ * 通过管理接口的stats命令读取缓存命中与未命中次数。
+ * @return 成功返回0，连接失败返回-1。
+ */
+static int read_cache_stats(const char *path, uint64_t *hits, uint64_t *misses) {
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path)) return -1;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) return -1;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || write(fd, "stats\n", 6) != 6) {
+        close(fd);
+        return -1;
+    }
+    char reply[8192];
+    size_t len = 0;
+    ssize_t n;
+    while (len < sizeof(reply) - 1 && (n = read(fd, reply + len, sizeof(reply) - 1 - len)) > 0) len += (size_t)n;
+    reply[len] = '\0';
+    close(fd);
+    const char *h = strstr(reply, "cache_hits "), *m = strstr(reply, "cache_misses ");
+    if (!h || !m) return -1;
+    *hits = strtoull(h + 11, NULL, 10);
+    *misses = strtoull(m + 13, NULL, 10);
+    return 0;
+}
+
+// ----------- 回放 -----------
+
+static int open_client(ReplayClient *c) {
+    c->fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (c->fd < 0) return -1;
+    int size = 1 << 20;
+    setsockopt(c->fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    setsockopt(c->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL, 0) | O_NONBLOCK);
+    if (connect(c->fd, (struct sockaddr *)&cfg.target, sizeof(cfg.target)) < 0) {
+        close(c->fd);
+        return -1;
+    }
+    return 0;
+}
+
+// 抓包中的客户端（地址与端口）固定映射到一个套接字，保留每个客户端的查询顺序
+static int client_for(const BenchUdp *u) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < (u->family == 4 ? 4 : 16); i++) h = (h ^ u->src[i]) * 0x100000001b3ULL;
+    h = (h ^ u->sport) * 0x100000001b3ULL;
+    return (int)(h % (uint64_t)cfg.clients);
+}
+
+static void send_query(ReplayStats *st, ReplayClient *c, const BenchUdp *u, uint64_t intended) {
+    uint8_t packet[MAX_DNS_PACKET_SIZE];
+    memcpy(packet, u->payload, u->len);
+    uint16_t id = (uint16_t)c->seq++;
+    ((DNSHeader *)packet)->id = htons(id);
+    if (send(c->fd, packet, u->len, 0) != (ssize_t)u->len) {
+        st->send_errors++;
+        return;
+    }
+    uint32_t slot = id & (REPLAY_SLOTS - 1);
+    c->sent_at[slot] = intended;
+    c->slot_id[slot] = id;
+    c->ref[slot] = find_answer(u->payload, (int)u->len);
+    st->sent++;
+}
+
+static void drain_client(ReplayStats *st, ReplayClient *c) {
+    uint8_t buf[MAX_DNS_PACKET_SIZE];
+    for (;;) {
+        ssize_t n = recv(c->fd, buf, sizeof(buf), 0);
+        if (n < 0) return;
+        if (n < DNS_HEADER_SIZE) continue;
+        const DNSHeader *h = (const DNSHeader *)buf;
+        uint16_t id = ntohs(h->id);
+        uint32_t slot = id & (REPLAY_SLOTS - 1);
+        if (!c->sent_at[slot] || c->slot_id[slot] != id) continue;
+        uint64_t latency = bench_now_ns() - c->sent_at[slot];
+        c->sent_at[slot] = 0;
+        if (latency > (uint64_t)cfg.timeout_ms * 1000000ULL) {
+            st->late++;
+            continue;
+        }
+        uint16_t flags = ntohs(h->flags);
+        st->received++;
+        st->rcodes[flags & 0xF]++;
+        if (flags & DNS_FLAG_TC) st->truncated++;
+        hist_record(&st->hist, latency);
+        if (c->ref[slot]) match_answer(st, buf, (int)n, c->ref[slot]);
+    }
+}
+
+// 取下一个可回放的查询，回放结束返回0
+static int next_query(BenchUdp *u, uint64_t count) {
+    if (cfg.limit && count >= cfg.limit) return 0;
+    while (bench_pcap_next_udp(&capture, u)) {
+        if (is_client_query(u)) return 1;
+    }
+    return 0;
+}
+
+static double replay(ReplayStats *st, ReplayClient *clients) {
+    struct pollfd *pfds = calloc((size_t)cfg.clients, sizeof(struct pollfd));
+    if (!pfds) return 0;
+    for (int i = 0; i < cfg.clients; i++) {
+        pfds[i].fd = clients[i].fd;
+        pfds[i].events = POLLIN;
+    }
+    BenchUdp u;
+    uint64_t count = 0;
+    int pending = next_query(&u, count);
+    uint64_t first_ns = pending ? u.time_ns : 0;
+    uint64_t start = bench_now_ns() + 10000000ULL;
+    uint64_t stop_at = cfg.max_duration > 0 ? start + (uint64_t)(cfg.max_duration * 1e9) : UINT64_MAX;
+    uint64_t last_intended = start, deadline = 0;
+    st->first_ns = first_ns;
+
+    for (;;) {
+        uint64_t now = bench_now_ns();
+        uint64_t intended = 0;
+        // 开环：发出所有已到计划时刻的查询，不等待应答
+        while (pending) {
+            if (cfg.rate > 0) {
+                intended = start + (uint64_t)(count * 1e9 / cfg.rate);
+            } else {
+                uint64_t offset = u.time_ns > first_ns ? u.time_ns - first_ns : 0;  // 抓包时间偶有倒退
+                intended = start + (uint64_t)(offset / cfg.speed);
+            }
+            if (intended < last_intended) intended = last_intended;
+            if (intended >= stop_at) {
+                pending = 0;
+                break;
+            }
+            if (intended > now) break;
+            send_query(st, &clients[client_for(&u)], &u, intended);
+            st->last_ns = u.time_ns;
+            last_intended = intended;
+            pending = next_query(&u, ++count);
+        }
+        if (!pending && !deadline) deadline = (now > last_intended ? now : last_intended) + cfg.timeout_ms * 1000000ULL;
+        if (deadline && (now >= deadline || st->received + st->late == st->sent)) break;
+        uint64_t wake = pending ? intended : deadline;
+        uint64_t wait_ns = wake > now ? wake - now : 0;
+#ifdef __linux__
+        struct timespec ts = {(time_t)(wait_ns / 1000000000ULL), (long)(wait_ns % 1000000000ULL)};
+        int ready = ppoll(pfds, (nfds_t)cfg.clients, &ts, NULL);
+#else
+        int ready = poll(pfds, (nfds_t)cfg.clients, (int)((wait_ns + 999999ULL) / 1000000ULL));
+#endif
+        if (ready > 0) {
+            for (int i = 0; i < cfg.clients; i++) {
+                if (pfds[i].revents) drain_client(st, &clients[i]);
+            }
+        }
+    }
+    free(pfds);
+    return (last_intended - start) / 1e9;
+}
+
+// ----------- 结果输出 -----------
+
+static void report(const ReplayStats *st, double send_s, uint64_t capture_queries, int have_cache, uint64_t hits,
+                   uint64_t misses) {
+    const LatencyHist *h = &st->hist;
+    uint64_t lost = st->sent - st->received;
+    double loss = st->sent ? 100.0 * lost / st->sent : 0.0;
+    double span_s = (st->last_ns - st->first_ns) / 1e9;
+    double achieved = send_s > 0 ? st->sent / send_s : 0.0;
+    double exact = st->with_ref ? 100.0 * st->exact / st->with_ref : 0.0;
+    double compatible = st->with_ref ? 100.0 * st->compatible / st->with_ref : 0.0;
+    double hit_ratio = hits + misses ? 100.0 * hits / (hits + misses) : 0.0;
+    uint64_t forwarded = atomic_load(&responder_captured) + atomic_load(&responder_synthetic);
+    if (cfg.csv) {
+        printf("sent,received,lost_pct,capture_qps,achieved_qps,mean_us,p50_us,p90_us,p99_us,p999_us,max_us,"
+               "exact_pct,compatible_pct,cache_hit_pct,upstream_queries\n");
+        printf("%llu,%llu,%.4f,%.0f,%.0f,%.1f,%.1f,%.1f,%.1f,%.1f,%.1f,%.2f,%.2f,%.2f,%llu\n",
+               (unsigned long long)st->sent, (unsigned long long)st->received, loss,
+               span_s > 0 ? st->sent / span_s : 0.0, achieved, hist_mean(h) / 1000.0, hist_percentile(h, 0.5) / 1000.0,
+               hist_percentile(h, 0.9) / 1000.0, hist_percentile(h, 0.99) / 1000.0,
+               hist_percentile(h, 0.999) / 1000.0, hist_load(&h->max) / 1000.0, exact, compatible,
+               have_cache ? hit_ratio : -1.0, (unsigned long long)forwarded);
+        return;
+    }
+    printf("replayed  %llu of %llu queries, capture span %.1fs (%.0f qps), replay %.1fs: %.0f qps achieved\n",
+           (unsigned long long)st->sent, (unsigned long long)capture_queries, span_s,
+           span_s > 0 ? st->sent / span_s : 0.0, send_s, achieved);
+    printf("received  %llu, lost %llu (%.3f%%), of which late %llu, send errors %llu\n",
+           (unsigned long long)st->received, (unsigned long long)lost, loss, (unsigned long long)st->late,
+           (unsigned long long)st->send_errors);
+    printf("rcode     NOERROR %llu  NXDOMAIN %llu  SERVFAIL %llu  other %llu  TC %llu\n",
+           (unsigned long long)st->rcodes[DNS_RCODE_NO_ERROR], (unsigned long long)st->rcodes[DNS_RCODE_NAME_ERROR],
+           (unsigned long long)st->rcodes[DNS_RCODE_SERVER_FAILURE],
+           (unsigned long long)(st->received - st->rcodes[DNS_RCODE_NO_ERROR] - st->rcodes[DNS_RCODE_NAME_ERROR] -
+                                st->rcodes[DNS_RCODE_SERVER_FAILURE]),
+           (unsigned long long)st->truncated);
+    printf("latency   mean %.1fus  p50 %.1fus  p90 %.1fus  p99 %.1fus  p99.9 %.1fus  p99.99 %.1fus  max %.1fus\n",
+           hist_mean(h) / 1000.0, hist_percentile(h, 0.5) / 1000.0, hist_percentile(h, 0.9) / 1000.0,
+           hist_percentile(h, 0.99) / 1000.0, hist_percentile(h, 0.999) / 1000.0, hist_percentile(h, 0.9999) / 1000.0,
+           hist_load(&h->max) / 1000.0);
+    printf("answers   %llu with a captured answer: exact %.2f%%, compatible %.2f%%\n",
+           (unsigned long long)st->with_ref, exact, compatible);
+    if (have_cache) {
+        printf("cache     hit ratio %.2f%% (%llu hits, %llu misses)\n", hit_ratio, (unsigned long long)hits,
+               (unsigned long long)misses);
+    }
+    if (cfg.responder_port) {
+        printf("upstream  %llu queries (%.2f%% of replayed), %llu answered from the capture\n",
+               (unsigned long long)forwarded, st->sent ? 100.0 * forwarded / st->sent : 0.0,
+               (unsigned long long)atomic_load(&responder_captured));
+    }
+    if (cfg.print_hist) hist_print_distribution(h, stdout, 5);
+}
+
+int main(int argc, char *argv[]) {
+    if (parse_args(argc, argv) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (bench_pcap_open(&capture, cfg.pcap) < 0) {
+        printf("无法读取抓包文件 %s（只支持pcap格式）\n", cfg.pcap);
+        return 1;
+    }
+    uint64_t packets = 0, capture_queries = 0, first_ns = 0, last_ns = 0;
+    index_capture(&packets, &capture_queries, &first_ns, &last_ns);
+    if (!cfg.csv) {
+        double span = (last_ns - first_ns) / 1e9;
+        printf("capture   %s: %llu packets, %llu queries over %.1fs, %u answered questions\n", cfg.pcap,
+               (unsigned long long)packets, (unsigned long long)capture_queries, span,
+               HASH_COUNT(answers));
+    }
+    if (capture_queries == 0) {
+        printf("抓包中没有发往端口%d的DNS查询\n", cfg.dns_port);
+        return 1;
+    }
+
+    pthread_t responder;
+    int responder_fd = -1;
+    if (cfg.responder_port && responder_start(&responder, &responder_fd) < 0) return 1;
+
+    pid_t relay = -1;
+    char table_path[] = "/tmp/dnsrelay-replay-XXXXXX";
+    char admin_path[64];
+    int status = 1;
+    if (cfg.spawn) {
+        snprintf(admin_path, sizeof(admin_path), "/tmp/dnsrelay-replay-%d.sock", (int)getpid());
+        cfg.admin = admin_path;
+        relay = spawn_relay(table_path, admin_path);
+        if (relay < 0) {
+            printf("启动中继 %s 失败\n", cfg.spawn);
+            goto out;
+        }
+    }
+    if (probe_relay() < 0) {
+        printf("中继在%d毫秒内没有应答\n", REPLAY_READY_TIMEOUT_MS);
+        goto out;
+    }
+
+    ReplayStats *st = calloc(1, sizeof(ReplayStats));
+    ReplayClient *clients = calloc((size_t)cfg.clients, sizeof(ReplayClient));
+    if (!st || !clients) goto out;
+    for (int i = 0; i < cfg.clients; i++) {
+        if (open_client(&clients[i]) < 0) {
+            printf("创建客户端套接字失败\n");
+            goto out;
+        }
+    }
+    // 缓存命中率取回放前后的差值，排除探测查询与之前的流量
+    uint64_t hits0 = 0, misses0 = 0, hits1 = 0, misses1 = 0;
+    int have_cache = cfg.admin && read_cache_stats(cfg.admin, &hits0, &misses0) == 0;
+    atomic_store(&responder_captured, 0);
+    atomic_store(&responder_synthetic, 0);
+    double send_s = replay(st, clients);
+    have_cache = have_cache && read_cache_stats(cfg.admin, &hits1, &misses1) == 0;
+    report(st, send_s, capture_queries, have_cache, hits1 - hits0, misses1 - misses0);
+    status = 0;
+
+out:
+    if (relay > 0) {
+        stop_relay(relay);
+        if (!cfg.table) unlink(table_path);
+    }
+    if (responder_fd >= 0) {
+        atomic_store(&responder_stop, 1);
+        pthread_join(responder, NULL);
+        close(responder_fd);
+    }
+    bench_pcap_close(&capture);
+    return status;
+}
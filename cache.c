@@ -4,42 +4,437 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "logging.h"
+#include "protocol.h"
 #include "util.h"
 
+// 键哈希（FNV-1a），高位选分片，低位选桶
+static inline uint32_t cache_key_hash(const char *key, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)key[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static inline CacheShard *cache_shard(DNSCache *cache, uint32_t hash) {
+    return &cache->shards[hash >> (32 - CACHE_SHARD_BITS)];
+}
+
+static inline uint64_t buckets_bytes(const CacheBuckets *b) {
+    return sizeof(CacheBuckets) + ((uint64_t)b->mask + 1) * sizeof(CacheSlot);
+}
+
+// 分片当前占用字节数（条目 + 桶数组），只在分片锁内调用
+static inline uint64_t shard_bytes(const CacheShard *s) {
+    return s->entry_bytes + buckets_bytes(atomic_load_explicit(&s->buckets, memory_order_relaxed));
+}
+
+static CacheBuckets *buckets_alloc(uint32_t count) {
+    CacheBuckets *b = calloc(1, sizeof(CacheBuckets) + (size_t)count * sizeof(CacheSlot));
+    if (!b) return NULL;
+    b->mask = count - 1;
+    for (uint32_t i = 0; i < count; i++) atomic_init(&b->slots[i], NULL);
+    return b;
+}
+
+// 按分片预算估计的初始桶数，取2的幂
+static uint32_t shard_initial_buckets(uint64_t shard_bytes_budget) {
+    uint64_t want = shard_bytes_budget / CACHE_EST_ENTRY_BYTES;
+    uint32_t count = CACHE_MIN_BUCKETS;
+    while (count < want && count < (1u << 24)) count <<= 1;
+    return count;
+}
+
+// 回收宽限期已结束的条目与桶数组，只检查队首，不等待
+static void shard_reclaim(DNSCache *cache, CacheShard *s) {
+    while (s->retired_head && qsbr_poll(cache->qsbr, s->retired_head->retire_epoch)) {
+        CacheEntry *e = s->retired_head;
+        s->retired_head = e->clock_next;
+        free(e);
+    }
+    if (!s->retired_head) s->retired_tail = NULL;
+    while (s->retired_buckets && qsbr_poll(cache->qsbr, s->retired_buckets->retire_epoch)) {
+        CacheBuckets *b = s->retired_buckets;
+        s->retired_buckets = b->retired_next;
+        free(b);
+    }
+}
+
+// 条目已从桶链与CLOCK环中移出：单线程使用时立即释放，否则等待读者离开
+static void shard_retire(DNSCache *cache, CacheShard *s, CacheEntry *e) {
+    if (!cache->qsbr) {
+        free(e);
+        return;
+    }
+    e->retire_epoch = qsbr_advance(cache->qsbr);
+    e->clock_next = NULL;
+    if (s->retired_tail) {
+        s->retired_tail->clock_next = e;
+    } else {
+        s->retired_head = e;
+    }
+    s->retired_tail = e;
+}
+
+// 在CLOCK环中把条目插到指针之前，即最晚被检查的位置
+static void clock_insert(CacheShard *s, CacheEntry *e) {
+    if (!s->hand) {
+        e->clock_prev = e->clock_next = e;
+        s->hand = e;
+        return;
+    }
+    e->clock_next = s->hand;
+    e->clock_prev = s->hand->clock_prev;
+    e->clock_prev->clock_next = e;
+    s->hand->clock_prev = e;
+}
+
+static void clock_unlink(CacheShard *s, CacheEntry *e) {
+    if (e->clock_next == e) {
+        s->hand = NULL;
+        return;
+    }
+    e->clock_prev->clock_next = e->clock_next;
+    e->clock_next->clock_prev = e->clock_prev;
+    if (s->hand == e) s->hand = e->clock_next;
+}
+
+// 找到指向条目的链接（桶头或前一条目的next），只在分片锁内调用
+static CacheSlot *shard_link_of(CacheShard *s, const CacheEntry *e) {
+    CacheBuckets *b = atomic_load_explicit(&s->buckets, memory_order_relaxed);
+    CacheSlot *link = &b->slots[e->hash & b->mask];
+    for (CacheEntry *cur; (cur = atomic_load_explicit(link, memory_order_relaxed)) != NULL; link = &cur->next) {
+        if (cur == e) return link;
+    }
+    return NULL;
+}
+
+// 从分片中移除条目并延迟释放，同步更新计数
+static void shard_remove(DNSCache *cache, CacheShard *s, CacheEntry *e) {
+    CacheSlot *link = shard_link_of(s, e);
+    // 被移出的条目保留自己的next，正在遍历到它的读者可以继续走下去
+    if (link) atomic_store_explicit(link, atomic_load_explicit(&e->next, memory_order_relaxed), memory_order_release);
+    clock_unlink(s, e);
+    s->count--;
+    s->entry_bytes -= e->bytes;
+    shard_retire(cache, s, e);
+}
+
+/**
+ * 桶数翻倍：把所有条目重新挂到新数组后整体发布。
+ * 与之并发的读者可能沿旧链走进新链而错过目标键，只会多一次未命中；
+ * 条目本身在此期间不会被释放，链表也始终无环。
+ */
+static void shard_grow(DNSCache *cache, CacheShard *s) {
+    CacheBuckets *old = atomic_load_explicit(&s->buckets, memory_order_relaxed);
+    CacheBuckets *fresh = buckets_alloc((old->mask + 1) * 2);
+    if (!fresh) return;
+    CacheEntry *e = s->hand;
+    for (uint32_t i = 0; i < s->count; i++, e = e->clock_next) {
+        CacheSlot *slot = &fresh->slots[e->hash & fresh->mask];
+        atomic_store_explicit(&e->next, atomic_load_explicit(slot, memory_order_relaxed), memory_order_release);
+        atomic_store_explicit(slot, e, memory_order_relaxed);
+    }
+    atomic_store_explicit(&s->buckets, fresh, memory_order_release);
+    if (!cache->qsbr) {
+        free(old);
+        return;
+    }
+    old->retire_epoch = qsbr_advance(cache->qsbr);
+    old->retired_next = NULL;
+    CacheBuckets **tail = &s->retired_buckets;
+    while (*tail) tail = &(*tail)->retired_next;
+    *tail = old;
+}
+
+// 按CLOCK顺序驱逐，直到再放入need字节后不超过预算；已过期的条目无论访问位都先淘汰
+static void shard_evict_until_fits(DNSCache *cache, CacheShard *s, uint64_t need) {
+    struct timeval now;
+    get_now(&now);
+    while (s->hand && shard_bytes(s) + need > s->max_bytes) {
+        CacheEntry *e = s->hand;
+        int expired = e->expire_time.tv_sec <= now.tv_sec;
+        if (!expired && atomic_exchange_explicit(&e->referenced, 0, memory_order_relaxed)) {
+            s->hand = e->clock_next;  // 最近被访问过，给一次机会
+            continue;
+        }
+        LOG_DEBUG("CLOCK驱逐：%s (%u字节)\n", e->key, e->bytes);
+        shard_remove(cache, s, e);
+        if (expired) {
+            s->expired++;
+        } else {
+            s->evicted++;
+        }
+    }
+}
+
+// 在分片中查找键，读者无锁调用
+static CacheEntry *shard_find(CacheShard *s, uint32_t hash, const char *key, size_t key_len) {
+    CacheBuckets *b = atomic_load_explicit(&s->buckets, memory_order_acquire);
+    for (CacheEntry *e = atomic_load_explicit(&b->slots[hash & b->mask], memory_order_acquire); e;
+         e = atomic_load_explicit(&e->next, memory_order_acquire)) {
+        // 先比较长度，较短的已存键不会被越界读取
+        if (e->hash == hash && e->key_len == key_len && memcmp(e->key, key, key_len) == 0) return e;
+    }
+    return NULL;
+}
+
+// 从缓存键 "域名#类型" 中取出域名部分
+static void cache_key_domain(const char *key, char *domain, size_t size) {
+    const char *sep = strrchr(key, '#');
+    size_t len = sep ? (size_t)(sep - key) : strlen(key);
+    if (len >= size) len = size - 1;
+    memcpy(domain, key, len);
+    domain[len] = '\0';
+}
+
+// 判断条目是否已被后缀清除覆盖：逐级检查域名的各个后缀，只需O(标签数)次查找
+static int cache_entry_flushed(DNSCache *cache, const CacheEntry *entry, const char *domain) {
+    if (atomic_load_explicit(&cache->tomb_count, memory_order_acquire) == 0) return 0;
+    int flushed = 0;
+    pthread_rwlock_rdlock(&cache->tomb_lock);
+    for (const char *p = domain; !flushed;) {
+        CacheTombstone *tomb;
+        HASH_FIND_STR(cache->tombstones, p, tomb);
+        if (tomb && entry->generation < tomb->generation) flushed = 1;
+        p = strchr(p, '.');
+        if (!p) break;
+        p++;
+    }
+    pthread_rwlock_unlock(&cache->tomb_lock);
+    return flushed;
+}
+
+// 丢弃代数不晚于upto的清除记录：此前开始的全表扫描已回收它们覆盖的条目
+static void cache_clear_tombstones(DNSCache *cache, uint64_t upto) {
+    pthread_rwlock_wrlock(&cache->tomb_lock);
+    CacheTombstone *tomb, *tmp;
+    HASH_ITER(hh, cache->tombstones, tomb, tmp) {
+        if (tomb->generation > upto) continue;
+        HASH_DEL(cache->tombstones, tomb);
+        free(tomb);
+    }
+    atomic_store(&cache->tomb_count, HASH_COUNT(cache->tombstones));
+    pthread_rwlock_unlock(&cache->tomb_lock);
+}
+
+// 各分片命中与未命中次数之和，即cache_get的查找次数
+static uint64_t cache_lookup_count(DNSCache *cache) {
+    uint64_t lookups = 0;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        lookups += atomic_load_explicit(&cache->shards[i].hits, memory_order_relaxed);
+        lookups += atomic_load_explicit(&cache->shards[i].misses, memory_order_relaxed);
+    }
+    return lookups;
+}
+
 // 创建DNS缓存管理器
-DNSCache *cache_create(uint32_t max_entries) {
-    DNSCache *cache = malloc(sizeof(DNSCache));
-    if (!cache) {
-        print_debug_info("缓存创建失败：内存分配错误\n");
+DNSCache *cache_create(uint64_t max_bytes) {
+    // 分片按缓存行对齐，避免不同分片的锁与计数落在同一缓存行
+    void *storage = calloc(1, sizeof(DNSCache) + 64);
+    if (!storage) {
+        LOG_WARN("缓存创建失败：内存分配错误\n");
+        return NULL;
+    }
+    DNSCache *cache = (DNSCache *)(((uintptr_t)storage + 63) & ~(uintptr_t)63);
+    cache->storage = storage;
+    atomic_init(&cache->max_bytes, max_bytes);
+    atomic_init(&cache->generation, 0);
+    atomic_init(&cache->tomb_count, 0);
+    pthread_rwlock_init(&cache->tomb_lock, NULL);
+    pthread_mutex_init(&cache->mrc_lock, NULL);
+    for (int i = 0; i < CACHE_MRC_SLOTS; i++) pthread_mutex_init(&cache->mrc_slots[i].lock, NULL);
+
+    uint32_t buckets = shard_initial_buckets(max_bytes / CACHE_SHARDS);
+    int failed = 0;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard *s = &cache->shards[i];
+        pthread_mutex_init(&s->lock, NULL);
+        s->max_bytes = max_bytes / CACHE_SHARDS;
+        atomic_init(&s->hits, 0);
+        atomic_init(&s->misses, 0);
+        CacheBuckets *b = buckets_alloc(buckets);
+        atomic_init(&s->buckets, b);
+        if (!b) failed = 1;
+    }
+    if (failed) {
+        cache_destroy(cache);
+        LOG_WARN("缓存创建失败：内存分配错误\n");
         return NULL;
     }
 
-    memset(cache, 0, sizeof(DNSCache));
-    cache->entries = NULL;
-    cache->stats.max_size = max_entries;
-
-    print_debug_info("DNS缓存已创建：最大条目=%u\n", max_entries);
+    LOG_DEBUG("DNS缓存已创建：字节预算=%llu，%d个分片\n", (unsigned long long)max_bytes, CACHE_SHARDS);
     return cache;
 }
 
-// 销毁DNS缓存管理器
+// 销毁DNS缓存管理器，调用时不能再有其他线程访问
 void cache_destroy(DNSCache *cache) {
     if (!cache) return;
 
-    CacheEntry *entry, *tmp;
-    HASH_ITER(hh, cache->entries, entry, tmp) {
-        HASH_DEL(cache->entries, entry);
-        free(entry);
+    LOG_DEBUG("DNS缓存已销毁：命中率=%.2f%%\n", cache_hit_rate(cache) * 100.0);
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard *s = &cache->shards[i];
+        CacheEntry *e = s->hand;
+        for (uint32_t n = 0; n < s->count; n++) {
+            CacheEntry *next = e->clock_next;
+            free(e);
+            e = next;
+        }
+        while (s->retired_head) {
+            CacheEntry *next = s->retired_head->clock_next;
+            free(s->retired_head);
+            s->retired_head = next;
+        }
+        while (s->retired_buckets) {
+            CacheBuckets *next = s->retired_buckets->retired_next;
+            free(s->retired_buckets);
+            s->retired_buckets = next;
+        }
+        free(atomic_load(&s->buckets));
+        pthread_mutex_destroy(&s->lock);
+    }
+    cache_clear_tombstones(cache, UINT64_MAX);
+    pthread_rwlock_destroy(&cache->tomb_lock);
+    pthread_mutex_destroy(&cache->mrc_lock);
+    for (int i = 0; i < CACHE_MRC_SLOTS; i++) pthread_mutex_destroy(&cache->mrc_slots[i].lock);
+    mrc_destroy(cache->mrc);
+    free(cache->storage);
+}
+
+void cache_set_qsbr(DNSCache *cache, QSBR *qsbr) {
+    if (cache) cache->qsbr = qsbr;
+}
+
+// 运行时调整字节预算，平均分到各分片
+void cache_set_capacity(DNSCache *cache, uint64_t max_bytes) {
+    if (!cache) return;
+    atomic_store(&cache->max_bytes, max_bytes);
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard *s = &cache->shards[i];
+        pthread_mutex_lock(&s->lock);
+        s->max_bytes = max_bytes / CACHE_SHARDS;
+        shard_evict_until_fits(cache, s, 0);
+        if (cache->qsbr) shard_reclaim(cache, s);
+        pthread_mutex_unlock(&s->lock);
+    }
+    LOG_DEBUG("缓存字节预算调整为 %llu\n", (unsigned long long)max_bytes);
+}
+
+// 本线程使用的采样缓冲区下标，首次采样时按线程出现的顺序分配
+static _Thread_local int t_mrc_slot = -1;
+static atomic_int g_mrc_next_slot;
+
+// 把一个缓冲区中的样本合并进估计器，调用者持有该缓冲区的锁与mrc_lock
+static void cache_mrc_merge_slot(DNSCache *cache, CacheMRCSlot *slot) {
+    mrc_access_hashes(cache->mrc, slot->hashes, slot->count);
+    slot->count = 0;
+}
+
+/**
+ * 查找路径上的采样：未落入采样区间的访问（绝大多数）只计算一次哈希，不写任何共享数据；
+ * 采样到的访问追加到本线程的缓冲区，攒满一批才尝试合并，估计器的锁每批只取一次。
+ * 估计器忙时保留样本等下一次，缓冲区满时丢弃新样本，查找从不等待估计器。
+ */
+static void cache_mrc_sample(DNSCache *cache, const char *key, size_t key_len) {
+    uint64_t hash = mrc_key_hash(key, key_len);
+    if (!mrc_may_sample(cache->mrc, hash)) return;
+    if (t_mrc_slot < 0) t_mrc_slot = atomic_fetch_add(&g_mrc_next_slot, 1) % CACHE_MRC_SLOTS;
+    CacheMRCSlot *slot = &cache->mrc_slots[t_mrc_slot];
+    pthread_mutex_lock(&slot->lock);
+    if (slot->count < CACHE_MRC_BATCH) slot->hashes[slot->count++] = hash;
+    if (slot->count == CACHE_MRC_BATCH && pthread_mutex_trylock(&cache->mrc_lock) == 0) {
+        cache_mrc_merge_slot(cache, slot);
+        pthread_mutex_unlock(&cache->mrc_lock);
     }
+    pthread_mutex_unlock(&slot->lock);
+}
+
+// 读取曲线前调用，调用者持有mrc_lock：合并所有缓冲区，并按分片计数补上全部查找次数
+static void cache_mrc_drain(DNSCache *cache) {
+    for (int i = 0; i < CACHE_MRC_SLOTS; i++) {
+        CacheMRCSlot *slot = &cache->mrc_slots[i];
+        pthread_mutex_lock(&slot->lock);
+        if (slot->count) cache_mrc_merge_slot(cache, slot);
+        pthread_mutex_unlock(&slot->lock);
+    }
+    uint64_t lookups = cache_lookup_count(cache);
+    mrc_add_references(cache->mrc, (double)(lookups - cache->mrc_lookups));
+    cache->mrc_lookups = lookups;
+}
 
-    print_debug_info("DNS缓存已销毁：命中率=%.2f%%, 总命中=%llu, 总未命中=%llu\n", cache_hit_rate(cache),
-                     cache->stats.hits, cache->stats.misses);
-    free(cache);
+// 启用缺失率曲线估计，由cache_get的每次查找驱动
+int cache_enable_mrc(DNSCache *cache, double sample_rate) {
+    if (!cache) return -1;
+    if (cache->mrc) return 0;
+    cache->mrc_lookups = cache_lookup_count(cache);
+    cache->mrc = mrc_create(sample_rate, CACHE_MRC_MAX_SAMPLES);
+    return cache->mrc ? 0 : -1;
 }
 
-// 生成缓存键（域名+查询类型）
-static inline void cache_key_generate(char *key, const char *domain, uint16_t qtype) {
-    snprintf(key, 270, "%s#%u", domain, qtype);
+// 设置自动调整容量的目标命中率与内存上限，未启用估计器时按默认采样率启用
+void cache_set_autosize(DNSCache *cache, double target_hit_ratio, uint64_t ceiling_bytes) {
+    if (!cache) return;
+    if (!cache->mrc) cache_enable_mrc(cache, CACHE_MRC_DEFAULT_RATE);
+    cache->target_hit_ratio = target_hit_ratio;
+    cache->ceiling_bytes = ceiling_bytes;
+}
+
+/**
+ * 根据缺失率曲线把字节预算调整到刚好达到目标命中率的大小
+ * 不超过内存上限，变化不足10%时保持不变以免来回抖动。
+ * 每次调整后衰减曲线，使其跟随访问模式的变化。
+ */
+void cache_autosize(DNSCache *cache) {
+    if (!cache || !cache->mrc || cache->target_hit_ratio <= 0.0) return;
+
+    CacheStats st;
+    cache_get_stats(cache, &st);
+    pthread_mutex_lock(&cache->mrc_lock);
+    cache_mrc_drain(cache);
+    if (cache->mrc->total < 1000.0) {  // 样本太少，曲线不可信
+        pthread_mutex_unlock(&cache->mrc_lock);
+        return;
+    }
+    uint64_t need = mrc_entries_for_hit_ratio(cache->mrc, cache->target_hit_ratio);
+    mrc_decay(cache->mrc);
+    pthread_mutex_unlock(&cache->mrc_lock);
+
+    // 平均每条目字节数（含桶数组分摊），缓存为空时按最短键估计
+    double avg_bytes =
+        st.current_size ? (double)st.current_bytes / st.current_size : (double)(sizeof(CacheEntry) + 16);
+    uint64_t want = cache->ceiling_bytes;
+    if (need != UINT64_MAX && (double)need * avg_bytes * 1.1 < (double)cache->ceiling_bytes) {
+        want = (uint64_t)((double)need * avg_bytes * 1.1);  // 留10%余量
+    }
+    if (want < CACHE_MIN_BYTES) want = CACHE_MIN_BYTES;
+
+    uint64_t cur = st.max_bytes;
+    uint64_t diff = want > cur ? want - cur : cur - want;
+    if (diff * 10 > cur) {
+        LOG_DEBUG("缓存自动调整：目标命中率%.2f%%需约%llu条目，预算 %llu -> %llu\n",
+                  cache->target_hit_ratio * 100.0, (unsigned long long)need, (unsigned long long)cur,
+                  (unsigned long long)want);
+        cache_set_capacity(cache, want);
+    }
+}
+
+// 生成缓存键（域名+查询类型），返回键长度，过长时返回-1；在查找路径上，不用snprintf
+static inline int cache_key_generate(char *key, const char *domain, uint16_t qtype) {
+    size_t len = strlen(domain);
+    if (len + 7 > CACHE_KEY_MAX) return -1;  // '#' + 最多5位类型 + 结尾0
+    memcpy(key, domain, len);
+    key[len++] = '#';
+    char digits[5];
+    int n = 0;
+    do {
+        digits[n++] = (char)('0' + qtype % 10);
+        qtype /= 10;
+    } while (qtype);
+    while (n) key[len++] = digits[--n];
+    key[len] = '\0';
+    return (int)len;
 }
 
 // 获取缓存条目剩余TTL
@@ -53,7 +448,7 @@ uint32_t cache_get_remaining_ttl(const CacheEntry *entry) {
 }
 
 /**
- * 向缓存添加条目
+ * 向缓存添加条目，已存在时整条替换（读者仍可读到旧条目直到其静止）
  * @param cache 缓存管理器
  * @param domain 域名
  * @param qtype 查询类型
@@ -65,150 +460,382 @@ int cache_put(DNSCache *cache, const char *domain, uint16_t qtype, const char *i
     if (!cache || !domain || !ip) {
         return -1;
     }
-
-    char key[270];
-    cache_key_generate(key, domain, qtype);
-
-    CacheEntry *existing;
-    HASH_FIND_STR(cache->entries, key, existing);
-
-    if (existing) {
-        // 先删除再插入，保持LRU顺序
-        HASH_DEL(cache->entries, existing);
-        strncpy(existing->ip, ip, sizeof(existing->ip) - 1);
-        existing->ip[sizeof(existing->ip) - 1] = '\0';
-        struct timeval now;
-        get_now(&now);
-        existing->expire_time.tv_sec = now.tv_sec + ttl;
-        HASH_ADD_STR(cache->entries, key, existing);
-
-        print_debug_info("缓存更新：%s (%u) -> %s, TTL=%u秒\n", domain, qtype, ip, ttl);
-        return 0;
-    }
-
-    // 检查缓存大小限制
-    if (cache->stats.current_size >= cache->stats.max_size) {
-        // 直接淘汰哈希表头部（最久未使用）
-        CacheEntry *oldest = cache->entries;
-        if (oldest) {
-            print_debug_info("LRU驱逐：%s\n", oldest->key);
-            HASH_DEL(cache->entries, oldest);
-            free(oldest);
-            cache->stats.current_size--;
-            cache->stats.evicted++;
-        }
+    // 写入时一次性生成应答记录，命中时无需再解析IP
+    uint8_t addr[16], rr[DNS_ANSWER_RR_MAX];
+    int family = qtype == DNS_TYPE_AAAA ? 6 : 4;
+    if (inet_pton(family == 6 ? AF_INET6 : AF_INET, ip, addr) != 1) return -1;
+    int rr_len = build_answer_rr(rr, family, addr, 0);
+
+    char key[CACHE_KEY_MAX];
+    int key_len = cache_key_generate(key, domain, qtype);
+    if (key_len < 0 || key_len >= CACHE_KEY_MAX) {
+        return -1;
     }
+    uint32_t hash = cache_key_hash(key, (size_t)key_len);
+    CacheShard *s = cache_shard(cache, hash);
 
-    // 创建新条目
-    CacheEntry *entry = malloc(sizeof(CacheEntry));
+    // 在锁外分配并填好新条目
+    uint32_t bytes = (uint32_t)(sizeof(CacheEntry) + key_len + 1);
+    CacheEntry *entry = malloc(bytes);
     if (!entry) {
-        print_debug_info("缓存添加失败：内存分配错误\n");
+        LOG_WARN("缓存添加失败：内存分配错误\n");
         return -1;
     }
-
-    strncpy(entry->key, key, sizeof(entry->key) - 1);
-    entry->key[sizeof(entry->key) - 1] = '\0';
+    memcpy(entry->key, key, key_len + 1);
+    entry->key_len = (uint16_t)key_len;
     strncpy(entry->ip, ip, sizeof(entry->ip) - 1);
     entry->ip[sizeof(entry->ip) - 1] = '\0';
+    entry->hash = hash;
     entry->qtype = qtype;
-
+    entry->rr_len = (uint8_t)rr_len;
+    memcpy(entry->rr, rr, (size_t)rr_len);
+    entry->bytes = bytes;
+    atomic_init(&entry->referenced, 0);
     struct timeval now;
     get_now(&now);
     entry->expire_time.tv_sec = now.tv_sec + ttl;
+    entry->expire_time.tv_usec = 0;
+
+    pthread_mutex_lock(&s->lock);
+    if (cache->qsbr) shard_reclaim(cache, s);
+    entry->generation = atomic_fetch_add(&cache->generation, 1) + 1;
+
+    CacheEntry *existing = shard_find(s, hash, key, (size_t)key_len);
+    if (existing) {
+        // 原位替换：新条目接管旧条目在桶链与CLOCK环中的位置，大小不变无需重新计费
+        atomic_init(&entry->next, atomic_load_explicit(&existing->next, memory_order_relaxed));
+        atomic_init(&entry->referenced, 1);
+        if (existing->clock_next == existing) {
+            entry->clock_prev = entry->clock_next = entry;
+        } else {
+            entry->clock_prev = existing->clock_prev;
+            entry->clock_next = existing->clock_next;
+            entry->clock_prev->clock_next = entry;
+            entry->clock_next->clock_prev = entry;
+        }
+        if (s->hand == existing) s->hand = entry;
+        atomic_store_explicit(shard_link_of(s, existing), entry, memory_order_release);
+        shard_retire(cache, s, existing);
+        pthread_mutex_unlock(&s->lock);
+        LOG_DEBUG("缓存更新：%s (%u) -> %s, TTL=%u秒\n", domain, qtype, ip, ttl);
+        return 0;
+    }
 
-    HASH_ADD_STR(cache->entries, key, entry);
-    cache->stats.current_size++;
+    // 单个条目超过整个分片预算时直接放弃
+    if (bytes > s->max_bytes) {
+        pthread_mutex_unlock(&s->lock);
+        free(entry);
+        LOG_DEBUG("缓存添加失败：条目%u字节超过预算\n", bytes);
+        return -1;
+    }
 
-    print_debug_info("缓存添加：%s (%u) -> %s, TTL=%u秒\n", domain, qtype, ip, ttl);
+    // 负载因子超过1时扩容，再按预算驱逐
+    CacheBuckets *b = atomic_load_explicit(&s->buckets, memory_order_relaxed);
+    if (s->count >= b->mask + 1 && b->mask < (1u << 24)) shard_grow(cache, s);
+    shard_evict_until_fits(cache, s, bytes);
+
+    b = atomic_load_explicit(&s->buckets, memory_order_relaxed);
+    CacheSlot *slot = &b->slots[hash & b->mask];
+    atomic_init(&entry->next, atomic_load_explicit(slot, memory_order_relaxed));
+    clock_insert(s, entry);
+    s->count++;
+    s->entry_bytes += bytes;
+    atomic_store_explicit(slot, entry, memory_order_release);  // 条目填好后再对读者可见
+    pthread_mutex_unlock(&s->lock);
+
+    LOG_DEBUG("缓存添加：%s (%u) -> %s, TTL=%u秒\n", domain, qtype, ip, ttl);
     return 0;
 }
 
 /**
- * 从缓存获取条目
+ * 从缓存获取条目，不加锁，可与其他线程的读写并发
  * @param cache 缓存管理器
  * @param domain 域名
  * @param qtype 查询类型
- * @return 缓存条目指针，未找到或过期返回NULL
+ * @return 缓存条目指针，未找到、过期或已被清除返回NULL
  */
-CacheEntry *cache_get(DNSCache *cache, const char *domain, uint16_t qtype) {
+const CacheEntry *cache_get(DNSCache *cache, const char *domain, uint16_t qtype) {
     if (!cache || !domain) {
         return NULL;
     }
 
-    char key[270];
-    cache_key_generate(key, domain, qtype);
+    char key[CACHE_KEY_MAX];
+    int key_len = cache_key_generate(key, domain, qtype);
+    if (key_len < 0 || key_len >= CACHE_KEY_MAX) return NULL;
 
-    CacheEntry *entry;
-    HASH_FIND_STR(cache->entries, key, entry);
+    // 按访问流估计缺失率曲线
+    if (cache->mrc) cache_mrc_sample(cache, key, (size_t)key_len);
 
-    if (!entry) {
-        cache->stats.misses++;
-        return NULL;
-    }
+    uint32_t hash = cache_key_hash(key, (size_t)key_len);
+    CacheShard *s = cache_shard(cache, hash);
+    CacheEntry *entry = shard_find(s, hash, key, (size_t)key_len);
 
-    // 检查是否过期
-    uint32_t remaining = cache_get_remaining_ttl(entry);
-    if (remaining <= 0) {
-        print_debug_info("缓存过期：%s (%u)\n", domain, qtype);
-        HASH_DEL(cache->entries, entry);
-        free(entry);
-        cache->stats.current_size--;
-        cache->stats.expired++;
-        cache->stats.misses++;
+    // 过期或被后缀清除的条目留给写者与定期清理回收，读者只当作未命中
+    if (!entry || cache_get_remaining_ttl(entry) == 0 || cache_entry_flushed(cache, entry, domain)) {
+        atomic_fetch_add_explicit(&s->misses, 1, memory_order_relaxed);
         return NULL;
     }
 
-    // 先删除再插入，保持LRU顺序
-    HASH_DEL(cache->entries, entry);
-    HASH_ADD_STR(cache->entries, key, entry);
-
-    cache->stats.hits++;
-
-    print_debug_info("缓存命中：%s (%u) -> %s, 剩余TTL=%u秒\n", domain, qtype, entry->ip, remaining);
+    // 访问位已置位时不再写，避免热点条目的缓存行在线程间来回传递
+    if (!atomic_load_explicit(&entry->referenced, memory_order_relaxed)) {
+        atomic_store_explicit(&entry->referenced, 1, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&s->hits, 1, memory_order_relaxed);
 
+    LOG_DEBUG("缓存命中：%s (%u) -> %s\n", domain, qtype, entry->ip);
     return entry;
 }
 
-// 清理过期的缓存条目
+// 清理过期的缓存条目，顺带回收已被后缀清除覆盖的条目
 void cache_cleanup_expired(DNSCache *cache) {
     if (!cache) return;
 
-    CacheEntry *entry, *tmp;
+    uint64_t start_generation = atomic_load(&cache->generation);
     uint32_t expired_count = 0;
+    uint32_t flushed_count = 0;
+    struct timeval now;
+    get_now(&now);
+
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard *s = &cache->shards[i];
+        pthread_mutex_lock(&s->lock);
+        CacheEntry *e = s->hand;
+        for (uint32_t n = s->count; n > 0; n--) {
+            CacheEntry *next = e->clock_next;
+            char domain[CACHE_KEY_MAX];
+            cache_key_domain(e->key, domain, sizeof(domain));
+            if (cache_entry_flushed(cache, e, domain)) {
+                shard_remove(cache, s, e);
+                s->flushed++;
+                flushed_count++;
+            } else if (e->expire_time.tv_sec <= now.tv_sec) {
+                shard_remove(cache, s, e);
+                s->expired++;
+                expired_count++;
+            }
+            e = next;
+        }
+        if (cache->qsbr) shard_reclaim(cache, s);
+        pthread_mutex_unlock(&s->lock);
+    }
+    // 全表扫描后，早于扫描开始的清除记录覆盖的条目都已回收，可以丢弃
+    cache_clear_tombstones(cache, start_generation);
+
+    if (expired_count > 0 || flushed_count > 0) {
+        LOG_DEBUG("清理过期缓存：删除%u个过期条目，%u个已清除条目\n", expired_count, flushed_count);
+    }
+}
+
+// 清除指定域名的缓存，qtype为0时清除A与AAAA两种类型，返回删除条数
+int cache_flush_name(DNSCache *cache, const char *domain, uint16_t qtype) {
+    if (!cache || !domain) return 0;
+    uint16_t types[2] = {qtype, 0};
+    if (qtype == 0) {
+        types[0] = DNS_TYPE_A;
+        types[1] = DNS_TYPE_AAAA;
+    }
+
+    int removed = 0;
+    for (int i = 0; i < 2 && types[i]; i++) {
+        char key[CACHE_KEY_MAX];
+        int key_len = cache_key_generate(key, domain, types[i]);
+        if (key_len < 0 || key_len >= CACHE_KEY_MAX) continue;
+        uint32_t hash = cache_key_hash(key, (size_t)key_len);
+        CacheShard *s = cache_shard(cache, hash);
+        pthread_mutex_lock(&s->lock);
+        CacheEntry *entry = shard_find(s, hash, key, (size_t)key_len);
+        if (entry) {
+            shard_remove(cache, s, entry);
+            s->flushed++;
+            removed++;
+        }
+        pthread_mutex_unlock(&s->lock);
+    }
+    LOG_DEBUG("按名称清除缓存：%s，删除%d个条目\n", domain, removed);
+    return removed;
+}
+
+/**
+ * 清除某个后缀下的全部域名（含后缀本身）
+ * 只记录一条带当前代数的清除记录，耗时与缓存大小无关；
+ * 受影响的条目在下次查找时视为未命中，在定期清理时才真正释放。
+ */
+int cache_flush_suffix(DNSCache *cache, const char *suffix) {
+    if (!cache || !suffix) return -1;
+    // 允许 "*.example.com"、".example.com" 与 "example.com." 等写法
+    if (suffix[0] == '*' && suffix[1] == '.') suffix += 2;
+    if (suffix[0] == '.') suffix++;
+    size_t len = strlen(suffix);
+    if (len > 0 && suffix[len - 1] == '.') len--;
+    if (len == 0 || len >= MAX_DOMAIN_LENGTH) return -1;
+
+    char name[MAX_DOMAIN_LENGTH];
+    memcpy(name, suffix, len);
+    name[len] = '\0';
+
+    pthread_rwlock_wrlock(&cache->tomb_lock);
+    CacheTombstone *tomb;
+    HASH_FIND_STR(cache->tombstones, name, tomb);
+    if (!tomb) {
+        tomb = malloc(sizeof(CacheTombstone) + len + 1);
+        if (!tomb) {
+            pthread_rwlock_unlock(&cache->tomb_lock);
+            return -1;
+        }
+        memcpy(tomb->suffix, name, len + 1);
+        HASH_ADD_STR(cache->tombstones, suffix, tomb);
+    }
+    tomb->generation = atomic_fetch_add(&cache->generation, 1) + 1;
+    atomic_store(&cache->tomb_count, HASH_COUNT(cache->tombstones));
+    pthread_rwlock_unlock(&cache->tomb_lock);
+    LOG_DEBUG("按后缀清除缓存：%s\n", name);
+    return 0;
+}
+
+// 清空整个缓存，返回删除条数
+uint32_t cache_flush_all(DNSCache *cache) {
+    if (!cache) return 0;
+    uint64_t start_generation = atomic_load(&cache->generation);
+    uint32_t removed = 0;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard *s = &cache->shards[i];
+        pthread_mutex_lock(&s->lock);
+        removed += s->count;
+        s->flushed += s->count;
+        while (s->hand) shard_remove(cache, s, s->hand);
+        if (cache->qsbr) shard_reclaim(cache, s);
+        pthread_mutex_unlock(&s->lock);
+    }
+    cache_clear_tombstones(cache, start_generation);
+    LOG_DEBUG("清空缓存：删除%u个条目\n", removed);
+    return removed;
+}
+
+// 查看条目但不更新访问位和统计，已过期或已清除时返回NULL
+const CacheEntry *cache_peek(DNSCache *cache, const char *domain, uint16_t qtype) {
+    if (!cache || !domain) return NULL;
+    char key[CACHE_KEY_MAX];
+    int key_len = cache_key_generate(key, domain, qtype);
+    if (key_len < 0 || key_len >= CACHE_KEY_MAX) return NULL;
+    uint32_t hash = cache_key_hash(key, (size_t)key_len);
+    const CacheEntry *entry = shard_find(cache_shard(cache, hash), hash, key, (size_t)key_len);
+    if (!entry || cache_get_remaining_ttl(entry) == 0) return NULL;
+    if (cache_entry_flushed(cache, entry, domain)) return NULL;
+    return entry;
+}
+
+// 条目副本在遍历缓冲区中按8字节对齐排列
+#define CACHE_COPY_ALIGN(n) (((n) + 7) & ~(size_t)7)
 
-    HASH_ITER(hh, cache->entries, entry, tmp) {
-        if (cache_get_remaining_ttl(entry) <= 0) {
-            HASH_DEL(cache->entries, entry);
-            free(entry);
-            cache->stats.current_size--;
-            cache->stats.expired++;
-            expired_count++;
+/**
+ * 逐分片按CLOCK顺序遍历有效条目。分片锁内只把未过期的条目复制到缓冲区，
+ * 解锁后再对副本调用visit，回调做多慢的I/O都不会挡住该分片的写者。
+ * @return 成功返回0，复制缓冲区分配失败返回-1（此前的分片已遍历）。
+ */
+int cache_foreach(DNSCache *cache, cache_visit_fn visit, void *arg) {
+    if (!cache || !visit) return -1;
+    char *copies = NULL;
+    size_t capacity = 0;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard *s = &cache->shards[i];
+        pthread_mutex_lock(&s->lock);
+        size_t need = s->entry_bytes + (size_t)s->count * 8;
+        if (need > capacity) {
+            char *grown = realloc(copies, need);
+            if (!grown) {
+                pthread_mutex_unlock(&s->lock);
+                free(copies);
+                LOG_WARN("遍历缓存失败：内存分配错误\n");
+                return -1;
+            }
+            copies = grown;
+            capacity = need;
+        }
+        size_t used = 0;
+        const CacheEntry *e = s->hand;
+        for (uint32_t n = 0; n < s->count; n++, e = e->clock_next) {
+            if (cache_get_remaining_ttl(e) == 0) continue;
+            memcpy(copies + used, e, e->bytes);
+            used += CACHE_COPY_ALIGN(e->bytes);
+        }
+        pthread_mutex_unlock(&s->lock);
+
+        for (size_t off = 0; off < used;) {
+            const CacheEntry *copy = (const CacheEntry *)(copies + off);
+            off += CACHE_COPY_ALIGN(copy->bytes);
+            uint32_t remaining = cache_get_remaining_ttl(copy);
+            if (remaining == 0) continue;
+            char domain[CACHE_KEY_MAX];
+            cache_key_domain(copy->key, domain, sizeof(domain));
+            if (cache_entry_flushed(cache, copy, domain)) continue;
+            visit(copy, remaining, arg);
         }
     }
+    free(copies);
+    return 0;
+}
 
-    if (expired_count > 0) {
-        print_debug_info("清理过期缓存：删除%u个条目\n", expired_count);
+// 汇总各分片的统计；读者计数无锁读取，与正在进行的操作相比可能略有滞后
+void cache_get_stats(DNSCache *cache, CacheStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    if (!cache) return;
+    stats->max_bytes = atomic_load(&cache->max_bytes);
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        CacheShard *s = &cache->shards[i];
+        stats->hits += atomic_load_explicit(&s->hits, memory_order_relaxed);
+        stats->misses += atomic_load_explicit(&s->misses, memory_order_relaxed);
+        pthread_mutex_lock(&s->lock);
+        stats->expired += s->expired;
+        stats->evicted += s->evicted;
+        stats->flushed += s->flushed;
+        stats->current_size += s->count;
+        stats->current_bytes += shard_bytes(s);
+        pthread_mutex_unlock(&s->lock);
     }
 }
 
 // 计算缓存命中率
-double cache_hit_rate(const DNSCache *cache) {
+double cache_hit_rate(DNSCache *cache) {
     if (!cache) return 0.0;
-    uint64_t total = cache->stats.hits + cache->stats.misses;
-    if (total == 0) return 0.0;
-    return (double)cache->stats.hits / (double)total;
+    uint64_t hits = 0, misses = 0;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        hits += atomic_load_explicit(&cache->shards[i].hits, memory_order_relaxed);
+        misses += atomic_load_explicit(&cache->shards[i].misses, memory_order_relaxed);
+    }
+    if (hits + misses == 0) return 0.0;
+    return (double)hits / (double)(hits + misses);
+}
+
+int cache_export_mrc(DNSCache *cache, uint64_t *entries, double *miss_ratios, int max_points) {
+    if (!cache || !cache->mrc) return -1;
+    pthread_mutex_lock(&cache->mrc_lock);
+    cache_mrc_drain(cache);
+    int n = mrc_export(cache->mrc, entries, miss_ratios, max_points);
+    pthread_mutex_unlock(&cache->mrc_lock);
+    return n;
 }
 
 // 打印缓存统计信息
-void cache_print_stats(const DNSCache *cache) {
+void cache_print_stats(DNSCache *cache) {
     if (!cache) return;
 
-    print_debug_info("=== DNS缓存统计 ===\n");
-    print_debug_info("当前大小: %u/%u\n", cache->stats.current_size, cache->stats.max_size);
-    print_debug_info("命中次数: %llu\n", cache->stats.hits);
-    print_debug_info("未命中次数: %llu\n", cache->stats.misses);
-    print_debug_info("命中率: %.2f%%\n", cache_hit_rate(cache) * 100.0);
-    print_debug_info("过期条目: %llu\n", cache->stats.expired);
-    print_debug_info("驱逐条目: %llu\n", cache->stats.evicted);
-    print_debug_info("==================\n");
-}
\ No newline at end of file
+    CacheStats st;
+    cache_get_stats(cache, &st);
+    LOG_DEBUG("=== DNS缓存统计 ===\n");
+    LOG_DEBUG("当前条目: %u\n", st.current_size);
+    LOG_DEBUG("占用字节: %llu/%llu\n", (unsigned long long)st.current_bytes, (unsigned long long)st.max_bytes);
+    LOG_DEBUG("命中次数: %llu\n", (unsigned long long)st.hits);
+    LOG_DEBUG("未命中次数: %llu\n", (unsigned long long)st.misses);
+    LOG_DEBUG("命中率: %.2f%%\n", cache_hit_rate(cache) * 100.0);
+    LOG_DEBUG("过期条目: %llu\n", (unsigned long long)st.expired);
+    LOG_DEBUG("驱逐条目: %llu\n", (unsigned long long)st.evicted);
+    LOG_DEBUG("清除条目: %llu\n", (unsigned long long)st.flushed);
+    LOG_DEBUG("==================\n");
+    if (cache->mrc) {
+        double avg_bytes = st.current_size ? (double)st.current_bytes / st.current_size : (double)sizeof(CacheEntry);
+        pthread_mutex_lock(&cache->mrc_lock);
+        cache_mrc_drain(cache);
+        mrc_print(cache->mrc, avg_bytes);
+        pthread_mutex_unlock(&cache->mrc_lock);
+    }
+}
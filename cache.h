@@ -8,56 +8,173 @@
 #include <sys/time.h>
 #endif
 
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <time.h>
 
+#include "mrc.h"
+#include "protocol.h"
+#include "qsbr.h"
 #include "uthash.h"
 #include "util.h"
 
+// 缓存键最大长度（域名 + '#' + 类型）
+#define CACHE_KEY_MAX 270
+// 分片数（2的幂），键哈希的高位选分片，低位选桶
+#define CACHE_SHARD_BITS 4
+#define CACHE_SHARDS (1 << CACHE_SHARD_BITS)
+// 每个分片的最少桶数，以及按预算预分配桶数时估计的单条目字节数
+#define CACHE_MIN_BUCKETS 16
+#define CACHE_EST_ENTRY_BYTES 192
 
-
-// 缓存条目结构
+/*
+ * 缓存条目：发布后除访问位外不再修改，更新时整条替换。
+ * 读者沿桶链无锁查找，条目被移出后经QSBR延迟释放，读者持有的指针在其下一次
+ * 静止状态之前始终有效；未设置QSBR时（单线程使用）移出即释放。
+ * 键按实际长度分配，条目占用的字节数随域名长度变化。
+ */
 typedef struct cache_entry {
-    char key[260];             // 域名 + 类型（键）
-    char ip[46];                  // IP地址 (IPv4最大15字符, IPv6最大45字符)
-    uint16_t qtype;               // 查询类型（A、AAAA等）
-    struct timeval expire_time;   // 过期时间
-    UT_hash_handle hh;            // uthash处理句柄
+    _Atomic(struct cache_entry *) next;  // 桶链表中的下一条
+    uint32_t hash;                       // 键的哈希
+    atomic_uchar referenced;             // CLOCK访问位，命中时置1
+    uint8_t rr_len;                      // 应答记录长度
+    uint16_t qtype;                      // 查询类型（A、AAAA等）
+    uint8_t rr[DNS_ANSWER_RR_MAX];       // 线格式应答记录，TTL字段在发送时按剩余时间填写
+    uint16_t key_len;                    // 键长度（不含结尾的0），查找时先比较长度
+    uint32_t bytes;                      // 本条目计入缓存预算的字节数
+    uint64_t generation;                 // 写入时的缓存代数，用于判断是否被后缀清除覆盖
+    struct timeval expire_time;          // 过期时间
+    struct cache_entry *clock_prev;      // CLOCK环，只在分片锁内访问
+    struct cache_entry *clock_next;      // 移出后复用为待回收链表
+    uint64_t retire_epoch;               // 移出时的QSBR纪元
+    char ip[46];                         // IP地址 (IPv4最大15字符, IPv6最大45字符)
+    char key[];                          // 域名 + 类型（键），柔性数组
 } CacheEntry;
 
-// 缓存统计信息
+typedef _Atomic(CacheEntry *) CacheSlot;
+
+// 分片的桶数组，扩容时整体替换，旧数组同样延迟释放
+typedef struct cache_buckets {
+    uint32_t mask;                        // 桶数-1
+    uint64_t retire_epoch;
+    struct cache_buckets *retired_next;
+    CacheSlot slots[];
+} CacheBuckets;
+
+// 缓存统计信息（各分片汇总）
 typedef struct cache_stats {
-    uint64_t hits;          // 缓存命中次数
-    uint64_t misses;        // 缓存未命中次数
-    uint64_t expired;       // 过期条目数
-    uint64_t evicted;       // 被驱逐条目数
-    uint32_t current_size;  // 当前缓存大小
-    uint32_t max_size;      // 最大缓存大小
+    uint64_t hits;           // 缓存命中次数
+    uint64_t misses;         // 缓存未命中次数
+    uint64_t expired;        // 过期条目数
+    uint64_t evicted;        // 被驱逐条目数
+    uint64_t flushed;        // 被管理命令清除的条目数
+    uint32_t current_size;   // 当前缓存条目数
+    uint64_t current_bytes;  // 当前占用字节数（条目 + 桶数组）
+    uint64_t max_bytes;      // 字节预算上限
 } CacheStats;
 
-// 缓存管理器
+/*
+ * 缓存分片：写者（插入、驱逐、清除）持分片锁，读者不加锁。
+ * 淘汰采用CLOCK：命中只置访问位而不移动条目，读路径不写共享链表。
+ */
+typedef struct cache_shard {
+    _Alignas(64) pthread_mutex_t lock;
+    _Atomic(CacheBuckets *) buckets;
+    CacheEntry *hand;                // CLOCK指针，NULL表示分片为空
+    uint32_t count;
+    uint64_t entry_bytes;
+    uint64_t max_bytes;              // 本分片的字节预算
+    CacheEntry *retired_head;        // 等待QSBR宽限期结束的条目，按纪元递增
+    CacheEntry *retired_tail;
+    CacheBuckets *retired_buckets;
+    uint64_t expired;
+    uint64_t evicted;
+    uint64_t flushed;
+    _Alignas(64) _Atomic uint64_t hits;  // 读者更新的计数放在单独的缓存行
+    _Atomic uint64_t misses;
+} CacheShard;
+
+// 后缀清除记录：代数早于generation且域名落在suffix之下的条目均视为已清除
+typedef struct cache_tombstone {
+    uint64_t generation;  // 清除发生时的缓存代数
+    UT_hash_handle hh;    // uthash处理句柄
+    char suffix[];        // 被清除的域名后缀（键）
+} CacheTombstone;
+
+// 遍历缓存条目的回调，entry为遍历时复制的副本，remaining_ttl为剩余生存时间
+typedef void (*cache_visit_fn)(const CacheEntry *entry, uint32_t remaining_ttl, void *arg);
+
+// 自动调整容量时的最小字节预算
+#define CACHE_MIN_BYTES (64ULL << 10)
+// MRC估计器默认采样率与样本上限
+#define CACHE_MRC_DEFAULT_RATE 0.01
+#define CACHE_MRC_MAX_SAMPLES 8192
+// 每个线程先把采样到的访问攒在自己的缓冲区中，攒满一批再合并进估计器
+#define CACHE_MRC_SLOTS 64
+#define CACHE_MRC_BATCH 32
+
+// 一个线程的采样缓冲区；平时只有所属线程加锁，导出曲线前的合并才会与之竞争
+typedef struct cache_mrc_slot {
+    _Alignas(64) pthread_mutex_t lock;
+    uint32_t count;
+    uint64_t hashes[CACHE_MRC_BATCH];
+} CacheMRCSlot;
+
+// 缓存管理器，可被多个服务线程同时使用
 typedef struct dns_cache {
-    CacheEntry *entries;   // 缓存条目哈希表
-    CacheStats stats;      // 统计信息
+    CacheShard shards[CACHE_SHARDS];
+    void *storage;                   // 按缓存行对齐前的原始内存
+    QSBR *qsbr;                      // 延迟回收所用的读者登记，NULL表示单线程使用
+    _Atomic uint64_t max_bytes;      // 总字节预算
+    _Atomic uint64_t generation;     // 缓存代数，每次写入或后缀清除递增
+    pthread_rwlock_t tomb_lock;      // 保护tombstones
+    atomic_uint tomb_count;          // 清除记录数，为0时读者不检查
+    CacheTombstone *tombstones;      // 尚未完全生效的后缀清除记录
+    pthread_mutex_t mrc_lock;        // 保护mrc与mrc_lookups
+    MRCEstimator *mrc;               // 缺失率曲线估计器，未启用时为NULL
+    uint64_t mrc_lookups;            // 已计入估计器的查找次数（各分片命中与未命中之和）
+    CacheMRCSlot mrc_slots[CACHE_MRC_SLOTS];  // 各线程的采样缓冲区
+    double target_hit_ratio;         // 自动调整容量的目标命中率，0表示不自动调整
+    uint64_t ceiling_bytes;          // 自动调整容量的内存上限
 } DNSCache;
 
 // 缓存初始化和清理
-DNSCache *cache_create(uint32_t max_entries);
+DNSCache *cache_create(uint64_t max_bytes);
 void cache_destroy(DNSCache *cache);
+// 多线程使用时设置读者登记：移出的条目等所有读者经过静止状态后才释放
+void cache_set_qsbr(DNSCache *cache, QSBR *qsbr);
+
+// 运行时调整字节预算，超出部分由各分片的CLOCK指针立即驱逐（已过期的条目优先）
+void cache_set_capacity(DNSCache *cache, uint64_t max_bytes);
 
-// 缓存操作
+// 缺失率曲线估计与容量自动调整
+int cache_enable_mrc(DNSCache *cache, double sample_rate);
+void cache_set_autosize(DNSCache *cache, double target_hit_ratio, uint64_t ceiling_bytes);
+void cache_autosize(DNSCache *cache);
+
+// 缓存操作：cache_get不加锁，返回的条目在调用线程下一次静止状态之前有效，不可修改
 int cache_put(DNSCache *cache, const char *domain, uint16_t qtype, const char *ip, uint32_t ttl);
-CacheEntry *cache_get(DNSCache *cache, const char *domain, uint16_t qtype);
+const CacheEntry *cache_get(DNSCache *cache, const char *domain, uint16_t qtype);
 
 // 缓存维护
 void cache_cleanup_expired(DNSCache *cache);
 uint32_t cache_get_remaining_ttl(const CacheEntry *entry);
 
-// 缓存统计
-void cache_print_stats(const DNSCache *cache);
-double cache_hit_rate(const DNSCache *cache);
+// 运行时管理：按名称、按后缀或全部清除，以及只读遍历
+int cache_flush_name(DNSCache *cache, const char *domain, uint16_t qtype);
+int cache_flush_suffix(DNSCache *cache, const char *suffix);
+uint32_t cache_flush_all(DNSCache *cache);
+const CacheEntry *cache_peek(DNSCache *cache, const char *domain, uint16_t qtype);
+// 遍历时visit收到的是条目副本，不持有任何锁，返回0成功，内存不足返回-1
+int cache_foreach(DNSCache *cache, cache_visit_fn visit, void *arg);
 
-// 工具函数
-static inline void cache_key_generate(char *key, const char *domain, uint16_t qtype);
+// 缓存统计
+void cache_get_stats(DNSCache *cache, CacheStats *stats);
+void cache_print_stats(DNSCache *cache);
+double cache_hit_rate(DNSCache *cache);
+// 导出缺失率曲线，未启用估计器时返回-1
+int cache_export_mrc(DNSCache *cache, uint64_t *entries, double *miss_ratios, int max_points);
 
 #endif /* DNS_CACHE_H */
@@ -0,0 +1,86 @@
+#include "filter.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t table_filter_block_count(uint32_t keys) {
+    uint64_t bits = (uint64_t)keys * FILTER_BITS_PER_KEY;
+    uint64_t blocks = (bits + FILTER_BLOCK_WORDS * 64 - 1) / (FILTER_BLOCK_WORDS * 64);
+    return blocks ? (uint32_t)blocks : 1;
+}
+
+int table_filter_init(TableFilter *f, uint32_t nodes, uint32_t rules) {
+    memset(f, 0, sizeof(*f));
+    f->block_count = table_filter_block_count(nodes + rules);
+    size_t bytes = (size_t)f->block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t);
+    // 多分配一条缓存行，手工对齐，保证每块只跨一条缓存行
+    f->storage = calloc(1, bytes + 64);
+    if (!f->storage) return -1;
+    f->blocks = (uint64_t *)(((uintptr_t)f->storage + 63) & ~(uintptr_t)63);
+    return 0;
+}
+
+void table_filter_attach(TableFilter *f, const uint64_t *blocks, uint32_t block_count, uint32_t key_count) {
+    f->blocks = (uint64_t *)blocks;  // 只读映射，之后不会再写入
+    f->block_count = block_count;
+    f->key_count = key_count;
+    f->storage = NULL;
+}
+
+void table_filter_free(TableFilter *f) {
+    free(f->storage);
+    memset(f, 0, sizeof(*f));
+}
+
+static void filter_block_set(uint64_t *block, uint64_t bits) {
+    for (int i = 0; i < FILTER_HASHES; i++) {
+        uint32_t pos = (uint32_t)(bits >> (i * 9)) & 511;
+        block[pos >> 6] |= 1ULL << (pos & 63);
+    }
+}
+
+void table_filter_add(TableFilter *f, uint64_t h, int has_rule) {
+    uint64_t *block = (uint64_t *)table_filter_block(f, h);
+    filter_block_set(block, filter_node_bits(h));
+    if (has_rule) filter_block_set(block, filter_rule_bits(h));
+    f->key_count++;
+}
+
+static int popcount64(uint64_t x) {
+    int n = 0;
+    for (; x; x &= x - 1) n++;
+    return n;
+}
+
+double table_filter_fpr(const TableFilter *f) {
+    if (!f->blocks || f->block_count == 0) return 0.0;
+    // 单个名称误判的概率等于其所落块中全部k位恰好已置位的概率，对各块取平均
+    double sum = 0.0;
+    for (uint32_t b = 0; b < f->block_count; b++) {
+        int set = 0;
+        for (int w = 0; w < FILTER_BLOCK_WORDS; w++) set += popcount64(f->blocks[(size_t)b * FILTER_BLOCK_WORDS + w]);
+        double fill = set / (double)(FILTER_BLOCK_WORDS * 64), p = 1.0;
+        for (int i = 0; i < FILTER_HASHES; i++) p *= fill;
+        sum += p;
+    }
+    return sum / f->block_count;
+}
+
+int table_filter_may_match(const TableFilter *f, const char *domain) {
+    size_t len = strlen(domain);
+    if (len > 0 && domain[len - 1] == '.') len--;
+    uint64_t h = FILTER_ROOT_HASH;
+    size_t end = len;
+    while (end > 0) {
+        size_t start = end;
+        while (start > 0 && domain[start - 1] != '.') start--;
+        if (end - start > 63) return 1;  // 非法标签交给完整查找处理
+        h = filter_chain_hash(h, name_label_hash(domain + start, (uint32_t)(end - start)));
+        int flags = table_filter_probe(f, h);
+        if (flags & FILTER_RULE) return 1;
+        if (!(flags & FILTER_NODE)) return 0;  // 更长的后缀不可能在表中
+        if (start == 0) break;
+        end = start - 1;
+    }
+    return 0;
+}
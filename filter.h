@@ -0,0 +1,90 @@
+#ifndef DNS_FILTER_H
+#define DNS_FILTER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FILTER_BLOCK_WORDS 8             // 每块512位，恰好一条缓存行
+#define FILTER_HASHES 7                  // 每个键在块内置位数
+#define FILTER_BITS_PER_KEY 12           // 每个键平均占用的位数
+#define FILTER_ROOT_HASH 0x243F6A8885A308D3ULL  // 根名称的链式哈希
+
+#define FILTER_NODE 1   // 该后缀是表中某个名称的后缀（字典树中存在该节点）
+#define FILTER_RULE 2   // 该后缀自身带有规则
+
+/*
+ * 本地表查找前的分块布隆过滤器（blocked Bloom filter）。
+ * 表中每个名称的每一级后缀按“从右到左逐标签链式哈希”得到64位值h，
+ * 由h的高位选块，同一块内放两组位：一组表示“存在该后缀”，
+ * 另一组（仅带规则的名称）表示“该名称有规则”。
+ * 查询时沿哈希链由短到长逐级判定，每级只读一条缓存行：
+ * 遇到规则位即交给完整查找；某一级后缀不存在则更长的后缀也不可能存在，
+ * 直接断定未命中，与字典树逐级下降时的提前退出一致，且不做任何字符串比较。
+ */
+typedef struct table_filter {
+    uint64_t *blocks;      // block_count * FILTER_BLOCK_WORDS 个字，按64字节对齐
+    uint32_t block_count;
+    uint32_t key_count;    // 加入的后缀数
+    void *storage;         // 自行分配时的原始内存，指向镜像内数据时为NULL
+} TableFilter;
+
+// 标签哈希（FNV-1a，忽略大小写），本地表与过滤器共用
+static inline uint32_t name_label_hash(const char *label, uint32_t len) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        uint8_t c = (uint8_t)label[i];
+        h ^= (c >= 'A' && c <= 'Z') ? (uint8_t)(c + ('a' - 'A')) : c;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 由父域名的链式哈希与标签哈希得到子域名的链式哈希
+static inline uint64_t filter_chain_hash(uint64_t parent, uint32_t label_hash) {
+    uint64_t h = parent ^ ((uint64_t)label_hash * 0x9E3779B97F4A7C15ULL);
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static inline const uint64_t *table_filter_block(const TableFilter *f, uint64_t h) {
+    return f->blocks + (size_t)(((h >> 32) * f->block_count) >> 32) * FILTER_BLOCK_WORDS;
+}
+
+// 块内置位模式：节点位与规则位由h派生出两个独立的位序列
+static inline uint64_t filter_node_bits(uint64_t h) { return h * 0xff51afd7ed558ccdULL; }
+static inline uint64_t filter_rule_bits(uint64_t h) { return (h ^ 0x5851F42D4C957F2DULL) * 0xc4ceb9fe1a85ec53ULL; }
+
+static inline int filter_block_test(const uint64_t *block, uint64_t bits) {
+    for (int i = 0; i < FILTER_HASHES; i++) {
+        uint32_t pos = (uint32_t)(bits >> (i * 9)) & 511;
+        if (!(block[pos >> 6] & (1ULL << (pos & 63)))) return 0;
+    }
+    return 1;
+}
+
+// 判定一个后缀，返回FILTER_NODE/FILTER_RULE的组合（可能误判为存在，不会漏判）
+static inline int table_filter_probe(const TableFilter *f, uint64_t h) {
+    const uint64_t *block = table_filter_block(f, h);
+    if (!filter_block_test(block, filter_node_bits(h))) return 0;
+    return FILTER_NODE | (filter_block_test(block, filter_rule_bits(h)) ? FILTER_RULE : 0);
+}
+
+// 容纳keys组置位模式所需的块数
+uint32_t table_filter_block_count(uint32_t keys);
+// 为nodes个后缀（其中rules个带规则）分配空过滤器，成功返回0
+int table_filter_init(TableFilter *f, uint32_t nodes, uint32_t rules);
+// 使用已在内存中的块数组（如镜像中的过滤器段），不复制
+void table_filter_attach(TableFilter *f, const uint64_t *blocks, uint32_t block_count, uint32_t key_count);
+void table_filter_free(TableFilter *f);
+// 加入一个后缀，has_rule表示该名称自身带有规则
+void table_filter_add(TableFilter *f, uint64_t h, int has_rule);
+// 按各块实际置位比例估计单个规则位判定的误判率
+double table_filter_fpr(const TableFilter *f);
+// 点分域名的某一级后缀可能带有规则时返回1，一定没有时返回0
+int table_filter_may_match(const TableFilter *f, const char *domain);
+
+#endif /* DNS_FILTER_H */
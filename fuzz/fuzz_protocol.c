@@ -0,0 +1,110 @@
+/*
+ * parse_dns_name 与应答构造函数的 libFuzzer 入口。
+ * 输入的第一个字节选择名称起始偏移，其余部分作为报文；
+ * 解析成功时检查输出的不变量，并用解析结果构造应答后再解析回来，
+ * 确认编码器写出的名称（含压缩指针）能被自己的解析器原样读回。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "protocol.h"
+
+#define FUZZ_CHECK(cond)                                                   \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            abort();                                                       \
+        }                                                                  \
+    } while (0)
+
+// 解析出的名称：长度不超过253，只含小写可见字符，不以点开头或结尾，无空标签
+static void check_domain(const char *domain) {
+    size_t len = strlen(domain);
+    FUZZ_CHECK(len <= 253);
+    if (len == 0) return;
+    FUZZ_CHECK(domain[0] != '.' && domain[len - 1] != '.');
+    for (size_t i = 0; i < len; i++) {
+        unsigned char c = (unsigned char)domain[i];
+        FUZZ_CHECK(c > 0x20 && c < 0x7F && !(c >= 'A' && c <= 'Z'));
+        if (c == '.') FUZZ_CHECK(domain[i + 1] != '.');
+    }
+}
+
+// 构造的应答：问题区与SOA属主都应解析为同一名称
+static void check_negative(const uint8_t *request, int question_len, const char *domain) {
+    uint8_t response[MAX_DNS_PACKET_SIZE];
+    char parsed[MAX_DOMAIN_LENGTH];
+    int len = build_negative_response(response, request, question_len, domain, DNS_RCODE_NAME_ERROR);
+    FUZZ_CHECK(len >= DNS_HEADER_SIZE + question_len && len <= MAX_DNS_PACKET_SIZE);
+
+    const DNSHeader *header = (const DNSHeader *)response;
+    FUZZ_CHECK(ntohs(header->qdcount) == 1 && ntohs(header->ancount) == 0);
+    FUZZ_CHECK(parse_dns_name(response, len, DNS_HEADER_SIZE, parsed, sizeof(parsed)) >= 0);
+    FUZZ_CHECK(strcmp(parsed, domain) == 0);
+    if (ntohs(header->nscount) == 1) {
+        int n = parse_dns_name(response, len, DNS_HEADER_SIZE + question_len, parsed, sizeof(parsed));
+        FUZZ_CHECK(n >= 0 && strcmp(parsed, domain) == 0);
+    }
+}
+
+// 通用构造器：同一名称写多次后逐条解析，压缩指针必须指回正确的名称
+static void check_builder(const char *domain, uint8_t repeat) {
+    uint8_t buf[MAX_DNS_PACKET_SIZE];
+    uint8_t addr[4] = {192, 0, 2, 1};
+    char parsed[MAX_DOMAIN_LENGTH];
+    DNSBuilder b;
+    dns_builder_init(&b, buf, MAX_DNS_PACKET_SIZE);
+    if (dns_builder_question(&b, domain[0] ? domain : ".", DNS_TYPE_A, DNS_CLASS_IN) < 0) return;
+    int added = 0;
+    for (int i = 0; i < (repeat & 31); i++) {
+        if (dns_builder_add_rr(&b, DNS_SECTION_ANSWER, domain[0] ? domain : ".", DNS_TYPE_A, DNS_CLASS_IN, 60, addr,
+                               sizeof(addr)) < 0) {
+            break;
+        }
+        added++;
+    }
+    int len = dns_builder_finish(&b, 0, 0x8180);
+    FUZZ_CHECK(len <= MAX_DNS_PACKET_SIZE);
+    FUZZ_CHECK(ntohs(((const DNSHeader *)buf)->ancount) == added);
+    FUZZ_CHECK(b.tc == (added < (repeat & 31)));
+
+    int off = DNS_HEADER_SIZE;
+    int n = parse_dns_name(buf, len, off, parsed, sizeof(parsed));
+    FUZZ_CHECK(n >= 0 && strcmp(parsed, domain) == 0);
+    off += n + (int)sizeof(DNSQuestion);
+    for (int i = 0; i < added; i++) {
+        n = parse_dns_name(buf, len, off, parsed, sizeof(parsed));
+        FUZZ_CHECK(n >= 0 && strcmp(parsed, domain) == 0);
+        off += n + (int)sizeof(DNS_RR) + (int)sizeof(addr);
+    }
+    FUZZ_CHECK(off == len);
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    if (size < 2 || size > 4096) return 0;
+    int offset = data[0] % (int)(size - 1);
+    const uint8_t *packet = data + 1;
+    int packet_len = (int)size - 1;
+
+    char domain[MAX_DOMAIN_LENGTH];
+    int name_len = parse_dns_name(packet, packet_len, offset, domain, sizeof(domain));
+    FUZZ_CHECK(name_len < 0 || (offset + name_len <= packet_len && name_len >= 1));
+    if (name_len < 0) return 0;
+    check_domain(domain);
+
+    // 名称从头部之后开始且不含压缩指针时，报文可以当作请求使用
+    int question_len = name_len + (int)sizeof(DNSQuestion);
+    if (offset == DNS_HEADER_SIZE && DNS_HEADER_SIZE + question_len <= packet_len &&
+        (packet[DNS_HEADER_SIZE + name_len - 1] == 0)) {
+        check_negative(packet, question_len, domain);
+        uint8_t response[MAX_DNS_PACKET_SIZE];
+        int len = build_dns_error_response(response, packet, question_len, DNS_RCODE_SERVER_FAILURE);
+        FUZZ_CHECK(len == DNS_HEADER_SIZE + question_len);
+    }
+    check_builder(domain, packet[packet_len - 1]);
+
+    uint8_t rr[DNS_ANSWER_RR_MAX];
+    int family = (packet[0] & 1) ? 6 : 4;
+    if (packet_len >= 16) FUZZ_CHECK(build_answer_rr(rr, family, packet, 300) == (family == 4 ? 16 : 28));
+    return 0;
+}
@@ -0,0 +1,38 @@
+/*
+ * 没有libFuzzer时（如GCC或MSVC构建）的驱动：依次读入命令行给出的文件
+ * 并调用LLVMFuzzerTestOneInput，用于回放语料或复现崩溃用例。
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        printf("Usage: %s <input>...\n", argv[0]);
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        FILE *fp = fopen(argv[i], "rb");
+        if (!fp) {
+            printf("无法打开文件: %s\n", argv[i]);
+            return 1;
+        }
+        fseek(fp, 0, SEEK_END);
+        long size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        uint8_t *data = malloc(size > 0 ? (size_t)size : 1);
+        if (!data || fread(data, 1, (size_t)size, fp) != (size_t)size) {
+            printf("读取文件失败: %s\n", argv[i]);
+            fclose(fp);
+            free(data);
+            return 1;
+        }
+        fclose(fp);
+        LLVMFuzzerTestOneInput(data, (size_t)size);
+        free(data);
+    }
+    printf("已执行 %d 个输入\n", argc - 1);
+    return 0;
+}
@@ -0,0 +1,86 @@
+#include "hist.h"
+
+#include <string.h>
+
+// 桶内取值的上界
+static uint64_t hist_bucket_high(uint32_t index) {
+    if (index < 2 * HIST_SUB_COUNT) return index;
+    uint32_t shift = index / HIST_SUB_COUNT - 1;
+    uint64_t sub = index % HIST_SUB_COUNT + HIST_SUB_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
+
+void hist_reset(LatencyHist *h) { memset(h, 0, sizeof(*h)); }
+
+void hist_merge(LatencyHist *dst, const LatencyHist *src) {
+    if (hist_load(&src->count) == 0) return;  // 未使用的直方图（如未启动的服务线程）不必逐桶累加
+    for (uint32_t i = 0; i < HIST_BUCKETS; i++) hist_add(&dst->counts[i], hist_load(&src->counts[i]));
+    hist_add(&dst->count, hist_load(&src->count));
+    hist_add(&dst->sum, hist_load(&src->sum));
+    uint64_t max = hist_load(&src->max);
+    if (max > hist_load(&dst->max)) atomic_store_explicit(&dst->max, max, memory_order_relaxed);
+}
+
+uint64_t hist_percentile(const LatencyHist *h, double p) {
+    uint64_t count = hist_load(&h->count), max = hist_load(&h->max);
+    if (count == 0) return 0;
+    uint64_t rank = (uint64_t)(p * count + 0.5);
+    if (rank == 0) rank = 1;
+    if (rank > count) rank = count;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += hist_load(&h->counts[i]);
+        if (seen >= rank) {
+            uint64_t v = hist_bucket_high(i);
+            return v < max ? v : max;
+        }
+    }
+    return max;
+}
+
+double hist_mean(const LatencyHist *h) {
+    uint64_t count = hist_load(&h->count);
+    return count ? (double)hist_load(&h->sum) / count : 0.0;
+}
+
+void hist_cumulative(const LatencyHist *h, const uint64_t *bounds, int n, uint64_t *out) {
+    uint64_t seen = 0;
+    int b = 0;
+    for (uint32_t i = 0; i < HIST_BUCKETS && b < n; i++) {
+        uint64_t high = hist_bucket_high(i);
+        while (b < n && high > bounds[b]) out[b++] = seen;
+        seen += hist_load(&h->counts[i]);
+    }
+    while (b < n) out[b++] = seen;
+}
+
+void hist_print_distribution(const LatencyHist *h, FILE *out, int ticks) {
+    fprintf(out, "%12s %14s %10s %14s\n", "Value(us)", "Percentile", "TotalCount", "1/(1-Percentile)");
+    uint64_t count = hist_load(&h->count), max = hist_load(&h->max);
+    if (count == 0) return;
+    // 百分位按“剩余比例每减半细分ticks格”递增：0, 0.1, ... 0.5, 0.55, ... 0.75, ...
+    double p = 0.0, step = 1.0 / (2.0 * ticks), half = 0.5;
+    uint64_t last_count = 0;
+    while (last_count < count) {
+        uint64_t v = hist_percentile(h, p);
+        uint64_t below = 0;
+        for (uint32_t i = 0; i < HIST_BUCKETS && hist_bucket_high(i) <= v; i++) below += hist_load(&h->counts[i]);
+        if (below > count || v >= max) below = count;
+        double shown = (double)below / count;
+        if (shown < 1.0) {
+            fprintf(out, "%12.3f %14.12f %10llu %14.2f\n", v / 1000.0, shown, (unsigned long long)below,
+                    1.0 / (1.0 - shown));
+        } else {
+            fprintf(out, "%12.3f %14.12f %10llu %14s\n", v / 1000.0, 1.0, (unsigned long long)below, "");
+        }
+        last_count = below;
+        p += step;
+        if (p >= half) {
+            half += (1.0 - half) / 2.0;
+            step /= 2.0;
+        }
+        if (p >= 1.0 - 1e-12) p = 1.0;
+    }
+    fprintf(out, "#[Mean = %.3f, Max = %.3f, Total count = %llu]\n", hist_mean(h) / 1000.0, max / 1000.0,
+            (unsigned long long)count);
+}
@@ -0,0 +1,71 @@
+#ifndef DNS_HIST_H
+#define DNS_HIST_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define HIST_SUB_BITS 6                               // 每个数量级细分为64格，相对误差不超过1/64
+#define HIST_SUB_COUNT (1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS 40                              // 可区分的最大值为2^40纳秒（约18分钟），更大的值计入最后一格
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+/*
+ * HDR风格的对数-线性直方图，记录纳秒级延迟。
+ * 小于128的值逐一计数；更大的值按最高位所在数量级分组，每组再按其后6位线性细分，
+ * 因此任意取值的桶宽不超过该值的1/64，记录只需一次前导零计数和一次数组自增。
+ * 每个直方图只由一个线程写入（如各服务线程各有一份），其他线程可随时读取汇总：
+ * 计数以relaxed原子读写做“读-加-写”，不是原子RMW，代价与普通自增相同。
+ */
+typedef struct latency_hist {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum;
+    _Atomic uint64_t max;
+    _Atomic uint64_t counts[HIST_BUCKETS];
+} LatencyHist;
+
+static inline int hist_msb(uint64_t v) {
+#if defined(__GNUC__) || defined(__clang__)
+    return 63 - __builtin_clzll(v);
+#else
+    int n = 0;
+    while (v >>= 1) n++;
+    return n;
+#endif
+}
+
+// 取值所在的桶下标
+static inline uint32_t hist_index(uint64_t v) {
+    if (v < 2 * HIST_SUB_COUNT) return (uint32_t)v;
+    int shift = hist_msb(v) - HIST_SUB_BITS;
+    if (shift >= HIST_MAX_BITS - HIST_SUB_BITS) return HIST_BUCKETS - 1;
+    return (uint32_t)(shift * HIST_SUB_COUNT + (v >> shift));
+}
+
+static inline uint64_t hist_load(const _Atomic uint64_t *c) { return atomic_load_explicit(c, memory_order_relaxed); }
+
+// 单写者自增
+static inline void hist_add(_Atomic uint64_t *c, uint64_t v) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v, memory_order_relaxed);
+}
+
+static inline void hist_record(LatencyHist *h, uint64_t ns) {
+    hist_add(&h->counts[hist_index(ns)], 1);
+    hist_add(&h->count, 1);
+    hist_add(&h->sum, ns);
+    if (ns > hist_load(&h->max)) atomic_store_explicit(&h->max, ns, memory_order_relaxed);
+}
+
+void hist_reset(LatencyHist *h);
+// 把src累加到dst，dst须由调用者独占（如用于汇总的局部副本）
+void hist_merge(LatencyHist *dst, const LatencyHist *src);
+// 第p分位（p取0~1）的估计值，取所在桶的上界，不超过记录到的最大值
+uint64_t hist_percentile(const LatencyHist *h, double p);
+double hist_mean(const LatencyHist *h);
+// 一次遍历求取值不超过各上界的累计计数（bounds升序，纳秒），用于输出累计桶形式的直方图；
+// 跨越上界的桶计入下一个上界
+void hist_cumulative(const LatencyHist *h, const uint64_t *bounds, int n, uint64_t *out);
+// 按HdrHistogram的百分位分布格式输出（值以微秒为单位），每个数量级的百分位输出ticks行
+void hist_print_distribution(const LatencyHist *h, FILE *out, int ticks);
+
+#endif /* DNS_HIST_H */
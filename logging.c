@@ -0,0 +1,327 @@
+#include "logging.h"
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+_Atomic int g_log_level = LOG_LEVEL_WARN;
+
+typedef struct log_slot {
+    uint64_t time_us;  // Unix时间（微秒）
+    int level;
+    char text[LOG_LINE_MAX];
+} LogSlot;
+
+// 一个调用点在当前一秒内的输出计数，用于限速
+typedef struct rate_entry {
+    const char *format;  // 调用点的格式串（字面量地址唯一标识调用点）
+    uint64_t second;
+    uint32_t count;
+    uint32_t suppressed;
+} RateEntry;
+
+/*
+ * 单个线程的日志缓冲区：所属线程只推进head，写线程只推进tail。
+ * 线程退出后缓冲区标记为空闲，由之后新建的线程复用（如每次重新加载时的解析线程）。
+ */
+typedef struct log_ring {
+    _Alignas(64) _Atomic uint32_t head;
+    _Alignas(64) _Atomic uint32_t tail;
+    _Alignas(64) atomic_int in_use;
+    _Atomic uint64_t dropped;     // 缓冲区满丢弃的消息数（所属线程单写）
+    _Atomic uint64_t suppressed;  // 限速省略的消息数（所属线程单写）
+    RateEntry rate[LOG_RATE_SLOTS];
+    LogSlot slots[LOG_RING_SLOTS];
+} LogRing;
+
+// 写线程按秒缓存格式化后的日期，避免每行调用localtime
+typedef struct log_stamp {
+    time_t second;
+    char text[24];
+} LogStamp;
+
+static LogRing *g_rings[LOG_MAX_THREADS];
+static atomic_int g_ring_count;
+static pthread_mutex_t g_ring_lock = PTHREAD_MUTEX_INITIALIZER;  // 只在线程第一次写日志时获取
+static pthread_key_t g_ring_key;
+static pthread_once_t g_key_once = PTHREAD_ONCE_INIT;
+static _Thread_local LogRing *t_ring;
+static _Thread_local int t_ring_failed;  // 没有可用的缓冲区，本线程一直同步输出
+static _Atomic unsigned g_rate_limit = LOG_RATE_DEFAULT;
+static atomic_int g_writer_running;
+static atomic_int g_writer_stop;
+static pthread_t g_writer;
+
+static void log_sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts = {0, ms * 1000000L};
+    nanosleep(&ts, NULL);
+#endif
+}
+
+static uint64_t log_now_us(void) {
+    struct timeval tv;
+    get_now(&tv);
+    return (uint64_t)tv.tv_sec * 1000000ULL + (uint64_t)tv.tv_usec;
+}
+
+const char *log_level_name(int level) {
+    static const char *const names[] = {"OFF", "ERROR", "WARN", "INFO", "DEBUG"};
+    return level >= LOG_LEVEL_OFF && level <= LOG_LEVEL_DEBUG ? names[level] : "?";
+}
+
+int log_parse_level(const char *name) {
+    for (int level = LOG_LEVEL_OFF; level <= LOG_LEVEL_DEBUG; level++) {
+        const char *candidate = log_level_name(level);
+        size_t i = 0;
+        while (name[i] && candidate[i] && (name[i] | 0x20) == (candidate[i] | 0x20)) i++;
+        if (!name[i] && !candidate[i]) return level;
+    }
+    if (name[0] >= '0' && name[0] <= '4' && name[1] == '\0') return name[0] - '0';
+    return -1;
+}
+
+void log_set_level(int level) {
+    if (level < LOG_LEVEL_OFF) level = LOG_LEVEL_OFF;
+    if (level > LOG_MAX_LEVEL) {
+        printf("当前构建只包含%s及以下级别的日志\n", log_level_name(LOG_MAX_LEVEL));
+        level = LOG_MAX_LEVEL;
+    }
+    atomic_store_explicit(&g_log_level, level, memory_order_relaxed);
+}
+
+void log_set_rate_limit(unsigned per_second) { atomic_store(&g_rate_limit, per_second); }
+
+static void emit_line(LogStamp *stamp, int level, uint64_t time_us, const char *text) {
+    time_t second = (time_t)(time_us / 1000000);
+    if (stamp->second != second) {
+        struct tm tm;
+#ifdef _WIN32
+        localtime_s(&tm, &second);
+#else
+        localtime_r(&second, &tm);
+#endif
+        strftime(stamp->text, sizeof(stamp->text), "%Y-%m-%d %H:%M:%S", &tm);
+        stamp->second = second;
+    }
+    fprintf(stdout, "%s.%06u %-5s %s\n", stamp->text, (unsigned)(time_us % 1000000), log_level_name(level), text);
+}
+
+// 格式化消息，去掉末尾换行（调用点沿用了printf风格的"\n"结尾）
+static void format_text(char *text, const char *format, va_list args) {
+    int n = vsnprintf(text, LOG_LINE_MAX, format, args);
+    if (n < 0) n = 0;
+    if (n >= LOG_LINE_MAX) n = LOG_LINE_MAX - 1;
+    while (n > 0 && (text[n - 1] == '\n' || text[n - 1] == '\r')) n--;
+    text[n] = '\0';
+}
+
+static void release_ring(void *arg) { atomic_store(&((LogRing *)arg)->in_use, 0); }
+
+static void make_ring_key(void) { pthread_key_create(&g_ring_key, release_ring); }
+
+// 为当前线程取得一个缓冲区：优先复用已退出线程留下的，否则新建
+static LogRing *acquire_ring(void) {
+    pthread_once(&g_key_once, make_ring_key);
+    pthread_mutex_lock(&g_ring_lock);
+    LogRing *ring = NULL;
+    int count = atomic_load(&g_ring_count);
+    for (int i = 0; i < count && !ring; i++) {
+        if (!atomic_load(&g_rings[i]->in_use)) ring = g_rings[i];
+    }
+    if (!ring && count < LOG_MAX_THREADS) {
+        ring = calloc(1, sizeof(LogRing));
+        if (ring) {
+            g_rings[count] = ring;
+            atomic_store(&g_ring_count, count + 1);
+        }
+    }
+    if (ring) {
+        memset(ring->rate, 0, sizeof(ring->rate));
+        atomic_store(&ring->in_use, 1);
+        pthread_setspecific(g_ring_key, ring);
+    }
+    pthread_mutex_unlock(&g_ring_lock);
+    return ring;
+}
+
+static LogSlot *ring_reserve(LogRing *ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head - tail >= LOG_RING_SLOTS) {
+        atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return NULL;
+    }
+    return &ring->slots[head % LOG_RING_SLOTS];
+}
+
+static void ring_commit(LogRing *ring) {
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * 限速判断：同一调用点每秒最多输出g_rate_limit条。
+ * @param reported 新的一秒开始时返回上一秒被省略的条数，供调用者补一条说明。
+ * @return 允许输出返回1，省略返回0。
+ */
+static int rate_allow(LogRing *ring, const char *format, uint64_t time_us, uint32_t *reported) {
+    unsigned limit = atomic_load_explicit(&g_rate_limit, memory_order_relaxed);
+    *reported = 0;
+    if (!limit) return 1;
+    uintptr_t key = (uintptr_t)format;
+    RateEntry *e = &ring->rate[(key ^ (key >> 7) ^ (key >> 13)) % LOG_RATE_SLOTS];
+    uint64_t second = time_us / 1000000;
+    if (e->format != format || e->second != second) {
+        if (e->format == format) *reported = e->suppressed;
+        e->format = format;
+        e->second = second;
+        e->count = 0;
+        e->suppressed = 0;
+    }
+    if (e->count < limit) {
+        e->count++;
+        return 1;
+    }
+    e->suppressed++;
+    atomic_store_explicit(&ring->suppressed, atomic_load_explicit(&ring->suppressed, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    return 0;
+}
+
+// 同步输出一条消息，用于写线程未启动（如工具程序）或线程没有可用缓冲区时
+static void write_sync(int level, uint64_t time_us, const char *format, va_list args) {
+    char text[LOG_LINE_MAX];
+    LogStamp stamp = {(time_t)-1, ""};
+    format_text(text, format, args);
+    emit_line(&stamp, level, time_us, text);
+    fflush(stdout);
+}
+
+void log_write(int level, const char *format, ...) {
+    uint64_t time_us = log_now_us();
+    va_list args;
+    va_start(args, format);
+    LogRing *ring = t_ring;
+    if (!ring && !t_ring_failed && atomic_load_explicit(&g_writer_running, memory_order_acquire)) {
+        ring = t_ring = acquire_ring();
+        t_ring_failed = ring == NULL;
+    }
+    if (!ring || !atomic_load_explicit(&g_writer_running, memory_order_acquire)) {
+        write_sync(level, time_us, format, args);
+        va_end(args);
+        return;
+    }
+
+    uint32_t reported;
+    if (!rate_allow(ring, format, time_us, &reported)) {
+        va_end(args);
+        return;
+    }
+    LogSlot *slot;
+    if (reported && (slot = ring_reserve(ring)) != NULL) {
+        // 该调用点上一秒超出限速，先补一条说明，格式串截断后作为来源提示
+        int n = snprintf(slot->text, sizeof(slot->text), "（上一秒省略了%u条同一来源的消息：%.60s", reported, format);
+        if (n >= (int)sizeof(slot->text)) n = (int)sizeof(slot->text) - 1;
+        while (n > 0 && slot->text[n - 1] == '\n') n--;
+        snprintf(slot->text + n, sizeof(slot->text) - n, "）");
+        slot->time_us = time_us;
+        slot->level = level;
+        ring_commit(ring);
+    }
+    slot = ring_reserve(ring);
+    if (slot) {
+        slot->time_us = time_us;
+        slot->level = level;
+        format_text(slot->text, format, args);
+        ring_commit(ring);
+    }
+    va_end(args);
+}
+
+// 按时间顺序合并输出各线程缓冲区中的消息，返回输出条数
+static int drain_rings(LogStamp *stamp) {
+    int written = 0;
+    for (;;) {
+        LogRing *next = NULL;
+        const LogSlot *first = NULL;
+        int count = atomic_load(&g_ring_count);
+        for (int i = 0; i < count; i++) {
+            LogRing *ring = g_rings[i];
+            uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+            if (tail == atomic_load_explicit(&ring->head, memory_order_acquire)) continue;
+            const LogSlot *slot = &ring->slots[tail % LOG_RING_SLOTS];
+            if (!first || slot->time_us < first->time_us) {
+                first = slot;
+                next = ring;
+            }
+        }
+        if (!next) return written;
+        emit_line(stamp, first->level, first->time_us, first->text);
+        uint32_t tail = atomic_load_explicit(&next->tail, memory_order_relaxed);
+        atomic_store_explicit(&next->tail, tail + 1, memory_order_release);
+        written++;
+    }
+}
+
+static void *log_writer(void *arg) {
+    (void)arg;
+    LogStamp stamp = {(time_t)-1, ""};
+    for (;;) {
+        int stopping = atomic_load(&g_writer_stop);
+        if (drain_rings(&stamp)) {
+            fflush(stdout);
+            continue;
+        }
+        // 停止时先把剩余消息写完
+        if (stopping) break;
+        log_sleep_ms(LOG_WRITER_IDLE_MS);
+    }
+    return NULL;
+}
+
+int log_start(void) {
+    if (atomic_load(&g_writer_running)) return 0;
+    atomic_store(&g_writer_stop, 0);
+    if (pthread_create(&g_writer, NULL, log_writer, NULL) != 0) {
+        printf("启动日志写线程失败，日志改为同步输出\n");
+        return -1;
+    }
+    atomic_store_explicit(&g_writer_running, 1, memory_order_release);
+    return 0;
+}
+
+void log_stop(void) {
+    if (!atomic_load(&g_writer_running)) return;
+    atomic_store(&g_writer_running, 0);
+    atomic_store(&g_writer_stop, 1);
+    pthread_join(g_writer, NULL);
+    // 停止前最后一刻写入缓冲区的消息
+    LogStamp stamp = {(time_t)-1, ""};
+    drain_rings(&stamp);
+    fflush(stdout);
+}
+
+uint64_t log_dropped(void) {
+    uint64_t dropped = 0;
+    int count = atomic_load(&g_ring_count);
+    for (int i = 0; i < count; i++) dropped += atomic_load_explicit(&g_rings[i]->dropped, memory_order_relaxed);
+    return dropped;
+}
+
+uint64_t log_suppressed(void) {
+    uint64_t suppressed = 0;
+    int count = atomic_load(&g_ring_count);
+    for (int i = 0; i < count; i++) {
+        suppressed += atomic_load_explicit(&g_rings[i]->suppressed, memory_order_relaxed);
+    }
+    return suppressed;
+}
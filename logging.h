@@ -0,0 +1,76 @@
+#ifndef DNS_LOGGING_H
+#define DNS_LOGGING_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+// 日志级别，数值越大越详细；级别不高于当前级别的消息才会输出
+#define LOG_LEVEL_OFF 0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_INFO 3   // -d：每个查询一行
+#define LOG_LEVEL_DEBUG 4  // -dd：详细调试信息
+
+// 编译进程序的最高级别，更详细的调用点在编译期整体删除（连同参数求值），由构建系统按配置设定
+#ifndef LOG_MAX_LEVEL
+#define LOG_MAX_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+#define LOG_LINE_MAX 240          // 单条消息的最大长度，超出部分截断
+#define LOG_RING_SLOTS 512        // 每个线程的日志缓冲区条数
+#define LOG_MAX_THREADS 64        // 同时持有缓冲区的线程数上限，超出的线程同步输出
+#define LOG_RATE_SLOTS 64         // 每个线程跟踪的调用点数（按格式串地址直接映射）
+#define LOG_RATE_DEFAULT 200      // 每个调用点每秒最多输出的消息数
+#define LOG_WRITER_IDLE_MS 10     // 缓冲区全空时写线程的休眠间隔
+
+#if defined(__GNUC__) || defined(__clang__)
+#define LOG_UNLIKELY(x) __builtin_expect(!!(x), 0)
+#define LOG_PRINTF_FORMAT(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define LOG_UNLIKELY(x) (x)
+#define LOG_PRINTF_FORMAT(fmt, args)
+#endif
+
+// 当前日志级别，热路径上只做一次宽松读取
+extern _Atomic int g_log_level;
+
+/*
+ * 按级别输出日志。未启用的级别只有一次比较分支，参数不求值；
+ * 超过LOG_MAX_LEVEL的级别在编译期被删除。启用时在调用线程格式化到本线程的缓冲区，
+ * 由后台写线程加上时间与级别后统一输出，调用方不做任何I/O。
+ */
+#define LOG_AT(level, ...)                                                                              \
+    do {                                                                                                \
+        if ((level) <= LOG_MAX_LEVEL &&                                                                 \
+            LOG_UNLIKELY((level) <= atomic_load_explicit(&g_log_level, memory_order_relaxed))) {         \
+            log_write((level), __VA_ARGS__);                                                            \
+        }                                                                                               \
+    } while (0)
+
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...) LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_INFO(...) LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+// 写入一条消息（由LOG_*宏在级别启用时调用），末尾的换行可有可无
+void log_write(int level, const char *format, ...) LOG_PRINTF_FORMAT(2, 3);
+// 设置日志级别，超过LOG_MAX_LEVEL时按LOG_MAX_LEVEL处理并给出提示
+void log_set_level(int level);
+// 每个调用点每秒最多输出的消息数，0表示不限制
+void log_set_rate_limit(unsigned per_second);
+// 解析级别名称（error/warn/info/debug/off），失败返回-1
+int log_parse_level(const char *name);
+const char *log_level_name(int level);
+/**
+ * 启动后台写线程，此后各线程的消息经缓冲区异步输出；未启动时同步输出。
+ * @return 成功返回0，失败返回-1（继续同步输出）。
+ */
+int log_start(void);
+// 输出缓冲区中剩余的消息并停止写线程
+void log_stop(void);
+// 因缓冲区满丢弃的消息数
+uint64_t log_dropped(void);
+// 因限速省略的消息数
+uint64_t log_suppressed(void);
+
+#endif /* DNS_LOGGING_H */
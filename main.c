@@ -1,6 +1,12 @@
+#include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 
+#include "admin.h"
 #include "cache.h"
+#include "logging.h"
+#include "metrics.h"
+#include "profile.h"
 #include "protocol.h"
 #include "server.h"
 #include "table.h"
@@ -8,25 +14,66 @@
 
 #define MY_PORT 53
 #define DEFAULT_UPSTREAM_DNS_IP "10.3.9.5"
-#define CACHE_MAX_ENTRIES 256  // 最大缓存条目数
+#define DEFAULT_CACHE_BYTES (4ULL << 20)      // 默认缓存字节预算 4MB
+#define DEFAULT_CACHE_CEILING (256ULL << 20)  // 默认自动调整内存上限 256MB
+#ifdef DNSRELAY_EMBEDDED_TABLE
+// 构建时生成的内置本地表镜像（dnsrelay-compile --emit-c）
+extern const uint8_t *const dnsrelay_embedded_table;
+extern const size_t dnsrelay_embedded_table_size;
+#define DEFAULT_TABLE_PATH DNS_TABLE_EMBEDDED
+#else
 #define DEFAULT_TABLE_PATH "dnsrelay.txt"
+#endif
 
 // 增加全局退出标志
 static volatile sig_atomic_t g_exit_flag = 0;
-// 全局上游DNS服务器IP
-static char upstream_dns_ip[64] = DEFAULT_UPSTREAM_DNS_IP;
-static char config_file[256] = DEFAULT_TABLE_PATH;  // 默认配置文件路径
+// 收到SIGHUP后由主循环发起本地表重新加载
+static volatile sig_atomic_t g_reload_flag = 0;
+static TableReloader g_reloader;
+// 各服务线程共用的本地表指针
+static _Atomic(DNSTable *) g_dns_table;
+// 1号起的服务线程（0号线程即主线程，上下文位于main中）
+static DNSContext g_workers[MAX_WORKERS];
+static pthread_t g_worker_threads[MAX_WORKERS];
+// 各服务线程的延迟统计
+static ServerStats g_stats[MAX_WORKERS];
+// 二进制查询日志（--qlog启用时）
+static QueryLog g_qlog;
+// 响应限速表（--rrl启用时）
+static RRLTable g_rrl;
+// 命令行参数（上游DNS服务器IP、配置文件路径、缓存预算）
+static RelayOptions g_options = {
+    .dns_server = DEFAULT_UPSTREAM_DNS_IP,
+    .upstream_port = DNS_PORT,
+    .listen_port = MY_PORT,
+    .config_file = DEFAULT_TABLE_PATH,
+    .cache_bytes = DEFAULT_CACHE_BYTES,
+    .cache_ceiling = DEFAULT_CACHE_CEILING,
+    .qlog_bytes = QLOG_DEFAULT_FILE_BYTES,
+    .qlog_files = QLOG_DEFAULT_FILES,
+    .qlog_ring = QLOG_DEFAULT_RING_BYTES,
+    .rrl_slip = RRL_DEFAULT_SLIP,
+    .rrl_prefix = RRL_DEFAULT_PREFIX,
+    .rrl_table = RRL_DEFAULT_TABLE_BYTES,
+};
 
-// 资源释放函数
-void free_dns_context(DNSContext *ctx) {
-    if (!ctx) return;
+// 释放单个服务线程独占的资源（套接字与转发表）
+static void free_worker_context(DNSContext *ctx) {
     closesocket(ctx->sock);
     closesocket(ctx->upstream_sock);
+    free_relay_table(ctx->relay_table);
+    ctx->relay_table = NULL;
+}
+
+// 资源释放函数，由0号线程在其他服务线程退出后调用，同时释放共享的表与缓存
+void free_dns_context(DNSContext *ctx) {
+    if (!ctx) return;
+    free_worker_context(ctx);
 #ifdef _WIN32
     WSACleanup();
 #endif
-    free_relay_table(ctx->relay_table);
-    free_dns_table(ctx->dns_table);
+    if (ctx->reloader) table_reloader_join(ctx->reloader);
+    free_dns_table(atomic_load(ctx->dns_table));
     cache_destroy(ctx->cache);
 }
 
@@ -36,6 +83,11 @@ void handle_sigint(int sig) {
     g_exit_flag = 1;
 }
 
+// SIGHUP信号处理函数：请求重新加载本地表
+void handle_sighup(int sig) {
+    g_reload_flag = 1;
+}
+
 // 负责启动DNS查询
 int start_dns_server(DNSContext *context) {
 #ifdef _WIN32
@@ -63,11 +115,19 @@ int start_dns_server(DNSContext *context) {
         return -1;
     }
 
+#ifdef SO_REUSEPORT
+    // 多个服务线程各自绑定同一端口，由内核按来源分发查询
+    if (g_options.workers > 1) {
+        int one = 1;
+        setsockopt(context->sock, SOL_SOCKET, SO_REUSEPORT, (const char *)&one, sizeof(one));
+    }
+#endif
+
     // 配置本地监听地址
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
     server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(MY_PORT);
+    server_addr.sin_port = htons((uint16_t)g_options.listen_port);
     if (bind(context->sock, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
         printf("绑定套接字失败，请确保以管理员权限运行\n");
         closesocket(context->sock);
@@ -78,112 +138,276 @@ int start_dns_server(DNSContext *context) {
     // 配置上游DNS服务器地址
     memset(&context->upstream_addr, 0, sizeof(context->upstream_addr));
     context->upstream_addr.sin_family = AF_INET;
-    context->upstream_addr.sin_port = htons(DNS_PORT);
+    context->upstream_addr.sin_port = htons((uint16_t)g_options.upstream_port);
 #ifdef _WIN32
-    context->upstream_addr.sin_addr.s_addr = inet_addr(upstream_dns_ip);
+    context->upstream_addr.sin_addr.s_addr = inet_addr(g_options.dns_server);
 #else
-    inet_pton(AF_INET, upstream_dns_ip, &context->upstream_addr.sin_addr);
+    inet_pton(AF_INET, g_options.dns_server, &context->upstream_addr.sin_addr);
 #endif
 
-    printf("DNS服务器启动，监听端口 %d\n", MY_PORT);
-    printf("上游DNS服务器: %s\n", upstream_dns_ip);
+    if (context->worker_id == 0) {
+        printf("DNS服务器启动，监听端口 %d\n", g_options.listen_port);
+        printf("上游DNS服务器: %s:%d\n", g_options.dns_server, g_options.upstream_port);
+    }
     return 0;
 }
 
+/**
+ * @brief 服务线程主循环：等待客户端查询与上游响应并处理，定期检查超时。
+ * 0号线程额外处理SIGHUP触发的重新加载。
+ */
+static void serve_loop(DNSContext *context) {
+    uint8_t recv_buffer[MAX_DNS_PACKET_SIZE];
+    uint8_t upstream_recv_buffer[MAX_DNS_PACKET_SIZE];
+    ServerStats *stats = &context->stats[context->worker_id];
+
+    fd_set readfds;
+    int maxfd = (context->sock > context->upstream_sock ? context->sock : context->upstream_sock);
+    maxfd++;
+
+    while (!g_exit_flag) {
+        FD_ZERO(&readfds);
+        FD_SET(context->sock, &readfds);
+        FD_SET(context->upstream_sock, &readfds);
+
+        // 设置select超时时间，定期处理转发表超时
+        // 阻塞期间不持有本地表与缓存条目指针，标记为离线使热加载与缓存回收无需等待
+        struct timeval tv = {0, 100000};
+        qsbr_offline(&g_reloader.qsbr, context->qsbr_reader);
+        int ret = select(maxfd, &readfds, NULL, NULL, &tv);
+        qsbr_online(&g_reloader.qsbr, context->qsbr_reader);
+        stage_sync_reset(context);
+
+        if (context->worker_id == 0 && g_reload_flag) {
+            g_reload_flag = 0;
+            if (table_reloader_request(&g_reloader) < 0) printf("本地表正在重新加载，忽略本次SIGHUP\n");
+        }
+
+        if (ret < 0) {
+            // select出错，打印错误信息（被信号打断属正常情况）
+            if (errno != EINTR) perror("select error");
+            continue;
+        }
+        if (ret == 0) {
+            // 超时，无事件发生，检查并处理转发表和缓存超时请求
+            handle_timed_out_requests(context);
+        }
+
+        // 检查本地监听套接字是否有数据（来自客户端的查询）
+        if (FD_ISSET(context->sock, &readfds)) {
+            struct sockaddr_in client_addr;
+            socklen_t client_addr_len = sizeof(client_addr);
+            stage_begin(context);
+            int recv_len = recvfrom(context->sock, (char *)recv_buffer, sizeof(recv_buffer), 0,
+                                    (struct sockaddr *)&client_addr, &client_addr_len);
+            if (recv_len > 0) {
+                stage_mark(context, STAGE_RECV);
+                // 收到客户端查询，进行处理
+                handle_client_query(context, client_addr, recv_buffer, recv_len);
+            } else if (recv_len < 0) {
+                hist_add(&stats->recv_errors, 1);
+            }
+        }
+
+        // 检查上游DNS套接字是否有数据（来自上游的响应）
+        if (FD_ISSET(context->upstream_sock, &readfds)) {
+            struct sockaddr_in from_addr;
+            socklen_t from_len = sizeof(from_addr);
+            stage_begin(context);
+            int len = recvfrom(context->upstream_sock, (char *)upstream_recv_buffer, sizeof(upstream_recv_buffer), 0,
+                               (struct sockaddr *)&from_addr, &from_len);
+            if (len > 0) {
+                stage_mark(context, STAGE_UP_RECV);
+                // 收到上游响应，进行处理
+                handle_upstream_response(context, upstream_recv_buffer, len);
+            } else if (len < 0) {
+                hist_add(&stats->recv_errors, 1);
+            }
+        }
+    }
+}
+
+static void *worker_thread(void *arg) {
+    serve_loop((DNSContext *)arg);
+    return NULL;
+}
+
+/**
+ * @brief 启动1号起的服务线程，与0号线程共享本地表、缓存与热加载器。
+ * @return 实际运行的服务线程总数，部分线程启动失败时少于请求数。
+ */
+static int start_workers(DNSContext *primary, int count) {
+    for (int i = 1; i < count; i++) {
+        DNSContext *w = &g_workers[i];
+        w->dns_table = primary->dns_table;
+        w->reloader = primary->reloader;
+        w->cache = primary->cache;
+        w->stats = primary->stats;
+        w->qlog = primary->qlog;
+        w->rrl = primary->rrl;
+        w->rrl_rng = (uint32_t)i * 0x9e3779b9u + 1;
+        w->worker_id = i;
+        get_now(&w->last_cache_cleanup);
+        w->qsbr_reader = qsbr_register(&g_reloader.qsbr);
+        if (w->qsbr_reader < 0 || start_dns_server(w) < 0) {
+            printf("启动第%d个服务线程失败，以%d个线程运行\n", i + 1, i);
+            if (w->qsbr_reader >= 0) qsbr_offline(&g_reloader.qsbr, w->qsbr_reader);
+            return i;
+        }
+        if (pthread_create(&g_worker_threads[i], NULL, worker_thread, w) != 0) {
+            printf("启动第%d个服务线程失败，以%d个线程运行\n", i + 1, i);
+            qsbr_offline(&g_reloader.qsbr, w->qsbr_reader);
+            free_worker_context(w);
+            return i;
+        }
+    }
+    return count;
+}
+
 // ======================= 程序入口 =======================
 // 负责加载表、启动服务器、释放资源
 int main(int argc, char *argv[]) {
     DNSContext context = {0};  // 初始化上下文
-    context.dns_table = NULL;
     context.relay_table = NULL;
     context.upstream_id_counter = 0;
     context.cache = NULL;
+    context.stats = g_stats;
 
     if (argc > 1 && (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)) {
         print_usage(argv[0]);
         return 0;
     }
 
-    parse_command_line(argc, argv, upstream_dns_ip, sizeof(upstream_dns_ip), config_file, sizeof(config_file));
-    // 检查上游DNS服务器地址是否为本机
-    if (strcmp(upstream_dns_ip, "127.0.0.1") == 0 || strcmp(upstream_dns_ip, "localhost") == 0) {
-        printf("错误：上游DNS服务器地址不能为本机");
+    if (parse_command_line(argc, argv, &g_options) < 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+    // 日志改由后台线程输出，任何返回路径上退出前都写完缓冲区中的消息
+    if (log_start() == 0) atexit(log_stop);
+    if (g_options.profile) profile_enable(1);
+    // 检查上游DNS服务器是否为本机的同一端口（即转发给自己）；本机其他端口上的测试解析器允许使用
+    if ((strncmp(g_options.dns_server, "127.", 4) == 0 || strcmp(g_options.dns_server, "localhost") == 0) &&
+        g_options.upstream_port == g_options.listen_port) {
+        printf("错误：上游DNS服务器不能为本机的监听端口\n");
         return 1;
     }
 
+    if (g_options.workers < 1) g_options.workers = 1;
+    if (g_options.workers > MAX_WORKERS) {
+        printf("服务线程数不能超过%d\n", MAX_WORKERS);
+        return 1;
+    }
+#ifndef SO_REUSEPORT
+    if (g_options.workers > 1) {
+        printf("当前平台不支持SO_REUSEPORT，使用单个服务线程\n");
+        g_options.workers = 1;
+    }
+#endif
+
     signal(SIGINT, handle_sigint);
+#ifdef SIGHUP
+    signal(SIGHUP, handle_sighup);
+#endif
+#ifdef SIGPIPE
+    // 管理或指标客户端提前断开时send返回错误即可，不能让SIGPIPE终止整个中继
+    signal(SIGPIPE, SIG_IGN);
+#endif
 
     // 初始化缓存
-    context.cache = cache_create(CACHE_MAX_ENTRIES);
+    context.cache = cache_create(g_options.cache_bytes);
     if (!context.cache) {
         printf("缓存初始化失败\n");
         return 1;
     }
+    if (g_options.mrc_rate > 0.0 && cache_enable_mrc(context.cache, g_options.mrc_rate) < 0) {
+        printf("缺失率曲线估计器初始化失败\n");
+    }
+    if (g_options.cache_target > 0.0) {
+        cache_set_autosize(context.cache, g_options.cache_target, g_options.cache_ceiling);
+    }
 
     // 初始化缓存清理时间
     get_now(&context.last_cache_cleanup);
 
     // 加载本地DNS表
-    if (load_dns_table(config_file, &context.dns_table) < 0) {
+#ifdef DNSRELAY_EMBEDDED_TABLE
+    dns_table_set_embedded(dnsrelay_embedded_table, dnsrelay_embedded_table_size);
+#endif
+    dns_table_set_load_threads(g_options.load_threads);
+    DNSTable *table = NULL;
+    if (!g_options.async_load && load_dns_table(g_options.config_file, &table) < 0) {
         return 1;
     }
+    atomic_init(&g_dns_table, table);
+    context.dns_table = &g_dns_table;
+    table_reloader_init(&g_reloader, &g_dns_table, g_options.config_file);
+    // 多线程服务或有管理线程查看缓存时，被替换或驱逐的缓存条目经QSBR宽限期后释放
+    if (g_options.workers > 1 || g_options.admin_path[0] != '\0') cache_set_qsbr(context.cache, &g_reloader.qsbr);
+    context.reloader = &g_reloader;
+    context.qsbr_reader = qsbr_register(&g_reloader.qsbr);
+    // 后台加载：表指针暂为空，查询全部转发，加载完成后原子切换
+    if (g_options.async_load) {
+        if (table_reloader_request(&g_reloader) < 0) {
+            printf("启动后台加载线程失败\n");
+            free_dns_context(&context);
+            return 1;
+        }
+        printf("本地表 %s 正在后台加载，完成前所有查询直接转发\n", g_options.config_file);
+    }
 
     if (start_dns_server(&context) < 0) {
         free_dns_context(&context);
         return 1;
     }
 
-    uint8_t recv_buffer[MAX_DNS_PACKET_SIZE];
-    uint8_t upstream_recv_buffer[MAX_DNS_PACKET_SIZE];
-
-    fd_set readfds;
-    int maxfd = (context.sock > context.upstream_sock ? context.sock : context.upstream_sock) + 1;
+    // 启动查询日志（可选），每个服务线程一个缓冲区，须在服务线程启动前打开
+    if (g_options.qlog_path[0] != '\0' &&
+        qlog_open(&g_qlog, g_options.qlog_path, g_options.workers, (uint32_t)g_options.qlog_ring,
+                  g_options.qlog_bytes, g_options.qlog_files) == 0) {
+        context.qlog = &g_qlog;
+    }
 
-    // ======================= 主循环 =======================
-    while (!g_exit_flag) {
-        FD_ZERO(&readfds);
-        FD_SET(context.sock, &readfds);
-        FD_SET(context.upstream_sock, &readfds);
+    // 启动响应限速（可选），限速表在服务线程间共用
+    if (g_options.rrl_rate) {
+        if (rrl_init(&g_rrl, g_options.rrl_rate, g_options.rrl_slip, g_options.rrl_prefix, g_options.rrl_table,
+                     g_options.workers) == 0) {
+            context.rrl = &g_rrl;
+            context.rrl_rng = 1;
+            printf("响应限速：每个/%d前缀每类应答每秒%u个，超出部分", g_options.rrl_prefix, g_options.rrl_rate);
+            if (g_options.rrl_slip) printf("每%d个改发一个截断应答，其余丢弃\n", g_options.rrl_slip);
+            else printf("全部丢弃\n");
+        } else {
+            printf("响应限速表初始化失败，不限速\n");
+        }
+    }
 
-        // 设置select超时时间，定期处理转发表超时
-        struct timeval tv = {0, 100000};
-        int ret = select(maxfd, &readfds, NULL, NULL, &tv);
+    // 启动管理接口（可选）
+    AdminServer admin = {.listen_fd = -1};
+    if (g_options.admin_path[0] != '\0' && admin_open(&admin, g_options.admin_path) == 0) {
+        admin_start(&admin, &context);
+    }
+    // 启动指标接口（可选）
+    MetricsServer metrics = {.listen_fd = -1};
+    if (g_options.metrics_port && metrics_open(&metrics, g_options.metrics_port) == 0) {
+        metrics_start(&metrics, &context);
+    }
 
-        if (ret < 0) {
-            // select出错，打印错误信息
-            perror("select error");
-            continue;
-        }
-        if (ret == 0) {
-            // 超时，无事件发生，检查并处理转发表和缓存超时请求
-            handle_timed_out_requests(&context);
-        }
+    int worker_count = start_workers(&context, g_options.workers);
+    if (worker_count > 1) printf("%d个服务线程共享端口 %d\n", worker_count, g_options.listen_port);
 
-        // 检查本地监听套接字是否有数据（来自客户端的查询）
-        if (FD_ISSET(context.sock, &readfds)) {
-            struct sockaddr_in client_addr;
-            socklen_t client_addr_len = sizeof(client_addr);
-            int recv_len = recvfrom(context.sock, (char *)recv_buffer, sizeof(recv_buffer), 0,
-                                    (struct sockaddr *)&client_addr, &client_addr_len);
-            if (recv_len > 0) {
-                // 收到客户端查询，进行处理
-                handle_client_query(&context, client_addr, recv_buffer, recv_len);
-            }
-        }
+    // ======================= 主循环 =======================
+    serve_loop(&context);
 
-        // 检查上游DNS套接字是否有数据（来自上游的响应）
-        if (FD_ISSET(context.upstream_sock, &readfds)) {
-            struct sockaddr_in from_addr;
-            socklen_t from_len = sizeof(from_addr);
-            int len = recvfrom(context.upstream_sock, (char *)upstream_recv_buffer, sizeof(upstream_recv_buffer), 0,
-                               (struct sockaddr *)&from_addr, &from_len);
-            if (len > 0) {
-                // 收到上游响应，进行处理
-                handle_upstream_response(&context, upstream_recv_buffer, len);
-            }
-        }
+    for (int i = 1; i < worker_count; i++) {
+        pthread_join(g_worker_threads[i], NULL);
+        free_worker_context(&g_workers[i]);
     }
     printf("退出主循环，释放所有资源...\n");
+    admin_close(&admin);
+    metrics_close(&metrics);
+    // 服务线程均已退出，写完缓冲区中剩余的查询日志
+    if (context.qlog) qlog_close(context.qlog);
+    if (context.rrl) rrl_free(context.rrl);
     // 关闭套接字，清理资源
     free_dns_context(&context);
     return 0;
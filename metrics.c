@@ -0,0 +1,261 @@
+#include "metrics.h"
+
+#include <stddef.h>
+
+#include "cache.h"
+#include "logging.h"
+#include "protocol.h"
+#include "textout.h"
+#include "util.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#endif
+
+// 直方图的累计桶上界（纳秒），对应Prometheus的le标签
+static const uint64_t metrics_bounds[] = {
+    10000ULL,     25000ULL,     50000ULL,     100000ULL,     250000ULL,     500000ULL,
+    1000000ULL,   2500000ULL,   5000000ULL,   10000000ULL,   25000000ULL,   50000000ULL,
+    100000000ULL, 250000000ULL, 500000000ULL, 1000000000ULL, 2500000000ULL, 5000000000ULL,
+};
+#define METRICS_BOUND_COUNT ((int)(sizeof(metrics_bounds) / sizeof(metrics_bounds[0])))
+
+static void metric_header(TextOut *out, const char *name, const char *type, const char *help) {
+    textout_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+static void metric_value(TextOut *out, const char *name, const char *type, const char *help, uint64_t value) {
+    metric_header(out, name, type, help);
+    textout_printf(out, "%s %llu\n", name, (unsigned long long)value);
+}
+
+// 输出一个直方图序列，label为空串时不带标签
+static void metric_histogram(TextOut *out, const char *name, const char *label, const LatencyHist *h) {
+    uint64_t cumulative[METRICS_BOUND_COUNT];
+    hist_cumulative(h, metrics_bounds, METRICS_BOUND_COUNT, cumulative);
+    const char *sep = label[0] ? "," : "";
+    for (int i = 0; i < METRICS_BOUND_COUNT; i++) {
+        textout_printf(out, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, label, sep, metrics_bounds[i] / 1e9,
+                       (unsigned long long)cumulative[i]);
+    }
+    uint64_t count = hist_load(&h->count);
+    textout_printf(out, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, label, sep, (unsigned long long)count);
+    if (label[0]) {
+        textout_printf(out, "%s_sum{%s} %.9f\n%s_count{%s} %llu\n", name, label, hist_load(&h->sum) / 1e9, name, label,
+                       (unsigned long long)count);
+    } else {
+        textout_printf(out, "%s_sum %.9f\n%s_count %llu\n", name, hist_load(&h->sum) / 1e9, name,
+                       (unsigned long long)count);
+    }
+}
+
+static void write_metrics(TextOut *out, DNSContext *ctx) {
+    LatencyHist *paths = calloc(PATH_COUNT + 1, sizeof(LatencyHist));
+    if (!paths) return;
+    for (int p = 0; p < PATH_COUNT; p++) server_stats_collect(ctx, (QueryPath)p, &paths[p]);
+    LatencyHist *rtt = &paths[PATH_COUNT];
+    server_stats_collect_rtt(ctx, rtt);
+    char label[64];
+
+    metric_header(out, "dnsrelay_queries_total", "counter", "Queries answered, by resolution path.");
+    for (int p = 0; p < PATH_COUNT; p++) {
+        textout_printf(out, "dnsrelay_queries_total{path=\"%s\"} %llu\n", query_path_names[p],
+                       (unsigned long long)hist_load(&paths[p].count));
+    }
+    metric_header(out, "dnsrelay_query_duration_seconds", "histogram",
+                  "Time from receiving a query to sending its answer, by resolution path.");
+    for (int p = 0; p < PATH_COUNT; p++) {
+        snprintf(label, sizeof(label), "path=\"%s\"", query_path_names[p]);
+        metric_histogram(out, "dnsrelay_query_duration_seconds", label, &paths[p]);
+    }
+    metric_header(out, "dnsrelay_upstream_rtt_seconds", "histogram", "Round trip time of forwarded queries.");
+    metric_histogram(out, "dnsrelay_upstream_rtt_seconds", "", rtt);
+    metric_value(out, "dnsrelay_upstream_timeouts_total", "counter",
+                 "Forwarded queries answered with SERVFAIL after the relay timeout.",
+                 hist_load(&paths[PATH_TIMEOUT].count));
+    metric_value(out, "dnsrelay_upstream_unmatched_total", "counter",
+                 "Upstream responses without a pending query (late or spoofed).",
+                 server_stats_sum(ctx, offsetof(ServerStats, unmatched)));
+    metric_value(out, "dnsrelay_relay_pending", "gauge", "Queries waiting for an upstream answer.",
+                 server_stats_sum(ctx, offsetof(ServerStats, relay_pending)));
+    metric_value(out, "dnsrelay_malformed_queries_total", "counter",
+                 "Queries dropped because they could not be parsed.",
+                 server_stats_sum(ctx, offsetof(ServerStats, malformed)));
+    metric_header(out, "dnsrelay_socket_errors_total", "counter", "Failed socket sends and receives.");
+    textout_printf(out, "dnsrelay_socket_errors_total{op=\"send\"} %llu\n",
+                   (unsigned long long)server_stats_sum(ctx, offsetof(ServerStats, send_errors)));
+    textout_printf(out, "dnsrelay_socket_errors_total{op=\"recv\"} %llu\n",
+                   (unsigned long long)server_stats_sum(ctx, offsetof(ServerStats, recv_errors)));
+    if (ctx->rrl) {
+        metric_header(out, "dnsrelay_rrl_limited_total", "counter",
+                      "Responses over the per-client rate limit, by action taken.");
+        textout_printf(out, "dnsrelay_rrl_limited_total{action=\"slip\"} %llu\n",
+                       (unsigned long long)server_stats_sum(ctx, offsetof(ServerStats, rrl_slipped)));
+        textout_printf(out, "dnsrelay_rrl_limited_total{action=\"drop\"} %llu\n",
+                       (unsigned long long)server_stats_sum(ctx, offsetof(ServerStats, rrl_dropped)));
+    }
+    free(paths);
+
+    CacheStats st;
+    cache_get_stats(ctx->cache, &st);
+    metric_value(out, "dnsrelay_cache_hits_total", "counter", "Cache lookups that found a live entry.", st.hits);
+    metric_value(out, "dnsrelay_cache_misses_total", "counter", "Cache lookups that found no live entry.", st.misses);
+    metric_value(out, "dnsrelay_cache_evictions_total", "counter", "Entries evicted to stay within the byte budget.",
+                 st.evicted);
+    metric_value(out, "dnsrelay_cache_expirations_total", "counter", "Entries removed after their TTL ran out.",
+                 st.expired);
+    metric_value(out, "dnsrelay_cache_flushed_total", "counter", "Entries removed by admin flush commands.",
+                 st.flushed);
+    metric_value(out, "dnsrelay_cache_entries", "gauge", "Entries currently cached.", st.current_size);
+    metric_value(out, "dnsrelay_cache_bytes", "gauge", "Bytes used by cache entries and bucket arrays.",
+                 st.current_bytes);
+    metric_value(out, "dnsrelay_cache_max_bytes", "gauge", "Cache byte budget.", st.max_bytes);
+
+    // 先取出表的字段再输出，输出可能写出缓冲区而使本线程短暂离线
+    const DNSTable *table = atomic_load_explicit(ctx->dns_table, memory_order_acquire);
+    int table_loaded = table != NULL;
+    uint32_t table_rules = table ? table->rule_count : 0;
+    metric_value(out, "dnsrelay_table_loaded", "gauge", "Whether a local table is loaded.", table_loaded);
+    metric_value(out, "dnsrelay_table_rules", "gauge", "Rules in the local table.", table_rules);
+    metric_value(out, "dnsrelay_table_reloads_total", "counter", "Successful local table reloads.",
+                 atomic_load(&ctx->reloader->reloads));
+
+    if (ctx->qlog) {
+        metric_value(out, "dnsrelay_qlog_written_total", "counter", "Query log records written to disk.",
+                     atomic_load(&ctx->qlog->written));
+        metric_value(out, "dnsrelay_qlog_dropped_total", "counter",
+                     "Query log records dropped because a buffer was full.", qlog_dropped(ctx->qlog));
+        metric_value(out, "dnsrelay_qlog_rotations_total", "counter", "Query log file rotations.",
+                     atomic_load(&ctx->qlog->rotations));
+    }
+}
+
+#ifndef _WIN32
+
+int metrics_open(MetricsServer *metrics, int port) {
+    metrics->listen_fd = -1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("创建指标套接字失败\n");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    // 只监听本机回环地址，由本机的采集代理抓取
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 8) < 0) {
+        printf("绑定指标端口失败: %d\n", port);
+        close(fd);
+        return -1;
+    }
+    // 非阻塞监听，避免select误报时accept阻塞指标线程而无法及时退出
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+
+    metrics->listen_fd = fd;
+    printf("指标接口监听于 http://127.0.0.1:%d/metrics\n", port);
+    return 0;
+}
+
+// 接受一个连接并应答一次抓取；进入时本线程处于离线状态，返回时亦然
+static void metrics_handle(MetricsServer *metrics) {
+    int fd = accept(metrics->listen_fd, NULL, NULL);
+    if (fd < 0) return;
+
+    struct timeval tv = {0, METRICS_IO_TIMEOUT_MS * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+    // 读到请求头结束为止，只使用请求行
+    char request[METRICS_MAX_REQUEST];
+    size_t len = 0;
+    while (len < sizeof(request) - 1) {
+        ssize_t n = recv(fd, request + len, sizeof(request) - 1 - len, 0);
+        if (n <= 0) break;
+        len += (size_t)n;
+        request[len] = '\0';
+        if (strstr(request, "\r\n\r\n") || strstr(request, "\n\n")) break;
+    }
+    request[len] = '\0';
+
+    QSBR *qsbr = &metrics->ctx->reloader->qsbr;
+    TextOut out;
+    textout_init(&out, fd, qsbr, metrics->qsbr_reader);
+    qsbr_online(qsbr, metrics->qsbr_reader);
+    if (strncmp(request, "GET /metrics ", 13) == 0 || strncmp(request, "GET / ", 6) == 0) {
+        LOG_DEBUG("指标抓取\n");
+        textout_printf(&out, "HTTP/1.1 200 OK\r\n"
+                             "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                             "Connection: close\r\n\r\n");
+        write_metrics(&out, metrics->ctx);
+    } else {
+        textout_printf(&out, "HTTP/1.1 404 Not Found\r\n"
+                             "Content-Type: text/plain\r\n"
+                             "Connection: close\r\n\r\n"
+                             "metrics are served at /metrics\n");
+    }
+    textout_flush(&out);
+    qsbr_offline(qsbr, metrics->qsbr_reader);
+    close(fd);
+}
+
+static void *metrics_thread(void *arg) {
+    MetricsServer *metrics = arg;
+    while (!atomic_load(&metrics->stop)) {
+        // 定期醒来检查退出标志
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(metrics->listen_fd, &readfds);
+        struct timeval tv = {0, 100000};
+        if (select(metrics->listen_fd + 1, &readfds, NULL, NULL, &tv) > 0) metrics_handle(metrics);
+    }
+    return NULL;
+}
+
+int metrics_start(MetricsServer *metrics, DNSContext *ctx) {
+    if (metrics->listen_fd < 0) return -1;
+    metrics->ctx = ctx;
+    metrics->qsbr_reader = qsbr_register(&ctx->reloader->qsbr);
+    if (metrics->qsbr_reader < 0) {
+        printf("指标线程登记失败，关闭指标接口\n");
+        metrics_close(metrics);
+        return -1;
+    }
+    qsbr_offline(&ctx->reloader->qsbr, metrics->qsbr_reader);
+    atomic_init(&metrics->stop, 0);
+    if (pthread_create(&metrics->thread, NULL, metrics_thread, metrics) != 0) {
+        printf("创建指标线程失败，关闭指标接口\n");
+        metrics_close(metrics);
+        return -1;
+    }
+    metrics->running = 1;
+    return 0;
+}
+
+void metrics_close(MetricsServer *metrics) {
+    if (metrics->running) {
+        atomic_store(&metrics->stop, 1);
+        pthread_join(metrics->thread, NULL);
+        metrics->running = 0;
+    }
+    if (metrics->listen_fd < 0) return;
+    close(metrics->listen_fd);
+    metrics->listen_fd = -1;
+}
+
+#else
+
+int metrics_open(MetricsServer *metrics, int port) {
+    metrics->listen_fd = -1;
+    printf("当前平台暂不支持指标接口: %d\n", port);
+    return -1;
+}
+
+int metrics_start(MetricsServer *metrics, DNSContext *ctx) { return -1; }
+
+void metrics_close(MetricsServer *metrics) { metrics->listen_fd = -1; }
+
+#endif
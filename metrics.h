@@ -0,0 +1,36 @@
+#ifndef DNS_METRICS_H
+#define DNS_METRICS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "server.h"
+
+// 抓取请求头的最大长度，只解析请求行
+#define METRICS_MAX_REQUEST 1024
+// 连接的收发超时（毫秒），避免异常客户端长时间占住指标线程
+#define METRICS_IO_TIMEOUT_MS 200
+
+/*
+ * Prometheus文本格式（兼容OpenMetrics抓取）的指标接口，监听127.0.0.1上的一个TCP端口。
+ * 由单独的指标线程处理：每个连接读取请求行，对 GET /metrics 写回全部指标后关闭连接。
+ * 指标在抓取时从各线程的统计与缓存计数汇总得到，平时不产生任何额外开销。
+ * 指标线程与管理线程一样作为QSBR读者登记，只在汇总期间在线。
+ *   curl http://127.0.0.1:9153/metrics
+ */
+typedef struct metrics_server {
+    int listen_fd;     // 监听套接字，未启用时为-1
+    DNSContext *ctx;   // 0号线程的上下文（共享的缓存、表与统计）
+    int qsbr_reader;   // 指标线程的QSBR读者编号
+    atomic_int stop;   // 通知指标线程退出
+    pthread_t thread;
+    int running;       // thread是否需要join
+} MetricsServer;
+
+int metrics_open(MetricsServer *metrics, int port);
+// 启动指标线程，此后抓取在该线程中应答
+int metrics_start(MetricsServer *metrics, DNSContext *ctx);
+// 停止指标线程并关闭监听套接字
+void metrics_close(MetricsServer *metrics);
+
+#endif /* DNS_METRICS_H */
@@ -0,0 +1,293 @@
+#include "mrc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "logging.h"
+#include "util.h"
+
+#define MRC_SUB_BITS 3  // log2(MRC_SUB_BUCKETS)
+
+// FNV-1a 后接 splitmix64 终结混合，使低位也足够均匀，可直接取模采样
+static uint64_t mrc_hash(const char *key, size_t len) {
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= (uint8_t)key[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+static inline uint32_t mrc_sample_value(uint64_t hash) {
+    return (uint32_t)(hash & (MRC_MODULUS - 1));
+}
+
+static int mrc_highest_bit(uint64_t v) {
+    int k = 0;
+    while (v >>= 1) k++;
+    return k;
+}
+
+// 重用距离 -> 直方图下标（对数-线性分桶）
+static int mrc_bucket_index(uint64_t d) {
+    if (d < MRC_SUB_BUCKETS) return (int)d;
+    int shift = mrc_highest_bit(d) - MRC_SUB_BITS;
+    int idx = (shift + 1) * MRC_SUB_BUCKETS + (int)((d >> shift) - MRC_SUB_BUCKETS);
+    return idx < MRC_BUCKETS ? idx : MRC_BUCKETS - 1;
+}
+
+// 直方图下标 -> 该桶覆盖的最小重用距离
+static uint64_t mrc_bucket_lower(int idx) {
+    if (idx < MRC_SUB_BUCKETS) return (uint64_t)idx;
+    int shift = idx / MRC_SUB_BUCKETS - 1;
+    return (uint64_t)(MRC_SUB_BUCKETS + idx % MRC_SUB_BUCKETS) << shift;
+}
+
+// ----------- 树状数组（逻辑时间 1..time_cap） -----------
+static void tree_add(MRCEstimator *mrc, uint32_t i, int32_t delta) {
+    for (; i <= mrc->time_cap; i += i & (~i + 1)) mrc->tree[i] += delta;
+}
+
+static uint32_t tree_prefix(const MRCEstimator *mrc, uint32_t i) {
+    uint32_t sum = 0;
+    for (; i > 0; i -= i & (~i + 1)) sum += mrc->tree[i];
+    return sum;
+}
+
+// ----------- 以采样值为序的最大堆 -----------
+static void heap_swap(MRCEstimator *mrc, uint32_t a, uint32_t b) {
+    MRCSample *t = mrc->heap[a];
+    mrc->heap[a] = mrc->heap[b];
+    mrc->heap[b] = t;
+    mrc->heap[a]->heap_idx = a;
+    mrc->heap[b]->heap_idx = b;
+}
+
+static void heap_push(MRCEstimator *mrc, MRCSample *s) {
+    uint32_t i = mrc->sample_count;
+    mrc->heap[i] = s;
+    s->heap_idx = i;
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (mrc_sample_value(mrc->heap[parent]->hash) >= mrc_sample_value(mrc->heap[i]->hash)) break;
+        heap_swap(mrc, i, parent);
+        i = parent;
+    }
+}
+
+static MRCSample *heap_pop(MRCEstimator *mrc) {
+    MRCSample *top = mrc->heap[0];
+    uint32_t n = mrc->sample_count - 1;
+    mrc->heap[0] = mrc->heap[n];
+    mrc->heap[0]->heap_idx = 0;
+    uint32_t i = 0;
+    for (;;) {
+        uint32_t l = 2 * i + 1, r = l + 1, largest = i;
+        if (l < n && mrc_sample_value(mrc->heap[l]->hash) > mrc_sample_value(mrc->heap[largest]->hash)) largest = l;
+        if (r < n && mrc_sample_value(mrc->heap[r]->hash) > mrc_sample_value(mrc->heap[largest]->hash)) largest = r;
+        if (largest == i) break;
+        heap_swap(mrc, i, largest);
+        i = largest;
+    }
+    return top;
+}
+
+MRCEstimator *mrc_create(double sample_rate, uint32_t max_samples) {
+    if (sample_rate <= 0.0 || sample_rate > 1.0 || max_samples == 0) return NULL;
+
+    MRCEstimator *mrc = calloc(1, sizeof(MRCEstimator));
+    if (!mrc) return NULL;
+    mrc->threshold = (uint32_t)(sample_rate * MRC_MODULUS);
+    if (mrc->threshold == 0) mrc->threshold = 1;
+    mrc->initial_threshold = mrc->threshold;
+    mrc->max_samples = max_samples;
+    mrc->time_cap = max_samples * 4;
+    mrc->heap = malloc((size_t)(max_samples + 1) * sizeof(MRCSample *));
+    mrc->scratch = malloc((size_t)(max_samples + 1) * sizeof(MRCSample *));
+    mrc->tree = calloc((size_t)mrc->time_cap + 1, sizeof(uint32_t));
+    if (!mrc->heap || !mrc->scratch || !mrc->tree) {
+        mrc_destroy(mrc);
+        return NULL;
+    }
+    LOG_DEBUG("MRC估计器已创建：采样率=%.4f，最大样本数=%u\n", sample_rate, max_samples);
+    return mrc;
+}
+
+void mrc_destroy(MRCEstimator *mrc) {
+    if (!mrc) return;
+    MRCSample *s, *tmp;
+    HASH_ITER(hh, mrc->samples, s, tmp) {
+        HASH_DEL(mrc->samples, s);
+        free(s);
+    }
+    free(mrc->heap);
+    free(mrc->scratch);
+    free(mrc->tree);
+    free(mrc);
+}
+
+static int compare_sample_time(const void *a, const void *b) {
+    uint32_t ta = (*(MRCSample *const *)a)->last_time;
+    uint32_t tb = (*(MRCSample *const *)b)->last_time;
+    return (ta > tb) - (ta < tb);
+}
+
+// 逻辑时间用尽时按访问先后重新编号，保持相对顺序不变
+static void mrc_compact_time(MRCEstimator *mrc) {
+    MRCSample **sorted = mrc->scratch;
+    memcpy(sorted, mrc->heap, (size_t)mrc->sample_count * sizeof(MRCSample *));
+    qsort(sorted, mrc->sample_count, sizeof(MRCSample *), compare_sample_time);
+    memset(mrc->tree, 0, ((size_t)mrc->time_cap + 1) * sizeof(uint32_t));
+    mrc->now = 0;
+    for (uint32_t i = 0; i < mrc->sample_count; i++) {
+        sorted[i]->last_time = ++mrc->now;
+        tree_add(mrc, mrc->now, 1);
+    }
+}
+
+// 样本数超限时降低阈值，淘汰采样值不小于新阈值的全部样本
+static void mrc_shrink(MRCEstimator *mrc) {
+    while (mrc->sample_count > mrc->max_samples) {
+        MRCSample *victim = heap_pop(mrc);
+        mrc->sample_count--;
+        mrc->threshold = mrc_sample_value(victim->hash);
+        tree_add(mrc, victim->last_time, -1);
+        HASH_DEL(mrc->samples, victim);
+        free(victim);
+        while (mrc->sample_count > 0 && mrc_sample_value(mrc->heap[0]->hash) >= mrc->threshold) {
+            victim = heap_pop(mrc);
+            mrc->sample_count--;
+            tree_add(mrc, victim->last_time, -1);
+            HASH_DEL(mrc->samples, victim);
+            free(victim);
+        }
+    }
+}
+
+static void mrc_record(MRCEstimator *mrc, uint64_t hash) {
+    if (mrc_sample_value(hash) >= mrc->threshold) return;  // 未被采样，绝大多数访问在此返回
+
+    if (mrc->now >= mrc->time_cap) mrc_compact_time(mrc);
+
+    double scale = (double)MRC_MODULUS / (double)mrc->threshold;  // 1/R
+    MRCSample *s;
+    HASH_FIND(hh, mrc->samples, &hash, sizeof(hash), s);
+    if (s) {
+        // 重用距离 = 上次访问之后被访问过的不同采样键数，再按 1/R 放大
+        uint32_t distinct = tree_prefix(mrc, mrc->now) - tree_prefix(mrc, s->last_time);
+        mrc->hist[mrc_bucket_index((uint64_t)(distinct * scale))] += scale;
+        tree_add(mrc, s->last_time, -1);
+    } else {
+        s = malloc(sizeof(MRCSample));
+        if (!s) return;
+        s->hash = hash;
+        HASH_ADD(hh, mrc->samples, hash, sizeof(uint64_t), s);
+        heap_push(mrc, s);
+        mrc->sample_count++;
+        mrc->cold += scale;
+    }
+    mrc->total += scale;
+    s->last_time = ++mrc->now;
+    tree_add(mrc, s->last_time, 1);
+
+    if (mrc->sample_count > mrc->max_samples) mrc_shrink(mrc);
+}
+
+void mrc_access(MRCEstimator *mrc, const char *key, size_t key_len) {
+    mrc->references += 1.0;
+    mrc_record(mrc, mrc_hash(key, key_len));
+}
+
+uint64_t mrc_key_hash(const char *key, size_t key_len) { return mrc_hash(key, key_len); }
+
+void mrc_access_hashes(MRCEstimator *mrc, const uint64_t *hashes, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) mrc_record(mrc, hashes[i]);
+}
+
+void mrc_add_references(MRCEstimator *mrc, double references) { mrc->references += references; }
+
+/*
+ * SHARDS-adj：热门键是否恰好被采样会使加权引用数偏离真实引用数，
+ * 把差值计入距离为0的桶，并以真实引用数归一化。
+ */
+static double mrc_adjusted_bucket(const MRCEstimator *mrc, int idx) {
+    return idx == 0 ? mrc->hist[0] + (mrc->references - mrc->total) : mrc->hist[idx];
+}
+
+double mrc_miss_ratio(const MRCEstimator *mrc, uint64_t entries) {
+    if (!mrc || mrc->total <= 0.0) return 1.0;
+    // 重用距离 >= entries 的访问在该容量的LRU缓存中缺失；所在桶按均匀分布取部分
+    double misses = mrc->cold;
+    for (int i = MRC_BUCKETS - 1; i >= 0; i--) {
+        uint64_t lo = mrc_bucket_lower(i);
+        uint64_t hi = i + 1 < MRC_BUCKETS ? mrc_bucket_lower(i + 1) : lo + 1;
+        if (lo >= entries) {
+            misses += mrc_adjusted_bucket(mrc, i);
+        } else {
+            if (hi > entries) misses += mrc_adjusted_bucket(mrc, i) * (double)(hi - entries) / (double)(hi - lo);
+            break;
+        }
+    }
+    double ratio = misses / mrc->references;
+    return ratio < 0.0 ? 0.0 : (ratio > 1.0 ? 1.0 : ratio);
+}
+
+uint64_t mrc_entries_for_hit_ratio(const MRCEstimator *mrc, double target_hit_ratio) {
+    if (!mrc || mrc->total <= 0.0) return UINT64_MAX;
+    double allowed_misses = (1.0 - target_hit_ratio) * mrc->references;
+    if (mrc->cold > allowed_misses) return UINT64_MAX;  // 冷缺失已超出允许范围，任何容量都达不到
+    // 从大到小累加缺失数，找到最后一个仍满足要求的桶
+    double misses = mrc->cold;
+    for (int i = MRC_BUCKETS - 1; i >= 0; i--) {
+        double w = mrc_adjusted_bucket(mrc, i);
+        if (misses + w > allowed_misses) {
+            return i + 1 < MRC_BUCKETS ? mrc_bucket_lower(i + 1) : mrc_bucket_lower(i) + 1;
+        }
+        misses += w;
+    }
+    return 1;
+}
+
+int mrc_export(const MRCEstimator *mrc, uint64_t *entries, double *miss_ratios, int max_points) {
+    if (!mrc || mrc->total <= 0.0) return 0;
+    // 找到最大的非空桶，在 [1, 上界] 上按几何级数取点
+    int last = 0;
+    for (int i = 0; i < MRC_BUCKETS; i++) {
+        if (mrc->hist[i] > 0.0) last = i;
+    }
+    uint64_t limit = mrc_bucket_lower(last) * 2 + 2;
+    int n = 0;
+    for (uint64_t size = 1; size <= limit && n < max_points; size = size < 8 ? size + 1 : size + size / 4) {
+        entries[n] = size;
+        miss_ratios[n] = mrc_miss_ratio(mrc, size);
+        n++;
+    }
+    return n;
+}
+
+void mrc_decay(MRCEstimator *mrc) {
+    if (!mrc) return;
+    for (int i = 0; i < MRC_BUCKETS; i++) mrc->hist[i] *= 0.5;
+    mrc->cold *= 0.5;
+    mrc->total *= 0.5;
+    mrc->references *= 0.5;
+}
+
+void mrc_print(const MRCEstimator *mrc, double avg_entry_bytes) {
+    if (!mrc) return;
+    uint64_t entries[MRC_MAX_POINTS];
+    double ratios[MRC_MAX_POINTS];
+    int n = mrc_export(mrc, entries, ratios, MRC_MAX_POINTS);
+
+    LOG_DEBUG("=== 缺失率曲线（采样率=%.5f，样本数=%u） ===\n", (double)mrc->threshold / MRC_MODULUS, mrc->sample_count);
+    for (int i = 0; i < n; i++) {
+        LOG_DEBUG("  %10llu 条目 (~%10.0f 字节): 缺失率 %.4f\n", (unsigned long long)entries[i],
+                  (double)entries[i] * avg_entry_bytes, ratios[i]);
+    }
+}
@@ -0,0 +1,75 @@
+#ifndef DNS_MRC_H
+#define DNS_MRC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "uthash.h"
+
+// 空间采样的取模基数P，采样条件为 hash mod P < T，采样率 R = T / P
+#define MRC_MODULUS (1u << 24)
+// 重用距离直方图：每个2的幂区间再细分的子桶数（对数-线性分桶）
+#define MRC_SUB_BUCKETS 8
+#define MRC_BUCKETS (MRC_SUB_BUCKETS * 40)
+// 导出缺失率曲线时的最大点数
+#define MRC_MAX_POINTS 64
+
+// 被采样的键，只记录其哈希值与最近一次访问的逻辑时间
+typedef struct mrc_sample {
+    uint64_t hash;       // 键的64位哈希（键）
+    uint32_t last_time;  // 最近一次访问的逻辑时间
+    uint32_t heap_idx;   // 在最大堆中的位置
+    UT_hash_handle hh;   // uthash处理句柄
+} MRCSample;
+
+/*
+ * SHARDS风格的在线缺失率曲线估计器（固定样本数版本）。
+ * 只跟踪哈希落入采样区间的键，用树状数组统计两次访问之间的不同键个数，
+ * 即重用距离，再按 1/R 放大后计入直方图。样本数超过上限时降低阈值T，
+ * 淘汰采样值最大的键，使内存占用与工作集大小无关。
+ */
+typedef struct mrc_estimator {
+    uint32_t threshold;     // 采样阈值T
+    uint32_t initial_threshold;  // 创建时的采样阈值，此后不变；T只降不升，可在不加锁时预先过滤
+    uint32_t max_samples;   // 最多跟踪的样本数
+    uint32_t sample_count;  // 当前样本数
+    MRCSample *samples;     // 样本哈希表
+    MRCSample **heap;       // 以采样值 (hash mod P) 为序的最大堆
+    MRCSample **scratch;    // 压缩逻辑时间时用于排序的临时数组
+    uint32_t *tree;         // 树状数组，下标为逻辑时间，值为该时刻是否为某键的最近访问
+    uint32_t time_cap;      // 逻辑时间上限，用尽后压缩重编号
+    uint32_t now;           // 当前逻辑时间
+    double hist[MRC_BUCKETS];  // 重用距离直方图（按 1/R 加权）
+    double cold;               // 冷缺失（首次访问）的加权计数
+    double total;              // 加权总引用数
+    double references;         // 实际总引用数（含未被采样的），用于SHARDS-adj校正
+} MRCEstimator;
+
+MRCEstimator *mrc_create(double sample_rate, uint32_t max_samples);
+void mrc_destroy(MRCEstimator *mrc);
+
+// 记录一次对键的访问
+void mrc_access(MRCEstimator *mrc, const char *key, size_t key_len);
+
+// 键的64位采样哈希
+uint64_t mrc_key_hash(const char *key, size_t key_len);
+// 哈希可能被采样时返回1；只读取不变的字段，可与估计器的更新并发调用
+static inline int mrc_may_sample(const MRCEstimator *mrc, uint64_t hash) {
+    return (uint32_t)(hash & (MRC_MODULUS - 1)) < mrc->initial_threshold;
+}
+// 记录一批已通过mrc_may_sample的访问，不计入总引用数
+void mrc_access_hashes(MRCEstimator *mrc, const uint64_t *hashes, uint32_t count);
+// 计入references次访问（含未被采样的），与mrc_access_hashes配合使用
+void mrc_add_references(MRCEstimator *mrc, double references);
+
+// 预测容纳entries个条目的LRU缓存的缺失率
+double mrc_miss_ratio(const MRCEstimator *mrc, uint64_t entries);
+// 达到目标命中率所需的最少条目数，无法达到时返回UINT64_MAX
+uint64_t mrc_entries_for_hit_ratio(const MRCEstimator *mrc, double target_hit_ratio);
+// 导出缺失率曲线，返回点数
+int mrc_export(const MRCEstimator *mrc, uint64_t *entries, double *miss_ratios, int max_points);
+// 所有计数减半，使曲线逐步遗忘旧的访问模式
+void mrc_decay(MRCEstimator *mrc);
+void mrc_print(const MRCEstimator *mrc, double avg_entry_bytes);
+
+#endif /* DNS_MRC_H */
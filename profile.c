@@ -0,0 +1,55 @@
+#include "profile.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#define PROFILE_CALIBRATE_NS 10000000ULL  // 换算所需的最短间隔（10毫秒）
+
+_Atomic int g_profile_enabled;
+
+// 换算起点，首次开启时写入一次
+static _Atomic uint64_t g_base_ticks;
+static _Atomic uint64_t g_base_ns;
+
+static void mark_base(void) {
+    if (atomic_load(&g_base_ns)) return;
+    atomic_store(&g_base_ticks, profile_ticks());
+    atomic_store(&g_base_ns, get_monotonic_ns());
+}
+
+void profile_enable(int on) {
+    if (on) mark_base();
+    atomic_store(&g_profile_enabled, on ? 1 : 0);
+}
+
+double profile_ns_per_tick(void) {
+#ifdef PROFILE_TSC
+    mark_base();
+    uint64_t base_ns = atomic_load(&g_base_ns);
+    uint64_t elapsed = get_monotonic_ns() - base_ns;
+    if (elapsed < PROFILE_CALIBRATE_NS) {
+#ifdef _WIN32
+        Sleep((DWORD)((PROFILE_CALIBRATE_NS - elapsed) / 1000000ULL + 1));
+#else
+        struct timespec ts = {0, (long)(PROFILE_CALIBRATE_NS - elapsed)};
+        nanosleep(&ts, NULL);
+#endif
+    }
+    uint64_t ticks = profile_ticks() - atomic_load(&g_base_ticks);
+    uint64_t ns = get_monotonic_ns() - base_ns;
+    return ticks ? (double)ns / (double)ticks : 1.0;
+#else
+    return 1.0;
+#endif
+}
+
+const char *profile_clock_name(void) {
+#ifdef PROFILE_TSC
+    return "tsc";
+#else
+    return "monotonic";
+#endif
+}
@@ -0,0 +1,47 @@
+#ifndef DNS_PROFILE_H
+#define DNS_PROFILE_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "util.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define PROFILE_TSC 1
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define PROFILE_TSC 1
+#endif
+
+/*
+ * 分阶段剖析的开关与时钟。关闭时每个查询只多一次宽松读取和几个可预测的分支；
+ * 开启后各阶段以时钟刻度计时：x86上读TSC（约20个周期，不陷入内核），其他平台退化为单调时钟纳秒。
+ * 刻度与纳秒的换算在输出时按开启以来的TSC增量与单调时钟增量求得，不需要单独校准。
+ */
+extern _Atomic int g_profile_enabled;
+
+static inline int profile_enabled(void) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_expect(atomic_load_explicit(&g_profile_enabled, memory_order_relaxed), 0);
+#else
+    return atomic_load_explicit(&g_profile_enabled, memory_order_relaxed);
+#endif
+}
+
+static inline uint64_t profile_ticks(void) {
+#ifdef PROFILE_TSC
+    return __rdtsc();
+#else
+    return get_monotonic_ns();
+#endif
+}
+
+// 开启或关闭剖析，首次开启时记下换算的起点
+void profile_enable(int on);
+// 每个时钟刻度对应的纳秒数；开启不久时先等待一小段时间使换算稳定
+double profile_ns_per_tick(void);
+// 时钟来源的名称（"tsc"或"monotonic"）
+const char *profile_clock_name(void);
+
+#endif /* DNS_PROFILE_H */
@@ -1,90 +1,346 @@
 #include "protocol.h"
 
-// 解析DNS查询包中的域名
-int parse_dns_name(const uint8_t* data, int offset, char* domain, int maxlen) {
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define DNS_NAME_SSE2 1
+#endif
+
+#define DNS_MAX_WIRE_NAME 255  // 线格式域名最大长度（含结尾的0）
+
+// 标签中不接受的字符：空白与控制字符、非ASCII字节，以及会破坏点分表示的'.'
+static inline int label_char_invalid(uint8_t c) {
+    return c <= 0x20 || c >= 0x7F || c == '.';
+}
+
+/**
+ * 拷贝一个标签，同时转为小写并校验字符
+ * src之后至少有avail个字节可读，dst之后至少有room个字节可写；
+ * 两者都足够时每次处理16字节，超出标签的部分在掩码中忽略，写入的多余字节随后被覆盖。
+ * @return 0成功，-1含非法字符
+ */
+static inline int copy_label(char* dst, int room, const uint8_t* src, int avail, int len) {
+    int k = 0;
+#ifdef DNS_NAME_SSE2
+    const __m128i bias = _mm_set1_epi8((char)(0x80 - 'A'));
+    const __m128i upper_limit = _mm_set1_epi8((char)(-128 + 26));
+    const __m128i case_bit = _mm_set1_epi8(0x20);
+    const __m128i min_char = _mm_set1_epi8(0x21);
+    const __m128i del = _mm_set1_epi8(0x7F);
+    const __m128i dot = _mm_set1_epi8('.');
+    for (; k < len && avail - k >= 16 && room - k >= 16; k += 16) {
+        __m128i x = _mm_loadu_si128((const __m128i*)(src + k));
+        // 'A'..'Z'平移后恰好落在有符号最小的26个值上
+        __m128i is_upper = _mm_cmplt_epi8(_mm_add_epi8(x, bias), upper_limit);
+        // 有符号比较下0x80及以上的字节同样小于0x21
+        __m128i bad = _mm_or_si128(_mm_cmplt_epi8(x, min_char),
+                                   _mm_or_si128(_mm_cmpeq_epi8(x, del), _mm_cmpeq_epi8(x, dot)));
+        int n = len - k < 16 ? len - k : 16;
+        if (_mm_movemask_epi8(bad) & ((1 << n) - 1)) return -1;
+        _mm_storeu_si128((__m128i*)(dst + k), _mm_or_si128(x, _mm_and_si128(is_upper, case_bit)));
+    }
+#endif
+    for (; k < len; k++) {
+        uint8_t c = src[k];
+        if (label_char_invalid(c)) return -1;
+        dst[k] = (char)((c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c);
+    }
+    return 0;
+}
+
+/**
+ * 解析报文中的域名，结果为小写点分形式
+ * 所有读取都以报文实际长度为界；标签长度不超过63、整个名称不超过255字节；
+ * 压缩指针只能指向比上一次跳转目标更早的位置，因此不会成环。
+ * @param data 报文
+ * @param data_len 报文实际长度
+ * @param offset 名称在报文中的起始偏移
+ * @return 名称在原位置占用的字节数，报文非法时返回-1
+ */
+int parse_dns_name(const uint8_t* data, int data_len, int offset, char* domain, int maxlen) {
+    if (offset < 0 || offset >= data_len || maxlen <= 0) return -1;
     int i = offset, j = 0;
-    uint8_t len;
-    int jumped = 0;         // 标记是否遇到压缩指针
-    int i_origin;    // 保存主路径偏移
+    int end = -1;         // 主路径上名称之后的位置，遇到第一个压缩指针时确定
+    int limit = offset;   // 压缩指针的目标必须小于该位置且不在头部内
+    int wire_len = 1;     // 已展开的线格式长度（计入结尾的0）
 
-    while ((len = data[i]) != 0) {
-        // 检查是否是压缩指针（最高两位为11）
+    for (;;) {
+        if (i >= data_len) return -1;
+        uint8_t len = data[i];
+        if (len == 0) break;
         if ((len & 0xC0) == 0xC0) {
-            if (!jumped) {
-                i_origin = i;  // 记录此时的i
-                jumped = 1;
-            }
-            // 提取压缩指针偏移量（两个字节）
-            i = ((len & 0x3F) << 8) | data[i + 1];
-        } else {
-        i++;  // 跳过长度字节
+            // 压缩指针（最高两位为11）
+            if (i + 1 >= data_len) return -1;
+            int target = ((len & 0x3F) << 8) | data[i + 1];
+            if (target >= limit || target < DNS_HEADER_SIZE) return -1;
+            if (end < 0) end = i + 2;
+            limit = target;
+            i = target;
+            continue;
+        }
+        if (len & 0xC0) return -1;  // 01与10开头为已废弃的扩展标签类型
+        wire_len += 1 + len;
+        if (wire_len > DNS_MAX_WIRE_NAME || i + 1 + len > data_len) return -1;
         // 每个 label 前加 '.'（除了第一个）
         if (j > 0) domain[j++] = '.';
-        if (j + len >= maxlen - 1) return -1;
-        memcpy(domain + j, data + i, len);
-        i += len;  j += len;
-        }
+        if (j + len >= maxlen) return -1;
+        if (copy_label(domain + j, maxlen - j, data + i + 1, data_len - i - 1, len) < 0) return -1;
+        i += 1 + len;
+        j += len;
     }
     domain[j] = '\0';
-    return jumped ? i_origin + 2 - offset : i + 1 - offset;
-}
-
-
-// 构造DNS响应包
-int build_standard_dns_response(uint8_t* response, const uint8_t* request, int question_len, const char* ip) {
-    DNSHeader* header;
-    uint32_t ip_addr;
-    // 1. 复制请求包头
-    memcpy(response, request, sizeof(DNSHeader));
-    // 2. 复制原始问题区
-    memcpy(response + sizeof(DNSHeader), request + sizeof(DNSHeader), question_len);
-    // 3. 设置flags
-    header = (DNSHeader*)response;
-    header->flags = htons(0x8180);
-    header->ancount = htons(1);
-    // 4. 回答区域名（压缩指针）
-    uint16_t* name = (uint16_t*)(response + sizeof(DNSHeader) + question_len);
-    *name = htons(0xC00C);
-    // 5. 构造资源记录（A记录）
-    DNS_RR* rr = (DNS_RR*)(name + 1);
-    rr->type = htons(DNS_TYPE_A);
-    rr->class = htons(DNS_CLASS_IN);
-    rr->ttl = htonl(300);
-    rr->rdlength = htons(4);
-    inet_pton(AF_INET, ip, (uint8_t*)rr + sizeof(DNS_RR));
-    return sizeof(DNSHeader) + question_len + 2 + sizeof(DNS_RR) + 4;  // 返回包长度
-}
-
-// 构造IPv6 DNS响应包
-int build_ipv6_dns_response(uint8_t* response, const uint8_t* request, int question_len, const char* ip) {
-    DNSHeader* header;
-    // 1. 复制请求包头
-    memcpy(response, request, sizeof(DNSHeader));
-    // 2. 复制原始问题区
-    memcpy(response + sizeof(DNSHeader), request + sizeof(DNSHeader), question_len);
-    // 3. 设置flags
-    header = (DNSHeader*)response;
-    header->flags = htons(0x8180);
-    header->ancount = htons(1);
-    // 4. 回答区域名（压缩指针）
-    uint16_t* name = (uint16_t*)(response + sizeof(DNSHeader) + question_len);
-    *name = htons(0xC00C);
-    // 5. 构造资源记录（A记录）
-    DNS_RR* rr = (DNS_RR*)(name + 1);
-    rr->type = htons(DNS_TYPE_AAAA);
-    rr->class = htons(DNS_CLASS_IN);
-    rr->ttl = htonl(300);
-    rr->rdlength = htons(16);
-    inet_pton(AF_INET6, ip, (uint8_t*)rr + sizeof(DNS_RR));
-    return sizeof(DNSHeader) + question_len + 2 + sizeof(DNS_RR) + 16;  // 返回包长度
+    return (end < 0 ? i + 1 : end) - offset;
+}
+
+
+int build_answer_rr(uint8_t* rr, int family, const uint8_t* addr, uint32_t ttl) {
+    int addr_len = family == 4 ? 4 : (family == 6 ? 16 : 0);
+    if (addr_len == 0) return 0;
+    uint16_t type = family == 4 ? DNS_TYPE_A : DNS_TYPE_AAAA;
+    rr[0] = 0xC0;  // 压缩指针指向问题区的名称（偏移12）
+    rr[1] = 0x0C;
+    rr[2] = (uint8_t)(type >> 8);
+    rr[3] = (uint8_t)type;
+    rr[4] = 0;
+    rr[5] = DNS_CLASS_IN;
+    rr[6] = (uint8_t)(ttl >> 24);
+    rr[7] = (uint8_t)(ttl >> 16);
+    rr[8] = (uint8_t)(ttl >> 8);
+    rr[9] = (uint8_t)ttl;
+    rr[10] = 0;
+    rr[11] = (uint8_t)addr_len;
+    memcpy(rr + 12, addr, (size_t)addr_len);
+    return 12 + addr_len;
+}
+
+// 应答的标志位（主机字节序）：QR=1、RA=1，RD位沿用请求
+static inline uint16_t response_flags(const uint8_t* request, uint16_t rcode) {
+    return (uint16_t)(0x8080 | (ntohs(((const DNSHeader*)request)->flags) & DNS_FLAG_RD) | rcode);
+}
+
+void build_response_header(DNSHeader* header, const uint8_t* request, uint16_t rcode, uint16_t ancount) {
+    const DNSHeader* req = (const DNSHeader*)request;
+    header->id = req->id;
+    header->flags = htons(response_flags(request, rcode));
+    header->qdcount = htons(1);
+    header->ancount = htons(ancount);
+    header->nscount = 0;
+    header->arcount = 0;  // 不回显请求中的附加记录（如EDNS OPT）
+}
+
+// 把点分名称转为未压缩的线格式，返回长度（含结尾0），非法时返回-1
+static int encode_name(const char* name, uint8_t* wire) {
+    size_t len = strlen(name);
+    if (len > 0 && name[len - 1] == '.') len--;
+    if (len > DNS_MAX_WIRE_NAME - 2) return -1;
+    int out = 0;
+    size_t start = 0;
+    while (start < len) {
+        size_t end = start;
+        while (end < len && name[end] != '.') end++;
+        if (end == start || end - start > 63) return -1;
+        wire[out++] = (uint8_t)(end - start);
+        memcpy(wire + out, name + start, end - start);
+        out += (int)(end - start);
+        start = end + 1;
+    }
+    wire[out++] = 0;
+    return out;
+}
+
+static inline uint8_t ascii_lower(uint8_t c) {
+    return (c >= 'A' && c <= 'Z') ? (uint8_t)(c + ('a' - 'A')) : c;
+}
+
+// 比较报文off处的名称（可含压缩指针）与未压缩的线格式名称wire是否相同，忽略大小写，越出已写内容时视为不同
+static int builder_name_equal(const DNSBuilder* b, int off, const uint8_t* wire) {
+    for (int hops = 0; hops < DNS_BUILDER_MAX_NAMES + 1;) {
+        if (off >= b->len) return 0;
+        uint8_t len = b->buf[off];
+        if ((len & 0xC0) == 0xC0) {
+            if (off + 1 >= b->len) return 0;
+            off = ((len & 0x3F) << 8) | b->buf[off + 1];
+            hops++;
+            continue;
+        }
+        if (len != *wire) return 0;
+        if (len == 0) return 1;
+        if (off + 1 + len >= b->len) return 0;
+        for (int i = 1; i <= len; i++) {
+            if (ascii_lower(b->buf[off + i]) != ascii_lower(wire[i])) return 0;
+        }
+        off += 1 + len;
+        wire += 1 + len;
+    }
+    return 0;
+}
+
+// 登记一个可被引用的名称位置（压缩指针只能表示14位偏移）
+static void builder_remember(DNSBuilder* b, int off) {
+    if (b->name_count < DNS_BUILDER_MAX_NAMES && off < 0x4000) b->names[b->name_count++] = (uint16_t)off;
+}
+
+// 写入名称：找到报文中已有的最长相同后缀，之前的标签原样写出，其余用压缩指针代替
+static int builder_put_name(DNSBuilder* b, const char* name) {
+    uint8_t wire[DNS_MAX_WIRE_NAME];
+    int wire_len = encode_name(name, wire);
+    if (wire_len < 0) return -1;
+
+    int pos = 0, target = -1;
+    for (; wire[pos] != 0; pos += 1 + wire[pos]) {
+        for (int i = 0; i < b->name_count && target < 0; i++) {
+            if (builder_name_equal(b, b->names[i], wire + pos)) target = b->names[i];
+        }
+        if (target >= 0) break;
+    }
+    int need = pos + (target >= 0 ? 2 : 1);
+    if (b->len + need > b->cap) return -1;
+    for (int p = 0; p < pos; p += 1 + wire[p]) builder_remember(b, b->len + p);
+    memcpy(b->buf + b->len, wire, (size_t)pos);
+    b->len += pos;
+    if (target >= 0) {
+        b->buf[b->len++] = (uint8_t)(0xC0 | (target >> 8));
+        b->buf[b->len++] = (uint8_t)target;
+    } else {
+        b->buf[b->len++] = 0;
+    }
+    return 0;
+}
+
+static int builder_put(DNSBuilder* b, const void* data, int len) {
+    if (b->len + len > b->cap) return -1;
+    memcpy(b->buf + b->len, data, (size_t)len);
+    b->len += len;
+    return 0;
+}
+
+static int builder_put16(DNSBuilder* b, uint16_t v) {
+    uint16_t n = htons(v);
+    return builder_put(b, &n, 2);
+}
+
+static int builder_put32(DNSBuilder* b, uint32_t v) {
+    uint32_t n = htonl(v);
+    return builder_put(b, &n, 4);
+}
+
+void dns_builder_init(DNSBuilder* b, uint8_t* buf, int cap) {
+    memset(b, 0, sizeof(*b));
+    b->buf = buf;
+    b->cap = cap;
+    b->len = DNS_HEADER_SIZE;
+}
+
+int dns_builder_question(DNSBuilder* b, const char* name, uint16_t qtype, uint16_t qclass) {
+    if (b->section != 0 || b->full) return -1;
+    int saved_len = b->len, saved_names = b->name_count;
+    if (builder_put_name(b, name) < 0 || builder_put16(b, qtype) < 0 || builder_put16(b, qclass) < 0) {
+        b->len = saved_len;
+        b->name_count = saved_names;
+        return -1;
+    }
+    b->counts[0]++;
+    return 0;
+}
+
+int dns_builder_question_raw(DNSBuilder* b, const uint8_t* question, int question_len) {
+    if (b->section != 0 || b->full || question_len < 5) return -1;
+    // 名称必须未压缩且恰好在类型与类之前结束，否则之后的压缩指针会引用到报文之外
+    int name_len = 0;
+    while (name_len < question_len - 4 && question[name_len] != 0) {
+        if (question[name_len] & 0xC0) return -1;
+        name_len += 1 + question[name_len];
+    }
+    if (name_len != question_len - 5) return -1;
+    int off = b->len;
+    if (builder_put(b, question, question_len) < 0) return -1;
+    // 每个标签处都可被引用
+    for (int p = off; b->buf[p] != 0; p += 1 + b->buf[p]) builder_remember(b, p);
+    b->counts[0]++;
+    return 0;
+}
+
+/**
+ * 开始一条记录：写入属主名称、类型、类、TTL与占位的RDLENGTH（区的顺序由调用者先行检查），
+ * 返回RDLENGTH所在偏移，随后由调用者写入RDATA，再调用builder_end_rr回填长度或回滚。
+ */
+static int builder_begin_rr(DNSBuilder* b, const char* name, uint16_t type, uint16_t rclass, uint32_t ttl) {
+    if (builder_put_name(b, name) < 0 || builder_put16(b, type) < 0 || builder_put16(b, rclass) < 0 ||
+        builder_put32(b, ttl) < 0) {
+        return -1;
+    }
+    int rdlength_off = b->len;
+    return builder_put16(b, 0) < 0 ? -1 : rdlength_off;
+}
+
+static int builder_end_rr(DNSBuilder* b, int rdlength_off, int ok, int start, int names, int section) {
+    if (!ok || b->len - rdlength_off - 2 > 0xFFFF) {
+        // 整条丢弃，之后的记录也不再追加，避免后面的区出现而前面的区不完整
+        b->len = start;
+        b->name_count = names;
+        b->full = 1;
+        if (section != DNS_SECTION_ADDITIONAL) b->tc = 1;
+        return -1;
+    }
+    uint16_t rdlength = htons((uint16_t)(b->len - rdlength_off - 2));
+    memcpy(b->buf + rdlength_off, &rdlength, 2);
+    b->counts[section]++;
+    return 0;
+}
+
+static int builder_check_section(DNSBuilder* b, int section) {
+    if (b->full || section < b->section || section < DNS_SECTION_ANSWER || section > DNS_SECTION_ADDITIONAL) {
+        return -1;
+    }
+    b->section = section;
+    return 0;
+}
+
+int dns_builder_add_rr(DNSBuilder* b, int section, const char* name, uint16_t type, uint16_t rclass, uint32_t ttl,
+                       const uint8_t* rdata, uint16_t rdlength) {
+    if (builder_check_section(b, section) < 0) return -1;
+    int start = b->len, names = b->name_count;
+    int rdlength_off = builder_begin_rr(b, name, type, rclass, ttl);
+    int ok = rdlength_off >= 0 && builder_put(b, rdata, rdlength) == 0;
+    return builder_end_rr(b, rdlength_off, ok, start, names, section);
+}
+
+int dns_builder_add_soa(DNSBuilder* b, int section, const char* zone, uint32_t ttl, const DNSSOA* soa) {
+    if (builder_check_section(b, section) < 0) return -1;
+    int start = b->len, names = b->name_count;
+    int rdlength_off = builder_begin_rr(b, zone, DNS_TYPE_SOA, DNS_CLASS_IN, ttl);
+    int ok = rdlength_off >= 0 && builder_put_name(b, soa->mname) == 0 && builder_put_name(b, soa->rname) == 0 &&
+             builder_put32(b, soa->serial) == 0 && builder_put32(b, soa->refresh) == 0 &&
+             builder_put32(b, soa->retry) == 0 && builder_put32(b, soa->expire) == 0 &&
+             builder_put32(b, soa->minimum) == 0;
+    return builder_end_rr(b, rdlength_off, ok, start, names, section);
+}
+
+int dns_builder_finish(DNSBuilder* b, uint16_t id, uint16_t flags) {
+    DNSHeader* header = (DNSHeader*)b->buf;
+    header->id = htons(id);
+    header->flags = htons(b->tc ? (uint16_t)(flags | DNS_FLAG_TC) : flags);
+    header->qdcount = htons(b->counts[0]);
+    header->ancount = htons(b->counts[DNS_SECTION_ANSWER]);
+    header->nscount = htons(b->counts[DNS_SECTION_AUTHORITY]);
+    header->arcount = htons(b->counts[DNS_SECTION_ADDITIONAL]);
+    return b->len;
 }
 
 // 构造DNS错误响应包，rcode为响应码
 int build_dns_error_response(uint8_t* response, const uint8_t* request, int question_len, uint16_t rcode) {
-    DNSHeader* header = (DNSHeader*)response;
-    memcpy(response, request, sizeof(DNSHeader));
-    memcpy(response + sizeof(DNSHeader), request + sizeof(DNSHeader), question_len);
-    header->flags = htons(0x8180 | rcode);
-    header->ancount = 0;
-    return sizeof(DNSHeader) + question_len;
+    DNSBuilder b;
+    dns_builder_init(&b, response, MAX_DNS_PACKET_SIZE);
+    dns_builder_question_raw(&b, request + DNS_HEADER_SIZE, question_len);
+    return dns_builder_finish(&b, ntohs(((const DNSHeader*)request)->id), response_flags(request, rcode));
+}
+
+int build_negative_response(uint8_t* response, const uint8_t* request, int question_len, const char* domain,
+                            uint16_t rcode) {
+    static const DNSSOA soa = {"localhost", "hostmaster.localhost", 1, 3600, 600, 86400, DNS_NEGATIVE_TTL};
+    DNSBuilder b;
+    dns_builder_init(&b, response, MAX_DNS_PACKET_SIZE);
+    dns_builder_question_raw(&b, request + DNS_HEADER_SIZE, question_len);
+    // 属主与问题区名称相同，压缩为指向偏移12的指针
+    dns_builder_add_soa(&b, DNS_SECTION_AUTHORITY, domain[0] ? domain : ".", DNS_NEGATIVE_TTL, &soa);
+    return dns_builder_finish(&b, ntohs(((const DNSHeader*)request)->id), response_flags(request, rcode));
 }
@@ -59,15 +59,84 @@ typedef struct dns_rr {
 #define DNS_RCODE_NAME_ERROR 3
 #define DNS_RCODE_NOT_IMPLEMENTED 4
 
+// 本地表应答的TTL
+#define DNS_LOCAL_TTL 300
+// 预生成的应答记录：指向问题区名称的压缩指针(2) + 类型/类/TTL/长度(10) + 地址(4或16)
+#define DNS_ANSWER_RR_MAX 28
+// 应答记录中TTL字段的偏移，缓存应答发送前在此处填入剩余TTL
+#define DNS_ANSWER_TTL_OFFSET 6
+
 // DNS记录类型
 #define DNS_TYPE_A 1      // IPv4地址记录
+#define DNS_TYPE_SOA 6    // 授权起始记录，否定应答放在授权区
 #define DNS_TYPE_AAAA 28  // IPv6地址记录
 #define DNS_CLASS_IN 1    // Internet类
 
-int parse_dns_name(const uint8_t* data, int offset, char* domain, int maxlen);
-int build_standard_dns_response(uint8_t* response, const uint8_t* request, int question_len, const char* ip);
-int build_ipv6_dns_response(uint8_t* response, const uint8_t* request, int question_len, const char* ip);
+#define DNS_FLAG_TC 0x0200  // 报文被截断
+#define DNS_FLAG_RD 0x0100  // 期望递归
+
+// 报文各区
+#define DNS_SECTION_ANSWER 1
+#define DNS_SECTION_AUTHORITY 2
+#define DNS_SECTION_ADDITIONAL 3
+
+// 本地合成的否定应答（拦截、类型不符）附带的SOA记录的TTL及否定缓存时间
+#define DNS_NEGATIVE_TTL 60
+// 报文构造器的名称压缩字典容量
+#define DNS_BUILDER_MAX_NAMES 32
+
+// SOA记录的数据部分
+typedef struct dns_soa {
+    const char* mname;  // 主服务器名
+    const char* rname;  // 管理员邮箱（'@'写作'.'）
+    uint32_t serial;
+    uint32_t refresh;
+    uint32_t retry;
+    uint32_t expire;
+    uint32_t minimum;   // 否定应答的缓存时间
+} DNSSOA;
+
+/*
+ * 通用报文构造器：按问题、回答、授权、附加的顺序追加记录，
+ * 名称自动使用压缩指针引用报文中已出现过的相同后缀。
+ * 报文长度受cap限制，放不下的记录整条丢弃：回答区或授权区的记录被丢弃时
+ * 置TC位，附加区的记录被丢弃时不置（RFC 2181 9节）。
+ */
+typedef struct dns_builder {
+    uint8_t* buf;
+    int cap;             // 报文长度上限
+    int len;             // 已写入的长度（含12字节头部）
+    int section;         // 当前所在的区，只能前进
+    int full;            // 已有记录被丢弃，之后不再追加
+    int tc;              // 是否需要置TC位
+    uint16_t counts[4];  // 问题、回答、授权、附加记录数
+    uint16_t names[DNS_BUILDER_MAX_NAMES];  // 可被压缩指针引用的名称偏移
+    int name_count;
+} DNSBuilder;
+
+void dns_builder_init(DNSBuilder* b, uint8_t* buf, int cap);
+// 追加问题，name为点分形式
+int dns_builder_question(DNSBuilder* b, const char* name, uint16_t qtype, uint16_t qclass);
+// 原样追加请求中的问题区（未压缩的名称 + 类型 + 类），保留客户端的大小写，名称含压缩指针或长度不符时返回-1
+int dns_builder_question_raw(DNSBuilder* b, const uint8_t* question, int question_len);
+// 追加一条资源记录，section为DNS_SECTION_*，成功返回0，放不下返回-1
+int dns_builder_add_rr(DNSBuilder* b, int section, const char* name, uint16_t type, uint16_t rclass, uint32_t ttl,
+                       const uint8_t* rdata, uint16_t rdlength);
+// 追加SOA记录，数据中的两个名称同样参与压缩
+int dns_builder_add_soa(DNSBuilder* b, int section, const char* zone, uint32_t ttl, const DNSSOA* soa);
+// 写入头部（id为主机字节序），返回报文长度
+int dns_builder_finish(DNSBuilder* b, uint16_t id, uint16_t flags);
+
+// 解析报文中偏移offset处的域名（转为小写），返回名称占用的字节数，报文非法（含指向头部的压缩指针）时返回-1
+int parse_dns_name(const uint8_t* data, int data_len, int offset, char* domain, int maxlen);
+// 生成线格式的A/AAAA应答记录（名称为0xC00C），family为4或6，返回记录长度，family非法返回0
+int build_answer_rr(uint8_t* rr, int family, const uint8_t* addr, uint32_t ttl);
+// 生成应答报文头部：沿用请求的ID与RD位，问题数1，回答数ancount
+void build_response_header(DNSHeader* header, const uint8_t* request, uint16_t rcode, uint16_t ancount);
 // 构造DNS查询失败响应包（如Name Error等）
 int build_dns_error_response(uint8_t* response, const uint8_t* request, int question_len, uint16_t rcode);
+// 构造本地合成的否定应答（NXDOMAIN或无数据），授权区附带以查询名称为属主的SOA记录
+int build_negative_response(uint8_t* response, const uint8_t* request, int question_len, const char* domain,
+                            uint16_t rcode);
 
 #endif /* DNS_PROTOCOL_H */
@@ -0,0 +1,199 @@
+#include "qlog.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#define QLOG_ALIGN(n) (((n) + 7u) & ~(size_t)7u)
+
+static void qlog_sleep_ms(int ms) {
+#ifdef _WIN32
+    Sleep(ms);
+#else
+    struct timespec ts = {0, ms * 1000000L};
+    nanosleep(&ts, NULL);
+#endif
+}
+
+// 打开新的日志文件并写入文件头
+static int qlog_open_file(QueryLog *log) {
+    log->fp = fopen(log->path, "wb");
+    if (!log->fp) return -1;
+    setvbuf(log->fp, NULL, _IOFBF, 1 << 16);
+    QLogFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, QLOG_MAGIC, sizeof(header.magic));
+    header.byte_order = QLOG_BYTE_ORDER;
+    struct timeval tv;
+    get_now(&tv);
+    header.mono_base_ns = get_monotonic_ns();
+    header.real_base_ns = (uint64_t)tv.tv_sec * 1000000000ULL + (uint64_t)tv.tv_usec * 1000ULL;
+    fwrite(&header, sizeof(header), 1, log->fp);
+    log->file_bytes = sizeof(header);
+    return 0;
+}
+
+// path -> path.1 -> path.2 ...，超出保留数的最旧文件被删除
+static void qlog_rotate(QueryLog *log) {
+    char from[sizeof(log->path) + 16], to[sizeof(log->path) + 16];
+    fclose(log->fp);
+    log->fp = NULL;
+    snprintf(to, sizeof(to), "%s.%d", log->path, log->max_files);
+    remove(to);
+    for (int i = log->max_files - 1; i >= 1; i--) {
+        snprintf(from, sizeof(from), "%s.%d", log->path, i);
+        snprintf(to, sizeof(to), "%s.%d", log->path, i + 1);
+        rename(from, to);
+    }
+    if (log->max_files > 0) {
+        snprintf(to, sizeof(to), "%s.1", log->path);
+        rename(log->path, to);
+    }
+    if (qlog_open_file(log) < 0) printf("查询日志轮转失败，无法创建 %s\n", log->path);
+    atomic_fetch_add(&log->rotations, 1);
+}
+
+// 取走一个缓冲区中已提交的全部记录，返回取走的记录数
+static uint64_t qlog_drain(QueryLog *log, QLogRing *ring) {
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint64_t records = 0;
+    while (tail < head) {
+        uint32_t off = (uint32_t)(tail & (ring->size - 1));
+        const QLogRecord *rec = (const QLogRecord *)(ring->data + off);
+        if (rec->length == 0) {  // 末尾填充，跳回缓冲区开头
+            tail += ring->size - off;
+            continue;
+        }
+        size_t padded = QLOG_ALIGN(rec->length);
+        if (log->fp) {
+            // 文件中同样按8字节对齐，便于读取方直接按结构体访问
+            fwrite(rec, padded, 1, log->fp);
+            log->file_bytes += padded;
+        }
+        tail += padded;
+        records++;
+    }
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+    return records;
+}
+
+static void *qlog_writer(void *arg) {
+    QueryLog *log = arg;
+    for (;;) {
+        int stopping = atomic_load(&log->stop);
+        uint64_t records = 0;
+        for (int i = 0; i < log->ring_count; i++) records += qlog_drain(log, &log->rings[i]);
+        if (records) {
+            atomic_fetch_add_explicit(&log->written, records, memory_order_relaxed);
+            if (log->fp && log->file_bytes >= log->max_file_bytes) qlog_rotate(log);
+            continue;
+        }
+        // 缓冲区全空：把已写的内容交给内核后休眠，停止时先把剩余记录写完
+        if (log->fp) fflush(log->fp);
+        if (stopping) break;
+        qlog_sleep_ms(QLOG_WRITER_IDLE_MS);
+    }
+    return NULL;
+}
+
+int qlog_open(QueryLog *log, const char *path, int rings, uint32_t ring_bytes, uint64_t max_file_bytes,
+              int max_files) {
+    memset(log, 0, sizeof(*log));
+    if (rings < 1 || rings > QLOG_MAX_RINGS) return -1;
+    strncpy(log->path, path, sizeof(log->path) - 1);
+    log->ring_count = rings;
+    log->max_file_bytes = max_file_bytes;
+    log->max_files = max_files;
+    uint32_t size = 4096;
+    while (size < ring_bytes && size < (1u << 30)) size <<= 1;
+    for (int i = 0; i < rings; i++) {
+        log->rings[i].data = calloc(1, size);
+        log->rings[i].size = size;
+        if (!log->rings[i].data) goto fail;
+    }
+    if (qlog_open_file(log) < 0) {
+        printf("无法创建查询日志 %s\n", path);
+        goto fail;
+    }
+    if (pthread_create(&log->writer, NULL, qlog_writer, log) != 0) {
+        fclose(log->fp);
+        goto fail;
+    }
+    printf("查询日志写入 %s（单个文件上限 %llu 字节，保留 %d 个旧文件）\n", path, (unsigned long long)max_file_bytes,
+           max_files);
+    return 0;
+
+fail:
+    for (int i = 0; i < rings; i++) free(log->rings[i].data);
+    memset(log, 0, sizeof(*log));
+    return -1;
+}
+
+void qlog_close(QueryLog *log) {
+    if (!log->ring_count) return;
+    atomic_store(&log->stop, 1);
+    pthread_join(log->writer, NULL);
+    if (log->fp) fclose(log->fp);
+    for (int i = 0; i < log->ring_count; i++) free(log->rings[i].data);
+    log->ring_count = 0;
+}
+
+int qlog_append(QueryLog *log, int ring_index, uint8_t kind, uint8_t path, uint32_t client_ip, uint16_t client_port,
+                uint64_t time_ns, const QLogPiece *pieces, int piece_count) {
+    QLogRing *ring = &log->rings[ring_index];
+    size_t msg_len = 0;
+    for (int i = 0; i < piece_count; i++) msg_len += pieces[i].len;
+    size_t length = sizeof(QLogRecord) + msg_len;
+    size_t need = QLOG_ALIGN(length);
+    if (length > UINT16_MAX || need > ring->size / 2) return -1;
+
+    uint64_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    uint32_t off = (uint32_t)(head & (ring->size - 1));
+    uint32_t contiguous = ring->size - off;
+    // 末尾放不下整条记录时先用填充占满末尾，记录从缓冲区开头写起
+    uint64_t total = need > contiguous ? contiguous + need : need;
+    if (head + total - tail > ring->size) {
+        atomic_store_explicit(&ring->dropped, atomic_load_explicit(&ring->dropped, memory_order_relaxed) + 1,
+                              memory_order_relaxed);
+        return -1;
+    }
+    if (need > contiguous) {
+        ((QLogRecord *)(ring->data + off))->length = 0;
+        head += contiguous;
+        off = 0;
+    }
+
+    QLogRecord *rec = (QLogRecord *)(ring->data + off);
+    rec->length = (uint16_t)length;
+    rec->kind = kind;
+    rec->path = path;
+    rec->client_ip = client_ip;
+    rec->client_port = client_port;
+    rec->msg_len = (uint16_t)msg_len;
+    rec->reserved = 0;
+    rec->time_ns = time_ns;
+    uint8_t *p = (uint8_t *)(rec + 1);
+    for (int i = 0; i < piece_count; i++) {
+        memcpy(p, pieces[i].data, pieces[i].len);
+        p += pieces[i].len;
+    }
+    memset(p, 0, need - length);
+    atomic_store_explicit(&ring->head, head + need, memory_order_release);
+    return 0;
+}
+
+uint64_t qlog_dropped(const QueryLog *log) {
+    uint64_t dropped = 0;
+    for (int i = 0; i < log->ring_count; i++) {
+        dropped += atomic_load_explicit(&log->rings[i].dropped, memory_order_relaxed);
+    }
+    return dropped;
+}
@@ -0,0 +1,97 @@
+#ifndef DNS_QLOG_H
+#define DNS_QLOG_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define QLOG_MAX_RINGS 32                 // 每个服务线程一个环形缓冲区
+#define QLOG_MAGIC "DNSQLOG1"
+#define QLOG_BYTE_ORDER 0x01020304u       // 写入时的主机字节序，读取方据此判断是否需要翻转
+#define QLOG_WRITER_IDLE_MS 5             // 缓冲区全空时写线程的休眠间隔
+#define QLOG_DEFAULT_RING_BYTES (1u << 20)
+#define QLOG_DEFAULT_FILE_BYTES (64ULL << 20)
+#define QLOG_DEFAULT_FILES 4
+
+#define QLOG_KIND_QUERY 1                 // 客户端查询（原始报文）
+#define QLOG_KIND_RESPONSE 2              // 发给客户端的应答（原始报文）
+#define QLOG_PATH_NONE 0xFF               // 查询记录或不属于任何解析路径的应答（如未实现的类型）
+
+/*
+ * 二进制查询日志文件格式（字段均为写入方的主机字节序）：
+ *   文件头 QLogFileHeader，之后是连续的记录；
+ *   每条记录为 QLogRecord 头部 + msg_len 字节的DNS报文，整体按8字节对齐补零，
+ *   length 为含头部、不含补齐的长度。
+ * 记录中的时间为单调时钟，加上文件头中两种时钟的差值即为Unix时间。
+ */
+typedef struct qlog_file_header {
+    char magic[8];          // QLOG_MAGIC
+    uint32_t byte_order;    // QLOG_BYTE_ORDER
+    uint32_t reserved;
+    uint64_t mono_base_ns;  // 打开文件时的单调时钟
+    uint64_t real_base_ns;  // 同一时刻的Unix时间（纳秒）
+} QLogFileHeader;
+
+typedef struct qlog_record {
+    uint16_t length;        // 记录长度（头部 + 报文），0表示环形缓冲区末尾的填充（只出现在内存中）
+    uint8_t kind;           // QLOG_KIND_*
+    uint8_t path;           // 应答所属的解析路径（QueryPath），查询为QLOG_PATH_NONE
+    uint32_t client_ip;     // 客户端IPv4地址（网络字节序）
+    uint16_t client_port;   // 客户端端口（网络字节序）
+    uint16_t msg_len;       // DNS报文长度
+    uint32_t reserved;
+    uint64_t time_ns;       // 单调时钟
+} QLogRecord;
+
+// 一段待写入的报文片段，应答可能由头部、问题区与应答记录几段组成
+typedef struct qlog_piece {
+    const void *data;
+    size_t len;
+} QLogPiece;
+
+/*
+ * 单生产者单消费者的字节环：服务线程只推进head，写线程只推进tail，
+ * 两者各占一条缓存行；空间不足时直接丢弃记录并计数，服务线程从不等待。
+ */
+typedef struct qlog_ring {
+    _Alignas(64) _Atomic uint64_t head;  // 已写入的总字节数（生产者）
+    _Alignas(64) _Atomic uint64_t tail;  // 已取走的总字节数（消费者）
+    _Alignas(64) _Atomic uint64_t dropped;  // 因缓冲区满丢弃的记录数（生产者单写）
+    uint8_t *data;
+    uint32_t size;  // 2的幂
+} QLogRing;
+
+typedef struct query_log {
+    QLogRing rings[QLOG_MAX_RINGS];
+    int ring_count;
+    char path[256];           // 当前日志文件，轮转后的旧文件依次为 path.1 ... path.N
+    uint64_t max_file_bytes;  // 单个文件达到此大小后轮转
+    int max_files;            // 保留的旧文件数
+    FILE *fp;
+    uint64_t file_bytes;
+    pthread_t writer;
+    atomic_int stop;
+    _Atomic uint64_t written;    // 已写入文件的记录数
+    _Atomic uint64_t rotations;
+} QueryLog;
+
+/**
+ * 打开日志文件并启动写线程，rings为服务线程数，ring_bytes为每个缓冲区的大小（向上取2的幂）。
+ * @return 成功返回0，失败返回-1。
+ */
+int qlog_open(QueryLog *log, const char *path, int rings, uint32_t ring_bytes, uint64_t max_file_bytes,
+              int max_files);
+// 写出缓冲区中剩余的记录后停止写线程并关闭文件
+void qlog_close(QueryLog *log);
+/**
+ * 追加一条记录到ring号缓冲区（只能由对应的服务线程调用），报文由若干片段拼接。
+ * @return 成功返回0，缓冲区满时丢弃并返回-1。
+ */
+int qlog_append(QueryLog *log, int ring, uint8_t kind, uint8_t path, uint32_t client_ip, uint16_t client_port,
+                uint64_t time_ns, const QLogPiece *pieces, int piece_count);
+// 所有缓冲区累计丢弃的记录数
+uint64_t qlog_dropped(const QueryLog *log);
+
+#endif /* DNS_QLOG_H */
@@ -0,0 +1,56 @@
+#include "qsbr.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+void qsbr_init(QSBR *q) {
+    atomic_init(&q->global_epoch, 1);
+    atomic_init(&q->reader_count, 0);
+    for (int i = 0; i < QSBR_MAX_READERS; i++) atomic_init(&q->readers[i].epoch, QSBR_OFFLINE);
+}
+
+int qsbr_register(QSBR *q) {
+    int id = atomic_fetch_add(&q->reader_count, 1);
+    if (id >= QSBR_MAX_READERS) {
+        atomic_fetch_sub(&q->reader_count, 1);
+        return -1;
+    }
+    qsbr_online(q, id);
+    return id;
+}
+
+static void qsbr_pause(void) {
+#ifdef _WIN32
+    Sleep(1);
+#else
+    struct timespec ts = {0, 1000000};
+    nanosleep(&ts, NULL);
+#endif
+}
+
+uint64_t qsbr_advance(QSBR *q) { return atomic_fetch_add(&q->global_epoch, 1) + 1; }
+
+static int qsbr_reader_passed(QSBR *q, int reader, uint64_t target) {
+    uint64_t epoch = atomic_load(&q->readers[reader].epoch);
+    return epoch == QSBR_OFFLINE || epoch >= target;
+}
+
+int qsbr_poll(QSBR *q, uint64_t target) {
+    int count = atomic_load(&q->reader_count);
+    for (int i = 0; i < count; i++) {
+        if (!qsbr_reader_passed(q, i, target)) return 0;
+    }
+    return 1;
+}
+
+void qsbr_synchronize(QSBR *q) {
+    // 推进纪元，然后等待每个在线读者报告不早于新纪元的静止状态
+    uint64_t target = qsbr_advance(q);
+    int count = atomic_load(&q->reader_count);
+    for (int i = 0; i < count; i++) {
+        while (!qsbr_reader_passed(q, i, target)) qsbr_pause();
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef DNS_QSBR_H
+#define DNS_QSBR_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define QSBR_MAX_READERS 64
+#define QSBR_OFFLINE UINT64_MAX  // 读者处于离线状态（如阻塞在select中），不持有任何共享指针
+
+/*
+ * 静止状态回收（QSBR）：读者在两次请求之间报告“静止”，写者替换共享指针后
+ * 调用qsbr_synchronize等待所有读者都至少经过一次静止状态，此后旧对象即可释放。
+ * 读者一侧只有一次原子存储，从不阻塞；等待只发生在写者（后台线程）中。
+ */
+typedef struct qsbr_reader {
+    _Atomic uint64_t epoch;  // 该读者最近一次静止时看到的全局纪元
+    char pad[56];            // 独占缓存行，避免读者之间伪共享
+} QSBRReader;
+
+typedef struct qsbr {
+    _Atomic uint64_t global_epoch;
+    _Atomic int reader_count;
+    QSBRReader readers[QSBR_MAX_READERS];
+} QSBR;
+
+void qsbr_init(QSBR *q);
+// 注册读者，返回读者编号，超过上限返回-1
+int qsbr_register(QSBR *q);
+// 等待此前发布的所有替换对全部读者可见，之后可安全释放旧对象
+void qsbr_synchronize(QSBR *q);
+// 推进纪元并返回新纪元，对象移出共享结构后记下该值，之后用qsbr_poll判断能否释放
+uint64_t qsbr_advance(QSBR *q);
+// 不等待地检查所有在线读者是否都已报告不早于target的静止状态
+int qsbr_poll(QSBR *q, uint64_t target);
+
+static inline void qsbr_quiescent(QSBR *q, int reader) {
+    atomic_store_explicit(&q->readers[reader].epoch, atomic_load_explicit(&q->global_epoch, memory_order_acquire),
+                          memory_order_release);
+}
+
+static inline void qsbr_offline(QSBR *q, int reader) {
+    atomic_store_explicit(&q->readers[reader].epoch, QSBR_OFFLINE, memory_order_release);
+}
+
+static inline void qsbr_online(QSBR *q, int reader) {
+    qsbr_quiescent(q, reader);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+#endif /* DNS_QSBR_H */
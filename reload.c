@@ -0,0 +1,73 @@
+#include "reload.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include "util.h"
+
+void table_reloader_init(TableReloader *r, _Atomic(DNSTable *) *slot, const char *filename) {
+    memset(r, 0, sizeof(*r));
+    r->slot = slot;
+    qsbr_init(&r->qsbr);
+    strncpy(r->filename, filename, sizeof(r->filename) - 1);
+    atomic_init(&r->busy, 0);
+    atomic_init(&r->reloads, 0);
+    pthread_mutex_init(&r->lock, NULL);
+}
+
+static void *reload_thread(void *arg) {
+    TableReloader *r = arg;
+    DNSTable *fresh = NULL;
+
+    // 在后台线程中完整构建新表，失败时保留旧表继续服务
+    int count = load_dns_table(r->filename, &fresh);
+    if (count < 0 && !atomic_load(r->slot)) {
+        printf("加载本地表失败，继续以只转发模式运行: %s\n", r->filename);
+    } else if (count < 0) {
+        printf("重新加载本地表失败，继续使用旧表: %s\n", r->filename);
+    } else {
+        DNSTable *old = atomic_exchange(r->slot, fresh);
+        if (old) {
+            qsbr_synchronize(&r->qsbr);  // 等待所有读者离开旧表
+            free_dns_table(old);
+            atomic_fetch_add(&r->reloads, 1);
+            printf("本地表已重新加载: %s，%d 条规则\n", r->filename, count);
+        } else {
+            // 启动时的后台加载：此前处于只转发模式
+            printf("本地表加载完成: %s，%d 条规则\n", r->filename, count);
+        }
+    }
+    atomic_store(&r->busy, 0);
+    return NULL;
+}
+
+static void reloader_join_locked(TableReloader *r) {
+    if (!r->thread_valid) return;
+    pthread_join(r->thread, NULL);
+    r->thread_valid = 0;
+}
+
+int table_reloader_request(TableReloader *r) {
+    int expected = 0;
+    pthread_mutex_lock(&r->lock);
+    if (!atomic_compare_exchange_strong(&r->busy, &expected, 1)) {
+        pthread_mutex_unlock(&r->lock);
+        return -1;
+    }
+    reloader_join_locked(r);  // 回收上一次已结束的线程
+    int ret = 0;
+    if (pthread_create(&r->thread, NULL, reload_thread, r) != 0) {
+        atomic_store(&r->busy, 0);
+        ret = -1;
+    } else {
+        r->thread_valid = 1;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return ret;
+}
+
+void table_reloader_join(TableReloader *r) {
+    pthread_mutex_lock(&r->lock);
+    reloader_join_locked(r);
+    pthread_mutex_unlock(&r->lock);
+}
@@ -0,0 +1,32 @@
+#ifndef DNS_RELOAD_H
+#define DNS_RELOAD_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "qsbr.h"
+#include "table.h"
+
+/*
+ * 本地表热加载：后台线程在服务路径之外构建新表，
+ * 原子替换共享指针后经QSBR等待所有读者离开旧表，再释放旧表。
+ * 服务线程的查找始终无锁、从不等待。
+ */
+typedef struct table_reloader {
+    _Atomic(DNSTable *) *slot;  // 被管理的共享表指针（位于DNSContext中）
+    QSBR qsbr;                  // 表指针的读者登记
+    char filename[256];         // 重新加载的文件
+    atomic_int busy;            // 是否有加载正在进行
+    pthread_mutex_t lock;       // 串行化请求与join：0号线程（SIGHUP）与管理线程都可能发起加载
+    pthread_t thread;
+    int thread_valid;           // thread是否需要join
+    atomic_uint reloads;        // 成功替换的次数
+} TableReloader;
+
+void table_reloader_init(TableReloader *r, _Atomic(DNSTable *) *slot, const char *filename);
+// 请求后台重新加载，已有加载进行中时返回-1
+int table_reloader_request(TableReloader *r);
+// 等待进行中的加载结束
+void table_reloader_join(TableReloader *r);
+
+#endif /* DNS_RELOAD_H */
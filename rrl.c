@@ -0,0 +1,114 @@
+#include "rrl.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+#include "logging.h"
+
+// splitmix64终结混合，前缀相邻的客户端均匀落到各组
+static inline uint64_t rrl_hash(uint64_t key) {
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+static inline uint32_t rrl_random(uint32_t *state) {
+    uint32_t x = *state ? *state : 0x9e3779b9u;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+int rrl_init(RRLTable *rrl, uint32_t rate, int slip, int prefix_len, uint64_t table_bytes, int threads) {
+    memset(rrl, 0, sizeof(*rrl));
+    if (rate == 0 || rate > INT32_MAX / RRL_TOKEN_UNIT || slip < 0 || prefix_len < 1 || prefix_len > 32) return -1;
+    if (table_bytes < RRL_MIN_TABLE_BYTES) table_bytes = RRL_MIN_TABLE_BYTES;
+    uint64_t groups = 1;
+    while (groups * 2 * sizeof(RRLGroup) <= table_bytes && groups < (1ULL << 31)) groups *= 2;
+
+    size_t lock_bytes = threads > 1 ? RRL_LOCKS * sizeof(RRLLock) : 0;
+    void *storage = calloc(1, groups * sizeof(RRLGroup) + lock_bytes + 64);
+    if (!storage) {
+        LOG_WARN("响应限速表创建失败：内存分配错误\n");
+        return -1;
+    }
+    rrl->storage = storage;
+    rrl->groups = (RRLGroup *)(((uintptr_t)storage + 63) & ~(uintptr_t)63);
+    rrl->group_mask = (uint32_t)(groups - 1);
+    rrl->rate = (int32_t)rate;
+    rrl->burst = (int32_t)rate * RRL_TOKEN_UNIT;
+    rrl->slip = slip;
+    rrl->prefix_mask = prefix_len == 32 ? UINT32_MAX : ~(UINT32_MAX >> prefix_len);
+    if (lock_bytes) {
+        rrl->locks = (RRLLock *)(rrl->groups + groups);
+        for (int i = 0; i < RRL_LOCKS; i++) pthread_mutex_init(&rrl->locks[i].lock, NULL);
+    }
+    return 0;
+}
+
+void rrl_free(RRLTable *rrl) {
+    if (!rrl->storage) return;
+    if (rrl->locks) {
+        for (int i = 0; i < RRL_LOCKS; i++) pthread_mutex_destroy(&rrl->locks[i].lock);
+    }
+    free(rrl->storage);
+    memset(rrl, 0, sizeof(*rrl));
+}
+
+/*
+ * 在组内找到键对应的桶，补充自上次以来的令牌后取一个。
+ * 找不到时占用空桶，或替换最久未更新的桶，新桶以满额开始。
+ */
+static int take_token(RRLTable *rrl, RRLGroup *g, uint64_t key, uint32_t now_ms) {
+    RRLBucket *b = NULL, *victim = &g->buckets[0];
+    for (int i = 0; i < RRL_GROUP_BUCKETS; i++) {
+        RRLBucket *c = &g->buckets[i];
+        if (c->key == key) {
+            b = c;
+            break;
+        }
+        if (victim->key && (!c->key || now_ms - c->stamp_ms > now_ms - victim->stamp_ms)) victim = c;
+    }
+    if (!b) {
+        b = victim;
+        b->key = key;
+        b->tokens = rrl->burst;
+    } else {
+        int64_t tokens = b->tokens + (int64_t)(now_ms - b->stamp_ms) * rrl->rate;
+        b->tokens = tokens > rrl->burst ? rrl->burst : (int32_t)tokens;
+    }
+    b->stamp_ms = now_ms;
+    if (b->tokens < RRL_TOKEN_UNIT) return 0;
+    b->tokens -= RRL_TOKEN_UNIT;
+    return 1;
+}
+
+RRLAction rrl_check(RRLTable *rrl, uint32_t client_ip, RRLClass cls, uint64_t now_ns, uint32_t *rng) {
+    // 键的最低位恒为1，与空桶的0区分
+    uint64_t key = ((uint64_t)(ntohl(client_ip) & rrl->prefix_mask) << 8) | ((uint64_t)cls << 1) | 1;
+    uint32_t index = (uint32_t)rrl_hash(key) & rrl->group_mask;
+    uint32_t now_ms = (uint32_t)(now_ns / 1000000ULL);
+    RRLGroup *g = &rrl->groups[index];
+    int passed;
+    if (rrl->locks) {
+        pthread_mutex_t *lock = &rrl->locks[index & (RRL_LOCKS - 1)].lock;
+        pthread_mutex_lock(lock);
+        passed = take_token(rrl, g, key, now_ms);
+        pthread_mutex_unlock(lock);
+    } else {
+        passed = take_token(rrl, g, key, now_ms);
+    }
+    if (passed) return RRL_PASS;
+    return rrl->slip && rrl_random(rng) % (uint32_t)rrl->slip == 0 ? RRL_SLIP : RRL_DROP;
+}
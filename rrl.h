@@ -0,0 +1,82 @@
+#ifndef DNS_RRL_H
+#define DNS_RRL_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define RRL_GROUP_BUCKETS 4                 // 每组桶数，一组恰好占一条缓存行
+#define RRL_LOCKS 64                        // 多线程时的锁条带数
+#define RRL_DEFAULT_SLIP 2
+#define RRL_DEFAULT_PREFIX 24
+#define RRL_DEFAULT_TABLE_BYTES (1u << 20)
+#define RRL_MIN_TABLE_BYTES (4u << 10)
+#define RRL_TOKEN_UNIT 1000                 // 令牌以千分之一为单位计数，补充时不丢失零头
+
+// 应答类别，与客户端前缀一起构成限速的键
+typedef enum rrl_class {
+    RRL_CLASS_ANSWER,    // 有回答的NOERROR
+    RRL_CLASS_NODATA,    // 无回答的NOERROR
+    RRL_CLASS_NXDOMAIN,  // 域名不存在
+    RRL_CLASS_ERROR,     // SERVFAIL、NOTIMP等其他错误
+    RRL_CLASS_COUNT
+} RRLClass;
+
+typedef enum rrl_action {
+    RRL_PASS,   // 照常发送
+    RRL_SLIP,   // 以截断应答（TC=1，无回答）代替，真实客户端可改用TCP重试
+    RRL_DROP,   // 不发送
+} RRLAction;
+
+// 一个令牌桶，key为0表示空闲
+typedef struct rrl_bucket {
+    uint64_t key;       // 客户端前缀与应答类别
+    uint32_t stamp_ms;  // 上次补充令牌的时间（单调时钟毫秒，按32位回绕计算差值）
+    int32_t tokens;     // 剩余令牌（RRL_TOKEN_UNIT为一个）
+} RRLBucket;
+
+// 同一组的桶在一条缓存行内，一次检查只访问一条缓存行（单线程时）
+typedef struct rrl_group {
+    _Alignas(64) RRLBucket buckets[RRL_GROUP_BUCKETS];
+} RRLGroup;
+
+typedef struct rrl_lock {
+    _Alignas(64) pthread_mutex_t lock;
+} RRLLock;
+
+/*
+ * 响应限速表：按（客户端前缀, 应答类别）做令牌桶，每秒补充rate个令牌，最多积累rate个。
+ * 表大小在初始化时固定，键经哈希落到一组，组内找不到时替换最久未更新的桶，
+ * 被替换的多是早已补满的空闲桶，因此满载时也只是让个别客户端提前恢复满额。
+ */
+typedef struct rrl_table {
+    RRLGroup *groups;
+    uint32_t group_mask;   // 组数-1
+    int32_t rate;          // 每秒令牌数
+    int32_t burst;         // 桶容量（RRL_TOKEN_UNIT为一个）
+    int slip;              // 每slip个受限应答中平均有一个以截断应答代替，0表示全部丢弃
+    uint32_t prefix_mask;  // 客户端地址的前缀掩码（主机字节序）
+    RRLLock *locks;        // 多个服务线程共用时的锁条带，单线程时为NULL
+    void *storage;         // 按缓存行对齐前的原始内存（组与锁条带）
+} RRLTable;
+
+/**
+ * 初始化限速表，table_bytes向下取为2的幂个组；threads大于1时按锁条带保护各组。
+ * @return 成功返回0，失败返回-1。
+ */
+int rrl_init(RRLTable *rrl, uint32_t rate, int slip, int prefix_len, uint64_t table_bytes, int threads);
+void rrl_free(RRLTable *rrl);
+
+/**
+ * 为发往client_ip（网络字节序）的一个应答取令牌。
+ * @param rng 调用线程的随机数状态，受限时决定截断还是丢弃。
+ * @return 处理方式。
+ */
+RRLAction rrl_check(RRLTable *rrl, uint32_t client_ip, RRLClass cls, uint64_t now_ns, uint32_t *rng);
+
+// 按应答码与回答数确定应答类别
+static inline RRLClass rrl_classify(uint16_t rcode, uint16_t ancount) {
+    if (rcode == 0) return ancount ? RRL_CLASS_ANSWER : RRL_CLASS_NODATA;
+    return rcode == 3 ? RRL_CLASS_NXDOMAIN : RRL_CLASS_ERROR;
+}
+
+#endif /* DNS_RRL_H */
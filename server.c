@@ -1,10 +1,108 @@
 #include "server.h"
 
 #include "cache.h"
+#include "logging.h"
 #include "protocol.h"
 #include "table.h"
 #include "util.h"
 
+const char *const query_path_names[PATH_COUNT] = {"local", "blocked", "cache", "upstream", "timeout"};
+const char *const query_stage_names[STAGE_COUNT] = {"recv", "parse", "table", "cache", "rrl", "build", "send",
+                                                    "forward", "qlog", "up_recv", "up_match", "up_cache", "up_send"};
+
+// 查询序号，只在INFO级别日志启用时递增
+static _Atomic uint64_t g_query_counter;
+
+// 记录一次应答的端到端延迟
+static inline void record_latency(DNSContext *ctx, QueryPath path, uint64_t received_ns) {
+    hist_record(&ctx->stats[ctx->worker_id].latency[path], get_monotonic_ns() - received_ns);
+}
+
+void server_stats_collect(const DNSContext *ctx, QueryPath path, LatencyHist *out) {
+    for (int i = 0; i < MAX_WORKERS; i++) hist_merge(out, &ctx->stats[i].latency[path]);
+}
+
+void server_stats_collect_rtt(const DNSContext *ctx, LatencyHist *out) {
+    for (int i = 0; i < MAX_WORKERS; i++) hist_merge(out, &ctx->stats[i].upstream_rtt);
+}
+
+void server_stats_collect_stage(const DNSContext *ctx, QueryStage stage, LatencyHist *out) {
+    for (int i = 0; i < MAX_WORKERS; i++) hist_merge(out, &ctx->stats[i].stages[stage]);
+}
+
+_Atomic uint32_t g_stage_reset_gen;
+
+void server_stats_reset_stages(void) { atomic_fetch_add(&g_stage_reset_gen, 1); }
+
+uint64_t server_stats_sum(const DNSContext *ctx, size_t field) {
+    uint64_t sum = 0;
+    for (int i = 0; i < MAX_WORKERS; i++) {
+        sum += hist_load((const _Atomic uint64_t *)((const char *)&ctx->stats[i] + field));
+    }
+    return sum;
+}
+
+// 发送返回值为负时计入发送失败
+static inline void count_send(DNSContext *ctx, long ret) {
+    if (ret < 0) hist_add(&ctx->stats[ctx->worker_id].send_errors, 1);
+}
+
+// 向查询日志追加一条记录，调用前须确认ctx->qlog非空
+static void log_message(DNSContext *ctx, uint8_t kind, uint8_t path, const struct sockaddr_in *client_addr,
+                        uint64_t time_ns, const QLogPiece *pieces, int piece_count) {
+    qlog_append(ctx->qlog, ctx->worker_id, kind, path, client_addr->sin_addr.s_addr, client_addr->sin_port, time_ns,
+                pieces, piece_count);
+}
+
+// 记录发给客户端的一个完整应答报文
+static inline void log_response(DNSContext *ctx, QueryPath path, const struct sockaddr_in *client_addr,
+                                const uint8_t *response, int len) {
+    if (!ctx->qlog) return;
+    QLogPiece piece = {response, (size_t)len};
+    log_message(ctx, QLOG_KIND_RESPONSE, (uint8_t)path, client_addr, get_monotonic_ns(), &piece, 1);
+}
+
+/**
+ * @brief 响应限速：客户端前缀的本类应答令牌用尽时丢弃应答，或按slip比例改发截断应答。
+ * @param path 解析路径（QueryPath或QLOG_PATH_NONE），写入查询日志。
+ * @param query 客户端的原始查询，截断应答取其ID与问题区。
+ * @param rcode 原应答的应答码，ancount为其回答数，二者决定应答类别。
+ * @return 应答照常发送时返回0，已丢弃或已改发截断应答时返回-1。
+ */
+static int rate_limit(DNSContext *ctx, uint8_t path, const struct sockaddr_in *client_addr, const uint8_t *query,
+                      int question_len, uint16_t rcode, uint16_t ancount) {
+    if (!ctx->rrl) return 0;
+    RRLAction action = rrl_check(ctx->rrl, client_addr->sin_addr.s_addr, rrl_classify(rcode, ancount),
+                                 get_monotonic_ns(), &ctx->rrl_rng);
+    stage_mark(ctx, STAGE_RRL);
+    if (action == RRL_PASS) return 0;
+    if (action == RRL_DROP) {
+        hist_add(&ctx->stats[ctx->worker_id].rrl_dropped, 1);
+        return -1;
+    }
+    // 截断应答只有头部与问题区，比原应答小，不会被用来放大流量
+    uint8_t response[MAX_DNS_PACKET_SIZE];
+    int len = build_dns_error_response(response, query, question_len, rcode);
+    ((DNSHeader *)response)->flags |= htons(DNS_FLAG_TC);
+    stage_mark(ctx, STAGE_BUILD);
+    count_send(ctx, sendto(ctx->sock, (char *)response, len, 0, (const struct sockaddr *)client_addr,
+                           sizeof(*client_addr)));
+    stage_mark(ctx, STAGE_SEND);
+    hist_add(&ctx->stats[ctx->worker_id].rrl_slipped, 1);
+    if (ctx->qlog) {
+        QLogPiece piece = {response, (size_t)len};
+        log_message(ctx, QLOG_KIND_RESPONSE, path, client_addr, get_monotonic_ns(), &piece, 1);
+        stage_mark(ctx, STAGE_QLOG);
+    }
+    return -1;
+}
+
+// 转发表增删后更新等待数
+static inline void update_pending(DNSContext *ctx) {
+    atomic_store_explicit(&ctx->stats[ctx->worker_id].relay_pending, HASH_COUNT(ctx->relay_table),
+                          memory_order_relaxed);
+}
+
 // 定时进行状态检查，检测超时。
 void handle_timed_out_requests(DNSContext *ctx) {
     struct timeval now;
@@ -17,27 +115,34 @@ void handle_timed_out_requests(DNSContext *ctx) {
         long usec_diff = now.tv_usec - entry->timestamp.tv_usec;
 
         if (sec_diff > RELAY_TIMEOUT || (sec_diff == RELAY_TIMEOUT && usec_diff > 0)) {
-            print_debug_info("RelayEntry超时: upstream_id=%u, client_id=%u, 域名请求超时未响应，发送Server failure\n",
-                             entry->upstream_id, entry->client_id);
+            LOG_DEBUG("RelayEntry超时: upstream_id=%u, client_id=%u, 域名请求超时未响应，发送Server failure\n",
+                      entry->upstream_id, entry->client_id);
 
-            uint8_t timeout_buffer[MAX_DNS_PACKET_SIZE] = {0};
-            // 构造超时错误响应
-            int send_len =
-                build_dns_error_response(timeout_buffer, entry->query, entry->question_len, DNS_RCODE_SERVER_FAILURE);
-            // 发送超时响应给客户端
-            sendto(ctx->sock, (char *)timeout_buffer, send_len, 0, (struct sockaddr *)&entry->client_addr,
-                   sizeof(entry->client_addr));
+            if (rate_limit(ctx, PATH_TIMEOUT, &entry->client_addr, entry->query, entry->question_len,
+                           DNS_RCODE_SERVER_FAILURE, 0) == 0) {
+                uint8_t timeout_buffer[MAX_DNS_PACKET_SIZE] = {0};
+                // 构造超时错误响应
+                int send_len = build_dns_error_response(timeout_buffer, entry->query, entry->question_len,
+                                                        DNS_RCODE_SERVER_FAILURE);
+                // 发送超时响应给客户端
+                count_send(ctx, sendto(ctx->sock, (char *)timeout_buffer, send_len, 0,
+                                       (struct sockaddr *)&entry->client_addr, sizeof(entry->client_addr)));
+                record_latency(ctx, PATH_TIMEOUT, entry->received_ns);
+                log_response(ctx, PATH_TIMEOUT, &entry->client_addr, timeout_buffer, send_len);
+            }
 
             // 从转发表删除并释放内存
             HASH_DEL(ctx->relay_table, entry);
             free(entry);
         }
     }
-    // 定期清理缓存
-    if (now.tv_sec - ctx->last_cache_cleanup.tv_sec >= CACHE_CLEANUP_INTERVAL) {
+    update_pending(ctx);
+    // 定期清理缓存，缓存共享，只由0号线程负责
+    if (ctx->worker_id == 0 && now.tv_sec - ctx->last_cache_cleanup.tv_sec >= CACHE_CLEANUP_INTERVAL) {
         cache_cleanup_expired(ctx->cache);
         ctx->last_cache_cleanup = now;
         cache_print_stats(ctx->cache);
+        cache_autosize(ctx->cache);
     }
 }
 
@@ -47,12 +152,13 @@ void handle_timed_out_requests(DNSContext *ctx) {
  * @param query_buffer 包含原始客户端查询的缓冲区。
  * @param query_len 查询的长度。
  * @param client_addr 原始客户端的地址信息。
+ * @param received_ns 收到该查询时的单调时钟。
  */
 void forward_query_to_upstream(DNSContext *ctx, const uint8_t *query_buffer, int query_len, int question_section_len,
-                               struct sockaddr_in client_addr) {
+                               struct sockaddr_in client_addr, uint64_t received_ns) {
     RelayEntry *entry = malloc(sizeof(RelayEntry));
     if (!entry) {
-        printf("分配RelayEntry失败，无法转发查询\n");
+        LOG_DEBUG("分配RelayEntry失败，无法转发查询\n");
         return;
     }
 
@@ -65,7 +171,9 @@ void forward_query_to_upstream(DNSContext *ctx, const uint8_t *query_buffer, int
     memcpy(entry->query, query_buffer, query_len);
     entry->question_len = question_section_len;
     get_now(&entry->timestamp);
+    entry->received_ns = received_ns;
     HASH_ADD(hh, ctx->relay_table, upstream_id, sizeof(uint16_t), entry);
+    update_pending(ctx);
 
     // 创建一个副本进行修改，避免污染原始的接收缓冲区
     uint8_t forward_buffer[MAX_DNS_PACKET_SIZE];
@@ -75,9 +183,72 @@ void forward_query_to_upstream(DNSContext *ctx, const uint8_t *query_buffer, int
     forward_header->id = htons(entry->upstream_id);
 
     // 未命中，转发到上游DNS服务器
-    print_debug_info("转发查询到上游DNS，upstream_id=%u, client_id=%u\n", entry->upstream_id, entry->client_id);
-    sendto(ctx->upstream_sock, (char *)forward_buffer, query_len, 0, (struct sockaddr *)&ctx->upstream_addr,
-           sizeof(ctx->upstream_addr));
+    LOG_DEBUG("转发查询到上游DNS，upstream_id=%u, client_id=%u\n", entry->upstream_id, entry->client_id);
+    entry->forwarded_ns = get_monotonic_ns();
+    count_send(ctx, sendto(ctx->upstream_sock, (char *)forward_buffer, query_len, 0,
+                           (struct sockaddr *)&ctx->upstream_addr, sizeof(ctx->upstream_addr)));
+}
+
+/**
+ * @brief 以分散-聚集方式发送本地应答。
+ * 新生成的头部、客户端请求中的问题区与预生成的应答记录三段直接交给内核，
+ * 不在用户态拼接报文，也不解析任何地址字符串。
+ * @param path 解析路径，写入查询日志。
+ * @param rr 应答记录，rr_len为0时发送无回答的应答。
+ * @return 已发送返回0，被响应限速拦下返回-1。
+ */
+static int send_answer(DNSContext *ctx, QueryPath path, const struct sockaddr_in *client_addr,
+                       const uint8_t *query_buffer, int question_len, uint16_t rcode, const uint8_t *rr, int rr_len) {
+    if (rate_limit(ctx, (uint8_t)path, client_addr, query_buffer, question_len, rcode, rr_len > 0) < 0) return -1;
+    DNSHeader header;
+    build_response_header(&header, query_buffer, rcode, rr_len > 0 ? 1 : 0);
+    stage_mark(ctx, STAGE_BUILD);
+    if (ctx->qlog) {
+        QLogPiece pieces[3] = {{&header, sizeof(header)},
+                               {query_buffer + DNS_HEADER_SIZE, (size_t)question_len},
+                               {rr, (size_t)rr_len}};
+        log_message(ctx, QLOG_KIND_RESPONSE, (uint8_t)path, client_addr, get_monotonic_ns(), pieces, 3);
+        stage_mark(ctx, STAGE_QLOG);
+    }
+#ifdef _WIN32
+    WSABUF bufs[3] = {{sizeof(header), (char *)&header},
+                      {(ULONG)question_len, (char *)query_buffer + DNS_HEADER_SIZE},
+                      {(ULONG)rr_len, (char *)rr}};
+    DWORD sent;
+    count_send(ctx, WSASendTo(ctx->sock, bufs, rr_len > 0 ? 3 : 2, &sent, 0, (const struct sockaddr *)client_addr,
+                              sizeof(*client_addr), NULL, NULL));
+#else
+    struct iovec iov[3] = {{&header, sizeof(header)},
+                           {(void *)(query_buffer + DNS_HEADER_SIZE), (size_t)question_len},
+                           {(void *)rr, (size_t)rr_len}};
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = (void *)client_addr;
+    msg.msg_namelen = sizeof(*client_addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = rr_len > 0 ? 3 : 2;
+    count_send(ctx, sendmsg(ctx->sock, &msg, 0));
+#endif
+    stage_mark(ctx, STAGE_SEND);
+    return 0;
+}
+
+// 发送本地合成的否定应答（拦截为NXDOMAIN，类型不符为无数据），授权区带SOA以便客户端做否定缓存；
+// 已发送返回0，被响应限速拦下返回-1
+static int send_negative(DNSContext *ctx, QueryPath path, const struct sockaddr_in *client_addr,
+                         const uint8_t *query_buffer, int question_len, const char *domain, uint16_t rcode) {
+    if (rate_limit(ctx, (uint8_t)path, client_addr, query_buffer, question_len, rcode, 0) < 0) return -1;
+    uint8_t response[MAX_DNS_PACKET_SIZE];
+    int len = build_negative_response(response, query_buffer, question_len, domain, rcode);
+    stage_mark(ctx, STAGE_BUILD);
+    count_send(ctx, sendto(ctx->sock, (char *)response, len, 0, (const struct sockaddr *)client_addr,
+                           sizeof(*client_addr)));
+    stage_mark(ctx, STAGE_SEND);
+    if (ctx->qlog) {
+        log_response(ctx, path, client_addr, response, len);
+        stage_mark(ctx, STAGE_QLOG);
+    }
+    return 0;
 }
 
 /**
@@ -88,135 +259,156 @@ void forward_query_to_upstream(DNSContext *ctx, const uint8_t *query_buffer, int
  * @param query_len 查询数据的长度。
  */
 void handle_client_query(DNSContext *ctx, struct sockaddr_in client_addr, uint8_t *query_buffer, int query_len) {
+    uint64_t received_ns = get_monotonic_ns();
     char domain[256];
     uint8_t response_buffer[MAX_DNS_PACKET_SIZE];  // 用于发送响应的独立缓冲区
 
+    // 记录收到的原始查询（包括随后因格式错误被丢弃的）
+    if (ctx->qlog) {
+        QLogPiece piece = {query_buffer, (size_t)query_len};
+        log_message(ctx, QLOG_KIND_QUERY, QLOG_PATH_NONE, &client_addr, received_ns, &piece, 1);
+        stage_mark(ctx, STAGE_QLOG);
+    }
+
     // ----------- 基本校验 -----------
     // 检查数据包长度是否合法
     if (query_len < DNS_HEADER_SIZE) {
-        print_debug_info("收到的数据包长度过小: %d 字节\n", query_len);
+        LOG_DEBUG("收到的数据包长度过小: %d 字节\n", query_len);
+        hist_add(&ctx->stats[ctx->worker_id].malformed, 1);
         return;
     }
     DNSHeader *header = (DNSHeader *)query_buffer;
     // 检查问题数是否为1
     if (ntohs(header->qdcount) != 1) {
-        print_debug_info("收到的查询问题数不是1: %d\n", ntohs(header->qdcount));
+        LOG_DEBUG("收到的查询问题数不是1: %d\n", ntohs(header->qdcount));
+        hist_add(&ctx->stats[ctx->worker_id].malformed, 1);
         return;
     }
 
     // ----------- 解析域名 -----------
-    // 从DNS报文中解析出域名
-    int qname_len = parse_dns_name(query_buffer, DNS_HEADER_SIZE, domain, sizeof(domain));
-    if (qname_len < 0) {
-        print_debug_info("解析域名失败\n");
+    // 从DNS报文中解析出域名，问题区之前只有头部，名称中的压缩指针都会被拒绝，之后可以原样复制问题区
+    int qname_len = parse_dns_name(query_buffer, query_len, DNS_HEADER_SIZE, domain, sizeof(domain));
+    if (qname_len < 0 || DNS_HEADER_SIZE + qname_len + (int)sizeof(DNSQuestion) > query_len) {
+        LOG_DEBUG("解析域名失败\n");
+        hist_add(&ctx->stats[ctx->worker_id].malformed, 1);
         return;
     }
 
-    // 输出调试信息：时间戳、序号、查询的域名
-    print_query_debug(domain);
+    // 输出查询日志：序号与查询的域名，时间戳由日志写线程添加
+    LOG_INFO("Query #%llu, Domain: %s\n", (unsigned long long)atomic_fetch_add(&g_query_counter, 1) + 1, domain);
     // 获取查询类型和类
     DNSQuestion *question = (DNSQuestion *)(query_buffer + DNS_HEADER_SIZE + qname_len);
     uint16_t qtype = ntohs(question->qtype);
     uint16_t qclass = ntohs(question->qclass);
     int question_section_len = qname_len + sizeof(DNSQuestion);
+    stage_mark(ctx, STAGE_PARSE);
 
     // ----------- 类型判断 -----------
     // 只处理A和AAAA类型的IN类查询，其他类型直接返回未实现
     int is_a = (qtype == DNS_TYPE_A && qclass == DNS_CLASS_IN);
     int is_aaaa = (qtype == DNS_TYPE_AAAA && qclass == DNS_CLASS_IN);
     if (is_a)
-        print_debug_info("收到A类查询: %s\n", domain);
+        LOG_DEBUG("收到A类查询: %s\n", domain);
     else if (is_aaaa)
-        print_debug_info("收到AAAA类查询: %s\n", domain);
+        LOG_DEBUG("收到AAAA类查询: %s\n", domain);
     else {
-        print_debug_info("收到非A/AAAA类型或非IN类查询: %s\n", domain);
+        LOG_DEBUG("收到非A/AAAA类型或非IN类查询: %s\n", domain);
+        if (rate_limit(ctx, QLOG_PATH_NONE, &client_addr, query_buffer, question_section_len,
+                       DNS_RCODE_NOT_IMPLEMENTED, 0) < 0) {
+            return;
+        }
         // 构造未实现错误响应
         int send_len =
             build_dns_error_response(response_buffer, query_buffer, question_section_len, DNS_RCODE_NOT_IMPLEMENTED);
-        sendto(ctx->sock, (char *)response_buffer, send_len, 0, (struct sockaddr *)&client_addr, sizeof(client_addr));
+        stage_mark(ctx, STAGE_BUILD);
+        count_send(ctx, sendto(ctx->sock, (char *)response_buffer, send_len, 0, (struct sockaddr *)&client_addr,
+                               sizeof(client_addr)));
+        stage_mark(ctx, STAGE_SEND);
+        if (ctx->qlog) {
+            QLogPiece piece = {response_buffer, (size_t)send_len};
+            log_message(ctx, QLOG_KIND_RESPONSE, QLOG_PATH_NONE, &client_addr, get_monotonic_ns(), &piece, 1);
+            stage_mark(ctx, STAGE_QLOG);
+        }
         return;
     }
     // ----------- 查询本地表 -----------
     // 在本地DNS表中查找域名
-    DNSRecord *record;
-    HASH_FIND_STR(ctx->dns_table, domain, record);
+    const DNSRecord *record = dns_table_lookup(atomic_load_explicit(ctx->dns_table, memory_order_acquire), domain);
+    stage_mark(ctx, STAGE_TABLE);
     if (record) {
         // 命中本地表，判断是否为拦截（0.0.0.0）
-        if (strcmp(record->ip, "0.0.0.0") == 0) {
-            print_debug_info("域名被拦截 %s\n", domain);
-            // 构造Name Error响应
-            int send_len =
-                build_dns_error_response(response_buffer, query_buffer, question_section_len, DNS_RCODE_NAME_ERROR);
-            sendto(ctx->sock, (char *)response_buffer, send_len, 0, (struct sockaddr *)&client_addr,
-                   sizeof(client_addr));
+        if (record->blocked) {
+            LOG_DEBUG("域名被拦截 %s\n", domain);
+            if (send_negative(ctx, PATH_BLOCKED, &client_addr, query_buffer, question_section_len, domain,
+                              DNS_RCODE_NAME_ERROR) == 0) {
+                record_latency(ctx, PATH_BLOCKED, received_ns);
+            }
             return;
         }
-
-        // 命中A记录，直接返回本地IP
-        if (is_a) {
-            print_debug_info("找到记录 %s -> %s\n", domain, record->ip);
-            int send_len = build_standard_dns_response(response_buffer, query_buffer, question_section_len, record->ip);
-            sendto(ctx->sock, (char *)response_buffer, send_len, 0, (struct sockaddr *)&client_addr,
-                   sizeof(client_addr));
-            return;
+        // 记录的地址族与查询类型一致时直接发送预生成的应答记录，否则返回空应答
+        int sent;
+        if (record->rr_len && (is_a ? record->family == 4 : record->family == 6)) {
+            LOG_DEBUG("找到记录 %s -> %s\n", domain, record->ip);
+            sent = send_answer(ctx, PATH_LOCAL, &client_addr, query_buffer, question_section_len, DNS_RCODE_NO_ERROR,
+                               record->rr, record->rr_len);
         } else {
-            // 有A记录但收到AAAA查询，返回空应答
-            print_debug_info("本地表有A记录，对AAAA查询返回空应答: %s\n", domain);
-            int send_len =
-                build_dns_error_response(response_buffer, query_buffer, question_section_len, DNS_RCODE_NO_ERROR);
-            sendto(ctx->sock, (char *)response_buffer, send_len, 0, (struct sockaddr *)&client_addr,
-                   sizeof(client_addr));
-            return;
+            LOG_DEBUG("本地表记录与查询类型不符，返回空应答: %s\n", domain);
+            sent = send_negative(ctx, PATH_LOCAL, &client_addr, query_buffer, question_section_len, domain,
+                                 DNS_RCODE_NO_ERROR);
         }
+        if (sent == 0) record_latency(ctx, PATH_LOCAL, received_ns);
+        return;
     }
     // ----------- 查询缓存 -----------
-    CacheEntry *cache_entry = cache_get(ctx->cache, domain, qtype);
-    if (cache_entry) {
-        // 命中缓存，直接返回缓存的IP
-        if (is_a && cache_entry->qtype == DNS_TYPE_A) {
-            int send_len =
-                build_standard_dns_response(response_buffer, query_buffer, question_section_len, cache_entry->ip);
-            sendto(ctx->sock, (char *)response_buffer, send_len, 0, (struct sockaddr *)&client_addr,
-                   sizeof(client_addr));
-            return;
-        } else if (is_aaaa && cache_entry->qtype == DNS_TYPE_AAAA) {
-            int send_len =
-                build_ipv6_dns_response(response_buffer, query_buffer, question_section_len, cache_entry->ip);
-            sendto(ctx->sock, (char *)response_buffer, send_len, 0, (struct sockaddr *)&client_addr,
-                   sizeof(client_addr));
-            return;
+    const CacheEntry *cache_entry = cache_get(ctx->cache, domain, qtype);
+    stage_mark(ctx, STAGE_CACHE);
+    if (cache_entry && cache_entry->rr_len) {
+        // 命中缓存，复制预生成的应答记录并填入剩余TTL
+        uint8_t rr[DNS_ANSWER_RR_MAX];
+        memcpy(rr, cache_entry->rr, cache_entry->rr_len);
+        uint32_t ttl = htonl(cache_get_remaining_ttl(cache_entry));
+        memcpy(rr + DNS_ANSWER_TTL_OFFSET, &ttl, sizeof(ttl));
+        if (send_answer(ctx, PATH_CACHE, &client_addr, query_buffer, question_section_len, DNS_RCODE_NO_ERROR, rr,
+                        cache_entry->rr_len) == 0) {
+            record_latency(ctx, PATH_CACHE, received_ns);
         }
+        return;
     }
     // 未命中本地表和缓存，转发到上游
-    forward_query_to_upstream(ctx, query_buffer, query_len, question_section_len, client_addr);
+    forward_query_to_upstream(ctx, query_buffer, query_len, question_section_len, client_addr, received_ns);
+    stage_mark(ctx, STAGE_FORWARD);
 }
 
 // ----------- 更新缓存 -----------
-void update_cache(DNSContext *ctx, uint8_t *response_buffer) {
+void update_cache(DNSContext *ctx, uint8_t *response_buffer, int response_len) {
     int ancount = ntohs(((DNSHeader *)response_buffer)->ancount);
     if (ancount <= 0) return;
 
     // 先解析问题区，得到qname_len，跳过问题区
     char q_domain[256] = "";
-    int qname_len = parse_dns_name(response_buffer, DNS_HEADER_SIZE, q_domain, sizeof(q_domain));
+    int qname_len = parse_dns_name(response_buffer, response_len, DNS_HEADER_SIZE, q_domain, sizeof(q_domain));
     if (qname_len < 0) {
-        print_debug_info("问题区域名解析失败\n");
+        LOG_DEBUG("问题区域名解析失败\n");
         return;
     }
     int offset = DNS_HEADER_SIZE + qname_len + sizeof(DNSQuestion);
     // 遍历回答区域的资源记录
     for (int i = 0; i < ancount; i++) {
         char rr_domain[256] = "";
-        int rr_name_len = parse_dns_name(response_buffer, offset, rr_domain, sizeof(rr_domain));
-        if (rr_name_len < 0) {
-            print_debug_info("回答区域名解析失败\n");
+        int rr_name_len = parse_dns_name(response_buffer, response_len, offset, rr_domain, sizeof(rr_domain));
+        if (rr_name_len < 0 || offset + rr_name_len + (int)sizeof(DNS_RR) > response_len) {
+            LOG_DEBUG("回答区域名解析失败\n");
             return;
         }
         DNS_RR *rr = (DNS_RR *)(response_buffer + offset + rr_name_len);
 
         uint16_t type = ntohs(rr->type);
         uint16_t rdlength = ntohs(rr->rdlength);
-        uint16_t ttl = ntohl(rr->ttl);
+        uint32_t ttl = ntohl(rr->ttl);
+        if (offset + rr_name_len + (int)sizeof(DNS_RR) + rdlength > response_len) {
+            LOG_DEBUG("回答区记录超出报文长度\n");
+            return;
+        }
         const uint8_t *rdata = response_buffer + offset + rr_name_len + sizeof(DNS_RR);
 
         // 只缓存A和AAAA记录
@@ -241,7 +433,7 @@ void update_cache(DNSContext *ctx, uint8_t *response_buffer) {
             // cache添加成功则返回
             return;
         }
-        print_debug_info("不支持的记录类型或长度不匹配，type=%u, rdlength=%u\n", type, rdlength);
+        LOG_DEBUG("不支持的记录类型或长度不匹配，type=%u, rdlength=%u\n", type, rdlength);
         // 跳到下一个资源记录
         offset += rr_name_len + sizeof(DNS_RR) + rdlength;
     }
@@ -256,7 +448,7 @@ void update_cache(DNSContext *ctx, uint8_t *response_buffer) {
 void handle_upstream_response(DNSContext *ctx, uint8_t *response_buffer, int response_len) {
     // 检查上游响应长度是否合法，防止无效包
     if (response_len < DNS_HEADER_SIZE) {
-        print_debug_info("收到的上游响应长度过小: %d 字节\n", response_len);
+        LOG_DEBUG("收到的上游响应长度过小: %d 字节\n", response_len);
         return;
     }
 
@@ -265,22 +457,35 @@ void handle_upstream_response(DNSContext *ctx, uint8_t *response_buffer, int res
     uint16_t resp_upstream_id = ntohs(header->id);
     RelayEntry *entry = NULL;
     HASH_FIND(hh, ctx->relay_table, &resp_upstream_id, sizeof(uint16_t), entry);
+    stage_mark(ctx, STAGE_UP_MATCH);
 
     if (entry) {
+        hist_record(&ctx->stats[ctx->worker_id].upstream_rtt, get_monotonic_ns() - entry->forwarded_ns);
         // 找到对应的转发请求，恢复原始客户端ID并转发响应
-        print_debug_info("收到上游响应，转发给客户端，upstream_id=%u, client_id=%u\n", resp_upstream_id,
-                         entry->client_id);
-        update_cache(ctx, response_buffer);  // 更新缓存
+        LOG_DEBUG("收到上游响应，转发给客户端，upstream_id=%u, client_id=%u\n", resp_upstream_id, entry->client_id);
+        update_cache(ctx, response_buffer, response_len);  // 更新缓存
+        stage_mark(ctx, STAGE_UP_CACHE);
         header->id = htons(entry->client_id);
-        // 发送响应给客户端
-        sendto(ctx->sock, (char *)response_buffer, response_len, 0, (struct sockaddr *)&entry->client_addr,
-               sizeof(entry->client_addr));
+        if (rate_limit(ctx, PATH_UPSTREAM, &entry->client_addr, entry->query, entry->question_len,
+                       ntohs(header->flags) & 0xF, ntohs(header->ancount)) == 0) {
+            // 发送响应给客户端
+            count_send(ctx, sendto(ctx->sock, (char *)response_buffer, response_len, 0,
+                                   (struct sockaddr *)&entry->client_addr, sizeof(entry->client_addr)));
+            stage_mark(ctx, STAGE_UP_SEND);
+            record_latency(ctx, PATH_UPSTREAM, entry->received_ns);
+            if (ctx->qlog) {
+                log_response(ctx, PATH_UPSTREAM, &entry->client_addr, response_buffer, response_len);
+                stage_mark(ctx, STAGE_QLOG);
+            }
+        }
 
         // 转发完成后移除转发表项，释放内存
         HASH_DEL(ctx->relay_table, entry);
         free(entry);
+        update_pending(ctx);
     } else {
         // 未找到对应请求，说明已超时或非法响应，直接丢弃
-        print_debug_info("未找到对应的RelayEntry, upstream_id=%u，丢弃响应\n", resp_upstream_id);
+        hist_add(&ctx->stats[ctx->worker_id].unmatched, 1);
+        LOG_DEBUG("未找到对应的RelayEntry, upstream_id=%u，丢弃响应\n", resp_upstream_id);
     }
 }
@@ -1,34 +1,142 @@
 #ifndef SERVER_H
 #define SERVER_H
 
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "table.h"
 #include "cache.h"
+#include "hist.h"
+#include "profile.h"
+#include "qlog.h"
+#include "reload.h"
+#include "rrl.h"
 #include "uthash.h"
 
 #define RELAY_TIMEOUT 1            // 超时时间（秒）
 #define CACHE_CLEANUP_INTERVAL 60  // 缓存清理间隔（秒）
+#define MAX_WORKERS 32             // 服务线程数上限（每个线程占一个QSBR读者）
 
-// 封装了服务器运行所需的所有状态
+// 查询的解析路径，按路径分别统计延迟
+typedef enum query_path {
+    PATH_LOCAL,     // 本地表命中（含类型不符的空应答）
+    PATH_BLOCKED,   // 本地表拦截
+    PATH_CACHE,     // 缓存命中
+    PATH_UPSTREAM,  // 上游应答
+    PATH_TIMEOUT,   // 上游超时，返回SERVFAIL
+    PATH_COUNT
+} QueryPath;
+
+extern const char *const query_path_names[PATH_COUNT];
+
+// 查询处理的各阶段，分阶段剖析开启时分别统计耗时
+typedef enum query_stage {
+    STAGE_RECV,      // 接收客户端查询（recvfrom）
+    STAGE_PARSE,     // 校验报文，解析域名与类型
+    STAGE_TABLE,     // 查找本地表
+    STAGE_CACHE,     // 查找缓存
+    STAGE_RRL,       // 响应限速检查（启用时）
+    STAGE_BUILD,     // 构造应答
+    STAGE_SEND,      // 向客户端发送本地应答
+    STAGE_FORWARD,   // 登记转发表并转发到上游
+    STAGE_QLOG,      // 写查询日志
+    STAGE_UP_RECV,   // 接收上游应答
+    STAGE_UP_MATCH,  // 在转发表中查找对应请求
+    STAGE_UP_CACHE,  // 解析上游应答并写入缓存
+    STAGE_UP_SEND,   // 把上游应答发给客户端
+    STAGE_COUNT
+} QueryStage;
+
+extern const char *const query_stage_names[STAGE_COUNT];
+
+/*
+ * 单个服务线程的统计：各路径从收到查询到发出应答的延迟直方图与若干计数。
+ * 只由所属线程写入（hist_add），管理接口与指标接口汇总各线程的副本。
+ */
+typedef struct server_stats {
+    LatencyHist latency[PATH_COUNT];
+    LatencyHist upstream_rtt;        // 转发到上游至收到应答
+    LatencyHist stages[STAGE_COUNT]; // 各阶段耗时（profile_ticks刻度），只在剖析开启时记录，关闭时不占用物理内存
+    _Atomic uint64_t malformed;      // 无法解析而丢弃的查询
+    _Atomic uint64_t send_errors;    // 发送失败次数
+    _Atomic uint64_t recv_errors;    // 接收失败次数
+    _Atomic uint64_t unmatched;      // 找不到对应转发记录的上游应答（迟到或伪造）
+    _Atomic uint64_t relay_pending;  // 当前等待上游应答的查询数
+    _Atomic uint64_t rrl_slipped;    // 超出限速、以截断应答代替的应答
+    _Atomic uint64_t rrl_dropped;    // 超出限速而丢弃的应答
+} ServerStats;
+
+/*
+ * 封装了一个服务线程运行所需的状态。多线程服务时每个线程各有一份：
+ * 监听套接字（SO_REUSEPORT绑定同一端口）、上游套接字与转发表各自独立，
+ * 本地表与缓存在线程间共享，查找均不加锁。
+ */
 typedef struct {
     int sock;                           // 本地监听套接字
     int upstream_sock;                  // 上游通信套接字
     struct sockaddr_in upstream_addr;   // 上游服务器地址
-    DNSRecord *dns_table;               // 本地DNS记录表
+    _Atomic(DNSTable *) *dns_table;     // 本地DNS记录表（各服务线程共用），热加载时由后台线程原子替换
+    TableReloader *reloader;            // 本地表热加载器
+    int qsbr_reader;                    // 本线程在reloader->qsbr中的读者编号
     RelayEntry *relay_table;            // 转发请求记录表
     uint16_t upstream_id_counter;       // 用于生成唯一上游请求ID的计数器
-    DNSCache *cache;                    // DNS缓存管理器
+    DNSCache *cache;                    // DNS缓存管理器（各服务线程共用）
+    int worker_id;                      // 服务线程编号，0号线程同时负责定期维护与SIGHUP触发的重新加载
+    ServerStats *stats;                 // 各服务线程的统计（MAX_WORKERS项，按worker_id下标），本线程只写自己的一项
+    QueryLog *qlog;                     // 二进制查询日志（各服务线程共用，每个线程写自己的缓冲区），NULL表示不记录
+    RRLTable *rrl;                      // 响应限速表（各服务线程共用），NULL表示不限速
+    uint32_t rrl_rng;                   // 本线程决定截断或丢弃所用的随机数状态
+    int profiling;                      // 当前报文是否分阶段计时（每个报文开始时读取一次开关）
+    uint64_t stage_clock;               // 上一阶段结束时的时钟刻度
+    uint32_t stage_reset_seen;          // 本线程已处理到的剖析清零请求序号
     struct timeval last_cache_cleanup;  // 上次缓存清理时间
 } DNSContext;
 
+// 剖析清零请求的序号：管理线程递增，各服务线程发现变化后清空自己的阶段耗时
+extern _Atomic uint32_t g_stage_reset_gen;
+
+// 服务线程每轮主循环调用一次：有新的清零请求时清空本线程的阶段耗时，直方图始终只有本线程写
+static inline void stage_sync_reset(DNSContext *ctx) {
+    uint32_t gen = atomic_load_explicit(&g_stage_reset_gen, memory_order_relaxed);
+    if (gen == ctx->stage_reset_seen) return;
+    ctx->stage_reset_seen = gen;
+    for (int s = 0; s < STAGE_COUNT; s++) {
+        LatencyHist *h = &ctx->stats[ctx->worker_id].stages[s];
+        if (hist_load(&h->count)) hist_reset(h);  // 从未记录的直方图不去触碰，保持不占物理内存
+    }
+}
+
+// 开始处理一个报文（在接收之前调用），剖析开启时记下起始时刻
+static inline void stage_begin(DNSContext *ctx) {
+    ctx->profiling = profile_enabled();
+    if (ctx->profiling) ctx->stage_clock = profile_ticks();
+}
+
+// 结束一个阶段：把上一阶段结束至今的耗时计入stage
+static inline void stage_mark(DNSContext *ctx, QueryStage stage) {
+    if (!ctx->profiling) return;
+    uint64_t now = profile_ticks();
+    hist_record(&ctx->stats[ctx->worker_id].stages[stage], now - ctx->stage_clock);
+    ctx->stage_clock = now;
+}
+
 void handle_timed_out_requests(DNSContext *ctx);
 void forward_query_to_upstream(DNSContext *ctx, const uint8_t *query_buffer, int query_len, int question_section_len,
-                               struct sockaddr_in client_addr);
+                               struct sockaddr_in client_addr, uint64_t received_ns);
 
 void handle_upstream_response(DNSContext *ctx, uint8_t *response_buffer, int response_len);
 void handle_client_query(DNSContext *ctx, struct sockaddr_in client_addr, uint8_t *query_buffer, int query_len);
+// 汇总所有服务线程某一路径的延迟直方图，out由调用者清零
+void server_stats_collect(const DNSContext *ctx, QueryPath path, LatencyHist *out);
+// 汇总所有服务线程的上游往返时间直方图，out由调用者清零
+void server_stats_collect_rtt(const DNSContext *ctx, LatencyHist *out);
+// 汇总所有服务线程某一阶段的耗时直方图（时钟刻度），out由调用者清零
+void server_stats_collect_stage(const DNSContext *ctx, QueryStage stage, LatencyHist *out);
+// 请求各服务线程清空自己的阶段耗时，各线程在下一轮主循环（至多约100毫秒后）生效
+void server_stats_reset_stages(void);
+// 汇总所有服务线程的某项计数，field为ServerStats中计数字段的偏移（offsetof）
+uint64_t server_stats_sum(const DNSContext *ctx, size_t field);
 
 #endif /* SERVER_H */
\ No newline at end of file
@@ -1,56 +1,658 @@
 #include "table.h"
+#include "logging.h"
+#include "table_image.h"
 #include "util.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
 
-// 加载DNS表，将dnsrelay.txt中的域名-IP映射读入哈希表
-int load_dns_table(const char *filename, DNSRecord **table) {
-    FILE *fp;
-    char line[512];
-    char ip[46], domain[256];  // 扩展ip字段以支持IPv6
-    int count = 0;
-    // 打开配置文件
-    fp = fopen(filename, "r");
-    if (!fp) {
-        printf("无法打开配置文件 %s\n", filename);
+#define TABLE_INITIAL_EDGES 1024  // 边哈希表初始容量（2的幂）
+
+static inline uint8_t to_lower(uint8_t c) {
+    return (c >= 'A' && c <= 'Z') ? (uint8_t)(c + ('a' - 'A')) : c;
+}
+
+// 标签哈希与父节点下标混合得到边哈希，结果非0
+static inline uint32_t edge_hash(uint32_t parent, uint32_t lh) {
+    uint32_t h = lh ^ parent * 0x9E3779B1u;
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h ? h : 1;
+}
+
+// 标签池中的小写标签与查询标签逐字节比较（忽略查询的大小写）
+static inline int label_equal(const char *stored, const char *label, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        if ((uint8_t)stored[i] != to_lower((uint8_t)label[i])) return 0;
+    }
+    return 1;
+}
+
+// 查找 (parent, label) 对应的子节点，未找到返回0
+static uint32_t table_find_child(const DNSTable *table, uint32_t parent, const char *label, uint32_t len,
+                                 uint32_t lh) {
+    uint32_t h = edge_hash(parent, lh);
+    for (uint32_t i = h & table->edge_mask;; i = (i + 1) & table->edge_mask) {
+        const TableEdge *e = &table->edges[i];
+        if (e->hash == 0) return 0;
+        if (e->hash == h && e->parent == parent && (uint8_t)table->labels[e->label] == len &&
+            label_equal(table->labels + e->label + 1, label, len)) {
+            return e->child;
+        }
+    }
+}
+
+static int table_grow_edges(DNSTable *table) {
+    uint32_t new_cap = (table->edge_mask + 1) * 2;
+    TableEdge *edges = calloc(new_cap, sizeof(TableEdge));
+    if (!edges) return -1;
+    for (uint32_t i = 0; i <= table->edge_mask; i++) {
+        const TableEdge *e = &table->edges[i];
+        if (e->hash == 0) continue;
+        uint32_t j = e->hash & (new_cap - 1);
+        while (edges[j].hash != 0) j = (j + 1) & (new_cap - 1);
+        edges[j] = *e;
+    }
+    free(table->edges);
+    table->edges = edges;
+    table->edge_mask = new_cap - 1;
+    return 0;
+}
+
+static uint32_t table_new_node(DNSTable *table) {
+    if (table->node_count == table->node_cap) {
+        uint32_t cap = table->node_cap ? table->node_cap * 2 : 256;
+        TableNode *nodes = realloc(table->nodes, cap * sizeof(TableNode));
+        if (!nodes) return 0;
+        table->nodes = nodes;
+        table->node_cap = cap;
+    }
+    memset(&table->nodes[table->node_count], 0, sizeof(TableNode));
+    return table->node_count++;
+}
+
+// 查找或创建子节点，失败返回0
+static uint32_t table_add_child(DNSTable *table, uint32_t parent, const char *label, uint32_t len, uint32_t lh) {
+    uint32_t child = table_find_child(table, parent, label, len, lh);
+    if (child) return child;
+
+    if ((table->edge_count + 1) * 2 > table->edge_mask + 1 && table_grow_edges(table) < 0) return 0;
+    if (table->labels_len + len + 1 > table->labels_cap) {
+        uint32_t cap = table->labels_cap ? table->labels_cap * 2 : 4096;
+        while (cap < table->labels_len + len + 1) cap *= 2;
+        char *labels = realloc(table->labels, cap);
+        if (!labels) return 0;
+        table->labels = labels;
+        table->labels_cap = cap;
+    }
+    child = table_new_node(table);
+    if (!child) return 0;
+
+    uint32_t offset = table->labels_len;
+    table->labels[offset] = (char)len;
+    for (uint32_t i = 0; i < len; i++) table->labels[offset + 1 + i] = (char)to_lower((uint8_t)label[i]);
+    table->labels_len += len + 1;
+
+    uint32_t h = edge_hash(parent, lh);
+    uint32_t i = h & table->edge_mask;
+    while (table->edges[i].hash != 0) i = (i + 1) & table->edge_mask;
+    table->edges[i].parent = parent;
+    table->edges[i].hash = h;
+    table->edges[i].child = child;
+    table->edges[i].label = offset;
+    table->edge_count++;
+    return child;
+}
+
+void dns_record_init(DNSRecord *record, const char *ip) {
+    memset(record, 0, sizeof(DNSRecord));
+    strncpy(record->ip, ip, sizeof(record->ip) - 1);
+    record->blocked = strcmp(ip, "0.0.0.0") == 0;
+    if (inet_pton(AF_INET, ip, record->addr) == 1) {
+        record->family = 4;
+    } else if (inet_pton(AF_INET6, ip, record->addr) == 1) {
+        record->family = 6;
+    }
+    record->rr_len = (uint8_t)build_answer_rr(record->rr, record->family, record->addr, DNS_LOCAL_TTL);
+}
+
+// 加载期间用于按IP去重的临时哈希表
+typedef struct record_index {
+    char ip[46];
+    uint32_t id;  // records下标+1
+    UT_hash_handle hh;
+} RecordIndex;
+
+static uint32_t table_intern_record(DNSTable *table, RecordIndex **index, const char *ip) {
+    RecordIndex *found;
+    HASH_FIND_STR(*index, ip, found);
+    if (found) return found->id;
+
+    if (table->record_count == table->record_cap) {
+        uint32_t cap = table->record_cap ? table->record_cap * 2 : 16;
+        DNSRecord *records = realloc(table->records, cap * sizeof(DNSRecord));
+        if (!records) return 0;
+        table->records = records;
+        table->record_cap = cap;
+    }
+    found = malloc(sizeof(RecordIndex));
+    if (!found) return 0;
+    DNSRecord *record = &table->records[table->record_count];
+    dns_record_init(record, ip);
+
+    strcpy(found->ip, record->ip);
+    found->id = ++table->record_count;
+    HASH_ADD_STR(*index, ip, found);
+    return found->id;
+}
+
+// 由已打开的镜像构造本地表，镜像中的各段直接使用，不复制
+static int table_from_image(TableImage *image, const char *name, DNSTable **table) {
+    DNSTable *t = image ? calloc(1, sizeof(DNSTable)) : NULL;
+    if (!t) {
+        printf("无法加载预编译本地表镜像 %s\n", name);
+        table_image_close(image);
+        return -1;
+    }
+    const TableImageHeader *h = image->header;
+    t->image = image;
+    t->rule_count = h->rule_count;
+    if (h->filter_blocks) table_filter_attach(&t->filter, image->filter, (uint32_t)h->filter_blocks, h->filter_keys);
+    *table = t;
+    LOG_DEBUG("已加载本地表镜像 %s：%u 条规则，%u 个名称，过滤器误判率约 %.4f%%\n", name, t->rule_count,
+              h->slot_count, 100.0 * table_filter_fpr(&t->filter));
+    return (int)t->rule_count;
+}
+
+// 构建期编译进可执行文件的镜像（见CMake选项DNSRELAY_EMBED_TABLE）
+static const uint8_t *g_embedded_image = NULL;
+static size_t g_embedded_size = 0;
+
+void dns_table_set_embedded(const uint8_t *image, size_t size) {
+    g_embedded_image = image;
+    g_embedded_size = size;
+}
+
+/**
+ * 插入一条已规范化的规则：name为小写、不带前缀与根标签，
+ * hashes为各标签的哈希（从右到左）。同一名称同类规则重复出现时以后出现的为准。
+ * @return 0成功，-1失败
+ */
+static int table_insert_rule(DNSTable *table, const char *name, uint32_t len, const uint32_t *hashes, int kind,
+                             uint32_t record_id) {
+    // 从最右侧的标签开始逐级下降
+    uint32_t node = 0, end = len;
+    for (uint32_t k = 0;; k++) {
+        uint32_t start = end;
+        while (start > 0 && name[start - 1] != '.') start--;
+        node = table_add_child(table, node, name + start, end - start, hashes[k]);
+        if (!node) return -1;
+        if (start == 0) break;
+        end = start - 1;
+    }
+
+    TableNode *n = &table->nodes[node];
+    if (kind == TABLE_RULE_EXACT) {
+        n->exact = record_id;
+    } else if (kind == TABLE_RULE_WILDCARD) {
+        n->subtree = record_id;
+    } else {
+        n->apex = record_id;
+        n->subtree = record_id;
+    }
+    table->rule_count++;
+    return 0;
+}
+
+/*
+ * 文本表的并行加载：文件整体读入内存后按行边界切成若干片段，
+ * 各线程独立完成分词、IP去重、名称校验与小写化以及标签哈希的计算；
+ * 随后在调用线程中按片段顺序把结果并入字典树，保证“后出现的规则为准”的语义不变。
+ */
+#define TABLE_PARSE_MIN_CHUNK (256u << 10)  // 每个解析线程至少分到的字节数
+#define TABLE_MAX_LOAD_THREADS 16
+
+static int g_load_threads = 0;  // 解析线程数，0表示按CPU核数
+
+void dns_table_set_load_threads(int threads) { g_load_threads = threads; }
+
+static int table_cpu_count(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+// 解析阶段产出的一条规则，名称已小写并去掉前缀与根标签
+typedef struct parsed_rule {
+    uint32_t name;         // 名称在片段名称池中的偏移
+    uint32_t hashes;       // 标签哈希在片段哈希池中的起始下标
+    uint32_t ip;           // 片段内的IP编号
+    uint8_t name_len;
+    uint8_t kind;
+} ParsedRule;
+
+// 一个解析线程负责的文件片段及其输出
+typedef struct parse_chunk {
+    const char *begin;
+    const char *end;
+    ParsedRule *rules;
+    uint32_t rule_count;
+    uint32_t rule_cap;
+    char *names;            // 小写名称池，容量等于片段长度，不会溢出
+    uint32_t names_len;
+    uint32_t *hashes;       // 标签哈希池，每条规则从右到左依次存放
+    uint32_t hash_count;
+    uint32_t hash_cap;
+    RecordIndex *ip_index;  // 片段内按IP去重，id为ips下标
+    char (*ips)[46];
+    uint32_t ip_count;
+    uint32_t ip_cap;
+    uint32_t last_ip;       // 上一行使用的IP编号，相邻行多为同一IP
+    int failed;             // 内存不足
+} ParseChunk;
+
+static int table_reserve(void **array, uint32_t *cap, uint32_t need, size_t elem_size) {
+    if (need <= *cap) return 0;
+    uint32_t new_cap = *cap ? *cap : 64;
+    while (new_cap < need) new_cap *= 2;
+    void *grown = realloc(*array, (size_t)new_cap * elem_size);
+    if (!grown) return -1;
+    *array = grown;
+    *cap = new_cap;
+    return 0;
+}
+
+// 片段内IP去重，返回IP编号，内存不足返回UINT32_MAX
+static uint32_t chunk_intern_ip(ParseChunk *c, const char *ip, uint32_t len) {
+    if (c->ip_count && strncmp(c->ips[c->last_ip], ip, len) == 0 && c->ips[c->last_ip][len] == '\0') {
+        return c->last_ip;
+    }
+    char key[46];
+    memcpy(key, ip, len);
+    key[len] = '\0';
+    RecordIndex *found;
+    HASH_FIND_STR(c->ip_index, key, found);
+    if (!found) {
+        found = malloc(sizeof(RecordIndex));
+        if (!found || table_reserve((void **)&c->ips, &c->ip_cap, c->ip_count + 1, sizeof(c->ips[0])) < 0) {
+            free(found);
+            return UINT32_MAX;
+        }
+        strcpy(found->ip, key);
+        strcpy(c->ips[c->ip_count], key);
+        found->id = c->ip_count++;
+        HASH_ADD_STR(c->ip_index, ip, found);
+    }
+    c->last_ip = found->id;
+    return found->id;
+}
+
+/**
+ * 校验并规范化一个规则名称，可带 "*." 或 "." 前缀表示通配或后缀规则
+ * @return 0成功，-1名称非法（内存不足时另外置位failed）
+ */
+static int chunk_add_rule(ParseChunk *c, const char *name, uint32_t len, uint32_t ip) {
+    uint8_t kind = TABLE_RULE_EXACT;
+    if (len >= 2 && name[0] == '*' && name[1] == '.') {
+        kind = TABLE_RULE_WILDCARD;
+        name += 2;
+        len -= 2;
+    } else if (len >= 1 && name[0] == '.') {
+        kind = TABLE_RULE_SUFFIX;
+        name += 1;
+        len -= 1;
+    }
+    if (len > 0 && name[len - 1] == '.') len--;  // 去掉根标签
+    if (len == 0) return -1;
+
+    if (table_reserve((void **)&c->rules, &c->rule_cap, c->rule_count + 1, sizeof(ParsedRule)) < 0 ||
+        table_reserve((void **)&c->hashes, &c->hash_cap, c->hash_count + len / 2 + 1, sizeof(uint32_t)) < 0) {
+        c->failed = 1;
         return -1;
     }
-    *table = NULL;  // 初始化哈希表
-    // 逐行读取配置文件
-    while (fgets(line, sizeof(line), fp)) {
-        DNSRecord *record;
-        // 解析一行，格式: IP 域名
-        if (sscanf(line, "%s %s", ip, domain) != 2) {
-            continue;
+    char *out = c->names + c->names_len;
+    for (uint32_t i = 0; i < len; i++) out[i] = (char)to_lower((uint8_t)name[i]);
+
+    uint32_t *hashes = c->hashes + c->hash_count, labels = 0, end = len;
+    for (;;) {
+        uint32_t start = end;
+        while (start > 0 && out[start - 1] != '.') start--;
+        if (end - start == 0 || end - start > 63) return -1;
+        hashes[labels++] = name_label_hash(out + start, end - start);
+        if (start == 0) break;
+        end = start - 1;
+    }
+
+    ParsedRule *rule = &c->rules[c->rule_count++];
+    rule->name = c->names_len;
+    rule->hashes = c->hash_count;
+    rule->ip = ip;
+    rule->name_len = (uint8_t)len;
+    rule->kind = kind;
+    c->names_len += len;
+    c->hash_count += labels;
+    return 0;
+}
+
+static const char *skip_blank(const char *p, const char *end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+    return p;
+}
+
+static const char *skip_token(const char *p, const char *end) {
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r') p++;
+    return p;
+}
+
+// 解析一行，格式: IP 域名，#开头为注释，其余字段忽略
+static void chunk_parse_line(ParseChunk *c, const char *line, const char *eol) {
+    if (line == eol || line[0] == '#') return;
+    const char *ip = skip_blank(line, eol);
+    const char *ip_end = skip_token(ip, eol);
+    const char *name = skip_blank(ip_end, eol);
+    const char *name_end = skip_token(name, eol);
+    if (ip == ip_end || name == name_end) return;
+
+    uint32_t ip_len = (uint32_t)(ip_end - ip), name_len = (uint32_t)(name_end - name);
+    if (ip_len <= 45 && name_len <= 255) {
+        uint32_t id = chunk_intern_ip(c, ip, ip_len);
+        if (id == UINT32_MAX) {
+            c->failed = 1;
+            return;
+        }
+        if (chunk_add_rule(c, name, name_len, id) == 0 || c->failed) return;
+    }
+    LOG_WARN("忽略无效记录: %.*s %.*s\n", (int)ip_len, ip, (int)name_len, name);
+}
+
+static void *parse_chunk_thread(void *arg) {
+    ParseChunk *c = arg;
+    c->names = malloc((size_t)(c->end - c->begin) + 1);
+    if (!c->names) {
+        c->failed = 1;
+        return NULL;
+    }
+    for (const char *p = c->begin; p < c->end && !c->failed;) {
+        const char *eol = memchr(p, '\n', (size_t)(c->end - p));
+        if (!eol) eol = c->end;
+        chunk_parse_line(c, p, eol);
+        p = eol + 1;
+    }
+    return NULL;
+}
+
+static void free_parse_chunk(ParseChunk *c) {
+    RecordIndex *cur, *tmp;
+    HASH_ITER(hh, c->ip_index, cur, tmp) {
+        HASH_DEL(c->ip_index, cur);
+        free(cur);
+    }
+    free(c->rules);
+    free(c->names);
+    free(c->hashes);
+    free(c->ips);
+}
+
+// 按片段内的顺序把解析结果并入字典树，返回成功插入的规则数，失败返回-1
+static int table_merge_chunk(DNSTable *table, RecordIndex **index, const ParseChunk *c) {
+    uint32_t *record_ids = malloc((c->ip_count ? c->ip_count : 1) * sizeof(uint32_t));
+    if (!record_ids) return -1;
+    for (uint32_t i = 0; i < c->ip_count; i++) {
+        record_ids[i] = table_intern_record(table, index, c->ips[i]);
+        if (!record_ids[i]) {
+            free(record_ids);
+            return -1;
         }
-        // 分配新节点
-        record = (DNSRecord *)malloc(sizeof(DNSRecord));
-        if (!record) {
-            continue;
+    }
+    int count = 0;
+    for (uint32_t i = 0; i < c->rule_count; i++) {
+        const ParsedRule *r = &c->rules[i];
+        const char *name = c->names + r->name;
+        if (table_insert_rule(table, name, r->name_len, c->hashes + r->hashes, r->kind, record_ids[r->ip]) < 0) {
+            free(record_ids);
+            return -1;
         }
-        // 拷贝IP和域名
-        strncpy(record->ip, ip, sizeof(record->ip) - 1);
-        record->ip[sizeof(record->ip) - 1] = '\0';
-        strncpy(record->domain, domain, sizeof(record->domain) - 1);
-        record->domain[sizeof(record->domain) - 1] = '\0';
-        // 加入哈希表
-        HASH_ADD_STR(*table, domain, record);
         count++;
-        print_debug_info("加载记录: %s -> %s\n", domain, ip);
+        LOG_DEBUG("加载记录: %.*s -> %s\n", (int)r->name_len, name, c->ips[r->ip]);
+    }
+    free(record_ids);
+    return count;
+}
+
+// 把整个文件读入以0结尾的缓冲区
+static char *table_read_file(const char *filename, size_t *size) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return NULL;
+    char *buf = NULL;
+    long len = -1;
+    if (fseek(fp, 0, SEEK_END) == 0) len = ftell(fp);
+    if (len >= 0 && fseek(fp, 0, SEEK_SET) == 0) buf = malloc((size_t)len + 1);
+    if (buf && fread(buf, 1, (size_t)len, fp) != (size_t)len) {
+        free(buf);
+        buf = NULL;
     }
     fclose(fp);
-    print_debug_info("总共加载 %d 条记录\n", count);
+    if (!buf) return NULL;
+    buf[len] = '\0';
+    *size = (size_t)len;
+    return buf;
+}
+
+// 按行边界把缓冲区切成至多max_chunks个片段，返回片段数
+static int table_split_chunks(const char *buf, size_t size, int max_chunks, ParseChunk *chunks) {
+    int n = max_chunks;
+    if ((size_t)n > size / TABLE_PARSE_MIN_CHUNK) n = (int)(size / TABLE_PARSE_MIN_CHUNK);
+    if (n < 1) n = 1;
+    const char *start = buf, *end = buf + size;
+    int count = 0;
+    for (int i = 0; i < n && start < end; i++) {
+        const char *stop = (i == n - 1) ? end : buf + size / (size_t)n * (size_t)(i + 1);
+        if (stop < start) stop = start;
+        const char *eol = stop < end ? memchr(stop, '\n', (size_t)(end - stop)) : NULL;
+        stop = eol ? eol + 1 : end;
+        memset(&chunks[count], 0, sizeof(ParseChunk));
+        chunks[count].begin = start;
+        chunks[count].end = stop;
+        count++;
+        start = stop;
+    }
     return count;
 }
 
-// 释放DNS表，释放所有节点内存
-void free_dns_table(DNSRecord *table) {
-    DNSRecord *current, *tmp;
-    HASH_ITER(hh, table, current, tmp) {
-        HASH_DEL(table, current);
-        free(current);
+static DNSTable *table_create(uint32_t expected_rules) {
+    DNSTable *t = calloc(1, sizeof(DNSTable));
+    if (!t) return NULL;
+    // 按规则数预留边表与节点，避免合并过程中反复扩容重哈希
+    uint32_t edge_cap = TABLE_INITIAL_EDGES;
+    while (edge_cap < 2 * (uint64_t)expected_rules && edge_cap < (1u << 30)) edge_cap *= 2;
+    t->edges = calloc(edge_cap, sizeof(TableEdge));
+    t->edge_mask = edge_cap - 1;
+    if (t->edges && expected_rules) {
+        t->nodes = malloc(((size_t)expected_rules + 1) * sizeof(TableNode));
+        if (t->nodes) t->node_cap = expected_rules + 1;
+    }
+    if (t->edges) table_new_node(t);  // 0号节点为根
+    if (!t->edges || t->node_count != 1) {
+        free_dns_table(t);
+        return NULL;
+    }
+    return t;
+}
+
+/**
+ * 由字典树构建查找前的过滤器，每个节点对应一个后缀，带规则的节点另置规则位
+ * 子节点总在父节点之后创建，按下标顺序即可由父节点的链式哈希推出子节点的。
+ * @return 0成功，-1内存不足
+ */
+static int table_build_filter(DNSTable *table) {
+    uint32_t rules = 0;
+    for (uint32_t n = 1; n < table->node_count; n++) {
+        const TableNode *node = &table->nodes[n];
+        rules += node->exact || node->apex || node->subtree;
     }
+    uint64_t *hashes = malloc((size_t)table->node_count * sizeof(uint64_t));
+    uint32_t *parents = malloc((size_t)table->node_count * sizeof(uint32_t));
+    uint32_t *label_hashes = malloc((size_t)table->node_count * sizeof(uint32_t));
+    int ok = hashes && parents && label_hashes && table_filter_init(&table->filter, table->node_count - 1, rules) == 0;
+    for (uint32_t i = 0; ok && i <= table->edge_mask; i++) {
+        const TableEdge *e = &table->edges[i];
+        if (e->hash == 0) continue;
+        parents[e->child] = e->parent;
+        label_hashes[e->child] = name_label_hash(table->labels + e->label + 1, (uint8_t)table->labels[e->label]);
+    }
+    if (ok) hashes[0] = FILTER_ROOT_HASH;
+    for (uint32_t n = 1; ok && n < table->node_count; n++) {
+        hashes[n] = filter_chain_hash(hashes[parents[n]], label_hashes[n]);
+        const TableNode *node = &table->nodes[n];
+        table_filter_add(&table->filter, hashes[n], node->exact || node->apex || node->subtree);
+    }
+    free(hashes);
+    free(parents);
+    free(label_hashes);
+    return ok ? 0 : -1;
+}
+
+// 加载文本格式的本地表
+static int load_dns_table_text(const char *filename, DNSTable **table) {
+    struct timeval started, parsed, merged;
+    get_now(&started);
+    size_t size = 0;
+    char *buf = table_read_file(filename, &size);
+    if (!buf) {
+        printf("无法打开配置文件 %s\n", filename);
+        return -1;
+    }
+
+    int threads = g_load_threads > 0 ? g_load_threads : table_cpu_count();
+    if (threads > TABLE_MAX_LOAD_THREADS) threads = TABLE_MAX_LOAD_THREADS;
+    ParseChunk chunks[TABLE_MAX_LOAD_THREADS];
+    int n = table_split_chunks(buf, size, threads, chunks);
+
+    // 第0个片段由调用线程自己解析
+    pthread_t tids[TABLE_MAX_LOAD_THREADS];
+    int started_thread[TABLE_MAX_LOAD_THREADS] = {0};
+    for (int i = 1; i < n; i++) {
+        started_thread[i] = pthread_create(&tids[i], NULL, parse_chunk_thread, &chunks[i]) == 0;
+    }
+    for (int i = 0; i < n; i++) {
+        if (i == 0 || !started_thread[i]) parse_chunk_thread(&chunks[i]);
+    }
+    uint32_t total_rules = 0;
+    int failed = 0;
+    for (int i = 0; i < n; i++) {
+        if (started_thread[i]) pthread_join(tids[i], NULL);
+        total_rules += chunks[i].rule_count;
+        failed |= chunks[i].failed;
+    }
+    get_now(&parsed);
+
+    DNSTable *t = failed ? NULL : table_create(total_rules);
+    RecordIndex *index = NULL;
+    int count = 0;
+    for (int i = 0; t && i < n; i++) {
+        int added = table_merge_chunk(t, &index, &chunks[i]);
+        if (added < 0) {
+            free_dns_table(t);
+            t = NULL;
+        }
+        count += added;
+    }
+    if (t && table_build_filter(t) < 0) {
+        free_dns_table(t);
+        t = NULL;
+    }
+    for (int i = 0; i < n; i++) free_parse_chunk(&chunks[i]);
+    free(buf);
+    RecordIndex *cur, *tmp;
+    HASH_ITER(hh, index, cur, tmp) {
+        HASH_DEL(index, cur);
+        free(cur);
+    }
+    if (!t) {
+        printf("本地DNS表内存分配失败\n");
+        return -1;
+    }
+    get_now(&merged);
+
+    *table = t;
+    LOG_DEBUG("总共加载 %d 条记录，%u 个节点，%u 个不同IP\n", count, t->node_count, t->record_count);
+    LOG_DEBUG("过滤器 %u 个后缀，%u 字节，误判率约 %.4f%%\n", t->filter.key_count,
+              t->filter.block_count * FILTER_BLOCK_WORDS * 8, 100.0 * table_filter_fpr(&t->filter));
+    LOG_DEBUG("%d 个线程解析用时 %.3f 秒，合并用时 %.3f 秒\n", n,
+              (parsed.tv_sec - started.tv_sec) + (parsed.tv_usec - started.tv_usec) / 1e6,
+              (merged.tv_sec - parsed.tv_sec) + (merged.tv_usec - parsed.tv_usec) / 1e6);
+    return count;
+}
+
+// 加载DNS表：内置镜像直接使用，预编译镜像直接映射，文本文件则读入字典树
+int load_dns_table(const char *filename, DNSTable **table) {
+    if (strcmp(filename, DNS_TABLE_EMBEDDED) == 0) {
+        if (!g_embedded_image) {
+            printf("本程序构建时未内置本地表\n");
+            return -1;
+        }
+        return table_from_image(table_image_attach(g_embedded_image, g_embedded_size), filename, table);
+    }
+    if (table_image_probe(filename)) {
+        return table_from_image(table_image_open(filename), filename, table);
+    }
+    return load_dns_table_text(filename, table);
+}
+
+/**
+ * 查找域名的最具体匹配
+ * 从最右侧标签开始沿字典树下降，记录沿途最深的子域名规则；
+ * 完整匹配到域名自身时精确规则优先，其次为后缀规则自身。
+ */
+const DNSRecord *dns_table_lookup(const DNSTable *table, const char *domain) {
+    if (!table) return NULL;
+    // 绝大多数查询不在表中，由过滤器直接判定，不做字符串比较
+    if (table->filter.blocks && !table_filter_may_match(&table->filter, domain)) return NULL;
+    if (table->image) return table_image_lookup(table->image, domain);
+    size_t len = strlen(domain);
+    if (len > 0 && domain[len - 1] == '.') len--;
+    if (len == 0) return NULL;
+
+    uint32_t node = 0, best = 0;
+    const char *end = domain + len;
+    while (end > domain) {
+        // 当前节点是查询域名的真祖先，其子域名规则适用
+        if (table->nodes[node].subtree) best = table->nodes[node].subtree;
+        const char *start = end;
+        while (start > domain && start[-1] != '.') start--;
+        if (end - start > 63) break;  // 非法标签，只可能命中祖先规则
+        uint32_t label_len = (uint32_t)(end - start);
+        node = table_find_child(table, node, start, label_len, name_label_hash(start, label_len));
+        if (!node) return best ? &table->records[best - 1] : NULL;
+        end = start > domain ? start - 1 : domain;
+    }
+    if (end > domain) return best ? &table->records[best - 1] : NULL;
+
+    const TableNode *n = &table->nodes[node];
+    uint32_t id = n->exact ? n->exact : (n->apex ? n->apex : best);
+    return id ? &table->records[id - 1] : NULL;
+}
+
+// 释放DNS表
+void free_dns_table(DNSTable *table) {
+    if (!table) return;
+    table_image_close(table->image);
+    table_filter_free(&table->filter);
+    free(table->nodes);
+    free(table->edges);
+    free(table->labels);
+    free(table->records);
+    free(table);
 }
 
 void free_relay_table(RelayEntry *table) {
@@ -6,17 +6,77 @@
 #include "uthash.h"
 #ifdef _WIN32
 #include <winsock2.h>
+#include <ws2tcpip.h>
 #else
 #include <arpa/inet.h>
 #endif
 #include <stdint.h>
 
-// DNS记录结构，用于哈希表存储
+#include "filter.h"
+#include "protocol.h"
+
+// 表示使用构建时编译进可执行文件的本地表的文件名
+#define DNS_TABLE_EMBEDDED "@embedded"
+
+// 本地表规则类型
+#define TABLE_RULE_EXACT 0     // "a.example.com"：只匹配该名称
+#define TABLE_RULE_WILDCARD 1  // "*.example.com"：匹配所有子域名，不含自身
+#define TABLE_RULE_SUFFIX 2    // ".example.com"：匹配自身及所有子域名
+
+// 规则命中后的应答记录，相同IP的规则共享同一条记录
+// 布局固定为96字节，预编译镜像中直接存放该结构的数组
 typedef struct dns_record {
-    char domain[256];   // 域名(键)
-    char ip[46];        // IP地址字符串 (支持IPv4和IPv6)
-    UT_hash_handle hh;  // uthash处理句柄
+    char ip[46];                  // IP地址字符串 (支持IPv4和IPv6)
+    uint8_t blocked;              // IP为0.0.0.0，表示拦截
+    uint8_t family;               // 4或6，IP无法解析时为0
+    uint8_t addr[16];             // 二进制地址
+    uint8_t rr_len;               // 预生成应答记录的长度，0表示无法应答
+    uint8_t rr[DNS_ANSWER_RR_MAX];  // 线格式应答记录，发送时直接拼在问题区之后
+    uint8_t pad[3];
 } DNSRecord;
+typedef char dns_record_layout_check[sizeof(DNSRecord) == 96 ? 1 : -1];
+
+// 预编译镜像（见table_image.h）
+typedef struct table_image TableImage;
+
+// 字典树节点，对应一个反转后的域名前缀（如 com -> example.com）
+// 各字段为records下标+1，0表示没有对应规则
+typedef struct table_node {
+    uint32_t exact;    // 精确规则
+    uint32_t apex;     // 后缀规则作用于节点自身
+    uint32_t subtree;  // 通配/后缀规则作用于所有子域名
+} TableNode;
+
+// 父节点 + 标签 -> 子节点 的边，存放在开放寻址哈希表中，每条16字节
+typedef struct table_edge {
+    uint32_t parent;  // 父节点下标
+    uint32_t hash;    // (父节点, 标签) 的哈希，0表示空槽
+    uint32_t child;   // 子节点下标
+    uint32_t label;   // 标签在labels中的偏移，该处首字节为标签长度
+} TableEdge;
+
+/*
+ * 本地DNS表：按标签反转的基数字典树，支持精确、通配与后缀规则，
+ * 查找时取最具体的匹配。所有边放在一张扁平的开放寻址表中，
+ * 每下降一级只需一次探测，查找代价与标签数有关而与规则数无关。
+ */
+typedef struct dns_table {
+    TableNode *nodes;       // 节点数组，0号为根
+    uint32_t node_count;
+    uint32_t node_cap;
+    TableEdge *edges;       // 边哈希表
+    uint32_t edge_mask;     // 容量-1（容量为2的幂）
+    uint32_t edge_count;
+    char *labels;           // 小写标签池，每个标签以长度字节开头
+    uint32_t labels_len;
+    uint32_t labels_cap;
+    DNSRecord *records;     // 去重后的应答记录
+    uint32_t record_count;
+    uint32_t record_cap;
+    uint32_t rule_count;    // 加载的规则数
+    TableImage *image;      // 非NULL时表示从预编译镜像加载，以上字典树字段均为空
+    TableFilter filter;     // 查找前的过滤器，blocks为NULL时不使用
+} DNSTable;
 
 // ID映射表结构定义
 typedef struct relay_entry {
@@ -26,10 +86,20 @@ typedef struct relay_entry {
     uint8_t query[512];              // 查询数据缓冲区
     int question_len;                // 查询数据长度
     struct timeval timestamp;        // 时间戳，用于超时处理
+    uint64_t received_ns;            // 收到客户端查询时的单调时钟，用于统计端到端延迟
+    uint64_t forwarded_ns;           // 转发到上游时的单调时钟，用于统计上游往返时间
     UT_hash_handle hh;               // uthash处理句柄
 } RelayEntry;
 
-int load_dns_table(const char *filename, DNSRecord **table);
-void free_dns_table(DNSRecord *table);
+// 由IP字符串填充应答记录（拦截标记、地址族与二进制地址）
+void dns_record_init(DNSRecord *record, const char *ip);
+int load_dns_table(const char *filename, DNSTable **table);
+// 设置文本表的解析线程数，0表示按CPU核数
+void dns_table_set_load_threads(int threads);
+// 登记内置镜像，之后以DNS_TABLE_EMBEDDED为文件名加载
+void dns_table_set_embedded(const uint8_t *image, size_t size);
+void free_dns_table(DNSTable *table);
+// 查找域名的最具体匹配规则，未命中返回NULL
+const DNSRecord *dns_table_lookup(const DNSTable *table, const char *domain);
 void free_relay_table(RelayEntry *table);
 #endif /* DNSRELAY_H */
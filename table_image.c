@@ -0,0 +1,210 @@
+#include "table_image.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+uint64_t image_hash(const uint8_t *wire, size_t len, uint32_t seed) {
+    uint64_t h = 1469598103934665603ULL ^ ((uint64_t)seed * 0x9E3779B97F4A7C15ULL);
+    for (size_t i = 0; i < len; i++) {
+        h ^= wire[i];
+        h *= 1099511628211ULL;
+    }
+    h ^= h >> 30;
+    h *= 0xbf58476d1ce4e5b9ULL;
+    h ^= h >> 27;
+    h *= 0x94d049bb133111ebULL;
+    h ^= h >> 31;
+    return h;
+}
+
+int dns_name_to_wire(const char *domain, uint8_t *wire, int cap) {
+    size_t len = strlen(domain);
+    if (len > 0 && domain[len - 1] == '.') len--;
+    if (len == 0 || (int)len + 2 > cap || len > 253) return -1;
+
+    int out = 0;
+    size_t start = 0;
+    while (start <= len) {
+        size_t end = start;
+        while (end < len && domain[end] != '.') end++;
+        size_t label_len = end - start;
+        if (label_len == 0 || label_len > 63) return -1;
+        wire[out++] = (uint8_t)label_len;
+        for (size_t i = start; i < end; i++) {
+            uint8_t c = (uint8_t)domain[i];
+            wire[out++] = (c >= 'A' && c <= 'Z') ? (uint8_t)(c + ('a' - 'A')) : c;
+        }
+        start = end + 1;
+    }
+    wire[out++] = 0;
+    return out;
+}
+
+int table_image_probe(const char *filename) {
+    FILE *fp = fopen(filename, "rb");
+    if (!fp) return 0;
+    char magic[8] = {0};
+    size_t n = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    return n == sizeof(magic) && memcmp(magic, TABLE_IMAGE_MAGIC, sizeof(magic)) == 0;
+}
+
+// 校验头部与各段边界，全部通过后填充各段指针
+// 判断从off开始的count个elem字节的元素是否完整落在size字节内；先限定偏移再比较，头部字段取任何值都不会溢出
+static int section_fits(uint64_t size, uint64_t off, uint64_t count, uint64_t elem) {
+    return off <= size && count <= (size - off) / elem;
+}
+
+static int table_image_validate(TableImage *image) {
+    if (image->size < sizeof(TableImageHeader)) return -1;
+    const TableImageHeader *h = (const TableImageHeader *)image->base;
+    if (memcmp(h->magic, TABLE_IMAGE_MAGIC, sizeof(h->magic)) != 0) return -1;
+    if (h->endian != TABLE_IMAGE_ENDIAN || h->version != TABLE_IMAGE_VERSION) return -1;
+    if (h->total_size != image->size || h->bucket_count == 0) return -1;
+    uint64_t size = image->size;
+    if (!section_fits(size, h->records_off, h->record_count, sizeof(DNSRecord)) ||
+        !section_fits(size, h->pilots_off, h->bucket_count, sizeof(uint32_t)) ||
+        !section_fits(size, h->slots_off, h->slot_count, sizeof(ImageSlot)) ||
+        !section_fits(size, h->names_off, h->names_len, 1) || h->filter_blocks > UINT32_MAX ||
+        !section_fits(size, h->filter_off, h->filter_blocks, FILTER_BLOCK_WORDS * sizeof(uint64_t))) {
+        return -1;
+    }
+    image->header = h;
+    image->records = (const DNSRecord *)(image->base + h->records_off);
+    image->pilots = (const uint32_t *)(image->base + h->pilots_off);
+    image->slots = (const ImageSlot *)(image->base + h->slots_off);
+    image->names = image->base + h->names_off;
+    image->filter = (const uint64_t *)(image->base + h->filter_off);
+    // 槽位引用的记录与名称也须在界内，查找时即可免去检查
+    for (uint32_t i = 0; i < h->slot_count; i++) {
+        const ImageSlot *s = &image->slots[i];
+        if (s->name_off >= h->names_len || s->exact > h->record_count || s->apex > h->record_count ||
+            s->subtree > h->record_count) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+TableImage *table_image_attach(const uint8_t *data, size_t size) {
+    TableImage *image = calloc(1, sizeof(TableImage));
+    if (!image) return NULL;
+    image->base = data;
+    image->size = size;
+    if (table_image_validate(image) < 0) {
+        free(image);
+        return NULL;
+    }
+    return image;
+}
+
+#ifndef _WIN32
+
+TableImage *table_image_open(const char *filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size <= 0) {
+        close(fd);
+        return NULL;
+    }
+    // 只读共享映射：多个进程加载同一镜像时共用物理页
+    void *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    TableImage *image = table_image_attach(base, (size_t)st.st_size);
+    if (!image) {
+        munmap(base, (size_t)st.st_size);
+        return NULL;
+    }
+    image->mapped = 1;
+    return image;
+}
+
+void table_image_close(TableImage *image) {
+    if (!image) return;
+    if (image->mapped) munmap((void *)image->base, image->size);
+    free(image);
+}
+
+#else
+
+TableImage *table_image_open(const char *filename) {
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    if (file == INVALID_HANDLE_VALUE) return NULL;
+    LARGE_INTEGER size;
+    HANDLE map = NULL;
+    const void *base = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        map = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (map) base = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+    }
+    TableImage *image = base ? table_image_attach(base, (size_t)size.QuadPart) : NULL;
+    if (!image) {
+        if (base) UnmapViewOfFile(base);
+        if (map) CloseHandle(map);
+        CloseHandle(file);
+        return NULL;
+    }
+    image->mapped = 1;
+    image->file_handle = file;
+    image->map_handle = map;
+    return image;
+}
+
+void table_image_close(TableImage *image) {
+    if (!image) return;
+    if (image->mapped) {
+        UnmapViewOfFile(image->base);
+        CloseHandle(image->map_handle);
+        CloseHandle(image->file_handle);
+    }
+    free(image);
+}
+
+#endif
+
+// 用最小完美哈希定位名称所在槽位，名称不在表中时返回NULL
+static const ImageSlot *table_image_find(const TableImage *image, const uint8_t *wire, size_t len) {
+    const TableImageHeader *h = image->header;
+    if (h->slot_count == 0) return NULL;
+    uint64_t hash = image_hash(wire, len, h->seed);
+    uint32_t bucket = (uint32_t)((hash >> 32) % h->bucket_count);
+    uint32_t slot = ((uint32_t)hash ^ image_pilot_mix(image->pilots[bucket])) % h->slot_count;
+    const ImageSlot *s = &image->slots[slot];
+    if (s->name_off + len > h->names_len || memcmp(image->names + s->name_off, wire, len) != 0) return NULL;
+    return s;
+}
+
+/**
+ * 在镜像中查找最具体的匹配
+ * 先查完整名称的精确规则与后缀规则自身，再由长到短查各级父域的子域名规则，
+ * 最多探测“标签数”次，命中即返回。
+ */
+const DNSRecord *table_image_lookup(const TableImage *image, const char *domain) {
+    uint8_t wire[MAX_WIRE_NAME];
+    int len = dns_name_to_wire(domain, wire, sizeof(wire));
+    if (len < 0) return NULL;
+
+    const ImageSlot *s = table_image_find(image, wire, (size_t)len);
+    if (s && (s->exact || s->apex)) return &image->records[(s->exact ? s->exact : s->apex) - 1];
+
+    for (int off = 1 + wire[0]; wire[off] != 0; off += 1 + wire[off]) {
+        s = table_image_find(image, wire + off, (size_t)(len - off));
+        if (s && s->subtree) return &image->records[s->subtree - 1];
+    }
+    return NULL;
+}
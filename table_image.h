@@ -0,0 +1,91 @@
+#ifndef DNS_TABLE_IMAGE_H
+#define DNS_TABLE_IMAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "table.h"
+
+#define TABLE_IMAGE_MAGIC "DNSRTBL"    // 8字节魔数（含结尾的0）
+#define TABLE_IMAGE_VERSION 3
+#define TABLE_IMAGE_ENDIAN 0x01020304u  // 字节序标记，读取端不一致时拒绝加载
+#define TABLE_IMAGE_ALIGN 64            // 各段按缓存行对齐
+#define MAX_WIRE_NAME 256               // 线格式域名最大长度
+
+/*
+ * 预编译本地表镜像的文件布局（均为主机字节序）：
+ *   TableImageHeader | DNSRecord[record_count] | uint32_t pilots[bucket_count]
+ *   | ImageSlot[slot_count] | 线格式域名池 | 过滤器块数组（见filter.h）
+ * 每个不同的规则名称占一个槽位，由“哈希-位移”最小完美哈希定位：
+ *   h = image_hash(name, seed)，bucket = h高32位 mod bucket_count，
+ *   slot = (h低32位 ^ mix(pilots[bucket])) mod slot_count
+ * 非表中名称同样会落到某个槽位，因此查找后需比较槽位中的名称。
+ */
+typedef struct table_image_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;
+    uint32_t seed;          // 哈希种子
+    uint32_t rule_count;    // 源文件中的有效规则条数
+    uint32_t record_count;  // 去重后的应答记录数
+    uint32_t bucket_count;  // 位移桶数
+    uint32_t slot_count;    // 槽位数 = 不同名称数
+    uint32_t filter_keys;   // 过滤器中的名称数
+    uint64_t records_off;   // 各段相对文件开头的偏移
+    uint64_t pilots_off;
+    uint64_t slots_off;
+    uint64_t names_off;
+    uint64_t names_len;
+    uint64_t filter_off;
+    uint64_t filter_blocks;  // 过滤器块数，0表示没有过滤器
+    uint64_t total_size;
+} TableImageHeader;
+
+// 槽位：与字典树节点含义相同，记录下标+1，0表示无
+typedef struct image_slot {
+    uint32_t name_off;  // 名称在域名池中的偏移
+    uint32_t exact;     // 精确规则
+    uint32_t apex;      // 后缀规则作用于名称自身
+    uint32_t subtree;   // 通配/后缀规则作用于所有子域名
+} ImageSlot;
+
+// 已打开的镜像，各指针直接指向只读映射的内存
+struct table_image {
+    const uint8_t *base;
+    size_t size;
+    const TableImageHeader *header;
+    const DNSRecord *records;
+    const uint32_t *pilots;
+    const ImageSlot *slots;
+    const uint8_t *names;
+    const uint64_t *filter;
+    int mapped;  // 1表示由mmap得到，释放时需解除映射
+#ifdef _WIN32
+    void *file_handle;
+    void *map_handle;
+#endif
+};
+
+// 镜像使用的名称哈希与位移混合函数，编译端与读取端必须一致
+uint64_t image_hash(const uint8_t *wire, size_t len, uint32_t seed);
+static inline uint32_t image_pilot_mix(uint32_t pilot) {
+    uint32_t x = pilot * 0x9E3779B1u;
+    x ^= x >> 15;
+    x *= 0x2C1B3C6Du;
+    x ^= x >> 12;
+    return x;
+}
+
+// 把点分域名转换为小写线格式，返回线格式长度（含结尾0），非法时返回-1
+int dns_name_to_wire(const char *domain, uint8_t *wire, int cap);
+
+// 判断文件是否为镜像格式
+int table_image_probe(const char *filename);
+// 以只读方式映射镜像文件
+TableImage *table_image_open(const char *filename);
+// 使用已在内存中的镜像（如链接进可执行文件的数据），不复制
+TableImage *table_image_attach(const uint8_t *data, size_t size);
+void table_image_close(TableImage *image);
+const DNSRecord *table_image_lookup(const TableImage *image, const char *domain);
+
+#endif /* DNS_TABLE_IMAGE_H */
@@ -0,0 +1,56 @@
+#include "textout.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <sys/socket.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0  // 没有该标志的平台（如macOS）在textout_init中设置SO_NOSIGPIPE
+#endif
+
+void textout_init(TextOut *out, int fd, QSBR *qsbr, int reader) {
+    out->fd = fd;
+    out->failed = 0;
+    out->qsbr = qsbr;
+    out->reader = reader;
+    out->len = 0;
+#ifdef SO_NOSIGPIPE
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+void textout_flush(TextOut *out) {
+    size_t off = 0;
+    if (out->qsbr) qsbr_offline(out->qsbr, out->reader);
+    while (!out->failed && off < out->len) {
+        // 对端已断开时只让send失败，不产生SIGPIPE
+        int n = (int)send(out->fd, out->buf + off, (int)(out->len - off), MSG_NOSIGNAL);
+        if (n <= 0) {
+            out->failed = 1;
+            break;
+        }
+        off += (size_t)n;
+    }
+    out->len = 0;
+    if (out->qsbr) qsbr_online(out->qsbr, out->reader);
+}
+
+void textout_printf(TextOut *out, const char *format, ...) {
+    char line[TEXTOUT_LINE_MAX];
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (n < 0) return;
+    if ((size_t)n >= sizeof(line)) n = sizeof(line) - 1;
+    if (out->len + (size_t)n > sizeof(out->buf)) textout_flush(out);
+    memcpy(out->buf + out->len, line, (size_t)n);
+    out->len += (size_t)n;
+}
@@ -0,0 +1,30 @@
+#ifndef DNS_TEXTOUT_H
+#define DNS_TEXTOUT_H
+
+#include <stddef.h>
+
+#include "qsbr.h"
+
+// 单次格式化输出的最大长度，超出部分截断
+#define TEXTOUT_LINE_MAX 1024
+
+/*
+ * 管理接口与指标接口共用的带缓冲文本输出：格式化结果追加到缓冲区，缓冲满时写出到连接，
+ * 写出失败后丢弃其余输出。设置了qsbr时，写出期间把reader标记为离线，
+ * 因此调用者不能跨越一次输出持有本地表或缓存条目指针。
+ */
+typedef struct text_out {
+    int fd;
+    int failed;  // 写出失败后不再尝试
+    QSBR *qsbr;  // 写出期间标记为离线的读者登记，NULL表示不需要
+    int reader;
+    size_t len;
+    char buf[16384];
+} TextOut;
+
+void textout_init(TextOut *out, int fd, QSBR *qsbr, int reader);
+// 写出缓冲区中的全部内容
+void textout_flush(TextOut *out);
+void textout_printf(TextOut *out, const char *format, ...);
+
+#endif /* DNS_TEXTOUT_H */
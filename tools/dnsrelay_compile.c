@@ -0,0 +1,424 @@
+/*
+ * dnsrelay-compile：把dnsrelay.txt格式的本地表编译为可直接mmap的二进制镜像。
+ * 用法：dnsrelay-compile [--emit-c] <input.txt> <output>
+ * 镜像格式见table_image.h，服务器检测到魔数后直接映射，无需解析。
+ * --emit-c 输出包含镜像数据的C源文件，用于在构建时把本地表编译进dnsrelay。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "table.h"
+#include "table_image.h"
+#include "uthash.h"
+
+#define MAX_SEED_ATTEMPTS 16
+#define MAX_PILOT (1u << 24)
+#define KEYS_PER_BUCKET 4
+
+// 去重后的应答记录
+typedef struct record_entry {
+    char ip[46];
+    uint32_t id;  // records下标+1
+    UT_hash_handle hh;
+} RecordEntry;
+
+// 一个不同的规则名称及其上的各类规则
+typedef struct name_entry {
+    uint8_t wire[MAX_WIRE_NAME];  // 小写线格式（键，以0结尾可按字符串处理）
+    int wire_len;
+    uint32_t exact, apex, subtree;
+    uint64_t hash;
+    uint32_t bucket;
+    UT_hash_handle hh;
+} NameEntry;
+
+typedef struct compiler {
+    RecordEntry *record_index;
+    DNSRecord *records;
+    uint32_t record_count;
+    uint32_t record_cap;
+    NameEntry *names;
+    uint32_t rule_count;
+    double filter_fpr;  // 过滤器估计误判率
+} Compiler;
+
+static uint32_t intern_record(Compiler *c, const char *ip) {
+    RecordEntry *found;
+    HASH_FIND_STR(c->record_index, ip, found);
+    if (found) return found->id;
+    if (c->record_count == c->record_cap) {
+        c->record_cap = c->record_cap ? c->record_cap * 2 : 16;
+        c->records = realloc(c->records, c->record_cap * sizeof(DNSRecord));
+        if (!c->records) return 0;
+    }
+    found = calloc(1, sizeof(RecordEntry));
+    if (!found) return 0;
+    dns_record_init(&c->records[c->record_count], ip);
+    strcpy(found->ip, c->records[c->record_count].ip);
+    found->id = ++c->record_count;
+    HASH_ADD_STR(c->record_index, ip, found);
+    return found->id;
+}
+
+// 添加一条规则，语义与table.c中的文本加载一致
+static int add_rule(Compiler *c, const char *name, uint32_t record_id) {
+    int kind = TABLE_RULE_EXACT;
+    if (name[0] == '*' && name[1] == '.') {
+        kind = TABLE_RULE_WILDCARD;
+        name += 2;
+    } else if (name[0] == '.') {
+        kind = TABLE_RULE_SUFFIX;
+        name += 1;
+    }
+    uint8_t wire[MAX_WIRE_NAME];
+    int len = dns_name_to_wire(name, wire, sizeof(wire));
+    if (len < 0) return -1;
+
+    NameEntry *entry;
+    HASH_FIND(hh, c->names, wire, (unsigned)len, entry);
+    if (!entry) {
+        entry = calloc(1, sizeof(NameEntry));
+        if (!entry) return -1;
+        memcpy(entry->wire, wire, (size_t)len);
+        entry->wire_len = len;
+        HASH_ADD(hh, c->names, wire, (unsigned)len, entry);
+    }
+    if (kind == TABLE_RULE_EXACT) {
+        entry->exact = record_id;
+    } else if (kind == TABLE_RULE_WILDCARD) {
+        entry->subtree = record_id;
+    } else {
+        entry->apex = record_id;
+        entry->subtree = record_id;
+    }
+    c->rule_count++;
+    return 0;
+}
+
+static int read_rules(Compiler *c, const char *filename) {
+    FILE *fp = fopen(filename, "r");
+    if (!fp) {
+        fprintf(stderr, "无法打开输入文件 %s\n", filename);
+        return -1;
+    }
+    char line[512], ip[46], domain[256];
+    unsigned long line_no = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        line_no++;
+        if (line[0] == '#' || sscanf(line, "%45s %255s", ip, domain) != 2) continue;
+        uint32_t record_id = intern_record(c, ip);
+        if (!record_id || add_rule(c, domain, record_id) < 0) {
+            fprintf(stderr, "%s:%lu: 忽略无效记录 %s %s\n", filename, line_no, ip, domain);
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+// 按桶大小降序排序，qsort比较函数通过全局变量访问各桶大小
+static const uint32_t *g_bucket_sizes;
+static int compare_bucket_size(const void *a, const void *b) {
+    uint32_t sa = g_bucket_sizes[*(const uint32_t *)a], sb = g_bucket_sizes[*(const uint32_t *)b];
+    return (sa < sb) - (sa > sb);
+}
+
+/**
+ * 构造“哈希-位移”最小完美哈希：按桶大小降序为每个桶寻找位移值，
+ * 使桶内所有名称落在互不相同且尚未占用的槽位上。
+ * @return 0成功，-1表示该种子下无法完成
+ */
+static int build_mph(NameEntry **keys, uint32_t n, uint32_t seed, uint32_t bucket_count, uint32_t *pilots,
+                     NameEntry **slots) {
+    uint32_t *sizes = calloc(bucket_count, sizeof(uint32_t));
+    uint32_t *starts = calloc((size_t)bucket_count + 1, sizeof(uint32_t));
+    uint32_t *order = malloc(bucket_count * sizeof(uint32_t));
+    NameEntry **by_bucket = malloc(n * sizeof(NameEntry *));
+    uint32_t *positions = malloc(n * sizeof(uint32_t));
+    int ok = sizes && starts && order && by_bucket && positions;
+
+    if (ok) {
+        for (uint32_t i = 0; i < n; i++) {
+            keys[i]->hash = image_hash(keys[i]->wire, (size_t)keys[i]->wire_len, seed);
+            keys[i]->bucket = (uint32_t)((keys[i]->hash >> 32) % bucket_count);
+            sizes[keys[i]->bucket]++;
+        }
+        for (uint32_t b = 0; b < bucket_count; b++) starts[b + 1] = starts[b] + sizes[b];
+        memset(order, 0, bucket_count * sizeof(uint32_t));
+        for (uint32_t i = 0; i < n; i++) by_bucket[starts[keys[i]->bucket] + order[keys[i]->bucket]++] = keys[i];
+        for (uint32_t b = 0; b < bucket_count; b++) order[b] = b;
+        g_bucket_sizes = sizes;
+        qsort(order, bucket_count, sizeof(uint32_t), compare_bucket_size);
+        memset(slots, 0, n * sizeof(NameEntry *));
+    }
+
+    for (uint32_t k = 0; ok && k < bucket_count; k++) {
+        uint32_t b = order[k];
+        uint32_t size = sizes[b];
+        NameEntry **members = by_bucket + starts[b];
+        pilots[b] = 0;
+        if (size == 0) continue;
+        uint32_t pilot;
+        for (pilot = 0; pilot < MAX_PILOT; pilot++) {
+            uint32_t mix = image_pilot_mix(pilot);
+            uint32_t j;
+            for (j = 0; j < size; j++) {
+                uint32_t pos = ((uint32_t)members[j]->hash ^ mix) % n;
+                if (slots[pos]) break;
+                uint32_t t;
+                for (t = 0; t < j && positions[t] != pos; t++) {
+                }
+                if (t < j) break;
+                positions[j] = pos;
+            }
+            if (j == size) break;
+        }
+        if (pilot == MAX_PILOT) {
+            ok = 0;
+            break;
+        }
+        pilots[b] = pilot;
+        for (uint32_t j = 0; j < size; j++) slots[positions[j]] = members[j];
+    }
+
+    free(sizes);
+    free(starts);
+    free(order);
+    free(by_bucket);
+    free(positions);
+    return ok ? 0 : -1;
+}
+
+// 过滤器中的一个后缀，按哈希排序后相邻合并
+typedef struct filter_suffix {
+    uint64_t hash;
+    int has_rule;
+} FilterSuffix;
+
+static int compare_suffix(const void *a, const void *b) {
+    uint64_t x = ((const FilterSuffix *)a)->hash, y = ((const FilterSuffix *)b)->hash;
+    return (x > y) - (x < y);
+}
+
+/**
+ * 构建过滤器：每个名称的每一级后缀（链式哈希从最右侧标签开始逐级计算，
+ * 与table_filter_may_match一致）都作为节点加入，名称自身另置规则位
+ * @return 0成功，-1内存不足
+ */
+static int build_filter(NameEntry **keys, uint32_t n, TableFilter *filter) {
+    size_t cap = 0, count = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        for (int off = 0; keys[i]->wire[off] != 0; off += 1 + keys[i]->wire[off]) cap++;
+    }
+    FilterSuffix *suffixes = malloc((cap ? cap : 1) * sizeof(FilterSuffix));
+    if (!suffixes) return -1;
+    for (uint32_t i = 0; i < n; i++) {
+        const uint8_t *wire = keys[i]->wire;
+        int offsets[128], labels = 0;
+        for (int off = 0; wire[off] != 0 && labels < 128; off += 1 + wire[off]) offsets[labels++] = off;
+        uint64_t h = FILTER_ROOT_HASH;
+        while (labels-- > 0) {
+            const uint8_t *label = wire + offsets[labels];
+            h = filter_chain_hash(h, name_label_hash((const char *)label + 1, label[0]));
+            suffixes[count].hash = h;
+            suffixes[count++].has_rule = labels == 0;
+        }
+    }
+    qsort(suffixes, count, sizeof(FilterSuffix), compare_suffix);
+
+    // 去重，同一后缀只要有一次带规则即置规则位
+    size_t unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (unique > 0 && suffixes[unique - 1].hash == suffixes[i].hash) {
+            suffixes[unique - 1].has_rule |= suffixes[i].has_rule;
+        } else {
+            suffixes[unique++] = suffixes[i];
+        }
+    }
+    if (table_filter_init(filter, (uint32_t)unique, n) < 0) {
+        free(suffixes);
+        return -1;
+    }
+    for (size_t i = 0; i < unique; i++) table_filter_add(filter, suffixes[i].hash, suffixes[i].has_rule);
+    free(suffixes);
+    return 0;
+}
+
+static uint64_t align_up(uint64_t v) { return (v + TABLE_IMAGE_ALIGN - 1) & ~(uint64_t)(TABLE_IMAGE_ALIGN - 1); }
+
+// 构造完整镜像，返回malloc得到的缓冲区
+static uint8_t *build_image(Compiler *c, size_t *out_size) {
+    uint32_t n = HASH_COUNT(c->names);
+    uint32_t bucket_count = n / KEYS_PER_BUCKET + 1;
+    NameEntry **keys = malloc((n ? n : 1) * sizeof(NameEntry *));
+    NameEntry **slots = malloc((n ? n : 1) * sizeof(NameEntry *));
+    uint32_t *pilots = calloc(bucket_count, sizeof(uint32_t));
+    if (!keys || !slots || !pilots) return NULL;
+    uint32_t i = 0;
+    NameEntry *e, *tmp;
+    HASH_ITER(hh, c->names, e, tmp) keys[i++] = e;
+
+    uint32_t seed = 0;
+    if (n > 0) {
+        for (; seed < MAX_SEED_ATTEMPTS; seed++) {
+            if (build_mph(keys, n, seed, bucket_count, pilots, slots) == 0) break;
+        }
+        if (seed == MAX_SEED_ATTEMPTS) {
+            fprintf(stderr, "无法构造完美哈希\n");
+            return NULL;
+        }
+    }
+
+    uint64_t names_len = 0;
+    for (i = 0; i < n; i++) names_len += (uint64_t)keys[i]->wire_len;
+
+    TableFilter filter;
+    if (build_filter(keys, n, &filter) < 0) return NULL;
+    c->filter_fpr = table_filter_fpr(&filter);
+
+    TableImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, TABLE_IMAGE_MAGIC, sizeof(header.magic));
+    header.version = TABLE_IMAGE_VERSION;
+    header.endian = TABLE_IMAGE_ENDIAN;
+    header.seed = seed;
+    header.rule_count = c->rule_count;
+    header.record_count = c->record_count;
+    header.bucket_count = bucket_count;
+    header.slot_count = n;
+    header.records_off = align_up(sizeof(TableImageHeader));
+    header.pilots_off = align_up(header.records_off + (uint64_t)c->record_count * sizeof(DNSRecord));
+    header.slots_off = align_up(header.pilots_off + (uint64_t)bucket_count * sizeof(uint32_t));
+    header.names_off = align_up(header.slots_off + (uint64_t)n * sizeof(ImageSlot));
+    header.names_len = names_len;
+    header.filter_keys = filter.key_count;
+    header.filter_off = align_up(header.names_off + names_len);
+    header.filter_blocks = filter.block_count;
+    header.total_size = header.filter_off + (uint64_t)filter.block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t);
+
+    uint8_t *image = calloc(1, (size_t)header.total_size);
+    if (!image) {
+        table_filter_free(&filter);
+        return NULL;
+    }
+    memcpy(image, &header, sizeof(header));
+    if (c->record_count) {
+        memcpy(image + header.records_off, c->records, c->record_count * sizeof(DNSRecord));
+    }
+    memcpy(image + header.pilots_off, pilots, bucket_count * sizeof(uint32_t));
+    ImageSlot *out_slots = (ImageSlot *)(image + header.slots_off);
+    uint32_t name_off = 0;
+    for (i = 0; i < n; i++) {
+        const NameEntry *s = slots[i];
+        out_slots[i].name_off = name_off;
+        out_slots[i].exact = s->exact;
+        out_slots[i].apex = s->apex;
+        out_slots[i].subtree = s->subtree;
+        memcpy(image + header.names_off + name_off, s->wire, (size_t)s->wire_len);
+        name_off += (uint32_t)s->wire_len;
+    }
+    memcpy(image + header.filter_off, filter.blocks, (size_t)filter.block_count * FILTER_BLOCK_WORDS * sizeof(uint64_t));
+    table_filter_free(&filter);
+
+    free(keys);
+    free(slots);
+    free(pilots);
+    *out_size = (size_t)header.total_size;
+    return image;
+}
+
+/**
+ * 在目标所在目录打开临时文件<filename>.tmp.<pid>，写完后由output_commit替换目标。
+ * 服务器正映射着旧镜像时也可以原地重新编译：旧文件的页保持不变，SIGHUP重新加载时才打开新文件。
+ */
+static FILE *output_open(const char *filename, const char *mode, char *tmp, size_t tmp_size) {
+#ifdef _WIN32
+    snprintf(tmp, tmp_size, "%s.tmp.%d", filename, _getpid());
+#else
+    snprintf(tmp, tmp_size, "%s.tmp.%d", filename, (int)getpid());
+#endif
+    FILE *fp = fopen(tmp, mode);
+    if (!fp) fprintf(stderr, "无法写入 %s\n", tmp);
+    return fp;
+}
+
+// 刷新并同步临时文件后以rename原子替换目标，ok为0或任一步失败时删除临时文件
+static int output_commit(FILE *fp, const char *tmp, const char *filename, int ok) {
+    ok = ok && fflush(fp) == 0 && !ferror(fp);
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(fp)) == 0;
+#else
+    ok = ok && fsync(fileno(fp)) == 0;
+#endif
+    ok = (fclose(fp) == 0) && ok;
+#ifdef _WIN32
+    // Windows的rename不覆盖已存在的文件
+    ok = ok && MoveFileExA(tmp, filename, MOVEFILE_REPLACE_EXISTING);
+#else
+    ok = ok && rename(tmp, filename) == 0;
+#endif
+    if (!ok) {
+        fprintf(stderr, "无法写入 %s\n", filename);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static int write_binary(const char *filename, const uint8_t *image, size_t size) {
+    char tmp[4096];
+    FILE *fp = output_open(filename, "wb", tmp, sizeof(tmp));
+    if (!fp) return -1;
+    return output_commit(fp, tmp, filename, fwrite(image, 1, size, fp) == size);
+}
+
+/**
+ * 输出C源文件：镜像按64位字存放在64字节对齐的只读数组中，
+ * 链接后位于只读数据段，启动时直接使用，不占用堆内存。
+ * 数组按主机字节序生成，目标平台字节序不同时镜像头部的字节序标记会拒绝加载。
+ */
+static int write_c_source(const char *filename, const char *input, const uint8_t *image, size_t size) {
+    char tmp[4096];
+    FILE *fp = output_open(filename, "w", tmp, sizeof(tmp));
+    if (!fp) return -1;
+    size_t words = (size + 7) / 8;
+    fprintf(fp, "/* 由dnsrelay-compile根据 %s 生成，请勿手工修改 */\n", input);
+    fprintf(fp, "#include <stddef.h>\n#include <stdint.h>\n\n");
+    fprintf(fp, "static _Alignas(64) const uint64_t embedded_words[%zu] = {\n", words ? words : 1);
+    for (size_t i = 0; i < words; i++) {
+        uint64_t w = 0;
+        memcpy(&w, image + i * 8, size - i * 8 < 8 ? size - i * 8 : 8);
+        fprintf(fp, "0x%llxULL,%s", (unsigned long long)w, (i % 6 == 5 || i + 1 == words) ? "\n" : "");
+    }
+    fprintf(fp, "};\n\nconst uint8_t *const dnsrelay_embedded_table = (const uint8_t *)embedded_words;\n");
+    fprintf(fp, "const size_t dnsrelay_embedded_table_size = %zu;\n", size);
+    return output_commit(fp, tmp, filename, 1);
+}
+
+int main(int argc, char *argv[]) {
+    int emit_c = argc == 4 && strcmp(argv[1], "--emit-c") == 0;
+    if (argc != 3 && !emit_c) {
+        fprintf(stderr, "Usage: %s [--emit-c] <input.txt> <output>\n", argv[0]);
+        return 2;
+    }
+    const char *input = argv[argc - 2], *output = argv[argc - 1];
+    Compiler c;
+    memset(&c, 0, sizeof(c));
+    if (read_rules(&c, input) < 0) return 1;
+
+    size_t size = 0;
+    uint8_t *image = build_image(&c, &size);
+    if (!image) return 1;
+    if ((emit_c ? write_c_source(output, input, image, size) : write_binary(output, image, size)) < 0) return 1;
+    printf("%s: %u 条规则，%u 个名称，%u 个不同IP，镜像 %zu 字节，过滤器误判率约 %.4f%%\n", output, c.rule_count,
+           HASH_COUNT(c.names), c.record_count, size, 100.0 * c.filter_fpr);
+    free(image);
+    return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * dnsrelay-qlog：把 --qlog 写出的二进制查询日志解码为文本，每条记录一行。
+ * 用法：dnsrelay-qlog <qlog> [qlog.1 ...]
+ * 输出列：Unix时间 Q/R 客户端地址:端口 报文ID 域名 类型，应答额外给出解析路径、RCODE与回答数，
+ * 例如
+ *   1760781600.123456789 Q 127.0.0.1:40000 id=4660 www.example.com A
+ *   1760781600.123470112 R 127.0.0.1:40000 id=4660 www.example.com A path=cache rcode=0 an=1
+ * 文件格式见qlog.h。
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "protocol.h"
+#include "qlog.h"
+#include "server.h"
+
+static const char *type_name(uint16_t qtype, char *buf, size_t len) {
+    if (qtype == DNS_TYPE_A) return "A";
+    if (qtype == DNS_TYPE_AAAA) return "AAAA";
+    snprintf(buf, len, "TYPE%u", qtype);
+    return buf;
+}
+
+static void print_record(const QLogFileHeader *header, const QLogRecord *rec, const uint8_t *msg) {
+    uint64_t t = rec->time_ns - header->mono_base_ns + header->real_base_ns;
+    char addr[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &rec->client_ip, addr, sizeof(addr));
+    printf("%llu.%09llu %c %s:%u", (unsigned long long)(t / 1000000000ULL), (unsigned long long)(t % 1000000000ULL),
+           rec->kind == QLOG_KIND_QUERY ? 'Q' : 'R', addr, ntohs(rec->client_port));
+    if (rec->msg_len < DNS_HEADER_SIZE) {
+        printf(" malformed len=%u\n", rec->msg_len);
+        return;
+    }
+    const DNSHeader *dns = (const DNSHeader *)msg;
+    printf(" id=%u", ntohs(dns->id));
+    char domain[256], type_buf[16];
+    int qname_len = ntohs(dns->qdcount) ? parse_dns_name(msg, rec->msg_len, DNS_HEADER_SIZE, domain, sizeof(domain))
+                                        : -1;
+    if (qname_len >= 0 && DNS_HEADER_SIZE + qname_len + (int)sizeof(DNSQuestion) <= rec->msg_len) {
+        const DNSQuestion *q = (const DNSQuestion *)(msg + DNS_HEADER_SIZE + qname_len);
+        printf(" %s %s", domain[0] ? domain : ".", type_name(ntohs(q->qtype), type_buf, sizeof(type_buf)));
+    } else {
+        printf(" - -");
+    }
+    if (rec->kind == QLOG_KIND_RESPONSE) {
+        printf(" path=%s rcode=%u an=%u", rec->path < PATH_COUNT ? query_path_names[rec->path] : "other",
+               ntohs(dns->flags) & 0xF, ntohs(dns->ancount));
+    }
+    printf("\n");
+}
+
+// 解码一个日志文件，返回记录数，格式错误返回-1
+static long decode_file(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        fprintf(stderr, "无法打开文件: %s\n", path);
+        return -1;
+    }
+    QLogFileHeader header;
+    if (fread(&header, sizeof(header), 1, fp) != 1 || memcmp(header.magic, QLOG_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "不是查询日志文件: %s\n", path);
+        fclose(fp);
+        return -1;
+    }
+    if (header.byte_order != QLOG_BYTE_ORDER) {
+        fprintf(stderr, "日志由字节序不同的主机写出，无法解码: %s\n", path);
+        fclose(fp);
+        return -1;
+    }
+
+    long records = 0;
+    uint8_t buf[sizeof(QLogRecord) + 65536];
+    QLogRecord *rec = (QLogRecord *)buf;
+    while (fread(rec, sizeof(QLogRecord), 1, fp) == 1) {
+        size_t padded = (rec->length + 7u) & ~7u;
+        if (rec->length < sizeof(QLogRecord) || rec->length - sizeof(QLogRecord) != rec->msg_len ||
+            fread(buf + sizeof(QLogRecord), padded - sizeof(QLogRecord), 1, fp) != 1) {
+            // 进程被强制结束时最后一条记录可能不完整
+            fprintf(stderr, "%s: 第%ld条记录之后的数据不完整\n", path, records);
+            break;
+        }
+        print_record(&header, rec, buf + sizeof(QLogRecord));
+        records++;
+    }
+    fclose(fp);
+    return records;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <qlog> [qlog.1 ...]\n", argv[0]);
+        return 1;
+    }
+    int status = 0;
+    for (int i = 1; i < argc; i++) {
+        if (decode_file(argv[i]) < 0) status = 1;
+    }
+    return status;
+}
@@ -1,45 +1,25 @@
 #include "util.h"
 
+#include <ctype.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-// 全局变量定义
-static int g_debug_mode = 0;
+#include "logging.h"
 
-void print_debug_info(const char *format, ...) {
-    if (g_debug_mode != 2) return;
+// 虚拟时钟，非NULL时get_now返回其当前值
+static const struct timeval *g_virtual_now;
 
-    va_list args;
-    va_start(args, format);
-    vprintf(format, args);
-    va_end(args);
-    fflush(stdout);
-}
-
-// 打印查询调试信息，包含时间戳、序号和域名
-void print_query_debug(const char *domain) {
-    static int g_query_counter = 0;
-    if (g_debug_mode != 1) return;
-
-    // 获取当前时间
-    time_t now;
-    struct tm *timeinfo;
-    char time_str[64];
-
-    time(&now);
-    timeinfo = localtime(&now);
-    strftime(time_str, sizeof(time_str), "%Y-%m-%d %H:%M:%S", timeinfo);
-
-    // 增加查询计数器
-    g_query_counter++;
-
-    // 输出调试信息
-    printf("[DEBUG] Time: %s, Query #%d, Domain: %s\n", time_str, g_query_counter, domain);
-    fflush(stdout);
-}
+void set_virtual_clock(const struct timeval *now) { g_virtual_now = now; }
 
 // 获取当前高精度时间戳
 void get_now(struct timeval *tv) {
+    if (g_virtual_now) {
+        *tv = *g_virtual_now;
+        return;
+    }
 #ifdef _WIN32
     FILETIME ft;
     ULARGE_INTEGER uli;
@@ -56,46 +36,232 @@ void get_now(struct timeval *tv) {
 #endif
 }
 
+uint64_t get_monotonic_ns(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (uint64_t)((double)now.QuadPart * 1e9 / (double)freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+// 解析带单位的字节数，如 "4096"、"64K"、"512M"、"1G"，成功返回0
+int parse_size(const char *text, uint64_t *out) {
+    char *end;
+    // strtoull接受负号并按无符号回绕，先行排除
+    while (isspace((unsigned char)*text)) text++;
+    if (*text == '-') return -1;
+    errno = 0;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text || errno == ERANGE) return -1;
+    int shift = 0;
+    switch (*end) {
+        case '\0': break;
+        case 'k': case 'K': shift = 10; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'g': case 'G': shift = 30; end++; break;
+        default: return -1;
+    }
+    if (*end == 'B' || *end == 'b') end++;
+    if (*end != '\0') return -1;
+    // 移位前检查溢出，否则如 "99999999999G" 会静默回绕成一个小值
+    if (value > (SIZE_MAX >> shift)) return -1;
+    *out = (uint64_t)value << shift;
+    return 0;
+}
+
 // 打印使用说明
 void print_usage(const char *program_name) {
-    printf("Usage: %s [options]\n", program_name);
+    printf("Usage: %s [options] [dns_server] [config_file]\n", program_name);
     printf("Options:\n");
-    printf("  -d              Enable debug mode\n");
-    printf("  <dns_server>    Specify DNS server IP (e.g., 192.168.0.1)\n");
+    printf("  -d              Enable debug mode 1 (query log)\n");
+    printf("  -dd             Enable debug mode 2 (query log and verbose debug info)\n");
+    printf("  --log-level <level>     off, error, warn (default), info (same as -d) or debug (same as -dd)\n");
+    printf("  --log-rate <n>  At most n messages per second from each log statement, 0 = unlimited (default 200)\n");
+    printf("  -p <port>       Listen port (default 53)\n");
+    printf("  -m <size>       Cache memory budget in bytes, K/M/G suffix allowed (default 4M)\n");
+    printf("  --mrc <rate>    Estimate the cache miss-ratio curve, sampling this fraction of keys\n");
+    printf("  --cache-target <ratio>  Resize the cache toward this hit ratio (e.g. 0.9)\n");
+    printf("  --cache-ceiling <size>  Memory ceiling for automatic resizing (default 256M)\n");
+    printf("  -a <path>       Serve admin commands on a local Unix socket (flush, dump, stats...)\n");
+    printf("  --metrics <port>        Serve Prometheus metrics on http://127.0.0.1:port/metrics\n");
+    printf("  --qlog <path>   Write a binary log of queries and responses (decode with dnsrelay-qlog)\n");
+    printf("  --qlog-size <size>      Rotate the query log at this size, K/M/G suffix allowed (default 64M)\n");
+    printf("  --qlog-files <n>        Rotated query logs to keep (default 4)\n");
+    printf("  --qlog-buffer <size>    Per-thread query log buffer; records are dropped when it is full (default 1M)\n");
+    printf("  --load-threads <n>      Threads used to parse a text table (default: one per CPU)\n");
+    printf("  --async-load    Start serving at once and load the table in the background (forward-only until ready)\n");
+    printf("  --workers <n>   Serving threads sharing the port via SO_REUSEPORT and one lock-free cache (default 1)\n");
+    printf("  --profile       Time each query processing stage from startup (toggle with the profile admin command)\n");
+    printf("  --rrl <rate>    Limit responses per second to each client prefix and response type\n");
+    printf("  --rrl-slip <n>  Send TC=1 for one in n limited responses, drop the rest; 0 = drop all (default 2)\n");
+    printf("  --rrl-prefix <len>      Client address prefix length sharing one limit (default 24)\n");
+    printf("  --rrl-table <size>      Rate limit table size, K/M/G suffix allowed (default 1M)\n");
+    printf("  <dns_server>    Specify DNS server IP, optionally with a port (e.g., 192.168.0.1 or 127.0.0.1:5354)\n");
     printf("  <config_file>   Specify configuration file path (e.g., c:\\dns-table.txt)\n");
     printf("\nExample:\n");
     printf("  %s -d 192.168.0.1 c:\\dns-table.txt\n", program_name);
-    printf("  %s 8.8.8.8 dnsrelay.txt\n", program_name);
+    printf("  %s -m 512M 8.8.8.8 dnsrelay.txt\n", program_name);
 }
 
-// 解析命令行参数
-int parse_command_line(int argc, char *argv[], char *dns_server, size_t dns_server_len, char *config_file,
-                       size_t config_file_len) {
+// 解析命令行参数，选项须位于位置参数之前
+int parse_command_line(int argc, char *argv[], RelayOptions *opts) {
     int arg_index = 1;
 
-    // 检查是否有调试标志
-    if (argc > 1 && strcmp(argv[1], "-d") == 0) {
-        g_debug_mode = 1;
-        arg_index = 2;
-        printf("Debug mode 1 enabled\n");
-    } else if (argc > 1 && strcmp(argv[1], "-dd") == 0) {
-        g_debug_mode = 2;
-        arg_index = 2;
-        printf("Debug mode 2 enabled\n");
+    for (; arg_index < argc && argv[arg_index][0] == '-'; arg_index++) {
+        const char *arg = argv[arg_index];
+        if (strcmp(arg, "-d") == 0) {
+            // 调试模式1：打印查询信息
+            log_set_level(LOG_LEVEL_INFO);
+            printf("Debug mode 1 enabled\n");
+        } else if (strcmp(arg, "-dd") == 0) {
+            // 调试模式2：同时打印详细调试信息
+            log_set_level(LOG_LEVEL_DEBUG);
+            printf("Debug mode 2 enabled\n");
+        } else if (strcmp(arg, "--log-level") == 0 && arg_index + 1 < argc) {
+            int level = log_parse_level(argv[++arg_index]);
+            if (level < 0) {
+                printf("无效的日志级别: %s\n", argv[arg_index]);
+                return -1;
+            }
+            log_set_level(level);
+        } else if (strcmp(arg, "--log-rate") == 0 && arg_index + 1 < argc) {
+            int rate = atoi(argv[++arg_index]);
+            if (rate < 0) {
+                printf("无效的限速: %s\n", argv[arg_index]);
+                return -1;
+            }
+            log_set_rate_limit((unsigned)rate);
+        } else if (strcmp(arg, "-p") == 0 && arg_index + 1 < argc) {
+            opts->listen_port = atoi(argv[++arg_index]);
+            if (opts->listen_port <= 0 || opts->listen_port > 65535) {
+                printf("无效的端口: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "-m") == 0 && arg_index + 1 < argc) {
+            if (parse_size(argv[++arg_index], &opts->cache_bytes) < 0 || opts->cache_bytes == 0) {
+                printf("无效的缓存大小: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--mrc") == 0 && arg_index + 1 < argc) {
+            opts->mrc_rate = atof(argv[++arg_index]);
+            if (opts->mrc_rate <= 0.0 || opts->mrc_rate > 1.0) {
+                printf("无效的采样率: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--cache-target") == 0 && arg_index + 1 < argc) {
+            opts->cache_target = atof(argv[++arg_index]);
+            if (opts->cache_target <= 0.0 || opts->cache_target >= 1.0) {
+                printf("无效的目标命中率: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--cache-ceiling") == 0 && arg_index + 1 < argc) {
+            if (parse_size(argv[++arg_index], &opts->cache_ceiling) < 0 || opts->cache_ceiling == 0) {
+                printf("无效的内存上限: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "-a") == 0 && arg_index + 1 < argc) {
+            strncpy(opts->admin_path, argv[++arg_index], sizeof(opts->admin_path) - 1);
+            opts->admin_path[sizeof(opts->admin_path) - 1] = '\0';
+        } else if (strcmp(arg, "--metrics") == 0 && arg_index + 1 < argc) {
+            opts->metrics_port = atoi(argv[++arg_index]);
+            if (opts->metrics_port <= 0 || opts->metrics_port > 65535) {
+                printf("无效的端口: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--qlog") == 0 && arg_index + 1 < argc) {
+            strncpy(opts->qlog_path, argv[++arg_index], sizeof(opts->qlog_path) - 1);
+            opts->qlog_path[sizeof(opts->qlog_path) - 1] = '\0';
+        } else if (strcmp(arg, "--qlog-size") == 0 && arg_index + 1 < argc) {
+            if (parse_size(argv[++arg_index], &opts->qlog_bytes) < 0 || opts->qlog_bytes == 0) {
+                printf("无效的日志大小: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--qlog-files") == 0 && arg_index + 1 < argc) {
+            opts->qlog_files = atoi(argv[++arg_index]);
+            if (opts->qlog_files < 0) {
+                printf("无效的文件数: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--qlog-buffer") == 0 && arg_index + 1 < argc) {
+            if (parse_size(argv[++arg_index], &opts->qlog_ring) < 0 || opts->qlog_ring == 0 ||
+                opts->qlog_ring > (1ULL << 30)) {
+                printf("无效的缓冲区大小: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--load-threads") == 0 && arg_index + 1 < argc) {
+            opts->load_threads = atoi(argv[++arg_index]);
+            if (opts->load_threads <= 0) {
+                printf("无效的线程数: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--async-load") == 0) {
+            opts->async_load = 1;
+        } else if (strcmp(arg, "--profile") == 0) {
+            opts->profile = 1;
+        } else if (strcmp(arg, "--rrl") == 0 && arg_index + 1 < argc) {
+            long rate = atol(argv[++arg_index]);
+            if (rate <= 0 || rate > 1000000) {
+                printf("无效的限速: %s\n", argv[arg_index]);
+                return -1;
+            }
+            opts->rrl_rate = (uint32_t)rate;
+        } else if (strcmp(arg, "--rrl-slip") == 0 && arg_index + 1 < argc) {
+            opts->rrl_slip = atoi(argv[++arg_index]);
+            if (opts->rrl_slip < 0) {
+                printf("无效的截断比例: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--rrl-prefix") == 0 && arg_index + 1 < argc) {
+            opts->rrl_prefix = atoi(argv[++arg_index]);
+            if (opts->rrl_prefix < 1 || opts->rrl_prefix > 32) {
+                printf("无效的前缀长度: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--rrl-table") == 0 && arg_index + 1 < argc) {
+            if (parse_size(argv[++arg_index], &opts->rrl_table) < 0 || opts->rrl_table == 0) {
+                printf("无效的限速表大小: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else if (strcmp(arg, "--workers") == 0 && arg_index + 1 < argc) {
+            opts->workers = atoi(argv[++arg_index]);
+            if (opts->workers <= 0) {
+                printf("无效的线程数: %s\n", argv[arg_index]);
+                return -1;
+            }
+        } else {
+            printf("未知选项: %s\n", arg);
+            return -1;
+        }
     }
 
     // 解析DNS服务器IP
     if (argc > arg_index) {
-        strncpy(dns_server, argv[arg_index], dns_server_len - 1);
-        dns_server[dns_server_len - 1] = '\0';
+        strncpy(opts->dns_server, argv[arg_index], sizeof(opts->dns_server) - 1);
+        opts->dns_server[sizeof(opts->dns_server) - 1] = '\0';
+        // 可选的 :port 后缀，用于把上游指向本机的测试解析器
+        char *colon = strchr(opts->dns_server, ':');
+        if (colon) {
+            *colon = '\0';
+            opts->upstream_port = atoi(colon + 1);
+            if (opts->upstream_port <= 0 || opts->upstream_port > 65535) {
+                printf("无效的上游端口: %s\n", colon + 1);
+                return -1;
+            }
+        }
         arg_index++;
     }
 
     // 解析配置文件路径
     if (argc > arg_index) {
-        strncpy(config_file, argv[arg_index], config_file_len - 1);
-        config_file[config_file_len - 1] = '\0';
+        strncpy(opts->config_file, argv[arg_index], sizeof(opts->config_file) - 1);
+        opts->config_file[sizeof(opts->config_file) - 1] = '\0';
     }
 
     return 0;
-}
\ No newline at end of file
+}
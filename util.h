@@ -11,11 +11,39 @@
 #include <sys/time.h>
 #endif
 
-void print_debug_info(const char *format, ...);
-void print_query_debug(const char *domain);
+// 命令行可配置的运行参数
+typedef struct relay_options {
+    char dns_server[64];    // 上游DNS服务器IP
+    int upstream_port;      // 上游DNS服务器端口，可在IP后以 :port 指定
+    int listen_port;        // 本地监听端口
+    char config_file[256];  // 本地DNS表文件路径
+    uint64_t cache_bytes;   // 缓存字节预算
+    double mrc_rate;        // 缺失率曲线估计采样率，0表示不启用
+    double cache_target;    // 自动调整容量的目标命中率，0表示不自动调整
+    uint64_t cache_ceiling; // 自动调整容量的内存上限
+    char admin_path[108];   // 管理套接字路径，为空表示不启用
+    int metrics_port;       // 指标HTTP端口，0表示不启用
+    char qlog_path[256];    // 二进制查询日志路径，为空表示不启用
+    uint64_t qlog_bytes;    // 单个查询日志文件的轮转大小
+    int qlog_files;         // 保留的旧查询日志文件数
+    uint64_t qlog_ring;     // 每个服务线程的查询日志缓冲区大小
+    int load_threads;       // 本地表解析线程数，0表示按CPU核数
+    int async_load;         // 启动时在后台加载本地表，加载完成前只转发
+    int workers;            // 服务线程数，0或1表示单线程
+    int profile;            // 启动时即开启分阶段剖析
+    uint32_t rrl_rate;      // 每个客户端前缀每类应答每秒的上限，0表示不限速
+    int rrl_slip;           // 受限应答中每slip个平均改发一个截断应答，0表示全部丢弃
+    int rrl_prefix;         // 限速时合并的客户端地址前缀长度
+    uint64_t rrl_table;     // 限速表大小（字节）
+} RelayOptions;
+
 void get_now(struct timeval *tv);
+// 以调用方维护的虚拟时钟代替系统时间（离线模拟用，单线程），NULL恢复系统时间；不影响单调时钟
+void set_virtual_clock(const struct timeval *now);
+// 单调时钟（纳秒），用于测量耗时，不受系统时间调整影响
+uint64_t get_monotonic_ns(void);
+int parse_size(const char *text, uint64_t *out);
 void print_usage(const char *program_name);
-int parse_command_line(int argc, char *argv[], char *dns_server, size_t dns_server_len, char *config_file,
-                       size_t config_file_len);
+int parse_command_line(int argc, char *argv[], RelayOptions *opts);
 
 #endif // UTIL_H
\ No newline at end of file